@@ -4,55 +4,35 @@
  */
 
 #include <errno.h>
-#include <fcntl.h>
 #include <getopt.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
-#include <linux/media.h>
-#include "v4l2-controls.h"
-#include "videodev2.h"
-#include <linux/v4l2-subdev.h>
 #include <sys/ioctl.h>
-#include <sys/mman.h>
-#include <sys/stat.h>
-#include <sys/sysmacros.h>
 
-#include "stm32-dcmipp-config.h"
+#include "isp-format.h"
+#include "isp-histo.h"
+#include "isp-publish.h"
+#include "isp-roi.h"
+#include "isp-record.h"
+#include "libdcmipp-isp.h"
+#include "tuning.h"
 
 #define STR_MAX_LEN	32
-struct isp_descriptor {
-	char media_dev_name[STR_MAX_LEN];
-	char isp_subdev_name[STR_MAX_LEN];
-	char params_dev_name[STR_MAX_LEN];
-	char stat_dev_name[STR_MAX_LEN];
-	char sensor_subdev_name[STR_MAX_LEN];
-	int isp_fd;
-	int params_fd;
-	int stat_fd;
-	int width;
-	int height;
-	int fmt;
-	char fmt_str[STR_MAX_LEN];
-	struct stm32_dcmipp_stat_buf *stats[4];
-	int stats_buf_nb;
-	size_t stats_buf_len;
-	struct stm32_dcmipp_params_cfg *params[4];
-	int params_buf_nb;
-	size_t params_buf_len;
-};
 
-/*
- * Compute luminance value from R/G/B components
- * using the BT 601 coefficients
- */
-static int luminance_from_rgb(int rgb[3])
-{
-	/* BT 601 coefficients */
-	return rgb[0] * 0.299 + rgb[1] * 0.587 + rgb[2] * 0.114;
-}
+/* Short options, the same for both passes so that getopt_long() reorders the arguments the same way */
+#define SHORT_OPTS	"hHvdb:t:gc:i:a:sS"
+
+/* Refresh rate of the continuous display (Hz) */
+#define REFRESH_RATE_DEFAULT	5
+#define REFRESH_RATE_MAX	60
 
 /*
  * Clamp a value within a range
@@ -68,1284 +48,850 @@ static int clamp(int val, int lo, int hi)
 }
 
 /*
- * Search for the device file name of the DCMIPP media device
+ * Helpers for statistics display
  */
-#define DCMIPP_DRV	"dcmipp"
-static int find_media(struct isp_descriptor *isp_desc)
+static void print_range(int min, int max, int val, int nb_pix, char histo[20][STR_MAX_LEN])
 {
-	struct media_device_info info;
-	char media_dev_name[STR_MAX_LEN];
-	int ret, fd, i;
-
-	for (i = 0; i < 255; i++) {
-		/* Search for the dcmipp media */
-		snprintf(media_dev_name, STR_MAX_LEN, "/dev/media%d", i);
-		fd = open(media_dev_name, O_RDWR);
-		if (fd < 0)
-			continue;
-
-		ret = ioctl(fd, MEDIA_IOC_DEVICE_INFO, &info);
-		close(fd);
-
-		if (!ret && !strcmp(info.driver, DCMIPP_DRV)) {
-			/* dcmipp found */
-			strncpy(isp_desc->media_dev_name, media_dev_name, STR_MAX_LEN);
-			return 0;
-		}
-	}
-
-	printf("Can't find media device\n");
-	return -ENXIO;
+	printf("    [%3d:%3d]   %7d\t%2d%%   %s\n", min, max, val, 100 * val / nb_pix, histo[clamp(20 * val / nb_pix, 0, 19)]);
 }
 
-/*
- * Search for the device file name of a DCMIPP video device for stats
- */
-static int find_video_dev(char *media_dev, char *v4l2_name, char *video_dev)
+static void print_average(const __u32 average_RGB[3])
 {
-	struct media_entity_desc info;
-	struct stat devstat;
-	char dev_name[STR_MAX_LEN];
-	int fd, i, ret;
-	__u32 id;
-
-	fd = open(media_dev, O_RDWR);
-	if (fd < 0)
-		return fd;
-
-	for (id = 0, ret = 0; ; id = info.id) {
-		/* Search across all the entities */
-		info.id = id | MEDIA_ENT_ID_FLAG_NEXT;
-		ret = ioctl(fd, MEDIA_IOC_ENUM_ENTITIES, &info);
-		if (ret < 0)
-			break;
-
-		if (!strcmp(info.name, v4l2_name)) {
-			/* isp entity found. Now search for its /dev/v4l-subdevx */
-			for (i = 0; i < 255; i++) {
-				/* check for a sub dev that matches the major/minor */
-				snprintf(dev_name, STR_MAX_LEN, "/dev/video%d", i);
-				if (stat(dev_name, &devstat) < 0)
-					continue;
-
-				if ((major(devstat.st_rdev) == info.dev.major) &&
-				    (minor(devstat.st_rdev) == info.dev.minor)) {
-					/* found */
-					strncpy(video_dev, dev_name, STR_MAX_LEN);
-					close(fd);
-					return 0;
-				}
-			}
-		}
-	}
-
-	close(fd);
-	printf("Can't find video device\n");
-	return -ENXIO;
+	printf("Average:\n");
+	printf("    Red             %d\n", average_RGB[0]);
+	printf("    Green           %d\n", average_RGB[1]);
+	printf("    Red             %d\n", average_RGB[2]);
+	printf("    Lum             %d\n", isp_luminance(average_RGB));
 }
 
 /*
- * Search for the device file name of a DCMIPP ISP subdevice
+ * Lower bound of the pixel value ranges of the cumulative bins
  */
-#define DCMIPP_ISP_NAME		"dcmipp_main_isp"
-static int find_isp_subdev(struct isp_descriptor *isp_desc)
-{
-	struct media_entity_desc info;
-	struct stat devstat;
-	char dev_name[STR_MAX_LEN];
-	int fd, i, ret;
-	__u32 id;
-
-	fd = open(isp_desc->media_dev_name, O_RDWR);
-	if (fd < 0)
-		return fd;
-
-	for (id = 0, ret = 0; ; id = info.id) {
-		/* Search across all the entities */
-		info.id = id | MEDIA_ENT_ID_FLAG_NEXT;
-		ret = ioctl(fd, MEDIA_IOC_ENUM_ENTITIES, &info);
-		if (ret < 0)
-			break;
+static const int bin_range_min[12] = { 0, 4, 8, 16, 32, 64, 128, 192, 224, 240, 248, 252 };
 
-		if (!strcmp(info.name, DCMIPP_ISP_NAME)) {
-			/* isp entity found. Now search for its /dev/v4l-subdevx */
-			for (i = 0; i < 255; i++) {
-				/* check for a sub dev that matches the major/minor */
-				snprintf(dev_name, STR_MAX_LEN, "/dev/v4l-subdev%d", i);
-				if (stat(dev_name, &devstat) < 0)
-					continue;
-
-				if ((major(devstat.st_rdev) == info.dev.major) &&
-				    (minor(devstat.st_rdev) == info.dev.minor)) {
-					/* found */
-					strncpy(isp_desc->isp_subdev_name, dev_name, STR_MAX_LEN);
-					close(fd);
-					return 0;
-				}
-			}
-		}
-	}
-
-	close(fd);
-	printf("Can't find isp subdev\n");
-	return -ENXIO;
+static int bin_range_max(int i)
+{
+	return i < 11 ? bin_range_min[i + 1] - 1 : 255;
 }
 
 /*
- * Search for the device file name of the sensor subdevice
+ * Pixel count of each value range from the cumulative bins, and total pixel count
+ * The first 6 bins count the pixels below a value, the last 6 ones the pixels above a value.
  */
-#define SENSOR_DRV_NAME		"imx335"
-static int find_sensor_subdev(struct isp_descriptor *isp_desc)
+static int bin_ranges(const __u32 bins[12], int range[12])
 {
-	struct media_entity_desc info;
-	struct stat devstat;
-	char dev_name[STR_MAX_LEN];
-	int fd, i, ret;
-	__u32 id;
-
-	fd = open(isp_desc->media_dev_name, O_RDWR);
-	if (fd < 0)
-		return fd;
-
-	for (id = 0, ret = 0; ; id = info.id) {
-		/* Search across all the entities */
-		info.id = id | MEDIA_ENT_ID_FLAG_NEXT;
-		ret = ioctl(fd, MEDIA_IOC_ENUM_ENTITIES, &info);
-		if (ret < 0)
-			break;
+	int i;
 
-		if (!strncmp(info.name, SENSOR_DRV_NAME, strlen(SENSOR_DRV_NAME))) {
-			/* entity found. Now search for its /dev/v4l-subdevx */
-			for (i = 0; i < 255; i++) {
-				/* check for a sub dev that matches the major/minor */
-				snprintf(dev_name, STR_MAX_LEN, "/dev/v4l-subdev%d", i);
-				if (stat(dev_name, &devstat) < 0)
-					continue;
-
-				if ((major(devstat.st_rdev) == info.dev.major) &&
-				    (minor(devstat.st_rdev) == info.dev.minor)) {
-					/* found */
-					strncpy(isp_desc->sensor_subdev_name, dev_name, STR_MAX_LEN);
-					close(fd);
-					return 0;
-				}
-			}
-		}
-	}
+	range[0] = bins[0];
+	for (i = 1; i < 6; i++)
+		range[i] = bins[i] - bins[i - 1];
+	for (i = 6; i < 11; i++)
+		range[i] = bins[i] - bins[i + 1];
+	range[11] = bins[11];
 
-	close(fd);
-	printf("Can't find sensor subdev\n");
-	return -ENXIO;
+	return bins[5] + bins[6];
 }
 
-/*
- * Open and initialize the stats capture video device
- */
-static int open_stats_vdev(struct isp_descriptor *isp_desc)
+static void print_bins(const __u32 bins[12])
 {
-	struct v4l2_requestbuffers req;
-	struct v4l2_capability cap;
-	struct v4l2_format fmt;
-	struct v4l2_buffer buf;
-	int i, ret;
-
-	isp_desc->stat_fd = open(isp_desc->stat_dev_name, O_RDWR);
-	if (isp_desc->stat_fd == -1) {
-		ret = -errno;
-		printf("Failed to open video device %s\n", isp_desc->stat_dev_name);
-		return ret;
-	}
-
-	ret = ioctl(isp_desc->stat_fd, VIDIOC_QUERYCAP, &cap);
-	if (ret) {
-		printf("Failed to query cap\n");
-		return ret;
-	}
-
-	if ((!(cap.capabilities & V4L2_CAP_META_CAPTURE)) || (!(cap.capabilities & V4L2_CAP_STREAMING))) {
-		printf("Incorrect capabilities (%x)\n", cap.capabilities);
-		return -ENXIO;
-	}
-
-	fmt.type = V4L2_BUF_TYPE_META_CAPTURE;
-	ret = ioctl(isp_desc->stat_fd, VIDIOC_G_FMT, &fmt);
-	if (ret) {
-		printf("Failed to get format\n");
-		return ret;
-	}
+	char histo[20][STR_MAX_LEN];
+	int range[12];
+	int nb_pix, i;
 
-	if (fmt.fmt.meta.dataformat != V4L2_META_FMT_ST_DCMIPP_ISP_STAT) {
-		printf("Invalid format (%x)\n", fmt.fmt.meta.dataformat);
-		return -ENXIO;
+	for (i = 0; i < 20; i++) {
+		strncpy(histo[i], "--------------------", STR_MAX_LEN);
+		histo[i][i + 1] = '\0';
 	}
 
-	/* Get one meta buffer */
-	req.count = 1;
-	req.type = V4L2_BUF_TYPE_META_CAPTURE;
-	req.memory = V4L2_MEMORY_MMAP;
-	ret = ioctl(isp_desc->stat_fd, VIDIOC_REQBUFS, &req);
-	if (ret) {
-		printf("Failed to request buffers\n");
-		return ret;
-	}
+	nb_pix = bin_ranges(bins, range);
 
-	isp_desc->stats_buf_nb = req.count;
+	printf("\nHistogram (bins):\n");
+	printf("    <    4      %7d\n", bins[0]);
+	printf("    <    8      %7d\n", bins[1]);
+	printf("    <   16      %7d\n", bins[2]);
+	printf("    <   32      %7d\n", bins[3]);
+	printf("    <   64      %7d\n", bins[4]);
+	printf("    <  128      %7d\n", bins[5]);
+	printf("    >= 128      %7d\n", bins[6]);
+	printf("    >= 192      %7d\n", bins[7]);
+	printf("    >= 224      %7d\n", bins[8]);
+	printf("    >= 240      %7d\n", bins[9]);
+	printf("    >= 248      %7d\n", bins[10]);
+	printf("    >= 252      %7d\n", bins[11]);
 
-	for (i = 0; i < req.count; i++) {
-		buf.type = V4L2_BUF_TYPE_META_CAPTURE;
-		buf.memory = V4L2_MEMORY_MMAP;
-		buf.index = i;
+	printf("\nHistogram (range):\n");
+	for (i = 0; i < 12; i++)
+		print_range(bin_range_min[i], bin_range_max(i), range[i], nb_pix, histo);
+}
 
-		ret = ioctl(isp_desc->stat_fd, VIDIOC_QUERYBUF, &buf);
-		if (ret) {
-			printf("Failed to query buffer %d\n", i);
-			return ret;
-		}
-		isp_desc->stats_buf_len = buf.length;
+static void display_histo(const __u16 *bins, __u8 vreg, __u8 hreg, __u8 comp, __u8 bin)
+{
+	int i, j, k, l;
+	int cnt = 0;
 
-		isp_desc->stats[i] = mmap(NULL, isp_desc->stats_buf_len, PROT_READ | PROT_WRITE, MAP_SHARED, isp_desc->stat_fd, buf.m.offset);
-		if (isp_desc->stats[i] == MAP_FAILED) {
-			printf("Failed to map buffer %d\n", i);
-			return -ENOMEM;
+	for (i = 1; i < vreg; i++) {
+		for (j = 1; j < hreg; j++) {
+			printf("Region XY (%d/%d)\n", j, i);
+			for (k = 0; k < comp; k++) {
+				printf("\tComponent n'%d: ", k);
+				for (l = 0; l < bin; l++)
+					printf("%d ", bins[cnt++]);
+				printf("\n");
+			}
 		}
 	}
-
-	return 0;
 }
 
 /*
- * Close the stats video device
+ * One line summary of the metrics of a histogram
  */
-static void close_stats_vdev(struct isp_descriptor *isp_desc)
+static void histo_metrics_str(const struct isp_histo_metrics *m, char *str, size_t size)
 {
-	int i;
-
-	for (i = 0; i < isp_desc->stats_buf_nb; i++)
-		munmap(isp_desc->stats[i], isp_desc->stats_buf_len);
-
-	close(isp_desc->stat_fd);
+	snprintf(str, size, "p1 %3u  p50 %3u  p99 %3u  mean %6.2f  clip %5.1f%% / %5.1f%%  entropy %.2f bits",
+		 m->p1, m->p50, m->p99, m->mean / 256.0, m->clip_low * 100.0 / 65536, m->clip_high * 100.0 / 65536,
+		 m->entropy / 65536.0);
 }
 
-/*
- * Open and initialize the params video output device
- */
-static int open_params_vdev(struct isp_descriptor *isp_desc)
+static void print_histo_metrics(const __u16 *histograms, const struct stm32_dcmipp_isp_histo_cfg *cfg)
 {
-	struct v4l2_requestbuffers req;
-	struct v4l2_capability cap;
-	struct v4l2_format fmt;
-	struct v4l2_buffer buf;
-	int i, ret;
-
-	isp_desc->params_fd = open(isp_desc->params_dev_name, O_RDWR);
-	if (isp_desc->params_fd == -1) {
-		ret = -errno;
-		printf("Failed to open video device %s\n", isp_desc->params_dev_name);
-		return ret;
-	}
-
-	ret = ioctl(isp_desc->params_fd, VIDIOC_QUERYCAP, &cap);
-	if (ret) {
-		printf("Failed to query cap\n");
-		return ret;
+	static struct isp_histo_metrics metrics[STM32_DCMIPP_HISTO_BIN_MAX / 4];
+	unsigned int comp_nb = cfg->comp < 4 ? 1 : 4;
+	unsigned int i, nb;
+	char str[128];
+
+	nb = isp_histo_analyze(cfg, histograms, metrics, NULL);
+	for (i = 0; i < nb; i++) {
+		histo_metrics_str(&metrics[i], str, sizeof(str));
+		printf("\tRegion XY (%u/%u) component n'%u: %s\n",
+		       i / comp_nb % cfg->hreg + 1, i / comp_nb / cfg->hreg + 1, i % comp_nb, str);
 	}
-
-	if ((!(cap.capabilities & V4L2_CAP_META_OUTPUT)) || (!(cap.capabilities & V4L2_CAP_STREAMING))) {
-		printf("Incorrect capabilities (%x)\n", cap.capabilities);
-		return -ENXIO;
-	}
-
-	fmt.type = V4L2_BUF_TYPE_META_OUTPUT;
-	ret = ioctl(isp_desc->params_fd, VIDIOC_G_FMT, &fmt);
-	if (ret) {
-		printf("Failed to get format\n");
-		return ret;
-	}
-
-	if (fmt.fmt.meta.dataformat != V4L2_META_FMT_ST_DCMIPP_ISP_PARAMS) {
-		printf("Invalid format (%x)\n", fmt.fmt.meta.dataformat);
-		return -ENXIO;
-	}
-
-	/* Get one meta buffer */
-	req.count = 1;
-	req.type = V4L2_BUF_TYPE_META_OUTPUT;
-	req.memory = V4L2_MEMORY_MMAP;
-	ret = ioctl(isp_desc->params_fd, VIDIOC_REQBUFS, &req);
-	if (ret) {
-		printf("Failed to request buffers\n");
-		return ret;
-	}
-
-	isp_desc->params_buf_nb = req.count;
-
-	for (i = 0; i < req.count; i++) {
-		buf.type = V4L2_BUF_TYPE_META_OUTPUT;
-		buf.memory = V4L2_MEMORY_MMAP;
-		buf.index = i;
-
-		ret = ioctl(isp_desc->params_fd, VIDIOC_QUERYBUF, &buf);
-		if (ret) {
-			printf("Failed to query buffer %d\n", i);
-			return ret;
-		}
-		isp_desc->params_buf_len = buf.length;
-
-		isp_desc->params[i] = mmap(NULL, isp_desc->params_buf_len, PROT_READ | PROT_WRITE, MAP_SHARED, isp_desc->params_fd, buf.m.offset);
-		if (isp_desc->params[i] == MAP_FAILED) {
-			printf("Failed to map buffer %d\n", i);
-			return -ENOMEM;
-		}
-	}
-
-	return 0;
-
 }
 
 /*
- * Close the params video output device
+ * Print the stats of a frame, and the histograms if a histogram config is given
  */
-static void close_params_vdev(struct isp_descriptor *isp_desc)
+static void print_stats(const struct isp_stats *stats, const struct stm32_dcmipp_isp_histo_cfg *histo_cfg)
 {
-	int i;
-
-	for (i = 0; i < isp_desc->params_buf_nb; i++)
-		munmap(isp_desc->params[i], isp_desc->params_buf_len);
-
-	close(isp_desc->params_fd);
+	printf("Location Pre-demosaicing\n");
+	print_average(stats->buf.pre.average_RGB);
+	print_bins(stats->buf.pre.bins);
+	printf("Location Post-demosaicing\n");
+	print_average(stats->buf.post.average_RGB);
+	print_bins(stats->buf.post.bins);
+
+	if (!histo_cfg)
+		return;
+
+	printf("Histogram\n");
+	display_histo(stats->buf.histograms,
+		      histo_cfg->vreg + 1, histo_cfg->hreg + 1, histo_cfg->comp < 4 ? 1 : 4,
+		      histo_cfg->bin == 0 ? 4 : histo_cfg->bin == 1 ? 16 : histo_cfg->bin == 2 ? 64 : 256);
+
+	printf("Histogram metrics\n");
+	print_histo_metrics(stats->buf.histograms, histo_cfg);
 }
 
-static void to_fmt_str(char *fmt_str, int fmt)
+/*
+ * Number of histogram values of a histogram config
+ */
+static unsigned int histo_value_nb(const struct stm32_dcmipp_isp_histo_cfg *cfg)
 {
-	if (fmt >= MEDIA_BUS_FMT_SBGGR8_1X8 && fmt <= MEDIA_BUS_FMT_SRGGB16_1X16)
-		strncpy(fmt_str, "Raw Bayer", STR_MAX_LEN);
-	else if (fmt == MEDIA_BUS_FMT_RGB565_2X8_LE)
-		strncpy(fmt_str, "RGB565", STR_MAX_LEN);
-	else if (fmt == MEDIA_BUS_FMT_RGB888_1X24)
-		strncpy(fmt_str, "RGB888", STR_MAX_LEN);
-	else if (fmt == MEDIA_BUS_FMT_YUV8_1X24)
-		strncpy(fmt_str, "YUV 420", STR_MAX_LEN);
-	else if (fmt >= MEDIA_BUS_FMT_UYVY8_2X8 && fmt <= MEDIA_BUS_FMT_YVYU8_2X8)
-		strncpy(fmt_str, "YUV 422", STR_MAX_LEN);
-	else
-		snprintf(fmt_str, STR_MAX_LEN, "Format = 0x%x", fmt);
+	unsigned int nb = cfg->hreg * cfg->vreg * (cfg->comp < 4 ? 1 : 4) * (4 << (2 * cfg->bin));
+
+	return nb < STM32_DCMIPP_HISTO_BIN_MAX ? nb : STM32_DCMIPP_HISTO_BIN_MAX;
 }
 
-#define DCMIPP_ISP_PARAMS_NAME		"dcmipp_main_isp_params_output"
-#define DCMIPP_ISP_STAT_NAME		"dcmipp_main_isp_stat_capture"
 /*
- * Search, open and initialize all DCMIPP devices
+ * Parse a histogram schedule: the source and component of each frame of the pattern, as SRC[:COMP]
+ * separated by commas, on the area of 'base'. The same entries share a configuration.
  */
-static int discover_dcmipp(struct isp_descriptor *isp_desc)
+static int parse_histo_sched(char *list, const struct stm32_dcmipp_isp_histo_cfg *base, struct isp_histo_sched_cfg *sched)
 {
-	struct v4l2_subdev_selection sel;
-	struct v4l2_subdev_format fmt;
-	int ret;
-
-	/* find dcmipp media dev */
-	ret = find_media(isp_desc);
-	if (ret)
-		return ret;
-
-	/* find isp sub dev */
-	ret = find_isp_subdev(isp_desc);
-	if (ret)
-		return ret;
-
-	/* find params video dev */
-	ret = find_video_dev(isp_desc->media_dev_name, DCMIPP_ISP_PARAMS_NAME,
-			     isp_desc->params_dev_name);
-	if (ret)
-		return ret;
-
-	/* find stat video dev */
-	ret = find_video_dev(isp_desc->media_dev_name, DCMIPP_ISP_STAT_NAME,
-			     isp_desc->stat_dev_name);
-	if (ret)
-		return ret;
-
-	/* find sensor sub dev */
-	ret = find_sensor_subdev(isp_desc);
-	if (ret)
-		return ret;
-
-	/* Get input frame params */
-	isp_desc->isp_fd = open(isp_desc->isp_subdev_name, O_RDWR);
-	if (isp_desc->isp_fd == -1) {
-		ret = -errno;
-		printf("Failed to open isp subdev %s\n", isp_desc->isp_subdev_name);
-		return ret;
-	}
-
-	fmt.which = V4L2_SUBDEV_FORMAT_ACTIVE;
-	fmt.pad = 0;
-	ret = ioctl(isp_desc->isp_fd, VIDIOC_SUBDEV_G_FMT, &fmt);
-	if (ret) {
-		printf("Failed to get format\n");
-		return ret;
-	}
-	isp_desc->fmt = fmt.format.code;
-	to_fmt_str(isp_desc->fmt_str, isp_desc->fmt);
-
-	sel.which = V4L2_SUBDEV_FORMAT_ACTIVE;
-	sel.pad = 0;
-	sel.target = V4L2_SEL_TGT_COMPOSE;
-	ret = ioctl(isp_desc->isp_fd, VIDIOC_SUBDEV_G_SELECTION, &sel);
-	if (ret) {
-		printf("Failed to get selection\n");
-		return ret;
+	struct stm32_dcmipp_isp_histo_cfg cfg;
+	unsigned int id;
+	char *tok, *end;
+
+	memset(sched, 0, sizeof(*sched));
+	for (tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+		cfg = *base;
+		cfg.src = strtoul(tok, &end, 0);
+		if (end != tok && *end == ':')
+			cfg.comp = strtoul(end + 1, &end, 0);
+		if (end == tok || *end || sched->pattern_len == ISP_HISTO_SCHED_PATTERN_MAX)
+			return -EINVAL;
+
+		for (id = 0; id < sched->cfg_nb; id++)
+			if (!memcmp(&cfg, &sched->cfg[id], sizeof(cfg)))
+				break;
+		if (id == sched->cfg_nb) {
+			if (id == ISP_HISTO_SCHED_CFG_MAX)
+				return -EINVAL;
+			sched->cfg[sched->cfg_nb++] = cfg;
+		}
+		sched->pattern[sched->pattern_len++] = id;
 	}
-	isp_desc->width = sel.r.width;
-	isp_desc->height = sel.r.height;
 
-	ret = open_params_vdev(isp_desc);
-	if (ret)
-		return ret;
-
-	ret = open_stats_vdev(isp_desc);
-	if (ret)
-		return ret;
-
-	return 0;
+	return sched->pattern_len ? 0 : -EINVAL;
 }
 
-static int get_ctrl(int fd, int id, int *value)
+/*
+ * Parse a comma separated list of recorded fields
+ */
+static int parse_record_fields(char *list, unsigned int *fields)
 {
-	struct v4l2_control ctrl;
-	int ret;
-
-	memset(&ctrl, 0, sizeof(struct v4l2_control));
-	ctrl.id = id;
-
-	ret = ioctl(fd, VIDIOC_G_CTRL, &ctrl);
-	if (ret)
-		printf("VIDIOC_S_CTRL setting failed\n");
+	char *tok;
+
+	*fields = 0;
+	for (tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+		if (!strcmp(tok, "avg"))
+			*fields |= ISP_RECORD_AVERAGES;
+		else if (!strcmp(tok, "bins"))
+			*fields |= ISP_RECORD_BINS;
+		else if (!strcmp(tok, "bad"))
+			*fields |= ISP_RECORD_BAD_PIXELS;
+		else if (!strcmp(tok, "histo"))
+			*fields |= ISP_RECORD_HISTOGRAMS;
+		else
+			return -EINVAL;
+	}
 
-	*value = ctrl.value;
-	return ret;
+	return 0;
 }
 
 /*
- * Helpers to access V4L2 controls
+ * Parse the capacity of the ring file, in frames
  */
-static int set_ctrl(int fd, int id, int value)
+static int parse_record_frames(const char *arg, unsigned int *frames)
 {
-	struct v4l2_control ctrl;
-	int ret;
+	char *end;
+	long nb;
 
-	memset(&ctrl, 0, sizeof(struct v4l2_control));
-	ctrl.id = id;
-	ctrl.value = value;
+	errno = 0;
+	nb = strtol(arg, &end, 0);
+	if (errno || end == arg || *end || nb <= 0 || nb > ISP_RECORD_CAPACITY_MAX)
+		return -EINVAL;
 
-	ret = ioctl(fd, VIDIOC_S_CTRL, &ctrl);
-	if (ret)
-		printf("VIDIOC_S_CTRL setting failed\n");
+	*frames = nb;
 
-	return ret;
+	return 0;
 }
 
-static int set_ext_ctrl(int fd, struct v4l2_ext_controls *extCtrls)
-{
-	int ret;
-
-	ret = ioctl(fd, VIDIOC_S_EXT_CTRLS, extCtrls);
-	if (ret)
-		printf("VIDIOC_S_EXT_CTRLS setting failed (CID %x)\n", extCtrls->controls->id);
-
-	return ret;
-}
+/*
+ * Stats of the frames captured between two refreshes of the continuous display
+ * The averages are the red, green, blue and luminance ones.
+ */
+struct stats_window {
+	unsigned int frames;
+	struct {
+		__u32 min[4];
+		__u32 max[4];
+		__u64 sum[4];
+		__u64 bins[12];
+	} loc[2];
+	__u32 bad_min;
+	__u32 bad_max;
+	__u64 bad_sum;
+	__u32 sequence;
+	__s32 exposure;
+	__s32 gain;
+	__u32 histograms[STM32_DCMIPP_HISTO_BIN_MAX];
+};
 
-static int set_ext_ctrl_int(int fd, unsigned int class, int v4l2_cid, int value)
+static void stats_window_reset(struct stats_window *win, unsigned int histo_nb)
 {
-	struct v4l2_ext_controls extCtrls;
-	struct v4l2_ext_control extCtrl;
-
-	memset(&extCtrl, 0, sizeof(struct v4l2_ext_control));
-	extCtrl.id = v4l2_cid;
-	extCtrl.value = value;
-
-	extCtrls.controls = &extCtrl;
-	extCtrls.count = 1;
-	extCtrls.ctrl_class = class;
-
-	return set_ext_ctrl(fd, &extCtrls);
+	memset(win, 0, offsetof(struct stats_window, histograms));
+	memset(win->histograms, 0, histo_nb * sizeof(win->histograms[0]));
 }
 
-static int get_ext_ctrl_int(int fd, unsigned int class, int v4l2_cid, int *value)
+static void stats_window_add(struct stats_window *win, const struct isp_stats *stats, unsigned int histo_nb)
 {
-	struct v4l2_ext_controls extCtrls;
-	struct v4l2_ext_control extCtrl;
-	int ret;
-
-	memset(&extCtrl, 0, sizeof(struct v4l2_ext_control));
-	extCtrl.id = v4l2_cid;
-
-	extCtrls.controls = &extCtrl;
-	extCtrls.count = 1;
-	extCtrls.ctrl_class = class;
+	const struct stm32_dcmipp_stat_avr_bins *loc;
+	unsigned int i, l;
+	__u32 val;
+
+	for (l = 0; l < 2; l++) {
+		loc = l ? &stats->buf.post : &stats->buf.pre;
+		for (i = 0; i < 4; i++) {
+			val = i < 3 ? loc->average_RGB[i] : isp_luminance(loc->average_RGB);
+			if (!win->frames || val < win->loc[l].min[i])
+				win->loc[l].min[i] = val;
+			if (!win->frames || val > win->loc[l].max[i])
+				win->loc[l].max[i] = val;
+			win->loc[l].sum[i] += val;
+		}
+		for (i = 0; i < 12; i++)
+			win->loc[l].bins[i] += loc->bins[i];
+	}
 
-	ret = ioctl(fd, VIDIOC_G_EXT_CTRLS, &extCtrls);
-	if (ret)
-		printf("VIDIOC_G_EXT_CTRLS setting failed (CID %x)\n", extCtrls.controls->id);
+	val = stats->buf.bad_pixel_count;
+	if (!win->frames || val < win->bad_min)
+		win->bad_min = val;
+	if (!win->frames || val > win->bad_max)
+		win->bad_max = val;
+	win->bad_sum += val;
 
-	*value = extCtrl.value;
+	for (i = 0; i < histo_nb; i++)
+		win->histograms[i] += stats->buf.histograms[i];
 
-	return ret;
+	win->sequence = stats->sequence;
+	win->exposure = stats->exposure;
+	win->gain = stats->gain;
+	win->frames++;
 }
 
 /*
- * Apply DCMIPP ISP params
+ * Text buffer, grown as needed
  */
-static int apply_params(struct isp_descriptor *isp_desc, struct stm32_dcmipp_params_cfg *params)
-{
-	enum v4l2_buf_type type;
-	struct v4l2_format fmt;
-	struct v4l2_buffer buf;
-	struct timeval tv;
-	size_t buflen = 0;
-	fd_set fds;
-	int ret;
-
-	*isp_desc->params[0] = *params;
-
-	/* Queue the buffer */
-	buf.type = V4L2_BUF_TYPE_META_OUTPUT;
-	buf.memory = V4L2_MEMORY_MMAP;
-	buf.index = 0;
-	buf.bytesused = sizeof(*params);
-
-	ret = ioctl(isp_desc->params_fd, VIDIOC_QBUF, &buf);
-	if (ret) {
-		printf("Failed to queue buffer\n");
-		return ret;
-	}
-
-	/* Start stream */
-	type = V4L2_BUF_TYPE_META_OUTPUT;
-	ret = ioctl(isp_desc->params_fd, VIDIOC_STREAMON, &type);
-	if (ret) {
-		printf("Failed to start stream\n");
-		return ret;
-	}
+struct text {
+	char *buf;
+	size_t len;
+	size_t size;
+};
 
-	FD_ZERO(&fds);
-	FD_SET(isp_desc->params_fd, &fds);
-	tv.tv_sec = 2;
-	tv.tv_usec = 0;
+static bool text_reserve(struct text *t, size_t n)
+{
+	size_t size;
+	char *buf;
 
-	/* Wait for buff */
-	ret = select(isp_desc->params_fd + 1, NULL, &fds, NULL, &tv);
-	if (ret < 0) {
-		printf("Select failed (%d)\n", ret);
-		return ret;
-	}
-	if (ret == 0) {
-		printf("Select timeout\n");
-		return -EBUSY;
-	}
+	if (t->len + n + 1 <= t->size)
+		return true;
 
-	/* Get the buff back, indicating the sequence into which it has been pushed */
-	buf.type = V4L2_BUF_TYPE_META_OUTPUT;
-	buf.memory = V4L2_MEMORY_MMAP;
-	ret = ioctl(isp_desc->params_fd, VIDIOC_DQBUF, &buf);
-	if (ret) {
-		printf("Failed to dequeue buffer\n");
-		return ret;
-	}
+	size = 2 * (t->len + n + 1);
+	buf = realloc(t->buf, size);
+	if (!buf)
+		return false;
+	t->buf = buf;
+	t->size = size;
 
-	/* Stop stream */
-	type = V4L2_BUF_TYPE_META_OUTPUT;
-	ret = ioctl(isp_desc->params_fd, VIDIOC_STREAMOFF, &type);
-	if (ret) {
-		printf("Failed to stop stream\n");
-		return ret;
-	}
-
-	return ret;
+	return true;
 }
 
 /*
- * Helper function to configure the stats video capture device and set the stats capture profile
+ * Append to a text buffer: the text is truncated if it cannot be grown
  */
-static int set_stat_profile(struct isp_descriptor *isp_desc, enum v4l2_isp_stat_profile profile)
+static void text_append(struct text *t, const char *s, size_t n)
 {
-	int ret;
-
-	if (profile > V4L2_STAT_PROFILE_AVERAGE_POST) {
-		printf("Invalid value : %d\n", profile);
-		return -EINVAL;
-	}
-
-	ret = set_ext_ctrl_int(isp_desc->stat_fd, V4L2_CTRL_CLASS_IMAGE_PROC, V4L2_CID_ISP_STAT_PROFILE, profile);
-	if (ret)
-		printf("Failed to apply Stat capture profile\n");
+	if (!text_reserve(t, n))
+		return;
+	memcpy(t->buf + t->len, s, n);
+	t->len += n;
+	t->buf[t->len] = '\0';
+}
 
-	return ret;
+static void text_printf(struct text *t, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+	if (n <= 0 || !text_reserve(t, n))
+		return;
+
+	va_start(ap, fmt);
+	vsnprintf(t->buf + t->len, n + 1, fmt, ap);
+	va_end(ap);
+	t->len += n;
 }
 
 /*
- * Helpers for statistics display
+ * Continuous display
+ *
+ * Each refresh renders the whole screen in a text buffer, which is compared line per line with the
+ * screen shown on the terminal: only the lines which changed are rewritten, with cursor addressing,
+ * and the whole update is sent in a single write. The screen is clipped to the terminal size so that
+ * it never scrolls. When the output is not a terminal, each screen is simply written after the
+ * previous one.
  */
-static void print_range(int min, int max, int val, int nb_pix, char histo[20][STR_MAX_LEN])
+struct screen {
+	bool tty;
+	unsigned int rows;
+	unsigned int cols;
+	struct text cur;
+	struct text shown;
+	struct text out;
+};
+
+static void screen_init(struct screen *scr)
 {
-	printf("    [%3d:%3d]   %7d\t%2d%%   %s\n", min, max, val, 100 * val / nb_pix, histo[clamp(20 * val / nb_pix, 0, 19)]);
+	memset(scr, 0, sizeof(*scr));
+	scr->tty = isatty(STDOUT_FILENO);
 }
 
-static void print_average(__u32 average_RGB[3])
+static void screen_free(struct screen *scr)
 {
-	printf("Average:\n");
-	printf("    Red             %d\n", average_RGB[0]);
-	printf("    Green           %d\n", average_RGB[1]);
-	printf("    Red             %d\n", average_RGB[2]);
-	printf("    Lum             %d\n", luminance_from_rgb(average_RGB));
+	free(scr->cur.buf);
+	free(scr->shown.buf);
+	free(scr->out.buf);
 }
 
-static void print_bins(__u32 bins[12])
+static void write_all(int fd, const char *buf, size_t len)
 {
-	int range0, range4, range8, range16, range32, range64;
-	int range128, range192, range224, range240, range248, range252;
-	char histo[20][STR_MAX_LEN];
-	int nb_pix, i;
+	ssize_t n;
 
-	for (i = 0; i < 20; i++) {
-		strncpy(histo[i], "--------------------", STR_MAX_LEN);
-		histo[i][i + 1] = '\0';
+	while (len) {
+		n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return;
+		buf += n;
+		len -= n;
 	}
-
-	range0 = bins[0];
-	range4 = bins[1] - bins[0];
-	range8 = bins[2] - bins[1];
-	range16 = bins[3] - bins[2];
-	range32 = bins[4] - bins[3];
-	range64 = bins[5] - bins[4];
-	range128 = bins[6] - bins[7];
-	range192 = bins[7] - bins[8];
-	range224 = bins[8] - bins[9];
-	range240 = bins[9] - bins[10];
-	range248 = bins[10] - bins[11];
-	range252 = bins[11];
-	nb_pix = bins[5] + bins[6];
-
-	printf("\nHistogram (bins):\n");
-	printf("    <    4      %7d\n", bins[0]);
-	printf("    <    8      %7d\n", bins[1]);
-	printf("    <   16      %7d\n", bins[2]);
-	printf("    <   32      %7d\n", bins[3]);
-	printf("    <   64      %7d\n", bins[4]);
-	printf("    <  128      %7d\n", bins[5]);
-	printf("    >= 128      %7d\n", bins[6]);
-	printf("    >= 192      %7d\n", bins[7]);
-	printf("    >= 224      %7d\n", bins[8]);
-	printf("    >= 240      %7d\n", bins[9]);
-	printf("    >= 248      %7d\n", bins[10]);
-	printf("    >= 252      %7d\n", bins[11]);
-
-	printf("\nHistogram (range):\n");
-	print_range(0, 3, range0, nb_pix, histo);
-	print_range(4, 7, range4, nb_pix, histo);
-	print_range(8, 15, range8, nb_pix, histo);
-	print_range(16, 31, range16, nb_pix, histo);
-	print_range(32, 63, range32, nb_pix, histo);
-	print_range(64, 127, range64, nb_pix, histo);
-	print_range(128, 191, range128, nb_pix, histo);
-	print_range(192, 223, range192, nb_pix, histo);
-	print_range(224, 239, range224, nb_pix, histo);
-	print_range(240, 247, range240, nb_pix, histo);
-	print_range(248, 251, range248, nb_pix, histo);
-	print_range(252, 255, range252, nb_pix, histo);
 }
 
 /*
- * Read stats from the DCMIPP ISP
+ * Length of the line starting at p, clipped to max
  */
-static int get_stat(struct isp_descriptor *isp_desc, bool loop, struct stm32_dcmipp_stat_buf **stats, enum v4l2_isp_stat_profile profile)
+static size_t line_len(const char *p, const char *end, size_t max, const char **next)
 {
-	enum v4l2_buf_type type;
-	struct v4l2_format fmt;
-	struct v4l2_buffer buf;
-	struct timeval tv;
-	size_t buflen = 0;
-	fd_set fds;
-	int i, ret;
-
-	/* Set the stat profile */
-	ret = set_stat_profile(isp_desc, profile);
-	if (ret) {
-		printf("Failed to set stat capture profile\n");
-		return ret;
-	}
+	const char *eol = memchr(p, '\n', end - p);
 
-	/* Queue buff */
-	for (i = 0; i < isp_desc->stats_buf_nb; i++) {
-		buf.type = V4L2_BUF_TYPE_META_CAPTURE;
-		buf.memory = V4L2_MEMORY_MMAP;
-		buf.index = i;
+	if (!eol)
+		eol = end;
+	*next = eol < end ? eol + 1 : end;
 
-		ret = ioctl(isp_desc->stat_fd, VIDIOC_QBUF, &buf);
-		if (ret) {
-			printf("Failed to queue buffer %d\n", i);
-			return ret;
-		}
-	}
+	return (size_t)(eol - p) < max ? (size_t)(eol - p) : max;
+}
 
-	/* Start stream */
-	type = V4L2_BUF_TYPE_META_CAPTURE;
-	ret = ioctl(isp_desc->stat_fd, VIDIOC_STREAMON, &type);
-	if (ret) {
-		printf("Failed to start stream\n");
-		return ret;
+static void screen_flush(struct screen *scr)
+{
+	const char *line, *end, *old, *old_line, *old_end, *next;
+	unsigned int row, rows, cols;
+	struct winsize ws;
+	struct text tmp;
+	size_t n, old_n;
+
+	fflush(stdout);
+
+	if (!scr->tty) {
+		text_append(&scr->cur, "\n", 1);
+		write_all(STDOUT_FILENO, scr->cur.buf, scr->cur.len);
+		scr->cur.len = 0;
+		return;
 	}
 
-	FD_ZERO(&fds);
-	FD_SET(isp_desc->stat_fd, &fds);
-	tv.tv_sec = 2;
-	tv.tv_usec = 0;
-
-	do {
-		/* Wait for buff */
-		ret = select(isp_desc->stat_fd + 1, &fds, NULL, NULL, &tv);
-
-		if (ret < 0) {
-			printf("Select failed (%d)\n", ret);
-			return ret;
-		}
-		if (ret == 0) {
-			printf("Select timeout\n");
-			return -EBUSY;
-		}
-
-		/* Get a buff */
-		buf.type = V4L2_BUF_TYPE_META_CAPTURE;
-		buf.memory = V4L2_MEMORY_MMAP;
-		ret = ioctl(isp_desc->stat_fd, VIDIOC_DQBUF, &buf);
-		if (ret) {
-			printf("Failed to dequeue buffer\n");
-			return ret;
-		}
-
-		/* Return result (if requested) */
-		if (stats)
-			*stats = isp_desc->stats[buf.index];
-
-		/* Print result */
-		if (loop) {
-			printf("\f");
-			printf("Location Pre-demosaicing\n");
-			print_average(isp_desc->stats[buf.index]->pre.average_RGB);
-			print_bins(isp_desc->stats[buf.index]->pre.bins);
-			printf("Location Post-demosaicing\n");
-			print_average(isp_desc->stats[buf.index]->post.average_RGB);
-			print_bins(isp_desc->stats[buf.index]->post.bins);
-		}
-
-		/* Queue buf */
-		ret = ioctl(isp_desc->stat_fd, VIDIOC_QBUF, &buf);
-		if (ret) {
-			printf("Failed to queue buffer %d\n", i);
-			return ret;
+	/* Redraw everything on the first refresh and when the terminal is resized */
+	scr->out.len = 0;
+	if (!ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) && (ws.ws_row != scr->rows || ws.ws_col != scr->cols)) {
+		scr->rows = ws.ws_row;
+		scr->cols = ws.ws_col;
+		scr->shown.len = 0;
+	}
+	if (!scr->shown.len)
+		text_printf(&scr->out, "\033[H\033[2J");
+
+	/* Keep the last row for the cursor */
+	rows = scr->rows > 1 ? scr->rows - 1 : UINT_MAX;
+	cols = scr->cols ? scr->cols : UINT_MAX;
+
+	line = scr->cur.buf;
+	end = line + scr->cur.len;
+	old = scr->shown.buf;
+	old_end = old + scr->shown.len;
+	for (row = 0; row < rows && line < end; row++) {
+		n = line_len(line, end, cols, &next);
+		if (old < old_end) {
+			old_line = old;
+			old_n = line_len(old_line, old_end, cols, &old);
+			if (old_n == n && !memcmp(line, old_line, n)) {
+				line = next;
+				continue;
+			}
 		}
-
-		/* Wait to let user see printf output */
-		if (loop)
-			usleep(100 * 1000);
-	} while (loop);
-
-	/* Stop stream */
-	type = V4L2_BUF_TYPE_META_CAPTURE;
-	ret = ioctl(isp_desc->stat_fd, VIDIOC_STREAMOFF, &type);
-	if (ret) {
-		printf("Failed to stop stream\n");
-		return ret;
+		text_printf(&scr->out, "\033[%u;1H", row + 1);
+		text_append(&scr->out, line, n);
+		text_printf(&scr->out, "\033[K");
+		line = next;
 	}
+	/* Clear the rest of a longer previous screen, and leave the cursor below */
+	text_printf(&scr->out, "\033[%u;1H\033[J", row + 1);
 
-	return ret;
+	write_all(STDOUT_FILENO, scr->out.buf, scr->out.len);
+
+	tmp = scr->shown;
+	scr->shown = scr->cur;
+	scr->cur = tmp;
+	scr->cur.len = 0;
 }
 
-#define IMX335_EXPOSURE_MAX		4491
-#define IMX335_EXPOSURE_MIN		50
-#define IMX335_GAIN_MIN			0
-#define IMX335_GAIN_MAX			240
-#define IMX335_GAIN_DB_UNIT		0.3
-
-#define AEC_ATTEMPT_MAX			20
-#define AEC_EXPOSURE_UPDATE		400
-#define AEC_GAIN_UPDATE_MAX		5
-#define AEC_TOLERANCE			15
-#define AEC_COEFF_LUM_GAIN		0.1
-#define AEC_TARGET			56 /* Note: 56 is transformed to 128 after gamma correction */
 /*
- * Function to configure both DCMIPP ISP & Sensor gain
- *
- * This algorithm updates the sensor gain and exposure so the average Luminance fits with a target.
- * Update the sensor gain until it reaches 0 : from that point, update the sensor exposure
+ * Render the stats aggregated over the last refresh interval
+ * 'frames' is the number of frames captured in the interval, the window being the last one with frames.
  */
-static int set_sensor_gain_exposure(struct isp_descriptor *isp_desc, bool verbose)
+static void render_stats(struct screen *scr, const struct stats_window *win, unsigned int frames, double interval,
+			 const struct isp_counters *counters, const struct stm32_dcmipp_isp_histo_cfg *histo_cfg)
 {
-	float gain_db, gain_update_db;
-	bool limit_reached = false, do_exposure_update, exposure_dec = false, exposure_inc = false;
-	int ret, avgL, gain, exposure, attempt = 0;
-	struct stm32_dcmipp_stat_buf *stats;
-	int sensor_fd;
-
-	sensor_fd = open(isp_desc->sensor_subdev_name, O_RDWR);
-	if (sensor_fd == -1) {
-		ret = -errno;
-		printf("Failed to open sensor subdev %s\n", isp_desc->sensor_subdev_name);
-		return ret;
-	}
-
-	/* Get sensor exposure */
-	ret = get_ctrl(sensor_fd, V4L2_CID_EXPOSURE, &exposure);
-	if (ret) {
-		printf("Failed to get sensor exposure\n");
-		close(sensor_fd);
-		return ret;
+	static const char * const avg[] = { "Red", "Green", "Blue", "Lum" };
+	static const char bar[] = "--------------------";
+	struct text *t = &scr->cur;
+	unsigned int nb = win->frames, i, l, v, h, k, b, bin_nb, comp_nb, cnt = 0;
+	struct isp_histo_metrics metrics;
+	int range[2][12], nb_pix[2], pct;
+	__u16 mean[256];
+	__u32 bins[12];
+	char str[128];
+
+	text_printf(t, "Frames %u (%.1f fps), %u skipped, %u dropped by the ISP\n",
+		    counters->frames, frames / interval, counters->skipped, counters->dropped);
+	if (!nb) {
+		text_printf(t, "Waiting for the stats\n");
+		return;
 	}
-
-	if (exposure != IMX335_EXPOSURE_MAX)
-		/* Start with exposure update (gain is expected to be 0) */
-		do_exposure_update = true;
-	else
-		/* Start with gain update (exposure is at its max) */
-		do_exposure_update = false;
-
-	/* Get sensor gain (unit = 0.3dB) */
-	ret = get_ext_ctrl_int(sensor_fd, V4L2_CTRL_CLASS_IMAGE_SOURCE, V4L2_CID_ANALOGUE_GAIN, &gain);
-	gain_db = gain * IMX335_GAIN_DB_UNIT;
-	if (ret) {
-		printf("Failed to get sensor gain\n");
-		close(sensor_fd);
-		return ret;
+	text_printf(t, "Frame %u: exposure %d, gain %d\n\n", win->sequence, win->exposure, win->gain);
+
+	text_printf(t, "Average (%u frames)      Pre-demosaicing           Post-demosaicing\n", nb);
+	text_printf(t, "                      min    mean     max       min    mean     max\n");
+	for (i = 0; i < 4; i++)
+		text_printf(t, "    %-12s  %7u %7llu %7u   %7u %7llu %7u\n", avg[i],
+			    win->loc[0].min[i], (unsigned long long)(win->loc[0].sum[i] / nb), win->loc[0].max[i],
+			    win->loc[1].min[i], (unsigned long long)(win->loc[1].sum[i] / nb), win->loc[1].max[i]);
+	text_printf(t, "    %-12s  %7u %7llu %7u\n", "Bad pixels",
+		    win->bad_min, (unsigned long long)(win->bad_sum / nb), win->bad_max);
+
+	for (l = 0; l < 2; l++) {
+		for (i = 0; i < 12; i++)
+			bins[i] = win->loc[l].bins[i] / nb;
+		nb_pix[l] = bin_ranges(bins, range[l]);
 	}
 
-	do {
-		/* Measure the luminance */
-		ret = get_stat(isp_desc, false, &stats, V4L2_STAT_PROFILE_AVERAGE_POST);
-		if (ret) {
-			close(sensor_fd);
-			return ret;
-		}
-
-		/* Compare the average luminance with the AEC_TARGET */
-		avgL = luminance_from_rgb(stats->post.average_RGB);
-		gain_update_db = 0;
-
-		if (verbose) {
-			printf("\nAttempt %d\n", attempt);
-			printf(" Current AvgL = %d\n", avgL);
-			printf(" Current gain = %d\n", gain);
-			printf(" Current expo = %d\n", exposure);
+	text_printf(t, "\nHistogram (range, mean)    Pre-demosaicing                   Post-demosaicing\n");
+	for (i = 0; i < 12; i++) {
+		text_printf(t, "    [%3d:%3d]", bin_range_min[i], bin_range_max(i));
+		for (l = 0; l < 2; l++) {
+			pct = nb_pix[l] ? 100LL * range[l][i] / nb_pix[l] : 0;
+			text_printf(t, "   %9d %3d%% %-*.*s", range[l][i], pct, l ? 0 : 20,
+				    nb_pix[l] ? clamp(20LL * range[l][i] / nb_pix[l], 0, 19) + 1 : 0, bar);
 		}
+		text_printf(t, "\n");
+	}
 
-		if (avgL > AEC_TARGET + AEC_TOLERANCE) {
-			/* Too bright, decrease gain */
-			gain_update_db = (float)(AEC_TARGET - avgL) * AEC_COEFF_LUM_GAIN;
-			if (gain_update_db < -AEC_GAIN_UPDATE_MAX)
-				gain_update_db = -AEC_GAIN_UPDATE_MAX;
-		} else if (avgL < AEC_TARGET - AEC_TOLERANCE) {
-			/* Too dark vador, call a Jedi and increase gain */
-			gain_update_db = (float)(AEC_TARGET - avgL) * AEC_COEFF_LUM_GAIN;
-			if (gain_update_db > AEC_GAIN_UPDATE_MAX)
-				gain_update_db = AEC_GAIN_UPDATE_MAX;
-		}
-
-		if (gain_update_db) {
-			/* Need to change something (gain or exposure) */
-			if (!do_exposure_update) {
-				/* Update gain as it has not reached its min value */
-				gain_db += gain_update_db;
-				gain = gain_db / IMX335_GAIN_DB_UNIT;
-
-				if (gain < IMX335_GAIN_MIN) {
-					gain = IMX335_GAIN_MIN;
-					/* Can't decrease gain anymore: we will have to decrease exposure */
-					do_exposure_update = true;
-				} else if (gain > IMX335_GAIN_MAX) {
-					gain = IMX335_GAIN_MAX;
-					limit_reached = true;
-				}
-
-				if (verbose)
-					printf(">New gain = %d\n", gain);
-
-				/* Set sensor gain */
-				ret = set_ext_ctrl_int(sensor_fd, V4L2_CTRL_CLASS_IMAGE_SOURCE, V4L2_CID_ANALOGUE_GAIN, gain);
-				if (ret) {
-					printf("Failed to set sensor gain\n");
-					close(sensor_fd);
-					return ret;
-				}
-			} else {
-				/* Update exposure since gain has reached its min value */
-				if (gain_update_db < 0) {
-					if (exposure_inc) {
-						/* We previously increased exposure, so do not try to decrease it from now */
-						limit_reached = true;
-					}
-					else
-					{
-						/* Decrease exposure */
-						exposure -= AEC_EXPOSURE_UPDATE;
-						exposure_dec = true;
-						if (exposure < IMX335_EXPOSURE_MIN)
-						{
-							exposure = IMX335_EXPOSURE_MIN;
-							limit_reached = true;
-						}
-					}
-				} else {
-					if (exposure_dec) {
-						/* We previously decreased exposure, so do not try to increase it from now */
-						limit_reached = true;
-					}
-					else
-					{
-						/* Increase exposure */
-						exposure += AEC_EXPOSURE_UPDATE;
-						exposure_inc = true;
-						if (exposure > IMX335_EXPOSURE_MAX) {
-							exposure = IMX335_EXPOSURE_MAX;
-							/* Can't increase exposure anymore: we will have to increase gain */
-							do_exposure_update = false;
-						}
-					}
-				}
-
-				if (verbose)
-					printf(">New expo = %d\n", exposure);
-
-				/* Set sensor exposure */
-				ret = set_ctrl(sensor_fd, V4L2_CID_EXPOSURE, exposure);
-				if (ret) {
-					printf("Failed to set sensor exposure\n");
-					close(sensor_fd);
-					return ret;
+	if (!histo_cfg)
+		return;
+
+	bin_nb = isp_histo_bin_nb(histo_cfg);
+	comp_nb = histo_cfg->comp < 4 ? 1 : 4;
+	text_printf(t, "\nHistogram (mean)\n");
+	for (v = 0; v < histo_cfg->vreg; v++) {
+		for (h = 0; h < histo_cfg->hreg; h++) {
+			for (k = 0; k < comp_nb && cnt + bin_nb <= STM32_DCMIPP_HISTO_BIN_MAX; k++) {
+				text_printf(t, "    Region XY (%u/%u) %u:", h + 1, v + 1, k);
+				for (b = 0; b < bin_nb; b++) {
+					mean[b] = win->histograms[cnt++] / nb;
+					text_printf(t, " %u", mean[b]);
 				}
+				isp_histo_compute(mean, bin_nb, &metrics, NULL);
+				histo_metrics_str(&metrics, str, sizeof(str));
+				text_printf(t, "\n        %s\n", str);
 			}
-
-			/* Note: we shall wait for 2 frames before checking the luminance update, but since it takes
-			   more time than 2 frames to get some updated statistics, there is no need to call sleep() here */
-
-			if (++attempt == AEC_ATTEMPT_MAX)
-				limit_reached = true;
 		}
-	} while (gain_update_db && !limit_reached);
-
-	close(sensor_fd);
-	return ret;
+	}
 }
 
 /*
- * Function to demonstrate the DCMIPP ISP contrast block control
+ * Render the last histograms of each scheduled configuration, the regions of each component merged
  */
-static int set_contrast(struct isp_descriptor *isp_desc, int type)
+static void render_histo_sched(struct screen *scr, struct isp_handle *isp, const struct isp_histo_sched_cfg *sched)
 {
-	struct stm32_dcmipp_params_cfg params = {
-		.module_cfg_update = STM32_DCMIPP_ISP_CE,
-	};
-	__u8 dynamic[9] = { 32, 32, 32, 27, 23, 20, 18, 17, 16 };
-	__u8 *lum;
-
-	int i, ret;
-
-	switch (type) {
-	case 0:
-		/* Disabled */
-		break;
-	case 1:
-		/* 50% */
-		params.ctrls.ce_cfg.en = 1;
-		lum = params.ctrls.ce_cfg.lum;
-
-		for (i = 0; i < 9; i++)
-			lum[i] = 8;
-		break;
-	case 2:
-		/* 200% */
-		params.ctrls.ce_cfg.en = 1;
-		lum = params.ctrls.ce_cfg.lum;
-		for (i = 0; i < 9; i++)
-			lum[i] = 32;
-		break;
-	case 3:
-		/* Dynamic */
-		params.ctrls.ce_cfg.en = 1;
-		lum = params.ctrls.ce_cfg.lum;
-		memcpy(lum, dynamic, sizeof(dynamic));
-		break;
-	default:
-		printf("Unknown contrast type (%d)\n", type);
-		return -EINVAL;
+	static struct isp_histo_entry entry;
+	const struct stm32_dcmipp_isp_histo_cfg *cfg;
+	struct text *t = &scr->cur;
+	unsigned int id, r, k, b, bin_nb, comp_nb, reg_nb;
+	struct isp_histo_metrics metrics;
+	__u32 sum[256];
+	__u16 mean[256];
+	char str[128];
+
+	text_printf(t, "\nScheduled histograms (pattern of %u frames)\n", sched->pattern_len);
+	for (id = 0; id < sched->cfg_nb; id++) {
+		cfg = &sched->cfg[id];
+		text_printf(t, "    #%u source %u, component %u: ", id, cfg->src, cfg->comp);
+		if (isp_histo_sched_get(isp, id, &entry)) {
+			text_printf(t, "waiting\n");
+			continue;
+		}
+		text_printf(t, "frame %u, refreshed every %u frames\n", entry.sequence, entry.period);
+
+		bin_nb = isp_histo_bin_nb(cfg);
+		reg_nb = cfg->hreg * cfg->vreg;
+		comp_nb = isp_histo_nb(cfg) / reg_nb;
+		for (k = 0; k < comp_nb; k++) {
+			memset(sum, 0, sizeof(sum));
+			for (r = 0; r < reg_nb; r++)
+				for (b = 0; b < bin_nb; b++)
+					sum[b] += entry.histograms[(r * comp_nb + k) * bin_nb + b];
+			for (b = 0; b < bin_nb; b++)
+				mean[b] = sum[b] / reg_nb;
+			isp_histo_compute(mean, bin_nb, &metrics, NULL);
+			histo_metrics_str(&metrics, str, sizeof(str));
+			text_printf(t, "        %u: %s\n", k, str);
+		}
 	}
-
-	ret = apply_params(isp_desc, &params);
-	if (ret)
-		printf("Failed to apply contrast\n");
-
-	return ret;
 }
 
+/* Output of the machine readable format, stdout being redirected to stderr for the text */
+static int format_fd = STDOUT_FILENO;
+
 /*
- * Convert a float value in a couple shift / mult used by the DCMIPP ISP
+ * Allocate the buffer of the machine readable output, and output the header
  */
-static void to_shift_mult_float(float f, __u8 *shift, __u8 *mult)
+static char *format_start(enum isp_format format, unsigned int histo_nb)
 {
-	int s;
-
-	if (f > 255)
-		printf("Warning, invalid value : %f\n", f);
+	char *buf = malloc(isp_format_size(format, histo_nb));
 
-	for (s = 0; s < 8; s++) {
-		if (f < 2.0)
-			break;
-		f /= 2;
-	}
+	if (buf)
+		write_all(format_fd, buf, isp_format_header(format, histo_nb, buf));
 
-	*shift = s;
-	*mult = f * 128;
+	return buf;
 }
 
 /*
- * Convert a float value to a reg 2.8 format (1.0 is coded by 0x100, the sign is
- * indicated as complement to 2
+ * Output the stats of a frame in a single write
  */
-static __u16 to_cconv_reg(float f)
+static void format_write(enum isp_format format, const struct isp_stats *stats, unsigned int histo_nb, char *buf)
 {
-	__s16 tmp = 256 * f;
+	write_all(format_fd, buf, isp_format_stats(format, stats, histo_nb, buf));
+}
+
+static __u64 clock_ns(void)
+{
+	struct timespec ts;
 
-	if (tmp < 0)
-		tmp = ((-tmp ^ 0x7FF) + 1) & 0x7FF;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-	return (__u16)tmp;
+	return (__u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 }
 
-/*
- * Function to adapt the DCMIPP ISP configuration based on the ambiant light profile
- */
-static int set_profile(struct isp_descriptor *isp_desc, int type)
+static volatile sig_atomic_t daemon_stop;
+
+static void daemon_signal_handler(int sig)
 {
-	/* Exposure / colorconv settings for D50 profile */
-	const float exposure_D50[3] = { 2.2, 1.0, 1.8 };
-	const float colorconv_D50[3][3] =
-		{ {  1.8008,	-0.6484,	-0.1523 },
-		  { -0.3555,	 1.6992,	-0.3438 },
-		  {  0.0977,	-0.957,		 1.8594 } };
-
-	/* Exposure / colorconv settings for TL84 profile */
-	const float exposure_TL84[3] = { 1.7, 1.0, 2.35 };
-	const float colorconv_TL84[3][3] =
-		{ {  1.551345,	-0.6937,	 0.13106 },
-		  { -0.38671,	 1.676898,	-0.33936 },
-		  {  0.055462,	-0.6677,	 1.599442 } };
-
-	float exposure[3], colorconv[3][3];
-	struct stm32_dcmipp_params_cfg params = {
-		.module_cfg_update = STM32_DCMIPP_ISP_BLC |
-				     STM32_DCMIPP_ISP_EX |
-				     STM32_DCMIPP_ISP_CC,
-		.ctrls = {
-			/* IMX335 black level set to 12 */
-			.blc_cfg = {
-				.en = 1,
-				.blc_r = 12,
-				.blc_g = 12,
-				.blc_b = 12,
-			},
-		},
-	};
-	struct stm32_dcmipp_isp_ex_cfg *exposure_wb = &params.ctrls.ex_cfg;
-	struct stm32_dcmipp_isp_cc_cfg *cconv = &params.ctrls.cc_cfg;
-
-	int i, j, ret;
-
-	if (type == 0) {
-		memcpy(exposure, exposure_D50, sizeof(exposure));
-		memcpy(colorconv, colorconv_D50, sizeof(colorconv));
-	} else if (type == 1) {
-		memcpy(exposure, exposure_TL84, sizeof(exposure));
-		memcpy(colorconv, colorconv_TL84, sizeof(colorconv));
-	} else {
-		printf("Invalid profile : %d\n", type);
-		return -EINVAL;
-	}
+	daemon_stop = 1;
+}
 
-	/* Set exposure */
-	to_shift_mult_float(exposure[0], &exposure_wb->shift_r, &exposure_wb->mult_r);
-	to_shift_mult_float(exposure[1], &exposure_wb->shift_g, &exposure_wb->mult_g);
-	to_shift_mult_float(exposure[2], &exposure_wb->shift_b, &exposure_wb->mult_b);
-	exposure_wb->en = 1;
-
-	/* Set colorconv */
-	cconv->rr = to_cconv_reg(colorconv[0][0]);
-	cconv->rg = to_cconv_reg(colorconv[0][1]);
-	cconv->rb = to_cconv_reg(colorconv[0][2]);
-	cconv->gr = to_cconv_reg(colorconv[1][0]);
-	cconv->gg = to_cconv_reg(colorconv[1][1]);
-	cconv->gb = to_cconv_reg(colorconv[1][2]);
-	cconv->br = to_cconv_reg(colorconv[2][0]);
-	cconv->bg = to_cconv_reg(colorconv[2][1]);
-	cconv->bb = to_cconv_reg(colorconv[2][2]);
-	cconv->en = 1;
-	cconv->clamp = STM32_DCMIPP_ISP_CC_CLAMP_DISABLED;
-
-	ret = apply_params(isp_desc, &params);
-	if (ret)
-		printf("Failed to apply exposure\n");
+static void install_signal_handler(void)
+{
+	struct sigaction sa;
 
-	return ret;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = daemon_signal_handler;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
 }
 
 /*
- * Function to set the histogram configuration
+ * Read and print the stats (and histograms), once or continuously until interrupted
+ *
+ * In the continuous mode, the stats are captured at the frame rate and aggregated until the display
+ * is refreshed, 'refresh' times per second. With a machine readable format, the stats of each frame
+ * are output instead. With a histogram schedule, the last histograms of each of its configurations
+ * are shown rather than the aggregated ones.
  */
-static int set_histogram(struct isp_descriptor *isp_desc, struct stm32_dcmipp_isp_histo_cfg *cfg)
+static int show_stats(struct isp_handle *isp, bool loop, const struct stm32_dcmipp_isp_histo_cfg *histo_cfg,
+		      const struct isp_histo_sched_cfg *sched, struct isp_record *record, unsigned int refresh,
+		      enum isp_format format)
 {
-	int ret;
-	struct stm32_dcmipp_params_cfg params = {
-		.module_cfg_update = STM32_DCMIPP_ISP_HISTO,
-	};
+	static struct stats_window windows[2];
+	struct stats_window *win = &windows[0], *shown = &windows[1], *tmp;
+	unsigned int histo_nb;
+	__u64 interval = 1000000000ULL / refresh, now, next;
+	struct isp_counters counters;
+	struct isp_stats stats;
+	unsigned int frames;
+	struct screen scr;
+	char *buf = NULL;
+	int ret, timeout;
+
+	if (sched) {
+		ret = isp_histo_sched_start(isp, sched);
+		if (ret) {
+			printf("Failed to start the histogram schedule\n");
+			return ret;
+		}
+		histo_cfg = NULL;
+	} else if (histo_cfg) {
+		if (format == ISP_FORMAT_TEXT) {
+			printf("Histogram config:\n\tarea (%d,%d/%dx%d) * %d/%d regions\n",
+			       histo_cfg->left, histo_cfg->top, histo_cfg->width, histo_cfg->height,
+			       histo_cfg->hreg, histo_cfg->vreg);
+			printf("\t %d bins, %d components, %dx%d decimation from source %d\n",
+			       histo_cfg->bin, histo_cfg->comp, histo_cfg->hdec, histo_cfg->vdec, histo_cfg->src);
+		}
+
+		ret = isp_set_histogram(isp, histo_cfg);
+		if (ret) {
+			printf("Failed to set histogram\n");
+			return ret;
+		}
+	}
+	histo_nb = histo_cfg ? histo_value_nb(histo_cfg) : 0;
 
-	params.ctrls.histo_cfg = *cfg;
+	if (format != ISP_FORMAT_TEXT) {
+		buf = format_start(format, histo_nb);
+		if (!buf)
+			return -ENOMEM;
+	}
 
-	printf("Histogram config:\n\tarea (%d,%d/%dx%d) * %d/%d regions\n",
-	       cfg->left, cfg->top, cfg->width, cfg->height,
-	       cfg->hreg, cfg->vreg);
-	printf("\t %d bins, %d components, %dx%d decimation from source %d\n",
-	       cfg->bin, cfg->comp, cfg->hdec, cfg->vdec, cfg->src);
+	if (!loop) {
+		ret = isp_stat_read(isp, V4L2_STAT_PROFILE_FULL, &stats);
+		if (!ret && buf)
+			format_write(format, &stats, histo_nb, buf);
+		else if (!ret)
+			print_stats(&stats, histo_cfg);
+		free(buf);
+		return ret;
+	}
 
-	ret = apply_params(isp_desc, &params);
+	ret = isp_set_stat_profile(isp, V4L2_STAT_PROFILE_FULL);
 	if (ret)
-		printf("Failed to apply histo config\n");
+		goto out;
 
-	return ret;
-}
+	ret = isp_stream_start(isp);
+	if (ret)
+		goto out;
+
+	install_signal_handler();
+	screen_init(&scr);
+	stats_window_reset(win, histo_nb);
+	stats_window_reset(shown, histo_nb);
+	next = clock_ns() + interval;
+
+	while (!daemon_stop) {
+		/* The machine readable output does not wait for the refresh */
+		now = clock_ns();
+		if (buf)
+			timeout = -1;
+		else
+			timeout = next > now ? (next - now + 999999) / 1000000 : 0;
+
+		ret = isp_event_dispatch(isp, timeout, &stats);
+		if (ret == -EINTR)
+			continue;
+		if (ret < 0)
+			break;
 
-static void display_histo(__u16 *bins, __u8 vreg, __u8 hreg, __u8 comp, __u8 bin)
-{
-	int i, j, k, l;
-	int cnt = 0;
+		if (ret && record)
+			isp_record_write(record, &stats);
+		if (ret && buf)
+			format_write(format, &stats, histo_nb, buf);
+		else if (ret)
+			stats_window_add(win, &stats, histo_nb);
 
-	for (i = 1; i < vreg; i++) {
-		for (j = 1; j < hreg; j++) {
-			printf("Region XY (%d/%d)\n", j, i);
-			for (k = 0; k < comp; k++) {
-				printf("\tComponent n'%d: ", k);
-				for (l = 0; l < bin; l++)
-					printf("%d ", bins[cnt++]);
-				printf("\n");
-			}
+		now = clock_ns();
+		if (buf || now < next)
+			continue;
+
+		/* Keep showing the last stats if no frame came during the interval */
+		frames = win->frames;
+		if (frames) {
+			tmp = shown;
+			shown = win;
+			win = tmp;
+			stats_window_reset(win, histo_nb);
 		}
+		isp_get_counters(isp, &counters);
+		render_stats(&scr, shown, frames, interval / 1e9, &counters, histo_cfg);
+		if (sched)
+			render_histo_sched(&scr, isp, sched);
+		screen_flush(&scr);
+
+		next += interval;
+		if (next <= now)
+			next = now + interval;
 	}
+
+	screen_free(&scr);
+	isp_stream_stop(isp);
+out:
+	if (sched)
+		isp_histo_sched_stop(isp);
+	free(buf);
+
+	return ret < 0 && ret != -EINTR ? ret : 0;
 }
 
 /*
- * Read histogram from the DCMIPP ISP
+ * Long-running control loop
+ *
+ * Both the stats and params queues keep streaming for the whole session, so each control step
+ * costs one frame instead of a full stream start / stop cycle.
  */
-static int get_histo(struct isp_descriptor *isp_desc, bool loop, struct stm32_dcmipp_isp_histo_cfg *cfg)
+static int run_daemon(struct isp_handle *isp, const struct isp_control_cfg *cfg, bool verbose,
+		      struct isp_record *record, enum isp_format format)
 {
-	enum v4l2_buf_type type;
-	struct v4l2_format fmt;
-	struct v4l2_buffer buf;
-	struct timeval tv;
-	size_t buflen = 0;
-	fd_set fds;
-	int i, ret;
-
-	/* Set the stat profile */
-	ret = set_stat_profile(isp_desc, 0);
-	if (ret) {
-		printf("Failed to set stat capture profile\n");
-		return ret;
-	}
+	struct isp_counters counters;
+	struct isp_stats stats;
+	unsigned int frames = 0;
+	char *buf = NULL;
+	int ret;
 
-	/* Set the histogram */
-	ret = set_histogram(isp_desc, cfg);
-	if (ret) {
-		printf("Failed to set histogram\n");
-		return ret;
+	if (format != ISP_FORMAT_TEXT) {
+		buf = format_start(format, 0);
+		if (!buf)
+			return -ENOMEM;
 	}
 
-	/* Queue buff */
-	for (i = 0; i < isp_desc->stats_buf_nb; i++) {
-		buf.type = V4L2_BUF_TYPE_META_CAPTURE;
-		buf.memory = V4L2_MEMORY_MMAP;
-		buf.index = i;
-
-		ret = ioctl(isp_desc->stat_fd, VIDIOC_QBUF, &buf);
-		if (ret) {
-			printf("Failed to queue buffer %d\n", i);
-			return ret;
-		}
-	}
+	install_signal_handler();
 
-	/* Start stream */
-	type = V4L2_BUF_TYPE_META_CAPTURE;
-	ret = ioctl(isp_desc->stat_fd, VIDIOC_STREAMON, &type);
+	ret = isp_control_start(isp, cfg);
 	if (ret) {
-		printf("Failed to start stream\n");
+		free(buf);
 		return ret;
 	}
 
-	FD_ZERO(&fds);
-	FD_SET(isp_desc->stat_fd, &fds);
-	tv.tv_sec = 2;
-	tv.tv_usec = 0;
-
-	do {
-		/* Wait for buff */
-		ret = select(isp_desc->stat_fd + 1, &fds, NULL, NULL, &tv);
+	ret = isp_set_stat_profile(isp, V4L2_STAT_PROFILE_FULL);
+	if (ret)
+		goto out;
 
-		if (ret < 0) {
-			printf("Select failed (%d)\n", ret);
-			return ret;
-		}
-		if (ret == 0) {
-			printf("Select timeout\n");
-			return -EBUSY;
-		}
+	ret = isp_stream_start(isp);
+	if (ret)
+		goto out;
 
-		/* Get a buff */
-		buf.type = V4L2_BUF_TYPE_META_CAPTURE;
-		buf.memory = V4L2_MEMORY_MMAP;
-		ret = ioctl(isp_desc->stat_fd, VIDIOC_DQBUF, &buf);
-		if (ret) {
-			printf("Failed to dequeue buffer\n");
-			return ret;
-		}
+	if (verbose)
+		printf("Control loop started\n");
 
-		/* Print result */
-		printf("Location Pre-demosaicing\n");
-		print_average(isp_desc->stats[buf.index]->pre.average_RGB);
-		print_bins(isp_desc->stats[buf.index]->pre.bins);
-		printf("Location Post-demosaicing\n");
-		print_average(isp_desc->stats[buf.index]->post.average_RGB);
-		print_bins(isp_desc->stats[buf.index]->post.bins);
-		printf("Histogram\n");
-		display_histo(isp_desc->stats[buf.index]->histograms,
-			      cfg->vreg + 1, cfg->hreg + 1, cfg->comp < 4 ? 1 : 4,
-			      cfg->bin == 0 ? 4 : cfg->bin == 1 ? 16 : cfg->bin == 2 ? 64 : 256);
-
-		/* Queue buf */
-		ret = ioctl(isp_desc->stat_fd, VIDIOC_QBUF, &buf);
-		if (ret) {
-			printf("Failed to queue buffer %d\n", i);
-			return ret;
-		}
+	while (!daemon_stop) {
+		/* The control algorithms are run on each new stats */
+		ret = isp_event_dispatch(isp, -1, record || buf ? &stats : NULL);
+		if (ret == -EINTR)
+			continue;
+		if (ret < 0)
+			break;
 
-		/* Wait to let user see printf output */
-		if (loop)
-			usleep(100 * 1000);
-	} while (loop);
+		if (ret && record)
+			isp_record_write(record, &stats);
+		if (ret && buf)
+			format_write(format, &stats, 0, buf);
+		frames += ret;
+	}
 
-	/* Stop stream */
-	type = V4L2_BUF_TYPE_META_CAPTURE;
-	ret = ioctl(isp_desc->stat_fd, VIDIOC_STREAMOFF, &type);
-	if (ret) {
-		printf("Failed to stop stream\n");
-		return ret;
+	isp_stream_stop(isp);
+
+	isp_get_counters(isp, &counters);
+	if (verbose)
+		printf("Control loop stopped after %u frames (%u skipped, %u dropped by the ISP)\n",
+		       frames, counters.skipped, counters.dropped);
+	if (counters.control_errors)
+		printf("Control algorithm errors: %u\n", counters.control_errors);
+	if (cfg->adaptive_stats && counters.stat_bytes_full) {
+		printf("Stats profiles: %u full, %u pre average, %u post average, control held on %u frames\n",
+		       counters.profile_frames[V4L2_STAT_PROFILE_FULL],
+		       counters.profile_frames[V4L2_STAT_PROFILE_AVERAGE_PRE],
+		       counters.profile_frames[V4L2_STAT_PROFILE_AVERAGE_POST], counters.held);
+		printf("Stats written: %llu KiB instead of %llu KiB (-%.1f%%)\n",
+		       (unsigned long long)counters.stat_bytes / 1024, (unsigned long long)counters.stat_bytes_full / 1024,
+		       100.0 - 100.0 * counters.stat_bytes / counters.stat_bytes_full);
 	}
+	if (cfg->scene_gate)
+		printf("Scene gate: %u scene changes, control gated on %u of %u frames\n", counters.scene_changes,
+		       counters.held, frames);
 
-	return ret;
+out:
+	isp_control_stop(isp);
+	free(buf);
+
+	return ret < 0 && ret != -EINTR ? ret : 0;
 }
 
 static void usage(const char *argv0)
@@ -1358,11 +904,51 @@ static void usage(const char *argv0)
 	printf("                                  1 :  50%%\n");
 	printf("                                  2 : 200%%\n");
 	printf("                                  3 : Dynamic\n");
+	printf("                                  4 : Adaptive, from the luminance histogram (on every frame with -d)\n");
 	printf("-i, --illuminant TYPE       Apply settings (black level, color conv, exposure) for a specific illuminant\n");
 	printf("                            TYPE  0 : D50 (daylight)\n");
 	printf("                                  1 : TL84 (fluo lamp)\n");
+	printf("-b, --buffers NB            Number of stats and params buffers (%d to %d, default %d)\n",
+	       ISP_BUF_NB_MIN, ISP_BUF_NB_MAX, ISP_BUF_NB_DEFAULT);
+	printf("-t, --tuning FILE           Sensor tuning file (default %s if present)\n", TUNING_FILE_DEFAULT);
+	printf("-d, --daemon                Keep streaming and run the control loop on every frame until interrupted\n");
+	printf("                            (AutoExposure / AutoWhiteBalance are run continuously if -g / -a are set)\n");
+	printf("--adaptive-stats            Select on each frame the cheapest stats profile feeding the control loop\n");
+	printf("                            and hold the settled AutoExposure and adaptive contrast (with -d)\n");
+	printf("--scene-gate                Run the settled control loop only on the scene changes, and at a low rate\n");
+	printf("                            otherwise (with -d)\n");
+	printf("--metering MODE             Metering of the AutoExposure run continuously (with -d -g)\n");
+	printf("                            MODE  0 : Frame average (default)\n");
+	printf("                                  1 : Center weighted\n");
+	printf("                                  2 : Spot\n");
+	printf("                                  3 : Matrix\n");
+	printf("--antiflicker MODE          Anti-flicker of the AutoExposure run continuously (with -d -g)\n");
+	printf("                            MODE  0 : Off (default)\n");
+	printf("                                  1 : Auto, once a flicker is detected\n");
+	printf("                                  2 : 50 Hz mains\n");
+	printf("                                  3 : 60 Hz mains\n");
+	printf("--cache                     Use the device discovery cache, saved in /var/cache\n");
+	printf("--publish[=SOCKET]          Publish the stats of each frame to other processes (with -S, -H or -d)\n");
+	printf("                            through the Unix socket SOCKET (default %s)\n", ISP_PUBLISH_SOCKET_DEFAULT);
+	printf("--roi[=SOCKET]              Weight the AutoExposure and the gray world AutoWhiteBalance toward the\n");
+	printf("                            regions of interest received on the Unix socket SOCKET (with -d,\n");
+	printf("                            default %s)\n", ISP_ROI_SOCKET_DEFAULT);
+	printf("--record FILE               Record the stats of each frame in a ring file (with -S, -H or -d)\n");
+	printf("--record-frames NB          Capacity of the ring file (default %d, max %d frames)\n", ISP_RECORD_CAPACITY_DEFAULT, ISP_RECORD_CAPACITY_MAX);
+	printf("--record-fields LIST        Recorded fields: avg, bins, bad, histo (default avg,bins,bad and histo with -H)\n");
+	printf("-a, --awb MODE              Apply the white balance (AutoWhiteBalance)\n");
+	printf("                            MODE  0 : Gray world\n");
+	printf("                                  1 : White patch\n");
 	printf("-s, --stat                  Read the stat\n");
 	printf("-S, --STAT                  Read the stat continuously\n");
+	printf("--refresh HZ                Refresh rate of the continuous display of -S and -H (default %d)\n",
+	       REFRESH_RATE_DEFAULT);
+	printf("--format FORMAT             Output format of the stats of -s, -S, -h, -H and -d\n");
+	printf("                            FORMAT text  : Human readable (default)\n");
+	printf("                                   jsonl : One JSON object per frame\n");
+	printf("                                   csv   : One line per frame, after a header line\n");
+	printf("                                   bin   : One binary record per frame (see isp-format.h)\n");
+	printf("                            Except with text, stdout only gets the stats: the messages go to stderr\n");
 	printf("--histo_top                 Top raw of the histogram area\n");
 	printf("--histo_left		    Left column of the histogram area\n");
 	printf("--histo_width		    Width of a region of histogram\n");
@@ -1375,6 +961,9 @@ static void usage(const char *argv0)
 	printf("--histo_dyn                 Dynamic of pixels to capture in histogram\n");
 	printf("--histo_h_decimation        Horizontal decimation in histogram\n");
 	printf("--histo_v_decimation        Vertical decimation in histogram\n");
+	printf("--histo-sched LIST          Rotate the histogram source and component across the frames (with -H):\n");
+	printf("                            SRC[:COMP] of each frame of the pattern, separated by commas, on the\n");
+	printf("                            histogram area above (e.g. 3:3,5:3,1:4)\n");
 	printf("--help                      Display usage\n");
 	printf("-v                          Verbose output\n");
 }
@@ -1392,6 +981,19 @@ enum {
 	HISTO_DYN,
 	HISTO_H_DECIMATION,
 	HISTO_V_DECIMATION,
+	CACHE,
+	PUBLISH,
+	RECORD,
+	RECORD_FRAMES,
+	RECORD_FIELDS,
+	REFRESH,
+	FORMAT,
+	METERING,
+	ANTIFLICKER,
+	ADAPTIVE_STATS,
+	SCENE_GATE,
+	ROI,
+	HISTO_SCHED,
 };
 
 
@@ -1399,10 +1001,27 @@ static struct option opts[] = {
 	{"gain", no_argument, 0, 'g'},
 	{"contrast", required_argument, 0, 'c'},
 	{"illuminant", required_argument, 0, 'i'},
+	{"awb", required_argument, 0, 'a'},
+	{"buffers", required_argument, 0, 'b'},
+	{"tuning", required_argument, 0, 't'},
+	{"daemon", no_argument, 0, 'd'},
+	{"metering", required_argument, 0, METERING},
+	{"antiflicker", required_argument, 0, ANTIFLICKER},
+	{"adaptive-stats", no_argument, 0, ADAPTIVE_STATS},
+	{"scene-gate", no_argument, 0, SCENE_GATE},
+	{"cache", no_argument, 0, CACHE},
+	{"publish", optional_argument, 0, PUBLISH},
+	{"roi", optional_argument, 0, ROI},
+	{"record", required_argument, 0, RECORD},
+	{"record-frames", required_argument, 0, RECORD_FRAMES},
+	{"record-fields", required_argument, 0, RECORD_FIELDS},
+	{"refresh", required_argument, 0, REFRESH},
+	{"format", required_argument, 0, FORMAT},
 	{"stat", no_argument, 0, 's'},
 	{"STAT", no_argument, 0, 'S'},
 	/* Histogram related */
 	{"histo", no_argument, 0, 'h'},
+	{"histo-sched", required_argument, 0, HISTO_SCHED},
 	{"HISTO", no_argument, 0, 'H'},
 	{"histo_top", required_argument, 0, HISTO_TOP},
 	{"histo_left", required_argument, 0, HISTO_LEFT},
@@ -1421,12 +1040,21 @@ static struct option opts[] = {
 
 int main(int argc, char *argv[])
 {
-	static struct isp_descriptor isp_desc;
-	int ret, opt;
-	bool do_call_stat, do_call_stat_cont, do_call_histo, do_call_histo_cont;
-	struct stm32_dcmipp_stat_buf *stats;
+	struct isp_open_cfg open_cfg = { 0 };
+	struct isp_control_cfg control_cfg = { 0 };
 	struct stm32_dcmipp_isp_histo_cfg histo_cfg = { 0 };
-	bool verbose = false;
+	struct isp_histo_sched_cfg histo_sched;
+	char *histo_sched_list = NULL;
+	bool do_call_stat, do_call_stat_cont, do_call_histo, do_call_histo_cont;
+	bool verbose = false, do_daemon = false;
+	const char *record_file = NULL;
+	unsigned int record_frames = ISP_RECORD_CAPACITY_DEFAULT, record_fields = 0;
+	struct isp_record *record = NULL;
+	int refresh = REFRESH_RATE_DEFAULT;
+	enum isp_format format = ISP_FORMAT_TEXT;
+	struct isp_handle *isp;
+	struct isp_info info;
+	int ret, opt;
 
 	if ((argc == 1) || ((argc == 2) && !strcmp(argv[1], "--help"))) {
 		usage(argv[0]);
@@ -1434,32 +1062,67 @@ int main(int argc, char *argv[])
 	}
 
 	/*
-	 * Detect the verbose -v option
+	 * Detect the verbose -v, daemon -d, buffers -b, tuning -t, cache and format options
 	 * Need to ensure that -v is detected first in order to be able
 	 * to give it as option to other functions
 	 */
-	while ((opt = getopt_long(argc, argv, ":v", opts, NULL)) != -1) {
+	optind = 0;
+	while ((opt = getopt_long(argc, argv, ":" SHORT_OPTS, opts, NULL)) != -1) {
 		switch (opt) {
 			case 'v':
 				verbose = true;
 				break;
+			case 'd':
+				do_daemon = true;
+				break;
+			case 'b':
+				open_cfg.buf_nb = atoi(optarg);
+				if (open_cfg.buf_nb < ISP_BUF_NB_MIN || open_cfg.buf_nb > ISP_BUF_NB_MAX) {
+					printf("Invalid number of buffers : %d\n", open_cfg.buf_nb);
+					return 1;
+				}
+				break;
+			case 't':
+				open_cfg.tuning_file = optarg;
+				break;
+			case CACHE:
+				open_cfg.cache = true;
+				break;
+			case FORMAT:
+				if (isp_format_parse(optarg, &format)) {
+					printf("Invalid format : %s\n", optarg);
+					return 1;
+				}
+				break;
 			default:
 				break;
 		}
 	}
-	optind = 1;
 
-	ret = discover_dcmipp(&isp_desc);
+	/* Only the machine readable output goes to stdout: all the text, library one included, to stderr */
+	if (format != ISP_FORMAT_TEXT) {
+		format_fd = dup(STDOUT_FILENO);
+		if (format_fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+			printf("Failed to redirect the text output\n");
+			return 1;
+		}
+	}
+
+	open_cfg.verbose = verbose;
+	ret = isp_open(&open_cfg, &isp);
 	if (ret)
 		return ret;
+
 	if (verbose) {
+		isp_get_info(isp, &info);
 		printf("DCMIPP ISP information:\n");
-		printf(" Media device:		%s\n", isp_desc.media_dev_name);
-		printf(" ISP sub-device:	%s\n", isp_desc.isp_subdev_name);
-		printf(" ISP stat device:	%s\n", isp_desc.stat_dev_name);
-		printf(" ISP params device:	%s\n", isp_desc.params_dev_name);
-		printf(" Sensor sub-device:	%s\n", isp_desc.sensor_subdev_name);
-		printf(" ISP frame:		%d x %d  -  %s\n", isp_desc.width, isp_desc.height, isp_desc.fmt_str);
+		printf(" Media device:		%s\n", info.media_dev_name);
+		printf(" ISP sub-device:	%s\n", info.isp_subdev_name);
+		printf(" ISP stat device:	%s\n", info.stat_dev_name);
+		printf(" ISP params device:	%s\n", info.params_dev_name);
+		printf(" Sensor sub-device:	%s (%s)\n", info.sensor_subdev_name, info.sensor_name);
+		printf(" ISP frame:		%d x %d  -  %s\n", info.width, info.height, info.fmt_str);
+		printf(" Buffers:		%d stats / %d params\n", info.stats_buf_nb, info.params_buf_nb);
 		printf("--------------------------------------------------\n\n");
 	}
 
@@ -1468,36 +1131,133 @@ int main(int argc, char *argv[])
 	do_call_histo = false;
 	do_call_histo_cont = false;
 
-	while ((opt = getopt_long(argc, argv, "hHvgc:i:sS", opts, NULL)) != -1) {
+	/* Send the settings of all the options at once */
+	isp_params_hold(isp);
+
+	optind = 0;
+	while ((opt = getopt_long(argc, argv, SHORT_OPTS, opts, NULL)) != -1) {
 		switch (opt) {
 		case 'g':
-			ret = set_sensor_gain_exposure(&isp_desc, verbose);
+			if (do_daemon) {
+				/* AutoExposure is run by the control loop */
+				control_cfg.aec = true;
+				break;
+			}
+			ret = isp_aec_run(isp);
 			if (ret)
-				return ret;
+				goto out;
 			if (verbose)
 				printf("Sensor gain and exposure applied\n");
 			break;
 		case 'c':
-			ret = set_contrast(&isp_desc, atoi(optarg));
+			if (do_daemon && atoi(optarg) == ISP_CONTRAST_ADAPTIVE) {
+				/* Adaptive contrast is run by the control loop */
+				control_cfg.contrast = true;
+				break;
+			}
+			ret = isp_set_contrast(isp, atoi(optarg));
 			if (ret)
-				return ret;
+				goto out;
 			if (verbose)
 				printf("Contrast applied\n");
 			break;
 		case 'i':
-			ret = set_profile(&isp_desc, atoi(optarg));
+			ret = isp_set_illuminant(isp, atoi(optarg));
 			if (ret)
-				return ret;
+				goto out;
 			if (verbose)
 				printf("Profile applied for BlackLevel, Exposure and ColorConversion\n");
 			break;
+		case 'a':
+			if (do_daemon) {
+				/* AutoWhiteBalance is run by the control loop */
+				control_cfg.awb = true;
+				control_cfg.awb_mode = atoi(optarg);
+				break;
+			}
+			ret = isp_awb_run(isp, atoi(optarg));
+			if (ret)
+				goto out;
+			if (verbose)
+				printf("White balance applied\n");
+			break;
+		case METERING:
+			control_cfg.metering = atoi(optarg);
+			if (control_cfg.metering < ISP_METERING_AVERAGE || control_cfg.metering > ISP_METERING_MATRIX) {
+				printf("Invalid metering mode : %s\n", optarg);
+				ret = 1;
+				goto out;
+			}
+			break;
+		case ANTIFLICKER:
+			control_cfg.antiflicker = atoi(optarg);
+			if (control_cfg.antiflicker < ISP_ANTIFLICKER_OFF || control_cfg.antiflicker > ISP_ANTIFLICKER_60HZ) {
+				printf("Invalid anti-flicker mode : %s\n", optarg);
+				ret = 1;
+				goto out;
+			}
+			break;
 		case 's':
 			do_call_stat = true;
 			break;
 		case 'S':
 			do_call_stat_cont = true;
 			break;
+		case PUBLISH:
+			ret = isp_publish_start(isp, optarg ? optarg : ISP_PUBLISH_SOCKET_DEFAULT);
+			if (ret) {
+				printf("Failed to publish the stats\n");
+				ret = 1;
+				goto out;
+			}
+			break;
+		case ADAPTIVE_STATS:
+			control_cfg.adaptive_stats = true;
+			break;
+		case SCENE_GATE:
+			control_cfg.scene_gate = true;
+			break;
+		case ROI:
+			ret = isp_roi_start(isp, optarg ? optarg : ISP_ROI_SOCKET_DEFAULT);
+			if (ret) {
+				printf("Failed to receive the ROIs\n");
+				ret = 1;
+				goto out;
+			}
+			control_cfg.roi = true;
+			break;
+		case RECORD:
+			record_file = optarg;
+			break;
+		case RECORD_FRAMES:
+			if (parse_record_frames(optarg, &record_frames)) {
+				printf("Invalid number of record frames : %s\n", optarg);
+				usage(argv[0]);
+				ret = 1;
+				goto out;
+			}
+			break;
+		case REFRESH:
+			refresh = atoi(optarg);
+			if (refresh <= 0 || refresh > REFRESH_RATE_MAX) {
+				printf("Invalid refresh rate : %s\n", optarg);
+				ret = 1;
+				goto out;
+			}
+			break;
+		case RECORD_FIELDS:
+			if (parse_record_fields(optarg, &record_fields)) {
+				printf("Invalid record fields : %s\n", optarg);
+				ret = 1;
+				goto out;
+			}
+			break;
 		case 'v':
+		case 'd':
+		case 'b':
+		case 't':
+		case CACHE:
+		case FORMAT:
 			/* Just to have getopt_long not complain */
 			break;
 		case 'h':
@@ -1542,35 +1302,63 @@ int main(int argc, char *argv[])
 		case HISTO_V_DECIMATION:
 			histo_cfg.vdec = atoi(optarg);
 			break;
+		case HISTO_SCHED:
+			histo_sched_list = optarg;
+			break;
 		default:
 			printf("Invalid option -%c\n", opt);
-			return 1;
+			ret = 1;
+			goto out;
+		}
+	}
+
+	ret = isp_params_commit(isp);
+	if (ret)
+		goto out;
+
+	if (histo_sched_list && (!do_call_histo_cont || format != ISP_FORMAT_TEXT ||
+				 parse_histo_sched(histo_sched_list, &histo_cfg, &histo_sched))) {
+		printf("Invalid histogram schedule : %s (with -H and the text format)\n", histo_sched_list);
+		ret = 1;
+		goto out;
+	}
+
+	if (record_file) {
+		if (!record_fields)
+			record_fields = ISP_RECORD_AVERAGES | ISP_RECORD_BINS | ISP_RECORD_BAD_PIXELS |
+					(do_call_histo_cont ? ISP_RECORD_HISTOGRAMS : 0);
+		ret = isp_record_create(record_file, record_fields, histo_value_nb(&histo_cfg), record_frames, &record);
+		if (ret) {
+			printf("Failed to create the record file %s\n", record_file);
+			ret = 1;
+			goto out;
 		}
 	}
 
 	if (do_call_histo || do_call_histo_cont) {
-		ret = get_histo(&isp_desc, do_call_histo_cont ? true : false, &histo_cfg);
+		ret = show_stats(isp, do_call_histo_cont, &histo_cfg, histo_sched_list ? &histo_sched : NULL, record,
+				 refresh, format);
+		if (ret) {
+			ret = 1;
+			goto out;
+		}
+	}
 
-		if (ret)
-			return 1;
+	if (do_call_stat || do_call_stat_cont) {
+		ret = show_stats(isp, !do_call_stat, NULL, NULL, record, refresh, format);
+		if (ret) {
+			ret = 1;
+			goto out;
+		}
 	}
 
-	if (do_call_stat) {
-		ret = get_stat(&isp_desc, false, &stats, V4L2_STAT_PROFILE_FULL);
-		if (ret)
-			return 1;
-		printf("Location Pre-demosaicing\n");
-		print_average(stats->pre.average_RGB);
-		print_bins(stats->pre.bins);
-		printf("Location Post-demosaicing\n");
-		print_average(stats->post.average_RGB);
-		print_bins(stats->post.bins);
-	} else if (do_call_stat_cont)
-		ret = get_stat(&isp_desc, true, NULL, V4L2_STAT_PROFILE_FULL);
-
-	close_params_vdev(&isp_desc);
-	close_stats_vdev(&isp_desc);
-	close(isp_desc.isp_fd);
+	if (do_daemon)
+		ret = run_daemon(isp, &control_cfg, verbose, record, format);
+
+out:
+	if (record)
+		isp_record_close(record);
+	isp_close(isp);
 
 	return ret;
 }
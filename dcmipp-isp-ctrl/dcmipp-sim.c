@@ -0,0 +1,1484 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (C) 2026 ST Microelectronics.
+ */
+
+/*
+ * DCMIPP simulator
+ *
+ * LD_PRELOAD shim emulating the DCMIPP media graph, the ISP stats and params meta queues and an
+ * IMX335 sensor, so that the unmodified library and tools run on a host without any hardware:
+ *
+ *   LD_PRELOAD=./libdcmipp-sim.so ./dcmipp-isp-ctrl -d -v
+ *
+ * The device accesses (open, ioctl, mmap, close) on the simulated nodes are served by the shim, the
+ * others go to the system. The simulated devices are backed by eventfds, so they can be watched with
+ * select or epoll: the stats device is readable when a filled buffer can be dequeued, the params
+ * device writable when a consumed buffer can be dequeued. Frame sync and control events are not
+ * emulated: their subscription fails as with drivers not supporting them.
+ *
+ * Time is simulated: a frame is produced each time the application waits (select or epoll_wait with
+ * a timeout) while nothing is ready, so that the control loops run as fast as they can process the
+ * stats. On each frame, the oldest queued params buffer is applied, the sensor settings written
+ * 'delay' frames earlier take effect, and the stats are computed into the oldest queued stats buffer.
+ * The buffer timestamps follow the frame count at 30 fps.
+ *
+ * The stats are rendered from a scene model, or replayed from a trace. Configuration is read from
+ * the environment:
+ *
+ * DCMIPP_SIM_SCENE: scene file, one line per change: the frame number then the changed parameters.
+ *     level=<n>    average green signal at 1000 lines and 0 dB (8-bit codes above the black level)
+ *     red=<f>      red / green ratio of the sensor signal
+ *     blue=<f>     blue / green ratio of the sensor signal
+ *     spread=<f>   half range of the scene luminances around the average (EV)
+ *     center=<f>   luminance of the center (middle third of the frame) relative to the rest
+ *     flicker=<f>  modulation of the light at twice the mains frequency, integrated over the exposure
+ *                  time ending at the frame timestamp (relative amplitude, 0 for a steady light)
+ *     mains=<n>    mains frequency of the flickering light (default 50 Hz)
+ *   e.g. "0 level=20 red=0.45 blue=0.55" then "300 level=160" for a 3 EV step on frame 300.
+ * DCMIPP_SIM_TRACE: stats to replay instead of rendering a scene, in the DCMIPP_SIM_LOG format, which
+ *   is also the one of the record files exported by isp-record-csv.
+ *   The trace is played in a loop, whatever the sensor and ISP settings.
+ * DCMIPP_SIM_LOG: CSV file receiving, for each frame, the sensor settings and the pre / post stats.
+ * DCMIPP_SIM_DELAY: frames before a sensor setting takes effect (default 2).
+ *
+ * The discovery cache of the library is hidden, so that the simulated devices are always discovered.
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <linux/media.h>
+#include "v4l2-controls.h"
+#include "videodev2.h"
+#include <linux/v4l2-subdev.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+
+#include "stm32-dcmipp-config.h"
+#include "isp-math.h"
+
+/* Simulated device nodes */
+#define SIM_MEDIA_DEV		"/dev/media0"
+#define SIM_DEV_DIR		"dcmipp-sim/"
+#define SIM_MAJOR		4095
+#define SIM_SYSFS_PREFIX	"/sys/dev/char/4095:"
+#define SIM_CACHE_DIR		"/var/cache/dcmipp-isp-ctrl/"
+
+/* IMX335 sensor, as seen through the DCMIPP */
+#define SIM_SENSOR_NAME		"imx335 1-001a"
+#define SIM_WIDTH		2592
+#define SIM_HEIGHT		1944
+#define SIM_EXPOSURE_MIN	50
+#define SIM_EXPOSURE_MAX	4491
+#define SIM_EXPOSURE_DEFAULT	1000
+#define SIM_GAIN_MAX		240
+#define SIM_GAIN_DB_UNIT	0.3
+#define SIM_BLACK_LEVEL		12
+#define SIM_DELAY_DEFAULT	2
+#define SIM_DELAY_MAX		8
+#define SIM_FRAME_US		33333
+#define SIM_LINE_NS		7407 /* 4500 lines per frame */
+#define SIM_MAINS_DEFAULT	50
+
+#define SIM_FILE_MAX		32
+#define SIM_BUF_MAX		8
+#define SIM_SAMPLE_NB		32
+#define SIM_SCENE_MAX		256
+#define SIM_TRACE_COLUMNS	31
+
+enum sim_node {
+	SIM_NODE_MEDIA,
+	SIM_NODE_ISP,
+	SIM_NODE_SENSOR,
+	SIM_NODE_PARAMS,
+	SIM_NODE_STAT,
+	SIM_NODE_NB,
+};
+
+static const struct {
+	const char *name;
+	const char *entity;
+	__u32 function;
+	__u32 intf_type;
+} sim_nodes[SIM_NODE_NB] = {
+	[SIM_NODE_MEDIA] = { "media0" },
+	[SIM_NODE_ISP] = { "v4l-subdev0", "dcmipp_main_isp", MEDIA_ENT_F_PROC_VIDEO_ISP,
+			   MEDIA_INTF_T_V4L_SUBDEV },
+	[SIM_NODE_SENSOR] = { "v4l-subdev1", SIM_SENSOR_NAME, MEDIA_ENT_F_CAM_SENSOR, MEDIA_INTF_T_V4L_SUBDEV },
+	[SIM_NODE_PARAMS] = { "video0", "dcmipp_main_isp_params_output", MEDIA_ENT_F_IO_V4L, MEDIA_INTF_T_V4L_VIDEO },
+	[SIM_NODE_STAT] = { "video1", "dcmipp_main_isp_stat_capture", MEDIA_ENT_F_IO_V4L, MEDIA_INTF_T_V4L_VIDEO },
+};
+
+struct sim_file {
+	int fd;
+	enum sim_node node;
+};
+
+struct sim_buf {
+	void *mem;
+	bool queued;
+	bool done;
+	__u32 order;
+	__u32 sequence;
+};
+
+/*
+ * Meta buffer queue: buffers are filled (or consumed) in the order they were queued
+ */
+struct sim_queue {
+	struct sim_buf buf[SIM_BUF_MAX];
+	int nb;
+	size_t len;
+	size_t stride;
+	__u32 order;
+	bool streaming;
+};
+
+/*
+ * Scene parameters, from the frame 'frame'
+ */
+struct sim_scene {
+	__u32 frame;
+	float level;
+	float red;
+	float blue;
+	float spread;
+	float center;
+	float flicker;
+	float mains;
+};
+
+/*
+ * Sensor setting written on a frame, effective 'delay' frames later
+ */
+struct sim_sensor_write {
+	__u32 frame;
+	int exposure;
+	int gain;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	bool ready;
+	struct sim_file files[SIM_FILE_MAX];
+	__u32 frame;
+	int delay;
+
+	/* Sensor controls: last written values and values of the current frame */
+	int exposure;
+	int gain;
+	int exposure_active;
+	int gain_active;
+	struct sim_sensor_write writes[SIM_DELAY_MAX + 2];
+	int write_nb;
+
+	/* ISP */
+	struct sim_queue stat;
+	struct sim_queue params;
+	struct stm32_dcmipp_isp_ctrls_cfg isp;
+	int stat_profile;
+	float sample_z[SIM_SAMPLE_NB];
+
+	/* Scene, or trace */
+	struct sim_scene scenes[SIM_SCENE_MAX];
+	int scene_nb;
+	int scene;
+	__u32 (*trace)[SIM_TRACE_COLUMNS];
+	int trace_nb;
+	FILE *log;
+} sim = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static int (*real_open)(const char *path, int flags, ...);
+static int (*real_close)(int fd);
+static int (*real_ioctl)(int fd, unsigned long request, ...);
+static void *(*real_mmap)(void *addr, size_t len, int prot, int flags, int fd, off_t offset);
+static int (*real_munmap)(void *addr, size_t len);
+static DIR *(*real_opendir)(const char *path);
+static FILE *(*real_fopen)(const char *path, const char *mode);
+static int (*real_select)(int nfds, fd_set *rfds, fd_set *wfds, fd_set *efds, struct timeval *tv);
+static int (*real_epoll_wait)(int epfd, struct epoll_event *events, int max, int timeout);
+
+/*
+ * Scene and trace files
+ */
+static int sim_load_scene(const char *path)
+{
+	struct sim_scene *scene;
+	char line[256], *tok, *end;
+	FILE *f;
+	int nb = 0;
+
+	f = real_fopen(path, "r");
+	if (!f)
+		return -errno;
+
+	while (fgets(line, sizeof(line), f) && nb < SIM_SCENE_MAX) {
+		tok = strtok(line, " \t\n");
+		if (!tok || tok[0] == '#')
+			continue;
+
+		scene = &sim.scenes[nb];
+		*scene = nb ? sim.scenes[nb - 1] : sim.scenes[0];
+		scene->frame = strtoul(tok, &end, 0);
+		if (*end || (nb && scene->frame < sim.scenes[nb - 1].frame))
+			goto invalid;
+
+		while ((tok = strtok(NULL, " \t\n"))) {
+			if (!strncmp(tok, "level=", 6))
+				scene->level = strtof(tok + 6, &end);
+			else if (!strncmp(tok, "red=", 4))
+				scene->red = strtof(tok + 4, &end);
+			else if (!strncmp(tok, "blue=", 5))
+				scene->blue = strtof(tok + 5, &end);
+			else if (!strncmp(tok, "spread=", 7))
+				scene->spread = strtof(tok + 7, &end);
+			else if (!strncmp(tok, "center=", 7))
+				scene->center = strtof(tok + 7, &end);
+			else if (!strncmp(tok, "flicker=", 8))
+				scene->flicker = strtof(tok + 8, &end);
+			else if (!strncmp(tok, "mains=", 6))
+				scene->mains = strtof(tok + 6, &end);
+			else
+				goto invalid;
+			if (*end)
+				goto invalid;
+		}
+		nb++;
+	}
+
+	fclose(f);
+	if (!nb)
+		return -EINVAL;
+	sim.scene_nb = nb;
+
+	return 0;
+
+invalid:
+	fprintf(stderr, "dcmipp-sim: invalid scene line %d\n", nb + 1);
+	fclose(f);
+	return -EINVAL;
+}
+
+static int sim_load_trace(const char *path)
+{
+	char *line = NULL, *p, *end;
+	size_t line_len = 0;
+	FILE *f;
+	int nb = 0, max = 0, i;
+	void *tmp;
+
+	f = real_fopen(path, "r");
+	if (!f)
+		return -errno;
+
+	/* Lines can be long: the columns after the stats (histograms of a record export) are ignored */
+	while (getline(&line, &line_len, f) > 0) {
+		/* Frame number, exposure and gain, then the stats */
+		p = line;
+		for (i = 0; i < 3; i++) {
+			strtoul(p, &end, 0);
+			if (end == p || *end != ',')
+				break;
+			p = end + 1;
+		}
+		if (i < 3)
+			continue;
+
+		if (nb == max) {
+			max = max ? 2 * max : 256;
+			tmp = realloc(sim.trace, max * sizeof(*sim.trace));
+			if (!tmp) {
+				free(line);
+				fclose(f);
+				return -ENOMEM;
+			}
+			sim.trace = tmp;
+		}
+
+		for (i = 0; i < SIM_TRACE_COLUMNS; i++) {
+			sim.trace[nb][i] = strtoul(p, &end, 0);
+			if (end == p)
+				break;
+			p = *end == ',' ? end + 1 : end;
+		}
+		if (i == SIM_TRACE_COLUMNS)
+			nb++;
+	}
+
+	free(line);
+	fclose(f);
+	if (!nb)
+		return -EINVAL;
+	sim.trace_nb = nb;
+
+	return 0;
+}
+
+static void sim_init(void)
+{
+	const char *env;
+	int i, ret;
+
+	if (sim.ready)
+		return;
+	sim.ready = true;
+
+	real_open = dlsym(RTLD_NEXT, "open");
+	real_close = dlsym(RTLD_NEXT, "close");
+	real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+	real_mmap = dlsym(RTLD_NEXT, "mmap");
+	real_munmap = dlsym(RTLD_NEXT, "munmap");
+	real_opendir = dlsym(RTLD_NEXT, "opendir");
+	real_fopen = dlsym(RTLD_NEXT, "fopen");
+	real_select = dlsym(RTLD_NEXT, "select");
+	real_epoll_wait = dlsym(RTLD_NEXT, "epoll_wait");
+
+	for (i = 0; i < SIM_FILE_MAX; i++)
+		sim.files[i].fd = -1;
+
+	sim.exposure = SIM_EXPOSURE_DEFAULT;
+	sim.exposure_active = SIM_EXPOSURE_DEFAULT;
+	sim.delay = SIM_DELAY_DEFAULT;
+	env = getenv("DCMIPP_SIM_DELAY");
+	if (env)
+		sim.delay = atoi(env);
+	if (sim.delay < 0 || sim.delay > SIM_DELAY_MAX) {
+		fprintf(stderr, "dcmipp-sim: invalid delay %d\n", sim.delay);
+		sim.delay = SIM_DELAY_DEFAULT;
+	}
+
+	/* The luminances of the scene are evenly spread in the log domain, around the average */
+	for (i = 0; i < SIM_SAMPLE_NB; i++)
+		sim.sample_z[i] = (2.0f * i + 1) / SIM_SAMPLE_NB - 1;
+
+	/* Default scene: gray, at the AEC target with the default 1000 lines and 0 dB */
+	sim.scenes[0] = (struct sim_scene){ .level = 44, .red = 1, .blue = 1, .spread = 2, .center = 1,
+					    .mains = SIM_MAINS_DEFAULT };
+	sim.scene_nb = 1;
+
+	env = getenv("DCMIPP_SIM_SCENE");
+	if (env) {
+		ret = sim_load_scene(env);
+		if (ret)
+			fprintf(stderr, "dcmipp-sim: failed to load scene %s (%d)\n", env, ret);
+	}
+
+	env = getenv("DCMIPP_SIM_TRACE");
+	if (env) {
+		ret = sim_load_trace(env);
+		if (ret)
+			fprintf(stderr, "dcmipp-sim: failed to load trace %s (%d)\n", env, ret);
+	}
+
+	env = getenv("DCMIPP_SIM_LOG");
+	if (env) {
+		sim.log = real_fopen(env, "w");
+		if (!sim.log)
+			fprintf(stderr, "dcmipp-sim: failed to create log %s\n", env);
+		else
+			fprintf(sim.log, "frame,exposure,gain,pre_r,pre_g,pre_b,pre_bins[12],"
+				"post_r,post_g,post_b,post_bins[12],bad_pixels\n");
+	}
+}
+
+__attribute__((constructor))
+static void sim_constructor(void)
+{
+	sim_init();
+}
+
+__attribute__((destructor))
+static void sim_destructor(void)
+{
+	if (sim.log)
+		fclose(sim.log);
+	free(sim.trace);
+}
+
+/*
+ * Simulated files
+ */
+static struct sim_file *sim_file_get(int fd)
+{
+	int i;
+
+	if (fd < 0)
+		return NULL;
+
+	for (i = 0; i < SIM_FILE_MAX; i++)
+		if (sim.files[i].fd == fd)
+			return &sim.files[i];
+
+	return NULL;
+}
+
+static int sim_node_from_path(const char *path)
+{
+	int i;
+
+	if (!strcmp(path, SIM_MEDIA_DEV))
+		return SIM_NODE_MEDIA;
+
+	if (strncmp(path, "/dev/" SIM_DEV_DIR, strlen("/dev/" SIM_DEV_DIR)))
+		return -1;
+	path += strlen("/dev/" SIM_DEV_DIR);
+
+	for (i = SIM_NODE_ISP; i < SIM_NODE_NB; i++)
+		if (!strcmp(path, sim_nodes[i].name))
+			return i;
+
+	return -1;
+}
+
+static int sim_open(enum sim_node node)
+{
+	int i, fd;
+
+	for (i = 0; i < SIM_FILE_MAX; i++)
+		if (sim.files[i].fd == -1)
+			break;
+	if (i == SIM_FILE_MAX) {
+		errno = EMFILE;
+		return -1;
+	}
+
+	fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (fd == -1)
+		return -1;
+
+	sim.files[i].fd = fd;
+	sim.files[i].node = node;
+
+	return fd;
+}
+
+static struct sim_queue *sim_queue_get(enum sim_node node)
+{
+	if (node == SIM_NODE_STAT)
+		return &sim.stat;
+	if (node == SIM_NODE_PARAMS)
+		return &sim.params;
+
+	return NULL;
+}
+
+static __u32 sim_queue_type(enum sim_node node)
+{
+	return node == SIM_NODE_STAT ? V4L2_BUF_TYPE_META_CAPTURE : V4L2_BUF_TYPE_META_OUTPUT;
+}
+
+/*
+ * Oldest buffer queued, or done if 'done' is set
+ */
+static struct sim_buf *sim_queue_oldest(struct sim_queue *q, bool done)
+{
+	struct sim_buf *oldest = NULL;
+	int i;
+
+	for (i = 0; i < q->nb; i++) {
+		if (done ? !q->buf[i].done : !q->buf[i].queued)
+			continue;
+		if (!oldest || (__s32)(q->buf[i].order - oldest->order) < 0)
+			oldest = &q->buf[i];
+	}
+
+	return oldest;
+}
+
+static void sim_queue_free(struct sim_queue *q)
+{
+	int i;
+
+	for (i = 0; i < q->nb; i++)
+		real_munmap(q->buf[i].mem, q->stride);
+
+	memset(q, 0, sizeof(*q));
+}
+
+/*
+ * Update the eventfds of the video devices: readable when a stats buffer is filled, writable when a
+ * params buffer is consumed (an eventfd is not writable when its counter is at the max).
+ */
+static void sim_update_ready(void)
+{
+	eventfd_t val;
+	bool ready;
+	int i;
+
+	for (i = 0; i < SIM_FILE_MAX; i++) {
+		if (sim.files[i].fd == -1)
+			continue;
+
+		if (sim.files[i].node == SIM_NODE_STAT) {
+			ready = sim.stat.streaming && sim_queue_oldest(&sim.stat, true);
+			eventfd_read(sim.files[i].fd, &val);
+			if (ready)
+				eventfd_write(sim.files[i].fd, 1);
+		} else if (sim.files[i].node == SIM_NODE_PARAMS) {
+			ready = sim.params.streaming && sim_queue_oldest(&sim.params, true);
+			eventfd_read(sim.files[i].fd, &val);
+			if (!ready)
+				eventfd_write(sim.files[i].fd, 0xfffffffffffffffe);
+		}
+	}
+}
+
+/*
+ * Frame rendering
+ */
+enum sim_stage {
+	SIM_STAGE_RAW,
+	SIM_STAGE_BLC,
+	SIM_STAGE_EX,
+	SIM_STAGE_CC,
+	SIM_STAGE_CE,
+	SIM_STAGE_NB,
+};
+
+/* Limits of the 12 bins of the average & bins statistics */
+static const int sim_bin_max[12] = { 3, 7, 15, 31, 63, 127, 191, 223, 239, 247, 251, 255 };
+
+static float sim_clamp(float v)
+{
+	return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+static float sim_luma(const float rgb[3])
+{
+	return 0.299f * rgb[0] + 0.587f * rgb[1] + 0.114f * rgb[2];
+}
+
+static int sim_bin(float v)
+{
+	int i;
+
+	for (i = 0; i < 11; i++)
+		if (v < sim_bin_max[i] + 1)
+			break;
+
+	return i;
+}
+
+/*
+ * Convert the pixel parts of the 12 ranges to the hardware bins: numbers of pixels below 4, 8, 16, 32,
+ * 64 and 128, then above 128, 192, 224, 240, 248 and 252
+ */
+static void sim_bins(const float part[12], __u32 bins[12])
+{
+	float below = 0, above = 0;
+	int i;
+
+	for (i = 0; i < 6; i++) {
+		below += part[i];
+		above += part[11 - i];
+		bins[i] = below * SIM_WIDTH * SIM_HEIGHT + 0.5f;
+		bins[11 - i] = above * SIM_WIDTH * SIM_HEIGHT + 0.5f;
+	}
+}
+
+/* Color conversion coefficient: 2.8 format, complement to 2 on 11 bits */
+static float sim_cconv(__u16 reg)
+{
+	int v = reg & 0x7FF;
+
+	return (v & 0x400 ? v - 0x800 : v) / 256.0f;
+}
+
+/*
+ * Run a pixel through the ISP blocks, keeping the value after each stage
+ */
+static void sim_isp_pixel(const float raw[3], float out[SIM_STAGE_NB][3])
+{
+	const struct stm32_dcmipp_isp_ctrls_cfg *isp = &sim.isp;
+	const struct stm32_dcmipp_isp_cc_cfg *cc = &isp->cc_cfg;
+	const __u8 blc[3] = { isp->blc_cfg.blc_r, isp->blc_cfg.blc_g, isp->blc_cfg.blc_b };
+	const __u8 shift[3] = { isp->ex_cfg.shift_r, isp->ex_cfg.shift_g, isp->ex_cfg.shift_b };
+	const __u8 mult[3] = { isp->ex_cfg.mult_r, isp->ex_cfg.mult_g, isp->ex_cfg.mult_b };
+	float *v, lum, factor;
+	int i, k;
+
+	memcpy(out[SIM_STAGE_RAW], raw, sizeof(out[0]));
+
+	v = out[SIM_STAGE_BLC];
+	for (i = 0; i < 3; i++)
+		v[i] = isp->blc_cfg.en ? sim_clamp(raw[i] - blc[i]) : raw[i];
+
+	v = out[SIM_STAGE_EX];
+	for (i = 0; i < 3; i++)
+		v[i] = isp->ex_cfg.en ? sim_clamp(out[SIM_STAGE_BLC][i] * mult[i] * (1 << shift[i]) / 128) :
+					out[SIM_STAGE_BLC][i];
+
+	v = out[SIM_STAGE_CC];
+	if (cc->en) {
+		const float *in = out[SIM_STAGE_EX];
+
+		v[0] = sim_clamp(sim_cconv(cc->rr) * in[0] + sim_cconv(cc->rg) * in[1] + sim_cconv(cc->rb) * in[2] +
+				 sim_cconv(cc->ra) * 256);
+		v[1] = sim_clamp(sim_cconv(cc->gr) * in[0] + sim_cconv(cc->gg) * in[1] + sim_cconv(cc->gb) * in[2] +
+				 sim_cconv(cc->ga) * 256);
+		v[2] = sim_clamp(sim_cconv(cc->br) * in[0] + sim_cconv(cc->bg) * in[1] + sim_cconv(cc->bb) * in[2] +
+				 sim_cconv(cc->ba) * 256);
+	} else {
+		memcpy(v, out[SIM_STAGE_EX], sizeof(out[0]));
+	}
+
+	/* Luminance enhancement: 9 points from 0 to 256, 16 is neutral */
+	v = out[SIM_STAGE_CE];
+	memcpy(v, out[SIM_STAGE_CC], sizeof(out[0]));
+	if (isp->ce_cfg.en) {
+		lum = sim_luma(v);
+		k = lum / 32;
+		if (k > 7)
+			k = 7;
+		factor = (isp->ce_cfg.lum[k] + (isp->ce_cfg.lum[k + 1] - isp->ce_cfg.lum[k]) * (lum - 32 * k) / 32) / 16;
+		for (i = 0; i < 3; i++)
+			v[i] = sim_clamp(v[i] * factor);
+	}
+}
+
+/*
+ * Area of a histogram region inside the center of the frame, relative to the region area
+ */
+static float sim_center_part(int left, int top, int width, int height)
+{
+	int x0 = left > SIM_WIDTH / 3 ? left : SIM_WIDTH / 3;
+	int y0 = top > SIM_HEIGHT / 3 ? top : SIM_HEIGHT / 3;
+	int x1 = left + width < 2 * SIM_WIDTH / 3 ? left + width : 2 * SIM_WIDTH / 3;
+	int y1 = top + height < 2 * SIM_HEIGHT / 3 ? top + height : 2 * SIM_HEIGHT / 3;
+
+	if (x1 <= x0 || y1 <= y0 || !width || !height)
+		return 0;
+
+	return (float)(x1 - x0) * (y1 - y0) / ((float)width * height);
+}
+
+/*
+ * Histograms of the regions, with the component layout of the hardware: region after region,
+ * each one with 1 component or 4 (R, Gr, B, Gb on raw data, R, G, B, L after demosaicing)
+ */
+static void sim_render_histograms(float samples[2][SIM_SAMPLE_NB][SIM_STAGE_NB][3], __u16 *out)
+{
+	static const int stages[] = {
+		[STM32_DCMIPP_ISP_HISTO_SRC_POST_DEC] = SIM_STAGE_RAW,
+		[STM32_DCMIPP_ISP_HISTO_SRC_POST_BLC] = SIM_STAGE_BLC,
+		[STM32_DCMIPP_ISP_HISTO_SRC_POST_EX] = SIM_STAGE_EX,
+		[STM32_DCMIPP_ISP_HISTO_SRC_POST_DM] = SIM_STAGE_EX,
+		[STM32_DCMIPP_ISP_HISTO_SRC_POST_CC] = SIM_STAGE_CC,
+		[STM32_DCMIPP_ISP_HISTO_SRC_POST_CE] = SIM_STAGE_CE,
+	};
+	const struct stm32_dcmipp_isp_histo_cfg *cfg = &sim.isp.histo_cfg;
+	static float bins[STM32_DCMIPP_HISTO_BIN_MAX];
+	int bin_nb = 4 << (2 * (cfg->bin & 3));
+	int comp_nb = cfg->comp == STM32_DCMIPP_ISP_HISTO_COMP_ALL ? 4 : 1;
+	int stage, reg, regs, nb, x, y, a, s, c, comp;
+	float pixels, weight[2], *v, val;
+
+	if (cfg->src > STM32_DCMIPP_ISP_HISTO_SRC_POST_CE || !cfg->width || !cfg->height)
+		return;
+	stage = stages[cfg->src];
+
+	regs = cfg->hreg * cfg->vreg;
+	if (regs * comp_nb * bin_nb > STM32_DCMIPP_HISTO_BIN_MAX)
+		regs = STM32_DCMIPP_HISTO_BIN_MAX / (comp_nb * bin_nb);
+	nb = regs * comp_nb * bin_nb;
+	memset(bins, 0, nb * sizeof(bins[0]));
+
+	for (reg = 0; reg < regs; reg++) {
+		x = cfg->left + (reg % cfg->hreg) * cfg->width;
+		y = cfg->top + (reg / cfg->hreg) * cfg->height;
+		pixels = (float)(cfg->width >> cfg->hdec) * (cfg->height >> cfg->vdec) / SIM_SAMPLE_NB;
+		weight[1] = sim_center_part(x, y, cfg->width, cfg->height);
+		weight[0] = 1 - weight[1];
+
+		for (a = 0; a < 2; a++) {
+			for (s = 0; s < SIM_SAMPLE_NB; s++) {
+				v = samples[a][s][stage];
+				for (c = 0; c < comp_nb; c++) {
+					comp = comp_nb == 1 ? cfg->comp : c;
+					if (comp < 3)
+						val = v[comp];
+					else
+						val = stage >= SIM_STAGE_CC ? sim_luma(v) : v[1];
+					bins[(reg * comp_nb + c) * bin_nb + (int)val * bin_nb / 256] += pixels * weight[a];
+				}
+			}
+		}
+	}
+
+	for (x = 0; x < nb; x++)
+		out[x] = bins[x] + 0.5f > 0xFFFF ? 0xFFFF : bins[x] + 0.5f;
+}
+
+/*
+ * Mean light of a flickering source over the exposure time of the current frame, relative to its
+ * average: the modulation cancels out when the exposure time is a multiple of its period
+ */
+static float sim_flicker(const struct sim_scene *scene)
+{
+	double w = 2 * M_PI * 2 * scene->mains;
+	double end = (double)sim.frame * SIM_FRAME_US / 1e6;
+	double time = (double)sim.exposure_active * SIM_LINE_NS / 1e9;
+
+	if (!scene->flicker || !(scene->mains > 0))
+		return 1;
+
+	return 1 + scene->flicker * (sin(w * end) - sin(w * (end - time))) / (w * time);
+}
+
+/*
+ * Compute the stats of the current frame from the scene and the sensor and ISP settings
+ */
+static void sim_render(struct stm32_dcmipp_stat_buf *stats)
+{
+	static float samples[2][SIM_SAMPLE_NB][SIM_STAGE_NB][3];
+	const struct sim_scene *scene = &sim.scenes[sim.scene];
+	const float area_weight[2] = { 8.0f / 9, 1.0f / 9 };
+	float signal, norm, raw[3], pre[3] = { 0 }, post[3] = { 0 };
+	float pre_bins[12] = { 0 }, post_bins[12] = { 0 }, w;
+	int a, s, i;
+
+	/* Average signal of the green pixels, then normalization of the samples to keep this average */
+	signal = scene->level * sim.exposure_active / 1000 * powf(10, sim.gain_active * SIM_GAIN_DB_UNIT / 20) *
+		 sim_flicker(scene);
+	norm = scene->spread > 0 ? 2 * scene->spread * M_LN2 / (exp2f(scene->spread) - exp2f(-scene->spread)) : 1;
+
+	for (a = 0; a < 2; a++) {
+		for (s = 0; s < SIM_SAMPLE_NB; s++) {
+			raw[1] = signal * (a ? scene->center : 1) * norm * exp2f(scene->spread * sim.sample_z[s]);
+			raw[0] = sim_clamp(SIM_BLACK_LEVEL + raw[1] * scene->red);
+			raw[2] = sim_clamp(SIM_BLACK_LEVEL + raw[1] * scene->blue);
+			raw[1] = sim_clamp(SIM_BLACK_LEVEL + raw[1]);
+			sim_isp_pixel(raw, samples[a][s]);
+
+			w = area_weight[a] / SIM_SAMPLE_NB;
+			for (i = 0; i < 3; i++) {
+				pre[i] += samples[a][s][SIM_STAGE_RAW][i] * w;
+				post[i] += samples[a][s][SIM_STAGE_EX][i] * w;
+			}
+			pre_bins[sim_bin(sim_luma(samples[a][s][SIM_STAGE_RAW]))] += w;
+			post_bins[sim_bin(sim_luma(samples[a][s][SIM_STAGE_EX]))] += w;
+		}
+	}
+
+	for (i = 0; i < 3; i++) {
+		stats->pre.average_RGB[i] = pre[i] + 0.5f;
+		stats->post.average_RGB[i] = post[i] + 0.5f;
+	}
+	sim_bins(pre_bins, stats->pre.bins);
+	sim_bins(post_bins, stats->post.bins);
+
+	sim_render_histograms(samples, stats->histograms);
+}
+
+static void sim_replay(struct stm32_dcmipp_stat_buf *stats)
+{
+	const __u32 *line = sim.trace[(sim.frame - 1) % sim.trace_nb];
+
+	memcpy(stats->pre.average_RGB, &line[0], sizeof(stats->pre.average_RGB));
+	memcpy(stats->pre.bins, &line[3], sizeof(stats->pre.bins));
+	memcpy(stats->post.average_RGB, &line[15], sizeof(stats->post.average_RGB));
+	memcpy(stats->post.bins, &line[18], sizeof(stats->post.bins));
+	stats->bad_pixel_count = line[30];
+}
+
+static void sim_log(const struct stm32_dcmipp_stat_buf *stats)
+{
+	int i;
+
+	fprintf(sim.log, "%u,%d,%d", sim.frame, sim.exposure_active, sim.gain_active);
+	for (i = 0; i < 3; i++)
+		fprintf(sim.log, ",%u", stats->pre.average_RGB[i]);
+	for (i = 0; i < 12; i++)
+		fprintf(sim.log, ",%u", stats->pre.bins[i]);
+	for (i = 0; i < 3; i++)
+		fprintf(sim.log, ",%u", stats->post.average_RGB[i]);
+	for (i = 0; i < 12; i++)
+		fprintf(sim.log, ",%u", stats->post.bins[i]);
+	fprintf(sim.log, ",%u\n", stats->bad_pixel_count);
+}
+
+/*
+ * Apply the modules of a params buffer
+ */
+#define SIM_MODULE(bit, cfg)	{ bit, offsetof(struct stm32_dcmipp_isp_ctrls_cfg, cfg), \
+				  sizeof(((struct stm32_dcmipp_isp_ctrls_cfg *)0)->cfg) }
+
+static void sim_apply_params(const struct stm32_dcmipp_params_cfg *params)
+{
+	static const struct {
+		__u32 bit;
+		size_t offset;
+		size_t size;
+	} modules[] = {
+		SIM_MODULE(STM32_DCMIPP_ISP_BPR, bpr_cfg),
+		SIM_MODULE(STM32_DCMIPP_ISP_BLC, blc_cfg),
+		SIM_MODULE(STM32_DCMIPP_ISP_EX, ex_cfg),
+		SIM_MODULE(STM32_DCMIPP_ISP_DM, dm_cfg),
+		SIM_MODULE(STM32_DCMIPP_ISP_CC, cc_cfg),
+		SIM_MODULE(STM32_DCMIPP_ISP_CE, ce_cfg),
+		SIM_MODULE(STM32_DCMIPP_ISP_HISTO, histo_cfg),
+	};
+	unsigned int i;
+
+	for (i = 0; i < sizeof(modules) / sizeof(modules[0]); i++)
+		if (params->module_cfg_update & modules[i].bit)
+			memcpy((char *)&sim.isp + modules[i].offset, (const char *)&params->ctrls + modules[i].offset,
+			       modules[i].size);
+}
+
+/*
+ * Produce one frame
+ */
+static void sim_frame(void)
+{
+	static struct stm32_dcmipp_stat_buf stats;
+	struct sim_buf *buf;
+
+	sim.frame++;
+
+	/* Sensor settings reaching this frame */
+	while (sim.write_nb && sim.writes[0].frame + sim.delay <= sim.frame) {
+		sim.exposure_active = sim.writes[0].exposure;
+		sim.gain_active = sim.writes[0].gain;
+		memmove(&sim.writes[0], &sim.writes[1], --sim.write_nb * sizeof(sim.writes[0]));
+	}
+
+	/* One params buffer per frame, applied from its start */
+	buf = sim.params.streaming ? sim_queue_oldest(&sim.params, false) : NULL;
+	if (buf) {
+		sim_apply_params(buf->mem);
+		buf->queued = false;
+		buf->done = true;
+		buf->order = ++sim.params.order;
+		buf->sequence = sim.frame;
+	}
+
+	while (sim.scene + 1 < sim.scene_nb && sim.scenes[sim.scene + 1].frame <= sim.frame)
+		sim.scene++;
+
+	memset(&stats, 0, sizeof(stats));
+	if (sim.trace_nb)
+		sim_replay(&stats);
+	else
+		sim_render(&stats);
+
+	if (sim.log)
+		sim_log(&stats);
+
+	/* The stats buffer only gets the part of the stats selected by the profile */
+	if (sim.stat_profile == V4L2_STAT_PROFILE_AVERAGE_PRE)
+		memset(&stats.post, 0, sizeof(stats) - offsetof(struct stm32_dcmipp_stat_buf, post));
+	else if (sim.stat_profile == V4L2_STAT_PROFILE_AVERAGE_POST)
+		memset(&stats.pre, 0, sizeof(stats.pre));
+	if (sim.stat_profile != V4L2_STAT_PROFILE_FULL)
+		memset(stats.histograms, 0, sizeof(stats.histograms));
+
+	/* Without buffer, the frame stats are lost */
+	buf = sim.stat.streaming ? sim_queue_oldest(&sim.stat, false) : NULL;
+	if (buf) {
+		memcpy(buf->mem, &stats, sim.stat.len < sizeof(stats) ? sim.stat.len : sizeof(stats));
+		buf->queued = false;
+		buf->done = true;
+		buf->order = ++sim.stat.order;
+		buf->sequence = sim.frame;
+	}
+
+	sim_update_ready();
+}
+
+/*
+ * Called when the application is about to wait: produce a frame if the ISP has buffers to work on
+ */
+static void sim_idle(void)
+{
+	pthread_mutex_lock(&sim.lock);
+	if ((sim.stat.streaming && sim_queue_oldest(&sim.stat, false)) ||
+	    (sim.params.streaming && sim_queue_oldest(&sim.params, false)))
+		sim_frame();
+	pthread_mutex_unlock(&sim.lock);
+}
+
+/*
+ * Media device
+ */
+static int sim_media_ioctl(unsigned long request, void *arg)
+{
+	struct media_v2_entity *ents;
+	struct media_v2_interface *intfs;
+	struct media_v2_link *links;
+	struct media_device_info *info;
+	struct media_v2_topology *topo;
+	int i, nb = SIM_NODE_NB - 1;
+
+	switch (request) {
+	case MEDIA_IOC_DEVICE_INFO:
+		info = arg;
+		memset(info, 0, sizeof(*info));
+		strcpy(info->driver, "dcmipp");
+		strcpy(info->model, "DCMIPP simulator");
+		strcpy(info->bus_info, "platform:dcmipp-sim");
+		info->media_version = MEDIA_API_VERSION;
+		return 0;
+
+	case MEDIA_IOC_G_TOPOLOGY:
+		topo = arg;
+		if ((topo->ptr_entities && topo->num_entities < nb) ||
+		    (topo->ptr_interfaces && topo->num_interfaces < nb) ||
+		    (topo->ptr_links && topo->num_links < nb)) {
+			errno = ENOSPC;
+			return -1;
+		}
+
+		ents = (struct media_v2_entity *)(uintptr_t)topo->ptr_entities;
+		intfs = (struct media_v2_interface *)(uintptr_t)topo->ptr_interfaces;
+		links = (struct media_v2_link *)(uintptr_t)topo->ptr_links;
+
+		/* One entity per device node, linked to its interface */
+		for (i = 0; i < nb; i++) {
+			if (ents) {
+				memset(&ents[i], 0, sizeof(ents[i]));
+				ents[i].id = 1 + i;
+				strcpy(ents[i].name, sim_nodes[1 + i].entity);
+				ents[i].function = sim_nodes[1 + i].function;
+			}
+			if (intfs) {
+				memset(&intfs[i], 0, sizeof(intfs[i]));
+				intfs[i].id = 0x100 + i;
+				intfs[i].intf_type = sim_nodes[1 + i].intf_type;
+				intfs[i].devnode.major = SIM_MAJOR;
+				intfs[i].devnode.minor = 1 + i;
+			}
+			if (links) {
+				memset(&links[i], 0, sizeof(links[i]));
+				links[i].id = 0x200 + i;
+				links[i].source_id = 0x100 + i;
+				links[i].sink_id = 1 + i;
+				links[i].flags = MEDIA_LNK_FL_INTERFACE_LINK | MEDIA_LNK_FL_ENABLED;
+			}
+		}
+
+		topo->topology_version = 1;
+		topo->num_entities = nb;
+		topo->num_interfaces = nb;
+		topo->num_links = nb;
+		topo->num_pads = 0;
+		return 0;
+	}
+
+	errno = ENOTTY;
+	return -1;
+}
+
+/*
+ * Controls: sensor exposure and gain, stats profile
+ */
+static int sim_ctrl(enum sim_node node, struct v4l2_ext_control *ctrl, bool set)
+{
+	switch (ctrl->id) {
+	case V4L2_CID_EXPOSURE:
+		if (node != SIM_NODE_SENSOR)
+			break;
+		if (set)
+			sim.exposure = ctrl->value < SIM_EXPOSURE_MIN ? SIM_EXPOSURE_MIN :
+				       ctrl->value > SIM_EXPOSURE_MAX ? SIM_EXPOSURE_MAX : ctrl->value;
+		ctrl->value = sim.exposure;
+		return 0;
+
+	case V4L2_CID_ANALOGUE_GAIN:
+		if (node != SIM_NODE_SENSOR)
+			break;
+		if (set)
+			sim.gain = ctrl->value < 0 ? 0 : ctrl->value > SIM_GAIN_MAX ? SIM_GAIN_MAX : ctrl->value;
+		ctrl->value = sim.gain;
+		return 0;
+
+	case V4L2_CID_ISP_STAT_PROFILE:
+		if (node != SIM_NODE_STAT)
+			break;
+		if (set) {
+			if (ctrl->value < V4L2_STAT_PROFILE_FULL || ctrl->value > V4L2_STAT_PROFILE_AVERAGE_POST)
+				break;
+			sim.stat_profile = ctrl->value;
+		}
+		ctrl->value = sim.stat_profile;
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+static int sim_ext_ctrls(enum sim_node node, struct v4l2_ext_controls *ctrls, bool set)
+{
+	struct sim_sensor_write *w;
+	unsigned int i;
+
+	for (i = 0; i < ctrls->count; i++) {
+		if (sim_ctrl(node, &ctrls->controls[i], set)) {
+			ctrls->error_idx = i;
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	if (!set || node != SIM_NODE_SENSOR)
+		return 0;
+
+	/* Written during the next frame */
+	if (sim.write_nb && sim.writes[sim.write_nb - 1].frame == sim.frame + 1) {
+		w = &sim.writes[sim.write_nb - 1];
+	} else {
+		if (sim.write_nb == SIM_DELAY_MAX + 2)
+			memmove(&sim.writes[0], &sim.writes[1], --sim.write_nb * sizeof(sim.writes[0]));
+		w = &sim.writes[sim.write_nb++];
+	}
+	w->frame = sim.frame + 1;
+	w->exposure = sim.exposure;
+	w->gain = sim.gain;
+
+	return 0;
+}
+
+/*
+ * Meta video devices
+ */
+static int sim_video_ioctl(enum sim_node node, unsigned long request, void *arg)
+{
+	struct sim_queue *q = sim_queue_get(node);
+	struct v4l2_requestbuffers *req;
+	struct v4l2_capability *cap;
+	struct v4l2_format *fmt;
+	struct v4l2_buffer *vbuf;
+	struct sim_buf *buf;
+	int i;
+
+	switch (request) {
+	case VIDIOC_QUERYCAP:
+		cap = arg;
+		memset(cap, 0, sizeof(*cap));
+		strcpy((char *)cap->driver, "dcmipp");
+		strcpy((char *)cap->card, "DCMIPP simulator");
+		strcpy((char *)cap->bus_info, "platform:dcmipp-sim");
+		cap->device_caps = V4L2_CAP_STREAMING |
+				   (node == SIM_NODE_STAT ? V4L2_CAP_META_CAPTURE : V4L2_CAP_META_OUTPUT);
+		cap->capabilities = cap->device_caps | V4L2_CAP_DEVICE_CAPS;
+		return 0;
+
+	case VIDIOC_G_FMT:
+		fmt = arg;
+		if (fmt->type != sim_queue_type(node))
+			break;
+		fmt->fmt.meta.dataformat = node == SIM_NODE_STAT ? V4L2_META_FMT_ST_DCMIPP_ISP_STAT :
+								   V4L2_META_FMT_ST_DCMIPP_ISP_PARAMS;
+		fmt->fmt.meta.buffersize = node == SIM_NODE_STAT ? sizeof(struct stm32_dcmipp_stat_buf) :
+								   sizeof(struct stm32_dcmipp_params_cfg);
+		return 0;
+
+	case VIDIOC_REQBUFS:
+		req = arg;
+		if (req->type != sim_queue_type(node) || req->memory != V4L2_MEMORY_MMAP)
+			break;
+		if (q->streaming) {
+			errno = EBUSY;
+			return -1;
+		}
+
+		sim_queue_free(q);
+		if (!req->count)
+			return 0;
+
+		q->len = node == SIM_NODE_STAT ? sizeof(struct stm32_dcmipp_stat_buf) :
+						 sizeof(struct stm32_dcmipp_params_cfg);
+		q->stride = (q->len + 4095) & ~4095;
+		q->nb = req->count < SIM_BUF_MAX ? req->count : SIM_BUF_MAX;
+		for (i = 0; i < q->nb; i++) {
+			q->buf[i].mem = real_mmap(NULL, q->stride, PROT_READ | PROT_WRITE,
+						  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (q->buf[i].mem == MAP_FAILED) {
+				q->nb = i;
+				sim_queue_free(q);
+				errno = ENOMEM;
+				return -1;
+			}
+		}
+		req->count = q->nb;
+		return 0;
+
+	case VIDIOC_QUERYBUF:
+	case VIDIOC_QBUF:
+		vbuf = arg;
+		if (vbuf->type != sim_queue_type(node) || vbuf->index >= q->nb)
+			break;
+		buf = &q->buf[vbuf->index];
+
+		if (request == VIDIOC_QBUF) {
+			if (buf->queued || buf->done)
+				break;
+			buf->queued = true;
+			buf->order = ++q->order;
+		}
+
+		vbuf->length = q->len;
+		vbuf->m.offset = vbuf->index * q->stride;
+		vbuf->flags = V4L2_BUF_FLAG_MAPPED | (buf->queued ? V4L2_BUF_FLAG_QUEUED : 0) |
+			      (buf->done ? V4L2_BUF_FLAG_DONE : 0);
+		sim_update_ready();
+		return 0;
+
+	case VIDIOC_DQBUF:
+		vbuf = arg;
+		if (vbuf->type != sim_queue_type(node))
+			break;
+		buf = q->streaming ? sim_queue_oldest(q, true) : NULL;
+		if (!buf) {
+			errno = EAGAIN;
+			return -1;
+		}
+
+		buf->done = false;
+		vbuf->index = buf - q->buf;
+		vbuf->sequence = buf->sequence;
+		vbuf->timestamp.tv_sec = (__u64)buf->sequence * SIM_FRAME_US / 1000000;
+		vbuf->timestamp.tv_usec = (__u64)buf->sequence * SIM_FRAME_US % 1000000;
+		vbuf->bytesused = q->len;
+		vbuf->length = q->len;
+		vbuf->flags = V4L2_BUF_FLAG_MAPPED | V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+		sim_update_ready();
+		return 0;
+
+	case VIDIOC_STREAMON:
+	case VIDIOC_STREAMOFF:
+		if (*(__u32 *)arg != sim_queue_type(node))
+			break;
+		q->streaming = request == VIDIOC_STREAMON;
+		if (!q->streaming)
+			for (i = 0; i < q->nb; i++)
+				q->buf[i].queued = q->buf[i].done = false;
+		sim_update_ready();
+		return 0;
+
+	case VIDIOC_G_EXT_CTRLS:
+	case VIDIOC_S_EXT_CTRLS:
+		return sim_ext_ctrls(node, arg, request == VIDIOC_S_EXT_CTRLS);
+
+	default:
+		errno = ENOTTY;
+		return -1;
+	}
+
+	errno = EINVAL;
+	return -1;
+}
+
+/*
+ * Subdevs: the ISP input format, the sensor controls
+ */
+static int sim_subdev_ioctl(enum sim_node node, unsigned long request, void *arg)
+{
+	struct v4l2_subdev_selection *sel;
+	struct v4l2_subdev_format *fmt;
+
+	switch (request) {
+	case VIDIOC_SUBDEV_G_FMT:
+		fmt = arg;
+		memset(&fmt->format, 0, sizeof(fmt->format));
+		fmt->format.width = SIM_WIDTH;
+		fmt->format.height = SIM_HEIGHT;
+		fmt->format.code = MEDIA_BUS_FMT_SRGGB10_1X10;
+		fmt->format.field = V4L2_FIELD_NONE;
+		return 0;
+
+	case VIDIOC_SUBDEV_G_SELECTION:
+		sel = arg;
+		sel->r.left = 0;
+		sel->r.top = 0;
+		sel->r.width = SIM_WIDTH;
+		sel->r.height = SIM_HEIGHT;
+		return 0;
+
+	case VIDIOC_G_EXT_CTRLS:
+	case VIDIOC_S_EXT_CTRLS:
+		return sim_ext_ctrls(node, arg, request == VIDIOC_S_EXT_CTRLS);
+	}
+
+	errno = ENOTTY;
+	return -1;
+}
+
+/*
+ * Interposed functions
+ */
+static int sim_open_path(const char *path, int flags, mode_t mode)
+{
+	int node, fd;
+
+	sim_init();
+
+	node = sim_node_from_path(path);
+	if (node < 0)
+		return real_open(path, flags, mode);
+
+	pthread_mutex_lock(&sim.lock);
+	fd = sim_open(node);
+	pthread_mutex_unlock(&sim.lock);
+
+	return fd;
+}
+
+int open(const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+	va_list ap;
+
+	if (flags & (O_CREAT | O_TMPFILE)) {
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+
+	return sim_open_path(path, flags, mode);
+}
+
+int open64(const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+	va_list ap;
+
+	if (flags & (O_CREAT | O_TMPFILE)) {
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+
+	return sim_open_path(path, flags | O_LARGEFILE, mode);
+}
+
+int close(int fd)
+{
+	struct sim_file *file;
+	struct sim_queue *q;
+	int i, users = 0;
+
+	sim_init();
+
+	pthread_mutex_lock(&sim.lock);
+	file = sim_file_get(fd);
+	if (file) {
+		/* The buffers are released with the last file of their device */
+		q = sim_queue_get(file->node);
+		for (i = 0; i < SIM_FILE_MAX; i++)
+			users += sim.files[i].fd != -1 && sim.files[i].node == file->node;
+		if (q && users == 1)
+			sim_queue_free(q);
+		file->fd = -1;
+	}
+	pthread_mutex_unlock(&sim.lock);
+
+	return real_close(fd);
+}
+
+int ioctl(int fd, unsigned long request, ...)
+{
+	struct sim_file *file;
+	va_list ap;
+	void *arg;
+	int ret;
+
+	sim_init();
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	pthread_mutex_lock(&sim.lock);
+	file = sim_file_get(fd);
+	if (!file) {
+		pthread_mutex_unlock(&sim.lock);
+		return real_ioctl(fd, request, arg);
+	}
+
+	switch (file->node) {
+	case SIM_NODE_MEDIA:
+		ret = sim_media_ioctl(request, arg);
+		break;
+	case SIM_NODE_PARAMS:
+	case SIM_NODE_STAT:
+		ret = sim_video_ioctl(file->node, request, arg);
+		break;
+	default:
+		ret = sim_subdev_ioctl(file->node, request, arg);
+		break;
+	}
+	pthread_mutex_unlock(&sim.lock);
+
+	return ret;
+}
+
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset)
+{
+	struct sim_file *file;
+	struct sim_queue *q;
+	void *mem = MAP_FAILED;
+
+	sim_init();
+
+	pthread_mutex_lock(&sim.lock);
+	file = sim_file_get(fd);
+	if (!file) {
+		pthread_mutex_unlock(&sim.lock);
+		return real_mmap(addr, len, prot, flags, fd, offset);
+	}
+
+	q = sim_queue_get(file->node);
+	if (q && q->stride && offset % q->stride == 0 && offset / q->stride < q->nb && len <= q->stride)
+		mem = q->buf[offset / q->stride].mem;
+	else
+		errno = EINVAL;
+	pthread_mutex_unlock(&sim.lock);
+
+	return mem;
+}
+
+void *mmap64(void *addr, size_t len, int prot, int flags, int fd, off64_t offset)
+{
+	return mmap(addr, len, prot, flags, fd, offset);
+}
+
+int munmap(void *addr, size_t len)
+{
+	int i;
+
+	sim_init();
+
+	/* The simulated buffers stay mapped until they are released */
+	pthread_mutex_lock(&sim.lock);
+	for (i = 0; i < SIM_BUF_MAX; i++) {
+		if ((sim.stat.buf[i].mem == addr && i < sim.stat.nb) ||
+		    (sim.params.buf[i].mem == addr && i < sim.params.nb)) {
+			pthread_mutex_unlock(&sim.lock);
+			return 0;
+		}
+	}
+	pthread_mutex_unlock(&sim.lock);
+
+	return real_munmap(addr, len);
+}
+
+/* Without sysfs, the media devices are searched among the /dev/mediaN files */
+DIR *opendir(const char *path)
+{
+	sim_init();
+
+	if (!strcmp(path, "/sys/bus/media/devices")) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	return real_opendir(path);
+}
+
+FILE *fopen(const char *path, const char *mode)
+{
+	static char uevent[SIM_NODE_NB][64], name[SIM_NODE_NB][64];
+	unsigned int minor;
+	char *attr;
+
+	sim_init();
+
+	/* Device and entity names of the simulated nodes */
+	if (!strncmp(path, SIM_SYSFS_PREFIX, strlen(SIM_SYSFS_PREFIX))) {
+		minor = strtoul(path + strlen(SIM_SYSFS_PREFIX), &attr, 10);
+		if (minor < 1 || minor >= SIM_NODE_NB) {
+			errno = ENOENT;
+			return NULL;
+		}
+		if (!strcmp(attr, "/name")) {
+			snprintf(name[minor], sizeof(name[minor]), "%s\n", sim_nodes[minor].entity);
+			return fmemopen(name[minor], strlen(name[minor]), "r");
+		}
+		snprintf(uevent[minor], sizeof(uevent[minor]), "DEVNAME=" SIM_DEV_DIR "%s\n", sim_nodes[minor].name);
+		return fmemopen(uevent[minor], strlen(uevent[minor]), "r");
+	}
+
+	if (!strncmp(path, SIM_CACHE_DIR, strlen(SIM_CACHE_DIR))) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	return real_fopen(path, mode);
+}
+
+FILE *fopen64(const char *path, const char *mode)
+{
+	return fopen(path, mode);
+}
+
+int select(int nfds, fd_set *rfds, fd_set *wfds, fd_set *efds, struct timeval *tv)
+{
+	struct timeval zero = { 0 };
+	fd_set r, w, e;
+	int ret;
+
+	sim_init();
+
+	if (tv && !tv->tv_sec && !tv->tv_usec)
+		return real_select(nfds, rfds, wfds, efds, tv);
+
+	/* Nothing ready: time to produce a frame */
+	if (rfds)
+		r = *rfds;
+	if (wfds)
+		w = *wfds;
+	if (efds)
+		e = *efds;
+	ret = real_select(nfds, rfds ? &r : NULL, wfds ? &w : NULL, efds ? &e : NULL, &zero);
+	if (ret) {
+		if (ret > 0) {
+			if (rfds)
+				*rfds = r;
+			if (wfds)
+				*wfds = w;
+			if (efds)
+				*efds = e;
+		}
+		return ret;
+	}
+
+	sim_idle();
+
+	return real_select(nfds, rfds, wfds, efds, tv);
+}
+
+int epoll_wait(int epfd, struct epoll_event *events, int max, int timeout)
+{
+	int ret;
+
+	sim_init();
+
+	if (!timeout)
+		return real_epoll_wait(epfd, events, max, timeout);
+
+	ret = real_epoll_wait(epfd, events, max, 0);
+	if (ret)
+		return ret;
+
+	sim_idle();
+
+	return real_epoll_wait(epfd, events, max, timeout);
+}
@@ -0,0 +1,620 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (C) 2026 ST Microelectronics.
+ */
+
+/*
+ * Convergence benchmark of the control algorithms
+ *
+ * Scripted lighting scenarios are played by the DCMIPP simulator against the streaming control loop
+ * of the library. Each run (tuning x algorithm x scenario) is executed in its own process, with the
+ * simulator preloaded and the scenario given as its scene file, and prints one JSON line:
+ *
+ *   version: tuning file of the run, the tuned controller being the algorithm version to compare
+ *   algorithm, scenario: names, see -h
+ *   frames: frames run; the lighting changes from frame 'settle' on, after a pre-roll
+ *   converge_frames: frames after 'settle' before the error stays within the tolerance, -1 if never
+ *   overshoot: max error past the target after 'settle', opposite to the initial error (EV)
+ *   steady_error: average absolute error on the last BENCH_STEADY_FRAMES frames (EV)
+ *   sensor_updates: frames with a new sensor gain or exposure after 'settle'
+ *   cpu_ns_mean, cpu_ns_max: CPU time of isp_event_dispatch() per frame, the simulator excluded
+ *
+ * The AEC error is the log2 of the post-ISP average luminance relative to the tuning target. The
+ * AWB runs keep the AEC running, their error is the log2 of the red / green and blue / green ratios
+ * of the post-ISP averages, which a neutral scene should get to 1.
+ *
+ *   make bench && ./isp-control-bench > results.jsonl
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+
+#include "libdcmipp-isp.h"
+#include "tuning.h"
+#include "videodev2.h"
+
+#define BENCH_SIM_DEFAULT	"./libdcmipp-sim.so"
+#define BENCH_FRAMES_MAX	512
+#define BENCH_STEADY_FRAMES	30
+#define BENCH_TIMEOUT_MS	1000
+
+/* Tolerances around the target (EV): the AEC one is the default hysteresis of the controller */
+#define BENCH_AEC_TOLERANCE	0.25
+#define BENCH_AWB_TOLERANCE	0.05
+
+/* Pre-roll letting the algorithms converge on the initial scene */
+#define BENCH_SETTLE		60
+
+/* Average green signal at the AEC target, with the default sensor settings */
+#define BENCH_LEVEL		44
+
+/* Red / green and blue / green ratios of the sensor under the calibrated illuminants */
+#define BENCH_D50		"red=0.45 blue=0.55"
+#define BENCH_TL84		"red=0.59 blue=0.43"
+#define BENCH_TUNGSTEN		"red=0.8 blue=0.3"
+
+struct bench_scenario {
+	const char *name;
+	const char *desc;
+	bool awb;
+	int frames;
+	int settle;
+	void (*script)(FILE *f);
+};
+
+struct bench_algo {
+	const char *name;
+	bool awb;
+	int awb_mode;
+	int antiflicker;
+};
+
+/*
+ * Scene scripts, in the DCMIPP_SIM_SCENE format
+ */
+static void script_step_up(FILE *f)
+{
+	fprintf(f, "1 level=%g " BENCH_D50 "\n", BENCH_LEVEL / 4.0);
+	fprintf(f, "%d level=%g\n", BENCH_SETTLE, BENCH_LEVEL * 2.0);
+}
+
+static void script_step_down(FILE *f)
+{
+	fprintf(f, "1 level=%g " BENCH_D50 "\n", BENCH_LEVEL * 2.0);
+	fprintf(f, "%d level=%g\n", BENCH_SETTLE, BENCH_LEVEL / 4.0);
+}
+
+/* 4 EV in 120 frames, at a constant EV rate */
+static void script_ramp(FILE *f, float ev_start, float ev_end)
+{
+	int i;
+
+	fprintf(f, "1 level=%g " BENCH_D50 "\n", BENCH_LEVEL * exp2f(ev_start));
+	for (i = 1; i <= 120; i++)
+		fprintf(f, "%d level=%g\n", BENCH_SETTLE + i, BENCH_LEVEL * exp2f(ev_start + (ev_end - ev_start) * i / 120));
+}
+
+static void script_ramp_up(FILE *f)
+{
+	script_ramp(f, -2, 2);
+}
+
+static void script_ramp_down(FILE *f)
+{
+	script_ramp(f, 2, -2);
+}
+
+/*
+ * 100 Hz lighting seen at 30 fps: the frame brightness beats at 10 Hz, which is a 3 frames period.
+ * The +/-15% modulation stays within the hysteresis of the AEC, which should not chase it.
+ */
+static void script_flicker(FILE *f)
+{
+	int i;
+
+	fprintf(f, "1 level=%d " BENCH_D50 "\n", BENCH_LEVEL);
+	for (i = BENCH_SETTLE; i < 240; i++)
+		fprintf(f, "%d level=%g\n", i, BENCH_LEVEL * (1 + 0.15 * sinf(2 * M_PI * i / 3)));
+}
+
+/*
+ * The scene gets lit by a lamp flickering at 100 Hz (50 Hz mains), the simulator integrating the light
+ * over the exposure time: the beats vanish when it is a multiple of 10 ms.
+ */
+static void script_mains_flicker(FILE *f)
+{
+	fprintf(f, "1 level=%g " BENCH_D50 "\n", BENCH_LEVEL / 2.0);
+	fprintf(f, "%d flicker=0.4 mains=50\n", BENCH_SETTLE);
+}
+
+/* A dark subject comes in front of a bright window */
+static void script_backlit(FILE *f)
+{
+	fprintf(f, "1 level=%d " BENCH_D50 "\n", BENCH_LEVEL);
+	fprintf(f, "%d level=%d center=0.05\n", BENCH_SETTLE, BENCH_LEVEL * 4);
+}
+
+static void script_d50_to_tl84(FILE *f)
+{
+	fprintf(f, "1 level=%d " BENCH_D50 "\n", BENCH_LEVEL);
+	fprintf(f, "%d " BENCH_TL84 "\n", BENCH_SETTLE);
+}
+
+static void script_tl84_to_tungsten(FILE *f)
+{
+	fprintf(f, "1 level=%d " BENCH_TL84 "\n", BENCH_LEVEL);
+	fprintf(f, "%d level=%g " BENCH_TUNGSTEN "\n", BENCH_SETTLE, BENCH_LEVEL / 2.0);
+}
+
+static const struct bench_scenario scenarios[] = {
+	{ "step-up", "+3 EV step", false, 180, BENCH_SETTLE, script_step_up },
+	{ "step-down", "-3 EV step", false, 180, BENCH_SETTLE, script_step_down },
+	{ "ramp-up", "+4 EV ramp over 120 frames", false, 240, BENCH_SETTLE, script_ramp_up },
+	{ "ramp-down", "-4 EV ramp over 120 frames", false, 240, BENCH_SETTLE, script_ramp_down },
+	{ "flicker", "+/-15% brightness beating at 10 Hz", false, 240, BENCH_SETTLE, script_flicker },
+	{ "mains-flicker", "+/-40% light flicker at 100 Hz, integrated over the exposure time", false, 240,
+	  BENCH_SETTLE, script_mains_flicker },
+	{ "backlit", "dark subject in front of a 2 EV brighter background", false, 180, BENCH_SETTLE,
+	  script_backlit },
+	{ "d50-to-tl84", "daylight to fluorescent lamp", true, 180, BENCH_SETTLE, script_d50_to_tl84 },
+	{ "tl84-to-tungsten", "fluorescent to uncalibrated tungsten lamp, -1 EV", true, 180, BENCH_SETTLE,
+	  script_tl84_to_tungsten },
+};
+
+static const struct bench_algo algos[] = {
+	{ "aec", false, 0, ISP_ANTIFLICKER_OFF },
+	{ "aec-antiflicker", false, 0, ISP_ANTIFLICKER_AUTO },
+	{ "awb-gray-world", true, ISP_AWB_GRAY_WORLD, ISP_ANTIFLICKER_OFF },
+	{ "awb-white-patch", true, ISP_AWB_WHITE_PATCH, ISP_ANTIFLICKER_OFF },
+};
+
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
+
+/*
+ * Per-frame error of a run, in EV: one component for the AEC, two for the AWB
+ */
+struct bench_frame {
+	bool valid;
+	float error[2];
+	unsigned long cpu_ns;
+	bool sensor_update;
+};
+
+static struct bench_frame frames[BENCH_FRAMES_MAX];
+
+static unsigned long thread_cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static float log2_ratio(__u32 a, __u32 b)
+{
+	return log2f((float)(a ? a : 1) / (b ? b : 1));
+}
+
+/*
+ * Get the AEC target of the sensor, from the same tuning as the library
+ */
+static int bench_target(const char *tuning_file, const char *sensor_name)
+{
+	static struct sensor_tuning tunings[TUNING_SENSOR_MAX];
+	int i, nb;
+
+	if (!tuning_file && !access(TUNING_FILE_DEFAULT, R_OK))
+		tuning_file = TUNING_FILE_DEFAULT;
+
+	nb = tuning_file ? tuning_load(tuning_file, tunings, TUNING_SENSOR_MAX) :
+			   tuning_default(tunings, TUNING_SENSOR_MAX);
+	for (i = 0; i < nb; i++)
+		if (!strcmp(tunings[i].name, sensor_name))
+			return tunings[i].aec.target;
+
+	return -ENODEV;
+}
+
+/*
+ * Read the sensor gain and exposure, to count the updates
+ */
+static int read_sensor(int fd, __s32 values[2])
+{
+	struct v4l2_ext_control ctrl[2] = {
+		{ .id = V4L2_CID_EXPOSURE },
+		{ .id = V4L2_CID_ANALOGUE_GAIN },
+	};
+	struct v4l2_ext_controls ctrls = {
+		.which = V4L2_CTRL_WHICH_CUR_VAL,
+		.count = 2,
+		.controls = ctrl,
+	};
+
+	if (ioctl(fd, VIDIOC_G_EXT_CTRLS, &ctrls))
+		return -errno;
+
+	values[0] = ctrl[0].value;
+	values[1] = ctrl[1].value;
+
+	return 0;
+}
+
+/*
+ * Compute the metrics of a run and print them as a JSON line
+ */
+static void report(FILE *out, const char *version, const struct bench_algo *algo, const struct bench_scenario *sc)
+{
+	float tolerance = sc->awb ? BENCH_AWB_TOLERANCE : BENCH_AEC_TOLERANCE;
+	float e0[2] = { 0 }, norm, dist, proj, overshoot = 0, steady = 0;
+	unsigned long cpu_total = 0, cpu_max = 0;
+	int n, converge = -1, steady_nb = 0, frame_nb = 0, updates = 0;
+
+	for (n = sc->settle; n <= sc->frames; n++) {
+		if (frames[n].valid) {
+			memcpy(e0, frames[n].error, sizeof(e0));
+			break;
+		}
+	}
+	norm = hypotf(e0[0], e0[1]);
+
+	for (n = 1; n <= sc->frames; n++) {
+		if (!frames[n].valid)
+			continue;
+
+		frame_nb++;
+		cpu_total += frames[n].cpu_ns;
+		if (frames[n].cpu_ns > cpu_max)
+			cpu_max = frames[n].cpu_ns;
+
+		if (n < sc->settle)
+			continue;
+
+		dist = hypotf(frames[n].error[0], frames[n].error[1]);
+
+		/* First frame from which the error stays within the tolerance */
+		if (dist >= tolerance)
+			converge = -1;
+		else if (converge < 0)
+			converge = n - sc->settle;
+
+		/* Error past the target: projected on the direction of the initial error */
+		if (norm > 0) {
+			proj = -(frames[n].error[0] * e0[0] + frames[n].error[1] * e0[1]) / norm;
+			if (proj > overshoot)
+				overshoot = proj;
+		}
+
+		if (n > sc->frames - BENCH_STEADY_FRAMES) {
+			steady += dist;
+			steady_nb++;
+		}
+
+		if (n > sc->settle && frames[n].sensor_update)
+			updates++;
+	}
+
+	fprintf(out, "{\"version\":\"%s\",\"algorithm\":\"%s\",\"scenario\":\"%s\",\"frames\":%d,\"settle\":%d,"
+	       "\"converge_frames\":%d,\"overshoot\":%.3f,\"steady_error\":%.3f,\"sensor_updates\":%d,"
+	       "\"cpu_ns_mean\":%lu,\"cpu_ns_max\":%lu}\n",
+	       version, algo->name, sc->name, sc->frames, sc->settle, converge, overshoot,
+	       steady_nb ? steady / steady_nb : 0, updates, frame_nb ? cpu_total / frame_nb : 0, cpu_max);
+}
+
+/*
+ * Run a scenario, in the process started with the simulator
+ */
+static int run(FILE *out, const char *tuning_file, const char *version, const struct bench_algo *algo,
+	       const struct bench_scenario *sc)
+{
+	struct isp_open_cfg open_cfg = {
+		.tuning_file = tuning_file,
+	};
+	struct isp_control_cfg control_cfg = {
+		.aec = true,
+		.awb = algo->awb,
+		.awb_mode = algo->awb_mode,
+		.antiflicker = algo->antiflicker,
+	};
+	struct epoll_event ev;
+	struct isp_handle *h;
+	struct isp_stats stats;
+	struct isp_info info;
+	__s32 sensor[2], prev[2];
+	__u32 sequence = 0;
+	unsigned long t0, t1;
+	int ret, target, sensor_fd;
+
+	ret = isp_open(&open_cfg, &h);
+	if (ret) {
+		printf("Failed to open the ISP (%d)\n", ret);
+		return ret;
+	}
+
+	isp_get_info(h, &info);
+	target = bench_target(tuning_file, info.sensor_name);
+	if (target <= 0) {
+		printf("No AEC target for %s\n", info.sensor_name);
+		ret = -ENODEV;
+		goto close;
+	}
+
+	sensor_fd = open(info.sensor_subdev_name, O_RDWR);
+	if (sensor_fd < 0 || read_sensor(sensor_fd, prev)) {
+		printf("Failed to read the controls of %s\n", info.sensor_subdev_name);
+		ret = -EIO;
+		goto close_sensor;
+	}
+
+	ret = isp_control_start(h, &control_cfg);
+	if (!ret)
+		ret = isp_stream_start(h);
+	if (ret) {
+		printf("Failed to start the control loop (%d)\n", ret);
+		goto close_sensor;
+	}
+
+	while (sequence < (__u32)sc->frames) {
+		/* The simulator produces a frame while waiting: only the dispatch is timed */
+		ret = epoll_wait(isp_event_fd(h), &ev, 1, BENCH_TIMEOUT_MS);
+		if (ret <= 0) {
+			ret = ret ? -errno : -ETIMEDOUT;
+			printf("Failed to wait for stats (%d)\n", ret);
+			break;
+		}
+
+		t0 = thread_cpu_ns();
+		ret = isp_event_dispatch(h, 0, &stats);
+		t1 = thread_cpu_ns();
+		if (ret < 0) {
+			printf("Failed to dispatch the ISP events (%d)\n", ret);
+			break;
+		}
+		if (!ret)
+			continue;
+
+		sequence = stats.sequence;
+		if (sequence >= BENCH_FRAMES_MAX)
+			continue;
+
+		frames[sequence].valid = true;
+		frames[sequence].cpu_ns = t1 - t0;
+		if (sc->awb) {
+			frames[sequence].error[0] = log2_ratio(stats.buf.post.average_RGB[0], stats.buf.post.average_RGB[1]);
+			frames[sequence].error[1] = log2_ratio(stats.buf.post.average_RGB[2], stats.buf.post.average_RGB[1]);
+		} else {
+			frames[sequence].error[0] = log2_ratio(isp_luminance(stats.buf.post.average_RGB), target);
+		}
+
+		if (!read_sensor(sensor_fd, sensor)) {
+			frames[sequence].sensor_update = sensor[0] != prev[0] || sensor[1] != prev[1];
+			prev[0] = sensor[0];
+			prev[1] = sensor[1];
+		}
+		ret = 0;
+	}
+
+	isp_stream_stop(h);
+	isp_control_stop(h);
+
+	if (!ret)
+		report(out, version, algo, sc);
+
+close_sensor:
+	if (sensor_fd >= 0)
+		close(sensor_fd);
+close:
+	isp_close(h);
+
+	return ret;
+}
+
+/*
+ * Start a run in a new process, with the simulator preloaded and playing the scenario
+ */
+static int spawn(const char *sim, const char *tuning_file, const char *version, const struct bench_algo *algo,
+		 const struct bench_scenario *sc)
+{
+	char scene[] = "/tmp/isp-control-bench-XXXXXX";
+	int fd, status;
+	pid_t pid;
+	FILE *f;
+
+	fd = mkstemp(scene);
+	if (fd < 0 || !(f = fdopen(fd, "w"))) {
+		fprintf(stderr, "Failed to create the scene file\n");
+		return -errno;
+	}
+	sc->script(f);
+	fclose(f);
+
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0) {
+		unlink(scene);
+		return -errno;
+	}
+
+	if (!pid) {
+		setenv("LD_PRELOAD", sim, 1);
+		setenv("DCMIPP_SIM_SCENE", scene, 1);
+		unsetenv("DCMIPP_SIM_TRACE");
+		execl("/proc/self/exe", "isp-control-bench", "--run", tuning_file ? tuning_file : "", version,
+		      algo->name, sc->name, NULL);
+		fprintf(stderr, "Failed to start the run: %s\n", strerror(errno));
+		_exit(EXIT_FAILURE);
+	}
+
+	waitpid(pid, &status, 0);
+	unlink(scene);
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+		fprintf(stderr, "Run %s / %s / %s failed\n", version, algo->name, sc->name);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static const struct bench_algo *find_algo(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(algos); i++)
+		if (!strcmp(algos[i].name, name))
+			return &algos[i];
+
+	return NULL;
+}
+
+static const struct bench_scenario *find_scenario(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(scenarios); i++)
+		if (!strcmp(scenarios[i].name, name))
+			return &scenarios[i];
+
+	return NULL;
+}
+
+static void usage(const char *prog)
+{
+	unsigned int i;
+
+	printf("Usage: %s [options]\n", prog);
+	printf("\n");
+	printf("Run the control algorithms on scripted scenarios with the DCMIPP simulator,\n");
+	printf("and print the convergence metrics of each run as a JSON line.\n");
+	printf("\n");
+	printf("Options:\n");
+	printf("  -t, --tuning <file>      Tuning file of a version to compare, can be repeated\n");
+	printf("                           (default: the tuning used by the library)\n");
+	printf("  -a, --algorithm <name>   Only run this algorithm\n");
+	printf("  -S, --scenario <name>    Only run this scenario\n");
+	printf("  -s, --sim <path>         Simulator library (default: %s)\n", BENCH_SIM_DEFAULT);
+	printf("  -h, --help               Display this help\n");
+	printf("\n");
+	printf("Algorithms:\n");
+	for (i = 0; i < ARRAY_SIZE(algos); i++)
+		printf("  %s\n", algos[i].name);
+	printf("\n");
+	printf("Scenarios:\n");
+	for (i = 0; i < ARRAY_SIZE(scenarios); i++)
+		printf("  %-18s %s %s\n", scenarios[i].name, scenarios[i].awb ? "(awb)" : "(aec)", scenarios[i].desc);
+}
+
+#define VERSION_MAX	8
+
+int main(int argc, char *argv[])
+{
+	const char *tunings[VERSION_MAX], *versions[VERSION_MAX];
+	const char *sim = BENCH_SIM_DEFAULT, *algo_name = NULL, *scenario_name = NULL;
+	const struct bench_algo *algo;
+	const struct bench_scenario *sc;
+	unsigned int a, s;
+	int opt, v, ret, version_nb = 0, errors = 0, runs = 0;
+	FILE *out;
+
+	static struct option long_options[] = {
+		{"tuning", required_argument, 0, 't'},
+		{"algorithm", required_argument, 0, 'a'},
+		{"scenario", required_argument, 0, 'S'},
+		{"sim", required_argument, 0, 's'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	/* A single run, started by spawn(): only the result goes to stdout, the traces to stderr */
+	if (argc == 6 && !strcmp(argv[1], "--run")) {
+		algo = find_algo(argv[4]);
+		sc = find_scenario(argv[5]);
+		out = fdopen(dup(STDOUT_FILENO), "w");
+		if (!algo || !sc || !out || dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+			return EXIT_FAILURE;
+		ret = run(out, argv[2][0] ? argv[2] : NULL, argv[3], algo, sc);
+		fclose(out);
+		return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	while ((opt = getopt_long(argc, argv, "t:a:S:s:h", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 't':
+			if (version_nb == VERSION_MAX) {
+				printf("Too many tuning files\n");
+				return EXIT_FAILURE;
+			}
+			tunings[version_nb] = optarg;
+			versions[version_nb++] = optarg;
+			break;
+		case 'a':
+			if (!find_algo(optarg)) {
+				printf("Unknown algorithm : %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			algo_name = optarg;
+			break;
+		case 'S':
+			if (!find_scenario(optarg)) {
+				printf("Unknown scenario : %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			scenario_name = optarg;
+			break;
+		case 's':
+			sim = optarg;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (access(sim, R_OK)) {
+		fprintf(stderr, "Simulator %s not found, build it with 'make sim'\n", sim);
+		return EXIT_FAILURE;
+	}
+
+	/* The library tuning: the default file if present, else the built-in descriptors */
+	if (!version_nb) {
+		tunings[0] = NULL;
+		versions[0] = access(TUNING_FILE_DEFAULT, R_OK) ? "built-in" : TUNING_FILE_DEFAULT;
+		version_nb = 1;
+	}
+
+	for (v = 0; v < version_nb; v++) {
+		for (a = 0; a < ARRAY_SIZE(algos); a++) {
+			if (algo_name && strcmp(algo_name, algos[a].name))
+				continue;
+			for (s = 0; s < ARRAY_SIZE(scenarios); s++) {
+				if (scenario_name && strcmp(scenario_name, scenarios[s].name))
+					continue;
+				/* White balance scenarios for the AWB algorithms, exposure ones for the AEC */
+				if (scenarios[s].awb != algos[a].awb)
+					continue;
+				runs++;
+				if (spawn(sim, tunings[v], versions[v], &algos[a], &scenarios[s]))
+					errors++;
+			}
+		}
+	}
+
+	if (!runs)
+		fprintf(stderr, "No run for this algorithm and scenario\n");
+
+	return errors || !runs ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,275 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (C) 2026 ST Microelectronics.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "isp-format.h"
+
+#define FORMAT_BIN_ALIGN	8
+
+/* Room for the fixed part of a text frame or header: about 40 numbers and their names */
+#define FORMAT_TEXT_FIXED	1024
+/* Room for a histogram value or its CSV column name */
+#define FORMAT_TEXT_HISTO	12
+
+/*
+ * Text output helpers: the numbers are converted by hand, as a frame holds up to thousands of them
+ */
+static char *put_str(char *p, const char *s)
+{
+	size_t len = strlen(s);
+
+	memcpy(p, s, len);
+
+	return p + len;
+}
+
+static char *put_u64(char *p, __u64 val)
+{
+	char digits[20];
+	int n = 0;
+
+	do {
+		digits[n++] = '0' + val % 10;
+		val /= 10;
+	} while (val);
+
+	while (n)
+		*p++ = digits[--n];
+
+	return p;
+}
+
+static char *put_s32(char *p, __s32 val)
+{
+	if (val < 0) {
+		*p++ = '-';
+		return put_u64(p, -(__s64)val);
+	}
+
+	return put_u64(p, val);
+}
+
+/*
+ * Comma separated values, 'sep' coming before each one
+ */
+static char *put_u32_list(char *p, const __u32 *val, unsigned int nb, char sep)
+{
+	unsigned int i;
+
+	for (i = 0; i < nb; i++) {
+		*p++ = sep;
+		p = put_u64(p, val[i]);
+		sep = ',';
+	}
+
+	return p;
+}
+
+static char *put_u16_list(char *p, const __u16 *val, unsigned int nb, char sep)
+{
+	unsigned int i;
+
+	for (i = 0; i < nb; i++) {
+		*p++ = sep;
+		p = put_u64(p, val[i]);
+		sep = ',';
+	}
+
+	return p;
+}
+
+static size_t bin_size(unsigned int histogram_nb)
+{
+	size_t size = sizeof(struct isp_format_frame) + 31 * sizeof(__u32) + histogram_nb * sizeof(__u16);
+
+	return (size + FORMAT_BIN_ALIGN - 1) & ~(size_t)(FORMAT_BIN_ALIGN - 1);
+}
+
+int isp_format_parse(const char *name, enum isp_format *format)
+{
+	if (!strcmp(name, "text"))
+		*format = ISP_FORMAT_TEXT;
+	else if (!strcmp(name, "jsonl"))
+		*format = ISP_FORMAT_JSONL;
+	else if (!strcmp(name, "csv"))
+		*format = ISP_FORMAT_CSV;
+	else if (!strcmp(name, "bin"))
+		*format = ISP_FORMAT_BIN;
+	else
+		return -EINVAL;
+
+	return 0;
+}
+
+/*
+ * Size of the buffer to allocate for the header or a frame
+ */
+size_t isp_format_size(enum isp_format format, unsigned int histogram_nb)
+{
+	if (histogram_nb > STM32_DCMIPP_HISTO_BIN_MAX)
+		histogram_nb = STM32_DCMIPP_HISTO_BIN_MAX;
+
+	switch (format) {
+	case ISP_FORMAT_JSONL:
+	case ISP_FORMAT_CSV:
+		return FORMAT_TEXT_FIXED + histogram_nb * FORMAT_TEXT_HISTO;
+	case ISP_FORMAT_BIN:
+		return bin_size(histogram_nb);
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Header to output once before the frames, only for csv: return its size
+ */
+size_t isp_format_header(enum isp_format format, unsigned int histogram_nb, char *buf)
+{
+	static const char * const avg[] = { "r", "g", "b" };
+	unsigned int i, l;
+	char *p = buf;
+
+	if (format != ISP_FORMAT_CSV)
+		return 0;
+
+	if (histogram_nb > STM32_DCMIPP_HISTO_BIN_MAX)
+		histogram_nb = STM32_DCMIPP_HISTO_BIN_MAX;
+
+	p = put_str(p, "sequence,exposure,gain");
+	for (l = 0; l < 2; l++) {
+		for (i = 0; i < 3; i++) {
+			p = put_str(p, l ? ",post_" : ",pre_");
+			p = put_str(p, avg[i]);
+		}
+		for (i = 0; i < 12; i++) {
+			p = put_str(p, l ? ",post_bin" : ",pre_bin");
+			p = put_u64(p, i);
+		}
+	}
+	p = put_str(p, ",bad_pixels,timestamp_ns");
+	for (i = 0; i < histogram_nb; i++) {
+		p = put_str(p, ",histo");
+		p = put_u64(p, i);
+	}
+	*p++ = '\n';
+
+	return p - buf;
+}
+
+static size_t format_jsonl(const struct isp_stats *stats, unsigned int histogram_nb, char *buf)
+{
+	const struct stm32_dcmipp_stat_avr_bins *loc;
+	unsigned int l;
+	char *p = buf;
+
+	p = put_str(p, "{\"sequence\":");
+	p = put_u64(p, stats->sequence);
+	p = put_str(p, ",\"timestamp_ns\":");
+	p = put_u64(p, stats->timestamp);
+	p = put_str(p, ",\"exposure\":");
+	p = put_s32(p, stats->exposure);
+	p = put_str(p, ",\"gain\":");
+	p = put_s32(p, stats->gain);
+	for (l = 0; l < 2; l++) {
+		loc = l ? &stats->buf.post : &stats->buf.pre;
+		p = put_str(p, l ? ",\"post\":{\"average\":" : ",\"pre\":{\"average\":");
+		p = put_u32_list(p, loc->average_RGB, 3, '[');
+		p = put_str(p, "],\"bins\":");
+		p = put_u32_list(p, loc->bins, 12, '[');
+		p = put_str(p, "]}");
+	}
+	p = put_str(p, ",\"bad_pixels\":");
+	p = put_u64(p, stats->buf.bad_pixel_count);
+	if (histogram_nb) {
+		p = put_str(p, ",\"histograms\":");
+		p = put_u16_list(p, stats->buf.histograms, histogram_nb, '[');
+		*p++ = ']';
+	}
+	p = put_str(p, "}\n");
+
+	return p - buf;
+}
+
+static size_t format_csv(const struct isp_stats *stats, unsigned int histogram_nb, char *buf)
+{
+	const struct stm32_dcmipp_stat_avr_bins *loc;
+	unsigned int l;
+	char *p = buf;
+
+	p = put_u64(p, stats->sequence);
+	*p++ = ',';
+	p = put_s32(p, stats->exposure);
+	*p++ = ',';
+	p = put_s32(p, stats->gain);
+	for (l = 0; l < 2; l++) {
+		loc = l ? &stats->buf.post : &stats->buf.pre;
+		p = put_u32_list(p, loc->average_RGB, 3, ',');
+		p = put_u32_list(p, loc->bins, 12, ',');
+	}
+	*p++ = ',';
+	p = put_u64(p, stats->buf.bad_pixel_count);
+	*p++ = ',';
+	p = put_u64(p, stats->timestamp);
+	p = put_u16_list(p, stats->buf.histograms, histogram_nb, ',');
+	*p++ = '\n';
+
+	return p - buf;
+}
+
+static size_t format_bin(const struct isp_stats *stats, unsigned int histogram_nb, char *buf)
+{
+	struct isp_format_frame frame = {
+		.magic = ISP_FORMAT_MAGIC,
+		.size = bin_size(histogram_nb),
+		.timestamp = stats->timestamp,
+		.sequence = stats->sequence,
+		.exposure = stats->exposure,
+		.gain = stats->gain,
+		.histogram_nb = histogram_nb,
+	};
+	char *p = buf;
+
+	memcpy(p, &frame, sizeof(frame));
+	p += sizeof(frame);
+	memcpy(p, stats->buf.pre.average_RGB, sizeof(stats->buf.pre.average_RGB));
+	p += sizeof(stats->buf.pre.average_RGB);
+	memcpy(p, stats->buf.post.average_RGB, sizeof(stats->buf.post.average_RGB));
+	p += sizeof(stats->buf.post.average_RGB);
+	memcpy(p, stats->buf.pre.bins, sizeof(stats->buf.pre.bins));
+	p += sizeof(stats->buf.pre.bins);
+	memcpy(p, stats->buf.post.bins, sizeof(stats->buf.post.bins));
+	p += sizeof(stats->buf.post.bins);
+	memcpy(p, &stats->buf.bad_pixel_count, sizeof(stats->buf.bad_pixel_count));
+	p += sizeof(stats->buf.bad_pixel_count);
+	memcpy(p, stats->buf.histograms, histogram_nb * sizeof(stats->buf.histograms[0]));
+	p += histogram_nb * sizeof(stats->buf.histograms[0]);
+	memset(p, 0, buf + frame.size - p);
+
+	return frame.size;
+}
+
+/*
+ * Serialize the stats of a frame, with its first 'histogram_nb' histogram values: return its size
+ * 'buf' must be at least isp_format_size() bytes.
+ */
+size_t isp_format_stats(enum isp_format format, const struct isp_stats *stats, unsigned int histogram_nb,
+			char *buf)
+{
+	if (histogram_nb > STM32_DCMIPP_HISTO_BIN_MAX)
+		histogram_nb = STM32_DCMIPP_HISTO_BIN_MAX;
+
+	switch (format) {
+	case ISP_FORMAT_JSONL:
+		return format_jsonl(stats, histogram_nb, buf);
+	case ISP_FORMAT_CSV:
+		return format_csv(stats, histogram_nb, buf);
+	case ISP_FORMAT_BIN:
+		return format_bin(stats, histogram_nb, buf);
+	default:
+		return 0;
+	}
+}
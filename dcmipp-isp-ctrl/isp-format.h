@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (C) 2026 ST Microelectronics.
+ */
+
+#ifndef ISP_FORMAT_H
+#define ISP_FORMAT_H
+
+#include <stddef.h>
+#include <linux/types.h>
+
+#include "libdcmipp-isp.h"
+
+/*
+ * Machine readable stats output
+ *
+ * A frame is serialized in a buffer of isp_format_size() bytes, allocated once, so that it can be
+ * output with a single write. Formats:
+ *   jsonl: one JSON object per line
+ *   csv:   one line per frame, after a header line. The columns follow the DCMIPP simulator log
+ *          format (sequence, exposure, gain, pre / post averages and bins, bad pixel count), so that
+ *          the output can be replayed with DCMIPP_SIM_TRACE. The capture time and the histograms
+ *          come next.
+ *   bin:   one record per frame, in the native byte order: a struct isp_format_frame followed by
+ *          the pre then post averages (6 __u32), the pre then post bins (24 __u32), the bad pixel
+ *          count (__u32) and 'histogram_nb' histogram values (__u16), padded to 8 bytes.
+ */
+
+enum isp_format {
+	ISP_FORMAT_TEXT,	/* Human readable output of the application, not handled here */
+	ISP_FORMAT_JSONL,
+	ISP_FORMAT_CSV,
+	ISP_FORMAT_BIN,
+};
+
+#define ISP_FORMAT_MAGIC	0x46505349 /* "ISPF" */
+
+/*
+ * @size: size of the record, header included
+ */
+struct isp_format_frame {
+	__u32 magic;
+	__u32 size;
+	__u64 timestamp;
+	__u32 sequence;
+	__s32 exposure;
+	__s32 gain;
+	__u32 histogram_nb;
+};
+
+int isp_format_parse(const char *name, enum isp_format *format);
+size_t isp_format_size(enum isp_format format, unsigned int histogram_nb);
+size_t isp_format_header(enum isp_format format, unsigned int histogram_nb, char *buf);
+size_t isp_format_stats(enum isp_format format, const struct isp_stats *stats, unsigned int histogram_nb,
+			char *buf);
+
+#endif
@@ -0,0 +1,220 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (C) 2026 ST Microelectronics.
+ */
+
+/*
+ * Micro-benchmark of the histogram analytics against a straightforward float version.
+ * The metrics are first checked on random histograms of each size, then the analysis of a whole
+ * frame is timed for the largest histogram layouts.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "isp-histo.h"
+
+#define CHECK_LOOPS	20000
+#define BENCH_LOOPS	2000
+
+static volatile unsigned int sink;
+
+static __u16 histograms[STM32_DCMIPP_HISTO_BIN_MAX];
+static struct isp_histo_metrics metrics[STM32_DCMIPP_HISTO_BIN_MAX / 4];
+
+/*
+ * Float version, with one pass per metric
+ */
+struct metrics_float {
+	double total;
+	double mean;
+	int p[3];
+	double clip_low;
+	double clip_high;
+	double entropy;
+};
+
+static void compute_float(const __u16 *histo, unsigned int bin_nb, struct metrics_float *m)
+{
+	static const double pct[3] = { 0.01, 0.5, 0.99 };
+	double sum, step = 256.0 / bin_nb;
+	unsigned int i, k;
+
+	m->total = 0;
+	for (i = 0; i < bin_nb; i++)
+		m->total += histo[i];
+	if (!m->total)
+		return;
+
+	m->mean = 0;
+	for (i = 0; i < bin_nb; i++)
+		m->mean += histo[i] * (i + 0.5) * step;
+	m->mean /= m->total;
+
+	for (k = 0; k < 3; k++) {
+		sum = 0;
+		for (i = 0; i < bin_nb; i++) {
+			sum += histo[i];
+			if (sum >= ceil(m->total * pct[k] - 1e-9))
+				break;
+		}
+		m->p[k] = (int)((i + 0.5) * step);
+	}
+
+	m->clip_low = histo[0] / m->total;
+	m->clip_high = histo[bin_nb - 1] / m->total;
+
+	m->entropy = 0;
+	for (i = 0; i < bin_nb; i++)
+		if (histo[i])
+			m->entropy -= histo[i] / m->total * log2(histo[i] / m->total);
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * Random histogram: a sparse or dense mix of peaks and noise, sometimes saturated or empty
+ */
+static void random_histo(__u16 *histo, unsigned int bin_nb)
+{
+	unsigned int i, kind = rand() % 8, peak = rand() % bin_nb;
+
+	for (i = 0; i < bin_nb; i++) {
+		switch (kind) {
+		case 0:
+			histo[i] = 0;
+			break;
+		case 1:
+			histo[i] = i == peak ? 65535 : 0;
+			break;
+		case 2:
+			histo[i] = 65535;
+			break;
+		case 3:
+			histo[i] = rand() % 4 ? 0 : rand() % 65536;
+			break;
+		default:
+			histo[i] = rand() % (1 + 65535 / (1 + abs((int)i - (int)peak)));
+			break;
+		}
+	}
+}
+
+/*
+ * The fixed-point mean is truncated to Q8, the entropy interpolated: the other metrics are exact
+ */
+static int check(void)
+{
+	struct isp_histo_metrics m;
+	struct metrics_float f;
+	unsigned int bin_nb, n, errors = 0;
+	double err_mean = 0, err_clip = 0, err_entropy = 0, e;
+
+	for (bin_nb = 4; bin_nb <= 256; bin_nb *= 4) {
+		for (n = 0; n < CHECK_LOOPS; n++) {
+			random_histo(histograms, bin_nb);
+			isp_histo_compute(histograms, bin_nb, &m, NULL);
+			compute_float(histograms, bin_nb, &f);
+
+			if (m.total != f.total) {
+				errors++;
+				continue;
+			}
+			if (!m.total)
+				continue;
+
+			e = fabs(m.mean / 256.0 - f.mean);
+			err_mean = e > err_mean ? e : err_mean;
+			if (e > 1.0 / 256)
+				errors++;
+
+			if (m.p1 != f.p[0] || m.p50 != f.p[1] || m.p99 != f.p[2])
+				errors++;
+
+			e = fmax(fabs(m.clip_low / 65536.0 - f.clip_low), fabs(m.clip_high / 65536.0 - f.clip_high));
+			err_clip = e > err_clip ? e : err_clip;
+			if (e > 1.0 / 65536)
+				errors++;
+
+			e = fabs(m.entropy / 65536.0 - f.entropy);
+			err_entropy = e > err_entropy ? e : err_entropy;
+			if (e > 1e-3)
+				errors++;
+		}
+	}
+
+	printf("  %u histograms of 4 to 256 bins: %u errors\n", 4 * CHECK_LOOPS, errors);
+	printf("  max error: mean %.5f, clipping %.7f, entropy %.5f bits\n", err_mean, err_clip, err_entropy);
+
+	return errors;
+}
+
+/*
+ * Time the analysis of all the histograms of a frame
+ */
+static void bench_layout(const char *name, __u8 hreg, __u8 vreg, __u8 comp, __u8 bin)
+{
+	struct stm32_dcmipp_isp_histo_cfg cfg = {
+		.hreg = hreg, .vreg = vreg, .comp = comp, .bin = bin,
+	};
+	unsigned int bin_nb = isp_histo_bin_nb(&cfg), nb = isp_histo_nb(&cfg);
+	struct metrics_float f;
+	double t0, t1, t2, acc = 0;
+	unsigned int n, i;
+
+	for (i = 0; i < nb; i++)
+		random_histo(histograms + i * bin_nb, bin_nb);
+
+	t0 = now_ns();
+	for (n = 0; n < BENCH_LOOPS; n++) {
+		for (i = 0; i < nb; i++) {
+			compute_float(histograms + i * bin_nb, bin_nb, &f);
+			acc += f.entropy;
+		}
+	}
+	t1 = now_ns();
+	for (n = 0; n < BENCH_LOOPS; n++) {
+		isp_histo_analyze(&cfg, histograms, metrics, NULL);
+		acc += metrics[0].entropy;
+	}
+	t2 = now_ns();
+	sink = acc;
+
+	printf("  %-26s float %8.2f us   fixed %8.2f us   x%.1f\n", name,
+	       (t1 - t0) / BENCH_LOOPS / 1000, (t2 - t1) / BENCH_LOOPS / 1000, (t1 - t0) / (t2 - t1));
+}
+
+int main(void)
+{
+	int errors;
+
+	srand(1);
+
+	printf("Fixed-point / float comparison:\n");
+	errors = check();
+
+	printf("Timings (per frame, %s):\n",
+#if defined(__ARM_NEON)
+	       "NEON"
+#elif defined(__SSE2__)
+	       "SSE2"
+#else
+	       "scalar"
+#endif
+	       );
+	bench_layout("5 regions x 4 x 256 bins", 5, 1, STM32_DCMIPP_ISP_HISTO_COMP_ALL, STM32_DCMIPP_ISP_HISTO_BIN_256);
+	bench_layout("80 regions x 4 x 16 bins", 10, 8, STM32_DCMIPP_ISP_HISTO_COMP_ALL, STM32_DCMIPP_ISP_HISTO_BIN_16);
+	bench_layout("320 regions x 16 bins", 20, 16, STM32_DCMIPP_ISP_HISTO_COMP_GR_G_Y_Y, STM32_DCMIPP_ISP_HISTO_BIN_16);
+	bench_layout("1 region x 4 x 64 bins", 1, 1, STM32_DCMIPP_ISP_HISTO_COMP_ALL, STM32_DCMIPP_ISP_HISTO_BIN_64);
+
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,221 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (C) 2026 ST Microelectronics.
+ */
+
+#include <string.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "isp-histo.h"
+
+#define HISTO_BIN_NB_MAX	256
+
+/*
+ * log2(1 + t) for t in [0, 1) by a degree 5 polynomial (error below 1.5e-5), with no constant term so
+ * that the log2 of the powers of 2 is exact
+ */
+#define LOG2_C1		1.44196557f
+#define LOG2_C2		-0.709662318f
+#define LOG2_C3		0.417594238f
+#define LOG2_C4		-0.196267763f
+#define LOG2_C5		0.046384577f
+
+static float log2_approx(float x)
+{
+	union { float f; __u32 u; } v = { .f = x };
+	int e = (int)(v.u >> 23) - 127;
+	float t;
+
+	v.u = (v.u & 0x7FFFFF) | 0x3F800000;
+	t = v.f - 1.0f;
+
+	return e + t * (LOG2_C1 + t * (LOG2_C2 + t * (LOG2_C3 + t * (LOG2_C4 + t * LOG2_C5))));
+}
+
+/*
+ * Cumulative distribution of a histogram of bin_nb values (a multiple of 4), and sum of the
+ * count * log2(count) terms of the entropy in clog (a null count giving a null term)
+ * Return the sum of the cumulative values, from which the mean is derived.
+ */
+#if defined(__ARM_NEON)
+static __u64 histo_scan(const __u16 *histo, unsigned int bin_nb, __u32 *cdf, float *clog)
+{
+	uint32x4_t zero = vdupq_n_u32(0), carry = zero, acc = zero, c, x;
+	float32x4_t facc = vdupq_n_f32(0), f, e, t, p;
+	unsigned int i;
+
+	for (i = 0; i < bin_nb; i += 4) {
+		c = vmovl_u16(vld1_u16(histo + i));
+
+		/* Prefix sum of the 4 lanes */
+		x = vaddq_u32(c, vextq_u32(zero, c, 3));
+		x = vaddq_u32(x, vextq_u32(zero, x, 2));
+		x = vaddq_u32(x, carry);
+		vst1q_u32(cdf + i, x);
+		carry = vdupq_n_u32(vgetq_lane_u32(x, 3));
+		acc = vaddq_u32(acc, x);
+
+		/* log2_approx() of the 4 lanes */
+		f = vcvtq_f32_u32(c);
+		e = vcvtq_f32_s32(vsubq_s32(vreinterpretq_s32_u32(vshrq_n_u32(vreinterpretq_u32_f32(f), 23)),
+					    vdupq_n_s32(127)));
+		t = vreinterpretq_f32_u32(vorrq_u32(vandq_u32(vreinterpretq_u32_f32(f), vdupq_n_u32(0x7FFFFF)),
+						    vdupq_n_u32(0x3F800000)));
+		t = vsubq_f32(t, vdupq_n_f32(1.0f));
+		p = vmlaq_f32(vdupq_n_f32(LOG2_C4), t, vdupq_n_f32(LOG2_C5));
+		p = vmlaq_f32(vdupq_n_f32(LOG2_C3), t, p);
+		p = vmlaq_f32(vdupq_n_f32(LOG2_C2), t, p);
+		p = vmlaq_f32(vdupq_n_f32(LOG2_C1), t, p);
+		facc = vmlaq_f32(facc, f, vmlaq_f32(e, t, p));
+	}
+
+	*clog = vgetq_lane_f32(facc, 0) + vgetq_lane_f32(facc, 1) + vgetq_lane_f32(facc, 2) +
+		vgetq_lane_f32(facc, 3);
+
+	return (__u64)vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1) + vgetq_lane_u32(acc, 2) +
+	       vgetq_lane_u32(acc, 3);
+}
+#elif defined(__SSE2__)
+static __u64 histo_scan(const __u16 *histo, unsigned int bin_nb, __u32 *cdf, float *clog)
+{
+	__m128i zero = _mm_setzero_si128(), carry = zero, acc = zero, c, x;
+	__m128 facc = _mm_setzero_ps(), f, e, t, p;
+	__u32 lanes[4];
+	float flanes[4];
+	unsigned int i;
+
+	for (i = 0; i < bin_nb; i += 4) {
+		c = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)(histo + i)), zero);
+
+		/* Prefix sum of the 4 lanes */
+		x = _mm_add_epi32(c, _mm_slli_si128(c, 4));
+		x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+		x = _mm_add_epi32(x, carry);
+		_mm_storeu_si128((__m128i *)(cdf + i), x);
+		carry = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+		acc = _mm_add_epi32(acc, x);
+
+		/* log2_approx() of the 4 lanes */
+		f = _mm_cvtepi32_ps(c);
+		e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(_mm_castps_si128(f), 23), _mm_set1_epi32(127)));
+		t = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(_mm_castps_si128(f), _mm_set1_epi32(0x7FFFFF)),
+						  _mm_set1_epi32(0x3F800000)));
+		t = _mm_sub_ps(t, _mm_set1_ps(1.0f));
+		p = _mm_add_ps(_mm_set1_ps(LOG2_C4), _mm_mul_ps(t, _mm_set1_ps(LOG2_C5)));
+		p = _mm_add_ps(_mm_set1_ps(LOG2_C3), _mm_mul_ps(t, p));
+		p = _mm_add_ps(_mm_set1_ps(LOG2_C2), _mm_mul_ps(t, p));
+		p = _mm_add_ps(_mm_set1_ps(LOG2_C1), _mm_mul_ps(t, p));
+		facc = _mm_add_ps(facc, _mm_mul_ps(f, _mm_add_ps(e, _mm_mul_ps(t, p))));
+	}
+
+	_mm_storeu_ps(flanes, facc);
+	*clog = flanes[0] + flanes[1] + flanes[2] + flanes[3];
+
+	_mm_storeu_si128((__m128i *)lanes, acc);
+
+	return (__u64)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+#else
+static __u64 histo_scan(const __u16 *histo, unsigned int bin_nb, __u32 *cdf, float *clog)
+{
+	__u32 sum = 0;
+	__u64 acc = 0;
+	float facc = 0;
+	unsigned int i;
+
+	for (i = 0; i < bin_nb; i++) {
+		sum += histo[i];
+		cdf[i] = sum;
+		acc += sum;
+		facc += histo[i] * log2_approx(histo[i]);
+	}
+	*clog = facc;
+
+	return acc;
+}
+#endif
+
+/*
+ * Index of the first bin whose cumulative value reaches threshold, which must not exceed the total
+ * The search is branchless: its steps only depend on bin_nb.
+ */
+static unsigned int cdf_search(const __u32 *cdf, unsigned int bin_nb, __u32 threshold)
+{
+	const __u32 *base = cdf;
+	unsigned int half;
+
+	while (bin_nb > 1) {
+		half = bin_nb / 2;
+		base = base[half - 1] < threshold ? base + half : base;
+		bin_nb -= half;
+	}
+
+	return base - cdf;
+}
+
+/*
+ * Metrics of a histogram of bin_nb values (4 to 256, a multiple of 4)
+ * Its cumulative distribution is returned in cdf if not NULL.
+ */
+void isp_histo_compute(const __u16 *histo, unsigned int bin_nb, struct isp_histo_metrics *metrics, __u32 *cdf)
+{
+	static const unsigned int percent[3] = { 1, 50, 99 };
+	__u16 *percentile[3] = { &metrics->p1, &metrics->p50, &metrics->p99 };
+	__u32 local[HISTO_BIN_NB_MAX], total;
+	__u64 cdf_sum, weighted;
+	unsigned int i, k;
+	float clog, entropy;
+
+	if (!cdf)
+		cdf = local;
+
+	cdf_sum = histo_scan(histo, bin_nb, cdf, &clog);
+	total = cdf[bin_nb - 1];
+
+	memset(metrics, 0, sizeof(*metrics));
+	metrics->total = total;
+	if (!total)
+		return;
+
+	/* The sum of the bin indexes is bin_nb * total minus the sum of the cumulative values */
+	weighted = (__u64)bin_nb * total - cdf_sum;
+	metrics->mean = ((2 * weighted + total) * (32768 / bin_nb)) / total;
+	metrics->clip_low = ((__u64)cdf[0] << 16) / total;
+	metrics->clip_high = ((__u64)(total - cdf[bin_nb - 2]) << 16) / total;
+
+	for (k = 0; k < 3; k++) {
+		i = cdf_search(cdf, bin_nb, ((__u64)total * percent[k] + 99) / 100);
+		*percentile[k] = (2 * i + 1) * 128 / bin_nb;
+	}
+
+	/* H = log2(total) - sum(count * log2(count)) / total */
+	entropy = log2_approx(total) - clog / total;
+	metrics->entropy = entropy > 0 ? entropy * 65536 + 0.5f : 0;
+}
+
+/*
+ * Metrics of all the histograms of a frame, in their order in the stats
+ * metrics must hold isp_histo_nb() entries, and cdf, if not NULL, the histogram values.
+ * Return the number of histograms analyzed, the ones beyond STM32_DCMIPP_HISTO_BIN_MAX being ignored.
+ */
+unsigned int isp_histo_analyze(const struct stm32_dcmipp_isp_histo_cfg *cfg, const __u16 *histograms,
+			       struct isp_histo_metrics *metrics, __u32 *cdf)
+{
+	unsigned int bin_nb = isp_histo_bin_nb(cfg);
+	unsigned int nb = isp_histo_nb(cfg), i;
+
+	if (bin_nb > HISTO_BIN_NB_MAX)
+		return 0;
+	if (nb > STM32_DCMIPP_HISTO_BIN_MAX / bin_nb)
+		nb = STM32_DCMIPP_HISTO_BIN_MAX / bin_nb;
+
+	for (i = 0; i < nb; i++)
+		isp_histo_compute(histograms + i * bin_nb, bin_nb, &metrics[i], cdf ? cdf + i * bin_nb : NULL);
+
+	return nb;
+}
@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (C) 2026 ST Microelectronics.
+ */
+
+#ifndef ISP_HISTO_H
+#define ISP_HISTO_H
+
+#include <linux/types.h>
+
+#include "stm32-dcmipp-config.h"
+
+/*
+ * Histogram analytics
+ *
+ * The histograms of a frame are laid out region per region (left to right, then top to bottom), each
+ * region holding 1 histogram, or 4 with STM32_DCMIPP_ISP_HISTO_COMP_ALL, of 4 << (2 * bin) values.
+ * The metrics of a histogram are computed from its cumulative distribution, built in a single pass
+ * over the histogram values (NEON or SSE2 when available). The pixel levels are given on 8 bits
+ * whatever the number of bins.
+ */
+
+/*
+ * @total: pixel count
+ * @mean: mean level (Q8), taking the center of the bins
+ * @p1, @p50, @p99: center of the bins below which lie 1 / 50 / 99 % of the pixels
+ * @clip_low, @clip_high: ratio of the pixels in the first / last bin (Q16)
+ * @entropy: entropy of the distribution in bits (Q16), up to log2 of the number of bins
+ */
+struct isp_histo_metrics {
+	__u32 total;
+	__u32 mean;
+	__u16 p1;
+	__u16 p50;
+	__u16 p99;
+	__u16 reserved;
+	__u32 clip_low;
+	__u32 clip_high;
+	__u32 entropy;
+};
+
+/*
+ * Number of histograms of a config, and number of bins of each of them
+ */
+static inline unsigned int isp_histo_nb(const struct stm32_dcmipp_isp_histo_cfg *cfg)
+{
+	return cfg->hreg * cfg->vreg * (cfg->comp == STM32_DCMIPP_ISP_HISTO_COMP_ALL ? 4 : 1);
+}
+
+static inline unsigned int isp_histo_bin_nb(const struct stm32_dcmipp_isp_histo_cfg *cfg)
+{
+	return 4 << (2 * cfg->bin);
+}
+
+void isp_histo_compute(const __u16 *histo, unsigned int bin_nb, struct isp_histo_metrics *metrics, __u32 *cdf);
+unsigned int isp_histo_analyze(const struct stm32_dcmipp_isp_histo_cfg *cfg, const __u16 *histograms,
+			       struct isp_histo_metrics *metrics, __u32 *cdf);
+
+#endif
@@ -0,0 +1,307 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (C) 2026 ST Microelectronics.
+ */
+
+/*
+ * Micro-benchmark of the fixed-point control math against the float versions it replaced.
+ * Each conversion is first checked on its whole input domain, then timed.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "isp-math.h"
+#include "tuning.h"
+
+#define BENCH_LOOPS	(1 << 22)
+
+static volatile unsigned int sink;
+
+/*
+ * Float versions
+ */
+static int luminance_float(const __u32 rgb[3])
+{
+	return rgb[0] * 0.299 + rgb[1] * 0.587 + rgb[2] * 0.114;
+}
+
+static void to_shift_mult_float(float f, __u8 *shift, __u8 *mult)
+{
+	int s;
+
+	for (s = 0; s < 8; s++) {
+		if (f < 2.0)
+			break;
+		f /= 2;
+	}
+
+	*shift = s;
+	*mult = f * 128;
+}
+
+static __u16 to_cconv_reg(float f)
+{
+	__s16 tmp = 256 * f;
+
+	if (tmp < 0)
+		tmp = ((-tmp ^ 0x7FF) + 1) & 0x7FF;
+
+	return (__u16)tmp;
+}
+
+static int gain_code_search(const float *gain_db, int lo, int hi, float db)
+{
+	int max = hi, mid;
+
+	if (db <= gain_db[lo])
+		return lo;
+
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (gain_db[mid] <= db)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	if (lo < max && gain_db[lo + 1] - db < db - gain_db[lo])
+		lo++;
+
+	return lo;
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void print_timing(const char *name, double float_ns, double fixed_ns)
+{
+	printf("  %-14s float %6.2f ns   fixed %6.2f ns   x%.1f\n", name,
+	       float_ns / BENCH_LOOPS, fixed_ns / BENCH_LOOPS, float_ns / fixed_ns);
+}
+
+/*
+ * The fixed-point luminance is the exact integer part of the BT 601 sum. The float version only
+ * differs when that sum is an integer, where the double rounding can give one less.
+ */
+static int check_luminance(void)
+{
+	unsigned int exact_points = 0, rounding = 0, errors = 0;
+	__u32 rgb[3], s;
+	int lum;
+
+	for (rgb[0] = 0; rgb[0] < 512; rgb[0]++)
+		for (rgb[1] = 0; rgb[1] < 512; rgb[1]++)
+			for (rgb[2] = 0; rgb[2] < 512; rgb[2]++) {
+				s = 299 * rgb[0] + 587 * rgb[1] + 114 * rgb[2];
+				lum = isp_math_luminance(rgb);
+				if (lum != (int)(s / 1000)) {
+					errors++;
+					continue;
+				}
+				if (rgb[0] > 255 || rgb[1] > 255 || rgb[2] > 255)
+					continue;
+				if (lum == luminance_float(rgb))
+					continue;
+				if (s % 1000 == 0 && lum == luminance_float(rgb) + 1)
+					rounding++;
+				else
+					errors++;
+			}
+
+	for (s = 0; s < 1000000; s += 7) {
+		rgb[0] = s * 3;
+		rgb[1] = s * 5;
+		rgb[2] = s;
+		if (isp_math_luminance(rgb) != (int)((299ULL * rgb[0] + 587ULL * rgb[1] + 114ULL * rgb[2]) / 1000))
+			errors++;
+	}
+
+	for (rgb[0] = 0; rgb[0] < 256; rgb[0]++)
+		for (rgb[1] = 0; rgb[1] < 256; rgb[1]++)
+			for (rgb[2] = 0; rgb[2] < 256; rgb[2]++)
+				if ((299 * rgb[0] + 587 * rgb[1] + 114 * rgb[2]) % 1000 == 0)
+					exact_points++;
+
+	printf("  luminance      %s: %u float rounding errors on %u integer sums\n",
+	       errors ? "FAILED" : "exact", rounding, exact_points);
+
+	return errors;
+}
+
+static int check_shift_mult(void)
+{
+	__u8 shift_f, mult_f, shift, mult;
+	unsigned int errors = 0;
+	__u32 q16;
+	float f;
+
+	/* Every Q16 value up to 256.0, all exactly representable as a float */
+	for (q16 = 0; q16 < (1 << 24); q16++) {
+		f = q16 / 65536.0f;
+		to_shift_mult_float(f, &shift_f, &mult_f);
+		isp_math_shift_mult(isp_math_q16(f), &shift, &mult);
+		if (shift != shift_f || mult != mult_f)
+			errors++;
+	}
+
+	/* Gains between Q16 values */
+	for (f = 0.001f; f < 255.0f; f *= 1.0001f) {
+		to_shift_mult_float(f, &shift_f, &mult_f);
+		isp_math_shift_mult(isp_math_q16(f), &shift, &mult);
+		if (shift != shift_f || mult != mult_f)
+			errors++;
+	}
+
+	printf("  shift / mult   %s: %u mismatches\n", errors ? "FAILED" : "bit-exact", errors);
+
+	return errors;
+}
+
+static int check_cconv(void)
+{
+	unsigned int errors = 0;
+	int q8;
+
+	/* The 2.8 signed range of the register */
+	for (q8 = -1024; q8 < 1024; q8++)
+		if (isp_math_cconv_reg(q8) != to_cconv_reg(q8 / 256.0f))
+			errors++;
+
+	printf("  cconv reg      %s: %u mismatches\n", errors ? "FAILED" : "bit-exact", errors);
+
+	return errors;
+}
+
+static int check_gain_table(const char *name, const float *gain_db, int lo, int hi)
+{
+	struct isp_math_index index;
+	unsigned int errors = 0, nb = 0;
+	float db, step;
+	int i, k;
+
+	if (isp_math_index_init(&index, gain_db, lo, hi)) {
+		printf("  %-14s FAILED: invalid table\n", name);
+		return 1;
+	}
+
+	/* Fine sweep, then each table value, its neighbours and the midpoints */
+	step = (gain_db[hi] - gain_db[lo]) / 100000;
+	for (db = gain_db[lo] - 1; db < gain_db[hi] + 1; db += step, nb++)
+		if (isp_math_index_nearest(&index, gain_db, db) != gain_code_search(gain_db, lo, hi, db))
+			errors++;
+
+	for (i = lo; i <= hi; i++) {
+		float points[] = {
+			gain_db[i], nextafterf(gain_db[i], -INFINITY), nextafterf(gain_db[i], INFINITY),
+			i < hi ? (gain_db[i] + gain_db[i + 1]) / 2 : gain_db[i] + 1,
+		};
+
+		for (k = 0; k < 4; k++, nb++)
+			if (isp_math_index_nearest(&index, gain_db, points[k]) !=
+			    gain_code_search(gain_db, lo, hi, points[k]))
+				errors++;
+	}
+
+	printf("  %-14s %s: %u mismatches on %u values\n", name, errors ? "FAILED" : "bit-exact", errors, nb);
+
+	return errors;
+}
+
+static int check_gain_code(void)
+{
+	static float gain_db[TUNING_GAIN_CODE_MAX + 1];
+	struct sensor_tuning tuning;
+	int i, errors;
+
+	tuning_default(&tuning, 1);
+	errors = check_gain_table("gain linear", tuning.gain_db, tuning.gain_min, tuning.gain_max);
+
+	/* Typical analogue gain law: gain = 1024 / (1024 - code) */
+	for (i = 0; i <= TUNING_GAIN_CODE_MAX; i++)
+		gain_db[i] = 20 * log10f(1024.0f / (1024 - i));
+	errors += check_gain_table("gain 1/x law", gain_db, 0, 1000);
+
+	return errors;
+}
+
+static void bench(void)
+{
+	struct sensor_tuning tuning;
+	double t0, t1, t2;
+	__u8 shift, mult;
+	__u32 rgb[3];
+	unsigned int i, acc;
+
+	tuning_default(&tuning, 1);
+
+	printf("Timings (per call):\n");
+
+	acc = 0;
+	t0 = now_ns();
+	for (i = 0; i < BENCH_LOOPS; i++) {
+		rgb[0] = i & 0xFF;
+		rgb[1] = (i >> 8) & 0xFF;
+		rgb[2] = (i >> 16) & 0xFF;
+		acc += luminance_float(rgb);
+	}
+	t1 = now_ns();
+	for (i = 0; i < BENCH_LOOPS; i++) {
+		rgb[0] = i & 0xFF;
+		rgb[1] = (i >> 8) & 0xFF;
+		rgb[2] = (i >> 16) & 0xFF;
+		acc += isp_math_luminance(rgb);
+	}
+	t2 = now_ns();
+	sink = acc;
+	print_timing("luminance", t1 - t0, t2 - t1);
+
+	acc = 0;
+	t0 = now_ns();
+	for (i = 0; i < BENCH_LOOPS; i++) {
+		to_shift_mult_float((i & 0xFFFF) / 4096.0f, &shift, &mult);
+		acc += shift + mult;
+	}
+	t1 = now_ns();
+	for (i = 0; i < BENCH_LOOPS; i++) {
+		isp_math_shift_mult(isp_math_q16((i & 0xFFFF) / 4096.0f), &shift, &mult);
+		acc += shift + mult;
+	}
+	t2 = now_ns();
+	sink = acc;
+	print_timing("shift / mult", t1 - t0, t2 - t1);
+
+	acc = 0;
+	t0 = now_ns();
+	for (i = 0; i < BENCH_LOOPS; i++)
+		acc += gain_code_search(tuning.gain_db, tuning.gain_min, tuning.gain_max, (i & 0xFFFF) / 900.0f);
+	t1 = now_ns();
+	for (i = 0; i < BENCH_LOOPS; i++)
+		acc += tuning_gain_code(&tuning, (i & 0xFFFF) / 900.0f);
+	t2 = now_ns();
+	sink = acc;
+	print_timing("gain code", t1 - t0, t2 - t1);
+}
+
+int main(void)
+{
+	int errors = 0;
+
+	printf("Fixed-point / float comparison:\n");
+	errors += check_luminance();
+	errors += check_shift_mult();
+	errors += check_cconv();
+	errors += check_gain_code();
+
+	bench();
+
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
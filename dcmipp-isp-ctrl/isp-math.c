@@ -0,0 +1,71 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (C) 2026 ST Microelectronics.
+ */
+
+#include <errno.h>
+
+#include "isp-math.h"
+
+/*
+ * Build the index of table[lo..hi], which must not decrease
+ */
+int isp_math_index_init(struct isp_math_index *index, const float *table, int lo, int hi)
+{
+	float range, start;
+	int b, i;
+
+	if (lo < 0 || hi < lo || hi > 0xFFFF)
+		return -EINVAL;
+
+	for (i = lo; i < hi; i++)
+		if (!(table[i + 1] >= table[i]))
+			return -EINVAL;
+
+	index->lo = lo;
+	index->hi = hi;
+	index->base = table[lo];
+	range = table[hi] - table[lo];
+	index->scale = range > 0 ? ISP_MATH_INDEX_BUCKETS / range : 0;
+
+	/*
+	 * Start each bucket from the last entry of the previous one: the bucket computed from a value
+	 * can then be one too high because of float rounding, the search still starts low enough.
+	 */
+	i = lo;
+	index->first[0] = lo;
+	for (b = 1; b < ISP_MATH_INDEX_BUCKETS; b++) {
+		start = index->scale > 0 ? index->base + (b - 1) / index->scale : index->base;
+		while (i < hi && table[i + 1] <= start)
+			i++;
+		index->first[b] = i;
+	}
+
+	return 0;
+}
+
+/*
+ * Get the entry whose value is the nearest to 'value'
+ * Give the same result as a binary search of the highest entry not above 'value' followed by a
+ * nearest neighbour check, the upper entry being taken only if strictly nearer.
+ */
+int isp_math_index_nearest(const struct isp_math_index *index, const float *table, float value)
+{
+	float pos;
+	int i;
+
+	if (!(value > table[index->lo]))
+		return index->lo;
+
+	pos = (value - index->base) * index->scale;
+	i = pos < ISP_MATH_INDEX_BUCKETS ? index->first[(int)pos] : index->first[ISP_MATH_INDEX_BUCKETS - 1];
+
+	/* Highest entry not above 'value' */
+	while (i < index->hi && table[i + 1] <= value)
+		i++;
+
+	if (i < index->hi && table[i + 1] - value < value - table[i])
+		i++;
+
+	return i;
+}
@@ -0,0 +1,93 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (C) 2026 ST Microelectronics.
+ */
+
+#ifndef ISP_MATH_H
+#define ISP_MATH_H
+
+#include <linux/types.h>
+
+/*
+ * BT 601 luminance coefficients in Q20, rounded up: for components up to 511 the sum truncates
+ * to the exact integer part of 0.299 R + 0.587 G + 0.114 B
+ */
+#define ISP_MATH_LUMA_R_Q20		313525u
+#define ISP_MATH_LUMA_G_Q20		615515u
+#define ISP_MATH_LUMA_B_Q20		119538u
+#define ISP_MATH_LUMA_Q20_MAX		0x1FF
+
+/*
+ * Compute luminance value from R/G/B components using the BT 601 coefficients
+ */
+static inline int isp_math_luminance(const __u32 rgb[3])
+{
+	if ((rgb[0] | rgb[1] | rgb[2]) <= ISP_MATH_LUMA_Q20_MAX)
+		return (ISP_MATH_LUMA_R_Q20 * rgb[0] + ISP_MATH_LUMA_G_Q20 * rgb[1] + ISP_MATH_LUMA_B_Q20 * rgb[2]) >> 20;
+
+	return (299ULL * rgb[0] + 587ULL * rgb[1] + 114ULL * rgb[2]) / 1000;
+}
+
+/*
+ * Convert a positive float value to Q16 (1.0 is coded by 0x10000), truncated
+ */
+static inline __u32 isp_math_q16(float f)
+{
+	if (!(f > 0))
+		return 0;
+	if (f >= 65536.0f)
+		return 0xFFFFFFFF;
+
+	return f * 65536.0f;
+}
+
+/*
+ * Convert a Q16 value in a couple shift / mult used by the DCMIPP ISP:
+ * value = mult / 128 << shift, with the smallest shift keeping the value below 2 before shifting.
+ */
+static inline void isp_math_shift_mult(__u32 q16, __u8 *shift, __u8 *mult)
+{
+	int s = 0;
+
+	/* Values from 2.0 have their most significant bit at 17 or above */
+	if (q16 >> 17) {
+		s = 31 - __builtin_clz(q16) - 16;
+		if (s > 8)
+			s = 8;
+	}
+
+	*shift = s;
+	*mult = q16 >> (s + 9);
+}
+
+/*
+ * Convert a Q8 value to a reg 2.8 format (1.0 is coded by 0x100, complement to 2 on 11 bits)
+ */
+static inline __u16 isp_math_cconv_reg(__s32 q8)
+{
+	return (__u16)q8 & 0x7FF;
+}
+
+/* Number of buckets of a gain table index */
+#define ISP_MATH_INDEX_BUCKETS		256
+
+/*
+ * Index of a non-decreasing float table, to find the nearest entry without a binary search
+ *
+ * @lo, @hi: range of the table entries
+ * @base: value at the start of the first bucket
+ * @scale: buckets per value unit
+ * @first: for each bucket, an entry not above the nearest one of any value of the bucket
+ */
+struct isp_math_index {
+	int lo;
+	int hi;
+	float base;
+	float scale;
+	__u16 first[ISP_MATH_INDEX_BUCKETS];
+};
+
+int isp_math_index_init(struct isp_math_index *index, const float *table, int lo, int hi);
+int isp_math_index_nearest(const struct isp_math_index *index, const float *table, float value);
+
+#endif
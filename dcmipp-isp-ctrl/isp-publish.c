@@ -0,0 +1,484 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (C) 2026 ST Microelectronics.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "isp-publish.h"
+
+#define SUBSCRIBER_READ_TRIES	4
+
+struct isp_publisher {
+	char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	int epoll_fd;
+	int listen_fd;
+	int memfd;
+	void *map;
+	size_t size;
+	struct isp_publish_header *header;
+	struct {
+		int sock;
+		int event;
+	} clients[ISP_PUBLISH_CLIENT_MAX];
+	int client_nb;
+};
+
+struct isp_subscriber {
+	int sock;
+	int event;
+	const void *map;
+	size_t size;
+	const struct isp_publish_header *header;
+};
+
+static struct isp_publish_slot *publish_slot(const struct isp_publish_header *header, const void *map, __u64 n)
+{
+	return (struct isp_publish_slot *)((char *)map + header->slot_offset + (n % header->slot_nb) * header->slot_size);
+}
+
+static int unix_address(const char *path, struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path))
+		return -ENAMETOOLONG;
+	strcpy(addr->sun_path, path);
+
+	return 0;
+}
+
+/*
+ * Create the shared ring: the memfd is sealed so that its size cannot change, and if the kernel
+ * supports it, so that the mapping of this process is the only writable one
+ */
+static int publisher_create_ring(struct isp_publisher *pub)
+{
+	int seals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+
+	pub->size = sizeof(struct isp_publish_header) + ISP_PUBLISH_SLOT_NB * sizeof(struct isp_publish_slot);
+
+	pub->memfd = memfd_create("dcmipp-isp-stats", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (pub->memfd < 0 || ftruncate(pub->memfd, pub->size))
+		return -errno;
+
+	pub->map = mmap(NULL, pub->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, pub->memfd, 0);
+	if (pub->map == MAP_FAILED) {
+		pub->map = NULL;
+		return -errno;
+	}
+
+#ifdef F_SEAL_FUTURE_WRITE
+	if (!fcntl(pub->memfd, F_ADD_SEALS, seals | F_SEAL_FUTURE_WRITE))
+		seals = 0;
+#endif
+	if (seals && fcntl(pub->memfd, F_ADD_SEALS, seals))
+		return -errno;
+
+	pub->header = pub->map;
+	pub->header->magic = ISP_PUBLISH_MAGIC;
+	pub->header->version = ISP_PUBLISH_VERSION;
+	pub->header->slot_nb = ISP_PUBLISH_SLOT_NB;
+	pub->header->slot_size = sizeof(struct isp_publish_slot);
+	pub->header->slot_offset = sizeof(struct isp_publish_header);
+	pub->header->head = 0;
+
+	return 0;
+}
+
+/*
+ * Start publishing: the clients connections are handled in the event loop 'epoll_fd'
+ */
+int isp_publisher_create(const char *socket_path, int epoll_fd, struct isp_publisher **pub)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+	struct isp_publisher *p;
+	struct sockaddr_un addr;
+	int ret;
+
+	ret = unix_address(socket_path, &addr);
+	if (ret) {
+		printf("Invalid socket path %s\n", socket_path);
+		return ret;
+	}
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return -ENOMEM;
+	p->epoll_fd = epoll_fd;
+	p->listen_fd = -1;
+	p->memfd = -1;
+
+	ret = publisher_create_ring(p);
+	if (ret) {
+		printf("Failed to create the stats ring\n");
+		goto err;
+	}
+
+	p->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (p->listen_fd < 0) {
+		ret = -errno;
+		goto err;
+	}
+
+	/* A socket left by a previous instance */
+	unlink(socket_path);
+	if (bind(p->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(p->listen_fd, ISP_PUBLISH_CLIENT_MAX)) {
+		ret = -errno;
+		printf("Failed to listen on %s\n", socket_path);
+		goto err;
+	}
+	strcpy(p->path, socket_path);
+
+	ev.data.fd = p->listen_fd;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, p->listen_fd, &ev)) {
+		ret = -errno;
+		goto err;
+	}
+
+	*pub = p;
+
+	return 0;
+
+err:
+	isp_publisher_destroy(p);
+	return ret;
+}
+
+static void publisher_drop_client(struct isp_publisher *pub, int i)
+{
+	epoll_ctl(pub->epoll_fd, EPOLL_CTL_DEL, pub->clients[i].sock, NULL);
+	close(pub->clients[i].sock);
+	close(pub->clients[i].event);
+	pub->clients[i] = pub->clients[--pub->client_nb];
+}
+
+void isp_publisher_destroy(struct isp_publisher *pub)
+{
+	while (pub->client_nb)
+		publisher_drop_client(pub, pub->client_nb - 1);
+
+	if (pub->listen_fd >= 0) {
+		epoll_ctl(pub->epoll_fd, EPOLL_CTL_DEL, pub->listen_fd, NULL);
+		close(pub->listen_fd);
+	}
+	if (pub->path[0])
+		unlink(pub->path);
+	if (pub->map)
+		munmap(pub->map, pub->size);
+	if (pub->memfd >= 0)
+		close(pub->memfd);
+	free(pub);
+}
+
+/*
+ * Send the ring and a new eventfd to a new client
+ */
+static void publisher_add_client(struct isp_publisher *pub, int sock)
+{
+	struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP, .data.fd = sock };
+	char control[CMSG_SPACE(2 * sizeof(int))];
+	__u32 magic = ISP_PUBLISH_MAGIC;
+	struct iovec iov = { .iov_base = &magic, .iov_len = sizeof(magic) };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control,
+		.msg_controllen = sizeof(control),
+	};
+	struct cmsghdr *cmsg;
+	int fds[2], event;
+
+	if (pub->client_nb == ISP_PUBLISH_CLIENT_MAX) {
+		printf("Too many stats subscribers\n");
+		close(sock);
+		return;
+	}
+
+	event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (event < 0) {
+		close(sock);
+		return;
+	}
+
+	memset(control, 0, sizeof(control));
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	fds[0] = pub->memfd;
+	fds[1] = event;
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	/* Clients do not send anything: any event on their socket is a disconnection */
+	if (sendmsg(sock, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) != sizeof(magic) ||
+	    epoll_ctl(pub->epoll_fd, EPOLL_CTL_ADD, sock, &ev)) {
+		close(event);
+		close(sock);
+		return;
+	}
+
+	pub->clients[pub->client_nb].sock = sock;
+	pub->clients[pub->client_nb].event = event;
+	pub->client_nb++;
+}
+
+/*
+ * Handle an event of the loop if it concerns the publisher
+ * Return true if it did.
+ */
+bool isp_publisher_handle(struct isp_publisher *pub, int fd)
+{
+	int i, sock;
+
+	if (fd == pub->listen_fd) {
+		while ((sock = accept4(pub->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+			publisher_add_client(pub, sock);
+		return true;
+	}
+
+	for (i = 0; i < pub->client_nb; i++) {
+		if (pub->clients[i].sock == fd) {
+			publisher_drop_client(pub, i);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Publish the stats of a frame in the next slot, and signal the subscribers
+ */
+void isp_publisher_write(struct isp_publisher *pub, __u32 sequence, __u64 timestamp, __s32 exposure, __s32 gain,
+			 const struct stm32_dcmipp_stat_buf *buf)
+{
+	struct isp_publish_header *header = pub->header;
+	__u64 n = header->head, one = 1;
+	struct isp_publish_slot *slot = publish_slot(header, pub->map, n);
+	__u32 seq = slot->seq;
+	int i;
+
+	__atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	slot->sequence = sequence;
+	slot->index = n;
+	slot->timestamp = timestamp;
+	slot->exposure = exposure;
+	slot->gain = gain;
+	memcpy(&slot->buf, buf, sizeof(slot->buf));
+
+	__atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+	__atomic_store_n(&header->head, n + 1, __ATOMIC_RELEASE);
+
+	for (i = 0; i < pub->client_nb; i++)
+		if (write(pub->clients[i].event, &one, sizeof(one)) < 0 && errno != EAGAIN)
+			printf("Failed to signal a stats subscriber\n");
+}
+
+/*
+ * Connect to a publisher and map its ring
+ */
+int isp_subscriber_open(const char *socket_path, struct isp_subscriber **sub)
+{
+	char control[CMSG_SPACE(2 * sizeof(int))];
+	const struct isp_publish_header *header;
+	struct isp_subscriber *s;
+	struct sockaddr_un addr;
+	__u32 magic = 0;
+	struct iovec iov = { .iov_base = &magic, .iov_len = sizeof(magic) };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control,
+		.msg_controllen = sizeof(control),
+	};
+	struct cmsghdr *cmsg;
+	int fds[2] = { -1, -1 }, ret;
+	struct stat st;
+
+	ret = unix_address(socket_path, &addr);
+	if (ret)
+		return ret;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return -ENOMEM;
+	s->event = -1;
+
+	s->sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (s->sock < 0 || connect(s->sock, (struct sockaddr *)&addr, sizeof(addr))) {
+		ret = -errno;
+		printf("Failed to connect to %s\n", socket_path);
+		goto err;
+	}
+
+	if (recvmsg(s->sock, &msg, MSG_CMSG_CLOEXEC) != sizeof(magic) || magic != ISP_PUBLISH_MAGIC) {
+		ret = -EPROTO;
+		goto err_protocol;
+	}
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+	    cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+		ret = -EPROTO;
+		goto err_protocol;
+	}
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+	s->event = fds[1];
+
+	if (fstat(fds[0], &st)) {
+		ret = -errno;
+		goto err;
+	}
+
+	s->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fds[0], 0);
+	close(fds[0]);
+	if (s->map == MAP_FAILED) {
+		ret = -errno;
+		goto err;
+	}
+	s->size = st.st_size;
+	s->header = header = s->map;
+
+	if (s->size < sizeof(*header) || header->magic != ISP_PUBLISH_MAGIC ||
+	    header->version != ISP_PUBLISH_VERSION || !header->slot_nb ||
+	    header->slot_size != sizeof(struct isp_publish_slot) ||
+	    header->slot_offset + (__u64)header->slot_nb * header->slot_size > s->size) {
+		munmap((void *)s->map, s->size);
+		ret = -EPROTO;
+		goto err_protocol;
+	}
+
+	*sub = s;
+
+	return 0;
+
+err_protocol:
+	printf("Unexpected stats publisher on %s\n", socket_path);
+err:
+	if (s->event >= 0)
+		close(s->event);
+	if (s->sock >= 0)
+		close(s->sock);
+	free(s);
+	return ret;
+}
+
+void isp_subscriber_close(struct isp_subscriber *sub)
+{
+	munmap((void *)sub->map, sub->size);
+	close(sub->event);
+	close(sub->sock);
+	free(sub);
+}
+
+/*
+ * File descriptor readable when new stats are published, to be watched by the application
+ */
+int isp_subscriber_fd(struct isp_subscriber *sub)
+{
+	return sub->event;
+}
+
+/*
+ * Wait for new stats
+ * Return the number of frames published since the previous call, 0 on timeout, or a negative error
+ * (-EPIPE once the publisher is gone).
+ */
+int isp_subscriber_wait(struct isp_subscriber *sub, int timeout_ms)
+{
+	struct pollfd fds[2] = {
+		{ .fd = sub->event, .events = POLLIN },
+		{ .fd = sub->sock, .events = POLLIN },
+	};
+	__u64 count;
+	int ret;
+
+	ret = poll(fds, 2, timeout_ms);
+	if (ret < 0)
+		return -errno;
+
+	if (read(sub->event, &count, sizeof(count)) == sizeof(count))
+		return count;
+
+	/* The publisher closes the socket when it stops */
+	if (fds[1].revents)
+		return -EPIPE;
+
+	return 0;
+}
+
+/*
+ * Get the slot of the last published frame, to be read in place
+ * The data is only valid if isp_subscriber_end() returns true once they have been read.
+ * Return NULL if nothing is published yet.
+ */
+const struct isp_publish_slot *isp_subscriber_begin(struct isp_subscriber *sub, __u32 *seq)
+{
+	const struct isp_publish_header *header = sub->header;
+	__u64 head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+	const struct isp_publish_slot *slot;
+
+	if (!head)
+		return NULL;
+
+	slot = publish_slot(header, sub->map, head - 1);
+	*seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+	return slot;
+}
+
+bool isp_subscriber_end(const struct isp_publish_slot *slot, __u32 seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	return !(seq & 1) && __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq;
+}
+
+/*
+ * Copy the stats of the last published frame
+ * Return 0 on success, -ENOENT if nothing is published yet, or -EAGAIN if the slot kept being
+ * overwritten while being copied.
+ */
+int isp_subscriber_read(struct isp_subscriber *sub, struct isp_stats *stats, __u64 *index)
+{
+	const struct isp_publish_slot *slot;
+	__u32 seq;
+	int i;
+
+	for (i = 0; i < SUBSCRIBER_READ_TRIES; i++) {
+		slot = isp_subscriber_begin(sub, &seq);
+		if (!slot)
+			return -ENOENT;
+
+		stats->sequence = slot->sequence;
+		stats->timestamp = slot->timestamp;
+		stats->exposure = slot->exposure;
+		stats->gain = slot->gain;
+		stats->histo_id = ISP_HISTO_ID_NONE;
+		memcpy(&stats->buf, &slot->buf, sizeof(stats->buf));
+		if (index)
+			*index = slot->index;
+
+		if (isp_subscriber_end(slot, seq))
+			return 0;
+	}
+
+	return -EAGAIN;
+}
@@ -0,0 +1,81 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (C) 2026 ST Microelectronics.
+ */
+
+#ifndef ISP_PUBLISH_H
+#define ISP_PUBLISH_H
+
+#include <stdbool.h>
+#include <linux/types.h>
+
+#include "libdcmipp-isp.h"
+
+/*
+ * Stats publication to other processes
+ *
+ * The process streaming the stats publishes each frame in a ring of slots in a sealed memfd. Other
+ * processes connect to its Unix socket and receive the memfd, which they map read-only, and their own
+ * eventfd, signaled on each new frame. They read the slots in place: each slot is protected by a
+ * seqlock, so readers never block the publisher, and only have to check that the slot did not change
+ * while they were reading it.
+ *
+ * Protocol: on connection, the publisher sends a single message of a __u32 ISP_PUBLISH_MAGIC with
+ * the memfd then the eventfd as SCM_RIGHTS. The client only has to keep the socket open.
+ */
+
+#define ISP_PUBLISH_MAGIC		0x42555049 /* "IPUB" */
+#define ISP_PUBLISH_VERSION		1
+#define ISP_PUBLISH_SLOT_NB		8
+#define ISP_PUBLISH_CLIENT_MAX		8
+
+/* Default socket of the stats publication */
+#define ISP_PUBLISH_SOCKET_DEFAULT	"/run/dcmipp-isp-stats.sock"
+
+/*
+ * @seq: even when the slot is stable, odd while it is being written
+ * @index: publication number of the frame
+ */
+struct isp_publish_slot {
+	__u32 seq;
+	__u32 sequence;
+	__u64 index;
+	__u64 timestamp;
+	__s32 exposure;
+	__s32 gain;
+	struct stm32_dcmipp_stat_buf buf;
+};
+
+/*
+ * @head: number of frames published, the last one being in the slot (head - 1) % slot_nb
+ */
+struct isp_publish_header {
+	__u32 magic;
+	__u32 version;
+	__u32 slot_nb;
+	__u32 slot_size;
+	__u64 slot_offset;
+	__u64 head;
+};
+
+/* Publisher side, run by the library while streaming */
+struct isp_publisher;
+
+int isp_publisher_create(const char *socket_path, int epoll_fd, struct isp_publisher **pub);
+void isp_publisher_destroy(struct isp_publisher *pub);
+bool isp_publisher_handle(struct isp_publisher *pub, int fd);
+void isp_publisher_write(struct isp_publisher *pub, __u32 sequence, __u64 timestamp, __s32 exposure, __s32 gain,
+			 const struct stm32_dcmipp_stat_buf *buf);
+
+/* Subscriber side */
+struct isp_subscriber;
+
+int isp_subscriber_open(const char *socket_path, struct isp_subscriber **sub);
+void isp_subscriber_close(struct isp_subscriber *sub);
+int isp_subscriber_fd(struct isp_subscriber *sub);
+int isp_subscriber_wait(struct isp_subscriber *sub, int timeout_ms);
+const struct isp_publish_slot *isp_subscriber_begin(struct isp_subscriber *sub, __u32 *seq);
+bool isp_subscriber_end(const struct isp_publish_slot *slot, __u32 seq);
+int isp_subscriber_read(struct isp_subscriber *sub, struct isp_stats *stats, __u64 *index);
+
+#endif
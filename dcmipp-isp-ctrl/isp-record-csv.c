@@ -0,0 +1,162 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (C) 2026 ST Microelectronics.
+ */
+
+/*
+ * Export a stats record file to CSV
+ *
+ * One line per recorded frame, from the oldest one still in the ring. The first columns follow the
+ * DCMIPP simulator log format (sequence, exposure, gain, then the pre / post averages and bins and
+ * the bad pixel count), so that a recording with these fields can be replayed with DCMIPP_SIM_TRACE.
+ * The capture time and the histograms come next.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "isp-record.h"
+
+static void print_header(const struct isp_record_header *header)
+{
+	static const char * const avg[] = { "r", "g", "b" };
+	const char *loc;
+	unsigned int i, l;
+
+	printf("sequence,exposure,gain");
+	for (l = 0; l < 2; l++) {
+		loc = l ? "post" : "pre";
+		if (header->fields & ISP_RECORD_AVERAGES)
+			for (i = 0; i < 3; i++)
+				printf(",%s_%s", loc, avg[i]);
+		if (header->fields & ISP_RECORD_BINS)
+			for (i = 0; i < 12; i++)
+				printf(",%s_bin%u", loc, i);
+	}
+	if (header->fields & ISP_RECORD_BAD_PIXELS)
+		printf(",bad_pixels");
+	printf(",timestamp_ns");
+	for (i = 0; i < header->histogram_nb; i++)
+		printf(",histo%u", i);
+	printf("\n");
+}
+
+static void print_frame(const struct isp_record_header *header, const struct isp_stats *stats)
+{
+	const struct stm32_dcmipp_stat_avr_bins *loc;
+	unsigned int i, l;
+
+	printf("%u,%d,%d", stats->sequence, stats->exposure, stats->gain);
+	for (l = 0; l < 2; l++) {
+		loc = l ? &stats->buf.post : &stats->buf.pre;
+		if (header->fields & ISP_RECORD_AVERAGES)
+			for (i = 0; i < 3; i++)
+				printf(",%u", loc->average_RGB[i]);
+		if (header->fields & ISP_RECORD_BINS)
+			for (i = 0; i < 12; i++)
+				printf(",%u", loc->bins[i]);
+	}
+	if (header->fields & ISP_RECORD_BAD_PIXELS)
+		printf(",%u", stats->buf.bad_pixel_count);
+	printf(",%" PRIu64, (uint64_t)stats->timestamp);
+	for (i = 0; i < header->histogram_nb; i++)
+		printf(",%u", stats->buf.histograms[i]);
+	printf("\n");
+}
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [options] FILE\n", prog);
+	printf("Export a stats record file to CSV on the standard output\n");
+	printf("-n, --last NB               Only export the last NB frames\n");
+	printf("-i, --info                  Print the record file information instead\n");
+	printf("-h, --help                  Display usage\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static struct option opts[] = {
+		{"last", required_argument, 0, 'n'},
+		{"info", no_argument, 0, 'i'},
+		{"help", no_argument, 0, 'h'},
+		{ },
+	};
+	const struct isp_record_header *header;
+	static struct isp_stats stats;
+	struct isp_record *record;
+	__u64 first, head, n, last = 0;
+	unsigned int lost = 0;
+	int ret, opt;
+	bool info = false;
+
+	while ((opt = getopt_long(argc, argv, "n:ih", opts, NULL)) != -1) {
+		switch (opt) {
+		case 'n':
+			last = strtoull(optarg, NULL, 0);
+			break;
+		case 'i':
+			info = true;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	ret = isp_record_open(argv[optind], &record);
+	if (ret)
+		return 1;
+
+	header = isp_record_header(record);
+	head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+	first = head > header->capacity ? head - header->capacity : 0;
+	if (last && head - first > last)
+		first = head - last;
+
+	if (info) {
+		printf("Fields:         %s%s%s%s\n",
+		       header->fields & ISP_RECORD_AVERAGES ? " averages" : "",
+		       header->fields & ISP_RECORD_BINS ? " bins" : "",
+		       header->fields & ISP_RECORD_BAD_PIXELS ? " bad_pixels" : "",
+		       header->fields & ISP_RECORD_HISTOGRAMS ? " histograms" : "");
+		printf("Histograms:      %u values\n", header->histogram_nb);
+		printf("Record size:     %u bytes\n", header->record_size);
+		printf("Capacity:        %u frames\n", header->capacity);
+		printf("Recorded:        %llu frames, %llu in the ring\n",
+		       (unsigned long long)head, (unsigned long long)(head - first));
+		isp_record_close(record);
+		return 0;
+	}
+
+	print_header(header);
+
+	/* The oldest records can be overwritten meanwhile if the file is still being recorded */
+	for (n = first; n < head; n++) {
+		ret = isp_record_read(record, n, &stats);
+		if (ret) {
+			lost++;
+			continue;
+		}
+		print_frame(header, &stats);
+	}
+
+	if (lost)
+		fprintf(stderr, "%u frames overwritten while being exported\n", lost);
+
+	isp_record_close(record);
+
+	return 0;
+}
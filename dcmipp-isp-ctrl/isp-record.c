@@ -0,0 +1,292 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (C) 2026 ST Microelectronics.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "isp-record.h"
+
+#define RECORD_ALIGN		8
+#define RECORD_DATA_OFFSET	64
+
+struct isp_record {
+	int fd;
+	bool writable;
+	void *map;
+	size_t size;
+	struct isp_record_header *header;
+};
+
+/*
+ * Size of a record with these fields
+ */
+static size_t record_size(unsigned int fields, unsigned int histogram_nb)
+{
+	size_t size = sizeof(struct isp_record_frame);
+
+	if (fields & ISP_RECORD_AVERAGES)
+		size += 6 * sizeof(__u32);
+	if (fields & ISP_RECORD_BINS)
+		size += 24 * sizeof(__u32);
+	if (fields & ISP_RECORD_BAD_PIXELS)
+		size += sizeof(__u32);
+	if (fields & ISP_RECORD_HISTOGRAMS)
+		size += histogram_nb * sizeof(__u16);
+
+	return (size + RECORD_ALIGN - 1) & ~(size_t)(RECORD_ALIGN - 1);
+}
+
+static struct isp_record_frame *record_slot(struct isp_record *record, __u64 n)
+{
+	const struct isp_record_header *header = record->header;
+
+	return (void *)((char *)record->map + header->data_offset + (n % header->capacity) * header->record_size);
+}
+
+/*
+ * Create a ring file of 'capacity' records, replacing any existing file
+ * The file blocks are allocated and the pages mapped up front, so that recording never waits for them.
+ */
+int isp_record_create(const char *path, unsigned int fields, unsigned int histogram_nb, unsigned int capacity,
+		      struct isp_record **record)
+{
+	struct isp_record *rec;
+	size_t size;
+	int ret;
+
+	if (!(fields & ISP_RECORD_HISTOGRAMS))
+		histogram_nb = 0;
+	if (!capacity || capacity > ISP_RECORD_CAPACITY_MAX || histogram_nb > STM32_DCMIPP_HISTO_BIN_MAX)
+		return -EINVAL;
+
+	rec = calloc(1, sizeof(*rec));
+	if (!rec)
+		return -ENOMEM;
+
+	size = RECORD_DATA_OFFSET + (size_t)capacity * record_size(fields, histogram_nb);
+
+	rec->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (rec->fd < 0) {
+		ret = -errno;
+		printf("Failed to create %s\n", path);
+		goto err;
+	}
+
+	ret = posix_fallocate(rec->fd, 0, size);
+	if (ret) {
+		ret = -ret;
+		printf("Failed to allocate %zu bytes for %s\n", size, path);
+		goto err_close;
+	}
+
+	rec->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, rec->fd, 0);
+	if (rec->map == MAP_FAILED) {
+		ret = -errno;
+		printf("Failed to map %s\n", path);
+		goto err_close;
+	}
+
+	rec->size = size;
+	rec->writable = true;
+	rec->header = rec->map;
+	rec->header->version = ISP_RECORD_VERSION;
+	rec->header->fields = fields;
+	rec->header->histogram_nb = histogram_nb;
+	rec->header->record_size = record_size(fields, histogram_nb);
+	rec->header->capacity = capacity;
+	rec->header->data_offset = RECORD_DATA_OFFSET;
+	rec->header->head = 0;
+	/* Valid file once the header is complete */
+	__atomic_store_n(&rec->header->magic, ISP_RECORD_MAGIC, __ATOMIC_RELEASE);
+
+	*record = rec;
+
+	return 0;
+
+err_close:
+	close(rec->fd);
+	unlink(path);
+err:
+	free(rec);
+	return ret;
+}
+
+/*
+ * Append the stats of a frame, overwriting the oldest record once the ring is full
+ */
+void isp_record_write(struct isp_record *record, const struct isp_stats *stats)
+{
+	struct isp_record_header *header = record->header;
+	__u64 n = header->head;
+	struct isp_record_frame *frame = record_slot(record, n);
+	char *p = (char *)(frame + 1);
+
+	/* Readers drop the record while it is being overwritten */
+	__atomic_store_n(&frame->index, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	frame->timestamp = stats->timestamp;
+	frame->sequence = stats->sequence;
+	frame->exposure = stats->exposure;
+	frame->gain = stats->gain;
+	frame->reserved = 0;
+
+	if (header->fields & ISP_RECORD_AVERAGES) {
+		memcpy(p, stats->buf.pre.average_RGB, sizeof(stats->buf.pre.average_RGB));
+		p += sizeof(stats->buf.pre.average_RGB);
+		memcpy(p, stats->buf.post.average_RGB, sizeof(stats->buf.post.average_RGB));
+		p += sizeof(stats->buf.post.average_RGB);
+	}
+	if (header->fields & ISP_RECORD_BINS) {
+		memcpy(p, stats->buf.pre.bins, sizeof(stats->buf.pre.bins));
+		p += sizeof(stats->buf.pre.bins);
+		memcpy(p, stats->buf.post.bins, sizeof(stats->buf.post.bins));
+		p += sizeof(stats->buf.post.bins);
+	}
+	if (header->fields & ISP_RECORD_BAD_PIXELS) {
+		memcpy(p, &stats->buf.bad_pixel_count, sizeof(stats->buf.bad_pixel_count));
+		p += sizeof(stats->buf.bad_pixel_count);
+	}
+	if (header->fields & ISP_RECORD_HISTOGRAMS)
+		memcpy(p, stats->buf.histograms, header->histogram_nb * sizeof(stats->buf.histograms[0]));
+
+	__atomic_store_n(&frame->index, n + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&header->head, n + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Map an existing ring file for reading, possibly while it is being recorded
+ */
+int isp_record_open(const char *path, struct isp_record **record)
+{
+	struct isp_record_header *header;
+	struct isp_record *rec;
+	struct stat st;
+	int ret;
+
+	rec = calloc(1, sizeof(*rec));
+	if (!rec)
+		return -ENOMEM;
+
+	rec->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (rec->fd < 0 || fstat(rec->fd, &st)) {
+		ret = -errno;
+		printf("Failed to open %s\n", path);
+		goto err;
+	}
+
+	if ((size_t)st.st_size < sizeof(*header)) {
+		ret = -EINVAL;
+		goto err_format;
+	}
+
+	rec->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, rec->fd, 0);
+	if (rec->map == MAP_FAILED) {
+		ret = -errno;
+		printf("Failed to map %s\n", path);
+		goto err;
+	}
+	rec->size = st.st_size;
+	rec->header = header = rec->map;
+
+	if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != ISP_RECORD_MAGIC ||
+	    header->version != ISP_RECORD_VERSION || !header->capacity ||
+	    header->record_size != record_size(header->fields, header->histogram_nb) ||
+	    header->histogram_nb > STM32_DCMIPP_HISTO_BIN_MAX ||
+	    header->data_offset + (__u64)header->capacity * header->record_size > rec->size) {
+		ret = -EINVAL;
+		munmap(rec->map, rec->size);
+		goto err_format;
+	}
+
+	*record = rec;
+
+	return 0;
+
+err_format:
+	printf("Invalid record file %s\n", path);
+err:
+	if (rec->fd >= 0)
+		close(rec->fd);
+	free(rec);
+	return ret;
+}
+
+const struct isp_record_header *isp_record_header(struct isp_record *record)
+{
+	return record->header;
+}
+
+/*
+ * Read the record n: the fields which are not recorded are cleared
+ * Return 0 on success, -ENOENT if it is not written yet, or -EAGAIN if it was overwritten meanwhile.
+ */
+int isp_record_read(struct isp_record *record, __u64 n, struct isp_stats *stats)
+{
+	const struct isp_record_header *header = record->header;
+	const struct isp_record_frame *frame;
+	__u64 head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+	const char *p;
+
+	if (n >= head)
+		return -ENOENT;
+	if (head - n > header->capacity)
+		return -EAGAIN;
+
+	frame = record_slot(record, n);
+	p = (const char *)(frame + 1);
+
+	if (__atomic_load_n(&frame->index, __ATOMIC_ACQUIRE) != n + 1)
+		return -EAGAIN;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->histo_id = ISP_HISTO_ID_NONE;
+	stats->timestamp = frame->timestamp;
+	stats->sequence = frame->sequence;
+	stats->exposure = frame->exposure;
+	stats->gain = frame->gain;
+
+	if (header->fields & ISP_RECORD_AVERAGES) {
+		memcpy(stats->buf.pre.average_RGB, p, sizeof(stats->buf.pre.average_RGB));
+		p += sizeof(stats->buf.pre.average_RGB);
+		memcpy(stats->buf.post.average_RGB, p, sizeof(stats->buf.post.average_RGB));
+		p += sizeof(stats->buf.post.average_RGB);
+	}
+	if (header->fields & ISP_RECORD_BINS) {
+		memcpy(stats->buf.pre.bins, p, sizeof(stats->buf.pre.bins));
+		p += sizeof(stats->buf.pre.bins);
+		memcpy(stats->buf.post.bins, p, sizeof(stats->buf.post.bins));
+		p += sizeof(stats->buf.post.bins);
+	}
+	if (header->fields & ISP_RECORD_BAD_PIXELS) {
+		memcpy(&stats->buf.bad_pixel_count, p, sizeof(stats->buf.bad_pixel_count));
+		p += sizeof(stats->buf.bad_pixel_count);
+	}
+	if (header->fields & ISP_RECORD_HISTOGRAMS)
+		memcpy(stats->buf.histograms, p, header->histogram_nb * sizeof(stats->buf.histograms[0]));
+
+	/* Overwritten while being copied */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&frame->index, __ATOMIC_RELAXED) != n + 1)
+		return -EAGAIN;
+
+	return 0;
+}
+
+void isp_record_close(struct isp_record *record)
+{
+	if (record->writable)
+		msync(record->map, record->size, MS_ASYNC);
+	munmap(record->map, record->size);
+	close(record->fd);
+	free(record);
+}
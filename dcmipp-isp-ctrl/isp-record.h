@@ -0,0 +1,78 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (C) 2026 ST Microelectronics.
+ */
+
+#ifndef ISP_RECORD_H
+#define ISP_RECORD_H
+
+#include <linux/types.h>
+
+#include "libdcmipp-isp.h"
+
+/*
+ * Stats recorder
+ *
+ * The stats of each frame are appended to a ring file of fixed size records, mapped in memory:
+ * recording a frame is a copy, without any system call, so that it never stalls the capture loop.
+ * Once full, the ring overwrites the oldest records. The file can be read while being recorded.
+ *
+ * File layout, in the native byte order:
+ *   struct isp_record_header, at offset 0
+ *   'capacity' records of 'record_size' bytes, from offset 'data_offset': record n is in the slot
+ *   n % capacity. A record is a struct isp_record_frame followed by the recorded fields, in the
+ *   order of their flags: pre then post averages (6 __u32), pre then post bins (24 __u32), bad
+ *   pixel count (__u32), 'histogram_nb' histogram values (__u16).
+ */
+
+#define ISP_RECORD_MAGIC		0x52505349 /* "ISPR" */
+#define ISP_RECORD_VERSION		1
+
+/* Recorded fields */
+#define ISP_RECORD_AVERAGES		(1 << 0)
+#define ISP_RECORD_BINS			(1 << 1)
+#define ISP_RECORD_BAD_PIXELS		(1 << 2)
+#define ISP_RECORD_HISTOGRAMS		(1 << 3)
+
+#define ISP_RECORD_CAPACITY_DEFAULT	1800 /* 1 minute at 30 fps */
+#define ISP_RECORD_CAPACITY_MAX		108000 /* 1 hour at 30 fps */
+
+/*
+ * @head: number of records written since the file creation
+ */
+struct isp_record_header {
+	__u32 magic;
+	__u32 version;
+	__u32 fields;
+	__u32 histogram_nb;
+	__u32 record_size;
+	__u32 capacity;
+	__u64 data_offset;
+	__u64 head;
+};
+
+/*
+ * @index: record number + 1, 0 while the record is being written
+ */
+struct isp_record_frame {
+	__u64 index;
+	__u64 timestamp;
+	__u32 sequence;
+	__s32 exposure;
+	__s32 gain;
+	__u32 reserved;
+};
+
+struct isp_record;
+
+int isp_record_create(const char *path, unsigned int fields, unsigned int histogram_nb, unsigned int capacity,
+		      struct isp_record **record);
+void isp_record_write(struct isp_record *record, const struct isp_stats *stats);
+
+int isp_record_open(const char *path, struct isp_record **record);
+const struct isp_record_header *isp_record_header(struct isp_record *record);
+int isp_record_read(struct isp_record *record, __u64 n, struct isp_stats *stats);
+
+void isp_record_close(struct isp_record *record);
+
+#endif
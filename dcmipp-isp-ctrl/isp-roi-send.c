@@ -0,0 +1,115 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (C) 2026 ST Microelectronics.
+ */
+
+/*
+ * ROI sender example
+ *
+ * Send regions of interest to the control loop of dcmipp-isp-ctrl -d --roi, once or periodically as
+ * a detector would do. The ROIs of a sender are removed with its connection: sent once, they are kept
+ * for their lifetime before exiting.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "isp-roi.h"
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [options] [LEFT,TOP,WIDTH,HEIGHT[,WEIGHT]]...\n", prog);
+	printf("Send the regions of interest to the control loop (at most %d, WEIGHT 1 to 65535, default 256)\n",
+	       ISP_ROI_MAX);
+	printf("-s, --socket SOCKET         Unix socket of the control loop (default %s)\n", ISP_ROI_SOCKET_DEFAULT);
+	printf("-t, --ttl MS                Lifetime of the ROIs (default %d ms)\n", ISP_ROI_TTL_DEFAULT_MS);
+	printf("-p, --period MS             Send the ROIs again every MS until interrupted\n");
+	printf("-h, --help                  Display usage\n");
+}
+
+static __u64 monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[])
+{
+	static struct option opts[] = {
+		{"socket", required_argument, 0, 's'},
+		{"ttl", required_argument, 0, 't'},
+		{"period", required_argument, 0, 'p'},
+		{"help", no_argument, 0, 'h'},
+		{ },
+	};
+	const char *socket_path = ISP_ROI_SOCKET_DEFAULT;
+	struct isp_roi rois[ISP_ROI_MAX] = { 0 };
+	unsigned int left, top, width, height, weight, ttl = 0, period = 0, nb = 0, i;
+	struct isp_roi_client *client;
+	int ret, opt, n;
+
+	while ((opt = getopt_long(argc, argv, "s:t:p:h", opts, NULL)) != -1) {
+		switch (opt) {
+		case 's':
+			socket_path = optarg;
+			break;
+		case 't':
+			ttl = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			period = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	for (; optind < argc; optind++) {
+		weight = 256;
+		n = sscanf(argv[optind], "%u,%u,%u,%u,%u", &left, &top, &width, &height, &weight);
+		if (nb == ISP_ROI_MAX || n < 4 || !width || !height || !weight || left > 0xffff || top > 0xffff ||
+		    width > 0xffff || height > 0xffff || weight > 0xffff) {
+			printf("Invalid ROI : %s\n", argv[optind]);
+			usage(argv[0]);
+			return 1;
+		}
+		rois[nb].left = left;
+		rois[nb].top = top;
+		rois[nb].width = width;
+		rois[nb].height = height;
+		rois[nb].weight = weight;
+		rois[nb].ttl_ms = ttl;
+		nb++;
+	}
+
+	ret = isp_roi_client_open(socket_path, &client);
+	if (ret)
+		return 1;
+
+	do {
+		for (i = 0; i < nb; i++)
+			rois[i].timestamp = monotonic_ns();
+		ret = isp_roi_client_send(client, rois, nb);
+		if (ret) {
+			fprintf(stderr, "Failed to send the ROIs: %s\n", strerror(-ret));
+			break;
+		}
+		usleep((period ? period : ttl ? ttl : ISP_ROI_TTL_DEFAULT_MS) * 1000);
+	} while (period);
+
+	isp_roi_client_close(client);
+
+	return ret ? 1 : 0;
+}
@@ -0,0 +1,283 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (C) 2026 ST Microelectronics.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "isp-roi.h"
+
+struct isp_roi_server {
+	char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	int epoll_fd;
+	int listen_fd;
+	__u64 generation;
+	struct {
+		int sock;
+		unsigned int roi_nb;
+		struct isp_roi roi[ISP_ROI_MAX];
+	} clients[ISP_ROI_CLIENT_MAX];
+	int client_nb;
+};
+
+struct isp_roi_client {
+	int sock;
+};
+
+static int unix_address(const char *path, struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path))
+		return -ENAMETOOLONG;
+	strcpy(addr->sun_path, path);
+
+	return 0;
+}
+
+/*
+ * Start listening for ROIs: the clients messages are handled in the event loop 'epoll_fd'
+ */
+int isp_roi_server_create(const char *socket_path, int epoll_fd, struct isp_roi_server **srv)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+	struct isp_roi_server *s;
+	struct sockaddr_un addr;
+	int ret;
+
+	ret = unix_address(socket_path, &addr);
+	if (ret) {
+		printf("Invalid socket path %s\n", socket_path);
+		return ret;
+	}
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return -ENOMEM;
+	s->epoll_fd = epoll_fd;
+
+	s->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (s->listen_fd < 0) {
+		ret = -errno;
+		goto err;
+	}
+
+	/* A socket left by a previous instance */
+	unlink(socket_path);
+	if (bind(s->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(s->listen_fd, ISP_ROI_CLIENT_MAX)) {
+		ret = -errno;
+		printf("Failed to listen on %s\n", socket_path);
+		goto err;
+	}
+	strcpy(s->path, socket_path);
+
+	ev.data.fd = s->listen_fd;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, s->listen_fd, &ev)) {
+		ret = -errno;
+		goto err;
+	}
+
+	*srv = s;
+
+	return 0;
+
+err:
+	isp_roi_server_destroy(s);
+	return ret;
+}
+
+/*
+ * Disconnect a client, its ROIs are removed
+ */
+static void server_drop_client(struct isp_roi_server *srv, int i)
+{
+	epoll_ctl(srv->epoll_fd, EPOLL_CTL_DEL, srv->clients[i].sock, NULL);
+	close(srv->clients[i].sock);
+	if (srv->clients[i].roi_nb)
+		srv->generation++;
+	srv->clients[i] = srv->clients[--srv->client_nb];
+}
+
+void isp_roi_server_destroy(struct isp_roi_server *srv)
+{
+	while (srv->client_nb)
+		server_drop_client(srv, srv->client_nb - 1);
+
+	if (srv->listen_fd >= 0) {
+		epoll_ctl(srv->epoll_fd, EPOLL_CTL_DEL, srv->listen_fd, NULL);
+		close(srv->listen_fd);
+	}
+	if (srv->path[0])
+		unlink(srv->path);
+	free(srv);
+}
+
+static void server_add_client(struct isp_roi_server *srv, int sock)
+{
+	struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP, .data.fd = sock };
+
+	if (srv->client_nb == ISP_ROI_CLIENT_MAX) {
+		printf("Too many ROI clients\n");
+		close(sock);
+		return;
+	}
+
+	if (epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, sock, &ev)) {
+		close(sock);
+		return;
+	}
+
+	srv->clients[srv->client_nb].sock = sock;
+	srv->clients[srv->client_nb].roi_nb = 0;
+	srv->client_nb++;
+}
+
+/*
+ * Read all the messages pending on a client socket, the last valid one giving its ROIs
+ * Return false if the client is gone.
+ */
+static bool server_read_client(struct isp_roi_server *srv, int i)
+{
+	struct isp_roi_msg msg;
+	unsigned int j;
+	ssize_t len;
+
+	while (1) {
+		len = recv(srv->clients[i].sock, &msg, sizeof(msg), MSG_DONTWAIT);
+		if (len < 0)
+			return errno == EAGAIN || errno == EINTR;
+		if (!len)
+			return false;
+
+		if (len < offsetof(struct isp_roi_msg, roi) || msg.magic != ISP_ROI_MAGIC ||
+		    msg.roi_nb > ISP_ROI_MAX || len != offsetof(struct isp_roi_msg, roi) + msg.roi_nb * sizeof(msg.roi[0])) {
+			printf("Invalid ROI message\n");
+			continue;
+		}
+
+		for (j = 0; j < msg.roi_nb; j++)
+			if (!msg.roi[j].ttl_ms)
+				msg.roi[j].ttl_ms = ISP_ROI_TTL_DEFAULT_MS;
+
+		memcpy(srv->clients[i].roi, msg.roi, msg.roi_nb * sizeof(msg.roi[0]));
+		srv->clients[i].roi_nb = msg.roi_nb;
+		srv->generation++;
+	}
+}
+
+/*
+ * Handle an event of the loop if it concerns the ROI server
+ * Return true if it did.
+ */
+bool isp_roi_server_handle(struct isp_roi_server *srv, int fd)
+{
+	int i, sock;
+
+	if (fd == srv->listen_fd) {
+		while ((sock = accept4(srv->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+			server_add_client(srv, sock);
+		return true;
+	}
+
+	for (i = 0; i < srv->client_nb; i++) {
+		if (srv->clients[i].sock == fd) {
+			if (!server_read_client(srv, i))
+				server_drop_client(srv, i);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Get the ROIs of all the clients still valid at the time 'now' (ns, CLOCK_MONOTONIC), in 'rois' of
+ * ISP_ROI_ACTIVE_MAX entries. 'generation' changes each time the ROIs received change.
+ * Return the number of ROIs.
+ */
+unsigned int isp_roi_server_get(struct isp_roi_server *srv, __u64 now, struct isp_roi *rois, __u64 *generation)
+{
+	const struct isp_roi *roi;
+	unsigned int nb = 0, j;
+	int i;
+
+	for (i = 0; i < srv->client_nb; i++) {
+		for (j = 0; j < srv->clients[i].roi_nb; j++) {
+			roi = &srv->clients[i].roi[j];
+			if (roi->timestamp + roi->ttl_ms * 1000000ULL >= now)
+				rois[nb++] = *roi;
+		}
+	}
+	*generation = srv->generation;
+
+	return nb;
+}
+
+/*
+ * Connect to the ROI input of a control loop
+ */
+int isp_roi_client_open(const char *socket_path, struct isp_roi_client **client)
+{
+	struct sockaddr_un addr;
+	struct isp_roi_client *c;
+	int ret;
+
+	ret = unix_address(socket_path, &addr);
+	if (ret)
+		return ret;
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return -ENOMEM;
+
+	c->sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (c->sock < 0 || connect(c->sock, (struct sockaddr *)&addr, sizeof(addr))) {
+		ret = -errno;
+		printf("Failed to connect to %s\n", socket_path);
+		if (c->sock >= 0)
+			close(c->sock);
+		free(c);
+		return ret;
+	}
+
+	*client = c;
+
+	return 0;
+}
+
+void isp_roi_client_close(struct isp_roi_client *client)
+{
+	close(client->sock);
+	free(client);
+}
+
+/*
+ * Replace the ROIs of this client, none to remove them
+ */
+int isp_roi_client_send(struct isp_roi_client *client, const struct isp_roi *rois, unsigned int nb)
+{
+	struct isp_roi_msg msg = {
+		.magic = ISP_ROI_MAGIC,
+		.roi_nb = nb,
+	};
+	size_t len = offsetof(struct isp_roi_msg, roi) + nb * sizeof(msg.roi[0]);
+
+	if (nb > ISP_ROI_MAX)
+		return -EINVAL;
+	memcpy(msg.roi, rois, nb * sizeof(msg.roi[0]));
+
+	if (send(client->sock, &msg, len, MSG_NOSIGNAL) != len)
+		return -errno;
+
+	return 0;
+}
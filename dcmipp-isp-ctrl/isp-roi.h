@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (C) 2026 ST Microelectronics.
+ */
+
+#ifndef ISP_ROI_H
+#define ISP_ROI_H
+
+#include <stdbool.h>
+#include <linux/types.h>
+
+/*
+ * Regions of interest given by other processes
+ *
+ * The process running the control loop listens on a Unix socket. Other processes (face or object
+ * detection for instance) connect to it and send their regions of interest, which the control loop
+ * weights in its AEC metering and AWB. Each message replaces all the ROIs of its sender. A ROI
+ * expires 'ttl_ms' after its timestamp: a sender which stops updating its ROIs does not leave them
+ * behind. The messages are read by the control loop without ever blocking it.
+ *
+ * Protocol: SOCK_SEQPACKET messages of a struct isp_roi_msg, truncated after its 'roi_nb' ROIs.
+ * Nothing is sent back.
+ */
+
+#define ISP_ROI_MAGIC			0x494f5249 /* "IROI" */
+#define ISP_ROI_MAX			8	/* ROIs of one message */
+#define ISP_ROI_CLIENT_MAX		4
+#define ISP_ROI_ACTIVE_MAX		(ISP_ROI_MAX * ISP_ROI_CLIENT_MAX)
+#define ISP_ROI_TTL_DEFAULT_MS		500
+
+/* Default socket of the ROI input */
+#define ISP_ROI_SOCKET_DEFAULT		"/run/dcmipp-isp-roi.sock"
+
+/*
+ * @left, @top, @width, @height: rectangle in the ISP frame (pixels, see isp_get_info())
+ * @weight: priority relatively to the other ROIs (Q8, 256 for 1.0)
+ * @ttl_ms: lifetime from 'timestamp', 0 for ISP_ROI_TTL_DEFAULT_MS
+ * @timestamp: time at which the ROI was found (ns, CLOCK_MONOTONIC)
+ */
+struct isp_roi {
+	__u16 left;
+	__u16 top;
+	__u16 width;
+	__u16 height;
+	__u16 weight;
+	__u16 reserved;
+	__u32 ttl_ms;
+	__u64 timestamp;
+};
+
+struct isp_roi_msg {
+	__u32 magic;
+	__u32 roi_nb;
+	struct isp_roi roi[ISP_ROI_MAX];
+};
+
+/* Server side, run by the library while streaming */
+struct isp_roi_server;
+
+int isp_roi_server_create(const char *socket_path, int epoll_fd, struct isp_roi_server **srv);
+void isp_roi_server_destroy(struct isp_roi_server *srv);
+bool isp_roi_server_handle(struct isp_roi_server *srv, int fd);
+unsigned int isp_roi_server_get(struct isp_roi_server *srv, __u64 now, struct isp_roi *rois, __u64 *generation);
+
+/* Client side */
+struct isp_roi_client;
+
+int isp_roi_client_open(const char *socket_path, struct isp_roi_client **client);
+void isp_roi_client_close(struct isp_roi_client *client);
+int isp_roi_client_send(struct isp_roi_client *client, const struct isp_roi *rois, unsigned int nb);
+
+#endif
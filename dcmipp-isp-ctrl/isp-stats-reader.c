@@ -0,0 +1,111 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (C) 2026 ST Microelectronics.
+ */
+
+/*
+ * Stats subscriber example
+ *
+ * Connect to the stats published by dcmipp-isp-ctrl --publish and print a CSV line per frame. The
+ * published slots are read in place: only the printed values are taken from the shared memory.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "isp-publish.h"
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [options] [SOCKET]\n", prog);
+	printf("Print the stats published on SOCKET (default %s)\n", ISP_PUBLISH_SOCKET_DEFAULT);
+	printf("-n, --frames NB             Stop after NB frames\n");
+	printf("-h, --help                  Display usage\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static struct option opts[] = {
+		{"frames", required_argument, 0, 'n'},
+		{"help", no_argument, 0, 'h'},
+		{ },
+	};
+	const char *socket_path = ISP_PUBLISH_SOCKET_DEFAULT;
+	const struct isp_publish_slot *slot;
+	struct isp_subscriber *sub;
+	unsigned long frames = 0, max = 0, missed = 0, retried = 0;
+	__u32 pre[3], post[3], seq, sequence, bad_pixels;
+	__s32 exposure, gain;
+	__u64 index, timestamp, last = 0;
+	int ret, opt;
+
+	while ((opt = getopt_long(argc, argv, "n:h", opts, NULL)) != -1) {
+		switch (opt) {
+		case 'n':
+			max = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (optind < argc)
+		socket_path = argv[optind];
+
+	ret = isp_subscriber_open(socket_path, &sub);
+	if (ret)
+		return 1;
+
+	printf("sequence,timestamp_ns,exposure,gain,pre_lum,post_lum,bad_pixels\n");
+
+	while (!max || frames < max) {
+		ret = isp_subscriber_wait(sub, -1);
+		if (ret < 0)
+			break;
+		if (!ret)
+			continue;
+
+		/* Copy the printed values only, and check that the slot did not change meanwhile */
+		slot = isp_subscriber_begin(sub, &seq);
+		if (!slot)
+			continue;
+		index = slot->index;
+		sequence = slot->sequence;
+		timestamp = slot->timestamp;
+		exposure = slot->exposure;
+		gain = slot->gain;
+		memcpy(pre, slot->buf.pre.average_RGB, sizeof(pre));
+		memcpy(post, slot->buf.post.average_RGB, sizeof(post));
+		bad_pixels = slot->buf.bad_pixel_count;
+		if (!isp_subscriber_end(slot, seq)) {
+			retried++;
+			continue;
+		}
+
+		/* Several notifications can be handled by a single read of the last frame */
+		if (frames && index <= last)
+			continue;
+		if (frames && index > last + 1)
+			missed += index - last - 1;
+		last = index;
+		frames++;
+
+		printf("%u,%" PRIu64 ",%d,%d,%d,%d,%u\n", sequence, (uint64_t)timestamp, exposure, gain,
+		       isp_luminance(pre), isp_luminance(post), bad_pixels);
+	}
+
+	if (ret == -EPIPE)
+		fprintf(stderr, "Publisher stopped\n");
+	fprintf(stderr, "%lu frames, %lu missed, %lu overwritten while read\n", frames, missed, retried);
+
+	isp_subscriber_close(sub);
+
+	return ret < 0 && ret != -EPIPE ? 1 : 0;
+}
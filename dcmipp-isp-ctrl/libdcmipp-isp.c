@@ -0,0 +1,4476 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (C) 2024 ST Microelectronics.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/media.h>
+#include "v4l2-controls.h"
+#include "videodev2.h"
+#include <linux/v4l2-subdev.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "stm32-dcmipp-config.h"
+#include "isp-histo.h"
+#include "isp-math.h"
+#include "isp-publish.h"
+#include "isp-roi.h"
+#include "libdcmipp-isp.h"
+#include "tuning.h"
+
+#define STR_MAX_LEN	32
+
+#define SENSOR_CTRL_MAX		8
+
+/*
+ * Shadow copy of the sensor controls
+ *
+ * The values are read once, then kept up to date from the values written and from the control
+ * events (changes made by other applications). Updates are staged and written all together.
+ */
+struct sensor_ctrls {
+	int fd;
+	int nb;
+	bool events;
+	struct {
+		__u32 id;
+		__s32 value;
+		__s32 staged;
+		bool dirty;
+	} ctrl[SENSOR_CTRL_MAX];
+};
+
+/*
+ * Sensor settings written while streaming, kept until the frame on which they are active
+ *
+ * @exposure, @gain: settings active on the last frame looked up
+ */
+#define SENSOR_HISTORY_MAX	(TUNING_AEC_LATENCY_MAX + 2)
+
+struct sensor_history {
+	struct {
+		__u32 sequence;
+		__s32 exposure;
+		__s32 gain;
+	} entry[SENSOR_HISTORY_MAX];
+	int nb;
+	__s32 exposure;
+	__s32 gain;
+};
+
+/*
+ * Histogram configurations sent while streaming, kept until the frame on which they are active
+ *
+ * @id: scheduler id of the configuration active on the last frame looked up (see isp_histo_sched_start())
+ */
+struct histo_history {
+	struct {
+		__u32 sequence;
+		__s32 id;
+	} entry[ISP_BUF_NB_MAX];
+	int nb;
+	__s32 id;
+};
+
+/*
+ * Stats profile while streaming: a profile set during the frame 'from - 1' is active from the frame
+ * 'from', the frame 'from - 1' only holding the parts of the stats common to both profiles
+ *
+ * @frames, @bytes, @bytes_full: counters of isp_counters
+ */
+struct stat_profile_history {
+	enum v4l2_isp_stat_profile profile;
+	enum v4l2_isp_stat_profile prev;
+	__u32 from;
+	unsigned int frames[V4L2_STAT_PROFILE_AVERAGE_POST + 1];
+	__u64 bytes;
+	__u64 bytes_full;
+};
+
+/* Parts of the stats filled by the ISP */
+#define STATS_PRE		0x1
+#define STATS_POST		0x2 /* with the bad pixel count */
+#define STATS_HISTO		0x4
+
+/* Params buffer without histogram configuration */
+#define HISTO_ID_UNCHANGED	(-2)
+
+/*
+ * Mirror of the configuration of the seven ISP blocks
+ *
+ * Updates are merged in 'staged', and the modules whose staged configuration differs from the one
+ * the ISP already has are flagged in 'dirty'. They are all sent in the next params buffer.
+ *
+ * @applied: configuration of the ISP, for the modules flagged in 'known'
+ * @hold: do not send the updates until they are committed
+ * @histo_id: scheduler id of the staged histogram configuration, ISP_HISTO_ID_NONE if not scheduled
+ */
+struct isp_state {
+	struct stm32_dcmipp_isp_ctrls_cfg applied;
+	struct stm32_dcmipp_isp_ctrls_cfg staged;
+	__u32 known;
+	__u32 dirty;
+	bool hold;
+	__s32 histo_id;
+};
+
+struct isp_descriptor {
+	char media_dev_name[STR_MAX_LEN];
+	char media_bus_info[STR_MAX_LEN + 1];
+	char media_serial[40 + 1];
+	char isp_subdev_name[STR_MAX_LEN];
+	char params_dev_name[STR_MAX_LEN];
+	char stat_dev_name[STR_MAX_LEN];
+	char sensor_subdev_name[STR_MAX_LEN];
+	char sensor_entity_name[64];
+	bool use_cache;
+	int isp_fd;
+	int params_fd;
+	int stat_fd;
+	int sensor_fd;
+	struct sensor_ctrls sensor_ctrls;
+	struct sensor_history sensor_history;
+	int epoll_fd;
+	bool frame_sync;
+	__u32 frame_sequence;
+	int width;
+	int height;
+	int fmt;
+	char fmt_str[STR_MAX_LEN];
+	int buf_nb;
+	struct stm32_dcmipp_stat_buf *stats[ISP_BUF_NB_MAX];
+	int stats_buf_nb;
+	size_t stats_buf_len;
+	__u32 stats_sequence;
+	unsigned int stats_frames;
+	unsigned int stats_dropped;
+	unsigned int stats_skipped;
+	struct stat_profile_history stat_profile;
+	struct stm32_dcmipp_params_cfg *params[ISP_BUF_NB_MAX];
+	bool params_queued[ISP_BUF_NB_MAX];
+	__s32 params_histo_id[ISP_BUF_NB_MAX];
+	struct histo_history histo_history;
+	int params_buf_nb;
+	size_t params_buf_len;
+	bool streaming;
+	struct isp_state state;
+	const struct sensor_tuning *tunings;
+	int tuning_nb;
+	const struct sensor_tuning *tuning;
+};
+
+/*
+ * Clamp a value within a range
+ */
+static int clamp(int val, int lo, int hi)
+{
+	if (val < lo)
+		return lo;
+	else if (val > hi)
+		return hi;
+	else
+		return val;
+}
+
+/*
+ * Check if a media device is the DCMIPP one and get its identification
+ */
+#define DCMIPP_DRV	"dcmipp"
+static int check_media(struct isp_descriptor *isp_desc, const char *media_dev_name)
+{
+	struct media_device_info info;
+	int ret, fd;
+
+	fd = open(media_dev_name, O_RDWR);
+	if (fd < 0)
+		return -errno;
+
+	ret = ioctl(fd, MEDIA_IOC_DEVICE_INFO, &info);
+	close(fd);
+
+	if (ret || strcmp(info.driver, DCMIPP_DRV))
+		return -ENXIO;
+
+	/* dcmipp found */
+	snprintf(isp_desc->media_dev_name, STR_MAX_LEN, "%s", media_dev_name);
+	memcpy(isp_desc->media_bus_info, info.bus_info, sizeof(info.bus_info));
+	isp_desc->media_bus_info[sizeof(info.bus_info)] = '\0';
+	memcpy(isp_desc->media_serial, info.serial, sizeof(info.serial));
+	isp_desc->media_serial[sizeof(info.serial)] = '\0';
+
+	return 0;
+}
+
+/*
+ * Search for the device file name of the DCMIPP media device
+ * Only the media devices registered in sysfs are checked, if sysfs is available.
+ */
+static int find_media(struct isp_descriptor *isp_desc)
+{
+	char media_dev_name[STR_MAX_LEN];
+	struct dirent *entry;
+	DIR *dir;
+	int i;
+
+	dir = opendir("/sys/bus/media/devices");
+	if (dir) {
+		while ((entry = readdir(dir))) {
+			if (strncmp(entry->d_name, "media", 5) || strlen(entry->d_name) > STR_MAX_LEN - 6)
+				continue;
+
+			strcpy(media_dev_name, "/dev/");
+			strcat(media_dev_name, entry->d_name);
+			if (!check_media(isp_desc, media_dev_name)) {
+				closedir(dir);
+				return 0;
+			}
+		}
+		closedir(dir);
+	} else {
+		for (i = 0; i < 255; i++) {
+			/* Search for the dcmipp media */
+			snprintf(media_dev_name, STR_MAX_LEN, "/dev/media%d", i);
+			if (!check_media(isp_desc, media_dev_name))
+				return 0;
+		}
+	}
+
+	printf("Can't find media device\n");
+	return -ENXIO;
+}
+
+/*
+ * Get the device file name of a char device from its major / minor
+ * The name is read from sysfs, or searched among the /dev/<prefix>N files if sysfs is not available.
+ */
+static int find_devnode(__u32 dev_major, __u32 dev_minor, const char *prefix, char *dev_name)
+{
+	struct stat devstat;
+	char path[64], line[64];
+	FILE *f;
+	int i;
+
+	snprintf(path, sizeof(path), "/sys/dev/char/%u:%u/uevent", dev_major, dev_minor);
+	f = fopen(path, "r");
+	if (f) {
+		while (fgets(line, sizeof(line), f)) {
+			if (strncmp(line, "DEVNAME=", 8))
+				continue;
+
+			line[strcspn(line, "\n")] = '\0';
+			fclose(f);
+			if (snprintf(dev_name, STR_MAX_LEN, "/dev/%s", line + 8) >= STR_MAX_LEN) {
+				printf("Device name too long: /dev/%s\n", line + 8);
+				dev_name[0] = '\0';
+				return -ENAMETOOLONG;
+			}
+			return 0;
+		}
+		fclose(f);
+	}
+
+	for (i = 0; i < 255; i++) {
+		/* check for a dev that matches the major/minor */
+		snprintf(dev_name, STR_MAX_LEN, "/dev/%s%d", prefix, i);
+		if (stat(dev_name, &devstat) < 0)
+			continue;
+
+		if ((major(devstat.st_rdev) == dev_major) &&
+		    (minor(devstat.st_rdev) == dev_minor)) {
+			/* found */
+			return 0;
+		}
+	}
+
+	dev_name[0] = '\0';
+	return -ENXIO;
+}
+
+#define DCMIPP_ISP_NAME			"dcmipp_main_isp"
+#define DCMIPP_ISP_PARAMS_NAME		"dcmipp_main_isp_params_output"
+#define DCMIPP_ISP_STAT_NAME		"dcmipp_main_isp_stat_capture"
+/*
+ * Search for the device file names of the ISP subdev, the params and stats video devices and the sensor subdev
+ *
+ * The whole media graph is read at once, then the interface links give the device node of each entity.
+ * The sensor is the first entity matching one of the sensor descriptors.
+ */
+static int find_entities(struct isp_descriptor *isp_desc)
+{
+	struct media_v2_topology topo;
+	struct media_v2_entity *ents = NULL, *ent;
+	struct media_v2_interface *intfs = NULL, *intf;
+	struct media_v2_link *links = NULL;
+	const struct sensor_tuning *tuning;
+	const char *prefix;
+	char *dev_name;
+	int fd, i, j, ret;
+
+	fd = open(isp_desc->media_dev_name, O_RDWR);
+	if (fd < 0)
+		return -errno;
+
+	/* Get the number of objects, then the objects */
+	memset(&topo, 0, sizeof(topo));
+	ret = ioctl(fd, MEDIA_IOC_G_TOPOLOGY, &topo);
+	if (ret) {
+		ret = -errno;
+		printf("Failed to get media topology\n");
+		goto out;
+	}
+
+	ents = calloc(topo.num_entities, sizeof(*ents));
+	intfs = calloc(topo.num_interfaces, sizeof(*intfs));
+	links = calloc(topo.num_links, sizeof(*links));
+	if (!ents || !intfs || !links) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	topo.ptr_entities = (uintptr_t)ents;
+	topo.ptr_interfaces = (uintptr_t)intfs;
+	topo.ptr_links = (uintptr_t)links;
+	ret = ioctl(fd, MEDIA_IOC_G_TOPOLOGY, &topo);
+	if (ret) {
+		ret = -errno;
+		printf("Failed to get media topology\n");
+		goto out;
+	}
+
+	isp_desc->isp_subdev_name[0] = '\0';
+	isp_desc->params_dev_name[0] = '\0';
+	isp_desc->stat_dev_name[0] = '\0';
+	isp_desc->sensor_subdev_name[0] = '\0';
+
+	for (i = 0; i < topo.num_links; i++) {
+		if ((links[i].flags & MEDIA_LNK_FL_LINK_TYPE) != MEDIA_LNK_FL_INTERFACE_LINK)
+			continue;
+
+		/* Interface link: from an interface (device node) to an entity */
+		for (j = 0, intf = NULL; j < topo.num_interfaces && !intf; j++)
+			if (intfs[j].id == links[i].source_id)
+				intf = &intfs[j];
+		for (j = 0, ent = NULL; j < topo.num_entities && !ent; j++)
+			if (ents[j].id == links[i].sink_id)
+				ent = &ents[j];
+		if (!intf || !ent)
+			continue;
+
+		tuning = NULL;
+		if (!strcmp(ent->name, DCMIPP_ISP_NAME)) {
+			dev_name = isp_desc->isp_subdev_name;
+			prefix = "v4l-subdev";
+		} else if (!strcmp(ent->name, DCMIPP_ISP_PARAMS_NAME)) {
+			dev_name = isp_desc->params_dev_name;
+			prefix = "video";
+		} else if (!strcmp(ent->name, DCMIPP_ISP_STAT_NAME)) {
+			dev_name = isp_desc->stat_dev_name;
+			prefix = "video";
+		} else {
+			for (j = 0; j < isp_desc->tuning_nb && !tuning; j++)
+				if (tuning_match(&isp_desc->tunings[j], ent->name))
+					tuning = &isp_desc->tunings[j];
+			if (!tuning || isp_desc->sensor_subdev_name[0])
+				continue;
+			dev_name = isp_desc->sensor_subdev_name;
+			prefix = "v4l-subdev";
+		}
+
+		ret = find_devnode(intf->devnode.major, intf->devnode.minor, prefix, dev_name);
+		if (ret == -ENAMETOOLONG)
+			goto out;
+		if (ret)
+			continue;
+
+		if (tuning) {
+			isp_desc->tuning = tuning;
+			snprintf(isp_desc->sensor_entity_name, sizeof(isp_desc->sensor_entity_name), "%s", ent->name);
+		}
+	}
+
+	ret = 0;
+	if (!isp_desc->isp_subdev_name[0]) {
+		printf("Can't find isp subdev\n");
+		ret = -ENXIO;
+	}
+	if (!isp_desc->params_dev_name[0] || !isp_desc->stat_dev_name[0]) {
+		printf("Can't find video device\n");
+		ret = -ENXIO;
+	}
+	if (!isp_desc->sensor_subdev_name[0]) {
+		printf("Can't find sensor subdev\n");
+		ret = -ENXIO;
+	}
+
+out:
+	free(ents);
+	free(intfs);
+	free(links);
+	close(fd);
+	return ret;
+}
+
+/*
+ * Discovery cache
+ *
+ * The device file names found by a full discovery are saved with the identification of the media
+ * device, and the device number and entity name of each node. They are reused as long as they all
+ * still match: the device numbers are given again to other entities when the probe order changes.
+ */
+#define DISCOVERY_CACHE_DIR	"/var/cache/dcmipp-isp-ctrl"
+#define DISCOVERY_CACHE_FILE	DISCOVERY_CACHE_DIR "/topology"
+
+/*
+ * Get the name of the entity of a char device, from sysfs
+ */
+static int devnode_entity(__u32 dev_major, __u32 dev_minor, char *name, size_t len)
+{
+	char path[64];
+	FILE *f;
+	int ret = 0;
+
+	snprintf(path, sizeof(path), "/sys/dev/char/%u:%u/name", dev_major, dev_minor);
+	f = fopen(path, "r");
+	if (!f)
+		return -errno;
+
+	if (fgets(name, len, f))
+		name[strcspn(name, "\n")] = '\0';
+	else
+		ret = -EIO;
+	fclose(f);
+
+	return ret;
+}
+
+static void save_cache_node(FILE *f, const char *key, const char *dev_name, const char *entity)
+{
+	struct stat devstat;
+
+	if (!stat(dev_name, &devstat))
+		fprintf(f, "%s=%s %u:%u %s\n", key, dev_name, major(devstat.st_rdev), minor(devstat.st_rdev), entity);
+}
+
+static void save_discovery_cache(struct isp_descriptor *isp_desc)
+{
+	FILE *f;
+
+	if (mkdir(DISCOVERY_CACHE_DIR, 0755) && errno != EEXIST)
+		return;
+
+	f = fopen(DISCOVERY_CACHE_FILE ".tmp", "w");
+	if (!f)
+		return;
+
+	fprintf(f, "media=%s\n", isp_desc->media_dev_name);
+	fprintf(f, "bus_info=%s\n", isp_desc->media_bus_info);
+	fprintf(f, "serial=%s\n", isp_desc->media_serial);
+	save_cache_node(f, "isp", isp_desc->isp_subdev_name, DCMIPP_ISP_NAME);
+	save_cache_node(f, "params", isp_desc->params_dev_name, DCMIPP_ISP_PARAMS_NAME);
+	save_cache_node(f, "stat", isp_desc->stat_dev_name, DCMIPP_ISP_STAT_NAME);
+	save_cache_node(f, "sensor", isp_desc->sensor_subdev_name, isp_desc->sensor_entity_name);
+
+	if (fclose(f) || rename(DISCOVERY_CACHE_FILE ".tmp", DISCOVERY_CACHE_FILE))
+		unlink(DISCOVERY_CACHE_FILE ".tmp");
+}
+
+/*
+ * Read a device file name from the cache and check that it is still the same device, of the same
+ * entity. The entity name is copied in 'entity' if not NULL, else it shall be 'expected'.
+ */
+static int load_cache_node(const char *value, char *dev_name, const char *expected, char *entity, size_t len)
+{
+	char name[STR_MAX_LEN], sysfs_entity[64];
+	unsigned int dev_major, dev_minor;
+	struct stat devstat;
+	int pos = 0;
+
+	if (sscanf(value, "%31s %u:%u %n", name, &dev_major, &dev_minor, &pos) != 3 || !pos)
+		return -EINVAL;
+	value += pos;
+
+	if (stat(name, &devstat) || major(devstat.st_rdev) != dev_major || minor(devstat.st_rdev) != dev_minor)
+		return -ENXIO;
+
+	if (devnode_entity(dev_major, dev_minor, sysfs_entity, sizeof(sysfs_entity)) || strcmp(sysfs_entity, value) ||
+	    (!entity && strcmp(value, expected)))
+		return -ENXIO;
+
+	if (entity)
+		snprintf(entity, len, "%s", value);
+	snprintf(dev_name, STR_MAX_LEN, "%s", name);
+
+	return 0;
+}
+
+static int load_discovery_cache(struct isp_descriptor *isp_desc)
+{
+	char line[128], media_dev_name[STR_MAX_LEN] = "", bus_info[sizeof(isp_desc->media_bus_info)] = "";
+	char serial[sizeof(isp_desc->media_serial)] = "";
+	char *value;
+	int i, ret = 0, nodes = 0;
+	FILE *f;
+
+	f = fopen(DISCOVERY_CACHE_FILE, "r");
+	if (!f)
+		return -ENOENT;
+
+	while (!ret && fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\n")] = '\0';
+		value = strchr(line, '=');
+		if (!value)
+			continue;
+		*value++ = '\0';
+
+		if (!strcmp(line, "media")) {
+			snprintf(media_dev_name, sizeof(media_dev_name), "%s", value);
+		} else if (!strcmp(line, "bus_info")) {
+			snprintf(bus_info, sizeof(bus_info), "%s", value);
+		} else if (!strcmp(line, "serial")) {
+			snprintf(serial, sizeof(serial), "%s", value);
+		} else {
+			if (!strcmp(line, "isp"))
+				ret = load_cache_node(value, isp_desc->isp_subdev_name, DCMIPP_ISP_NAME, NULL, 0);
+			else if (!strcmp(line, "params"))
+				ret = load_cache_node(value, isp_desc->params_dev_name, DCMIPP_ISP_PARAMS_NAME, NULL, 0);
+			else if (!strcmp(line, "stat"))
+				ret = load_cache_node(value, isp_desc->stat_dev_name, DCMIPP_ISP_STAT_NAME, NULL, 0);
+			else if (!strcmp(line, "sensor"))
+				ret = load_cache_node(value, isp_desc->sensor_subdev_name, NULL,
+						      isp_desc->sensor_entity_name,
+						      sizeof(isp_desc->sensor_entity_name));
+			else
+				continue;
+			nodes++;
+		}
+	}
+	fclose(f);
+
+	if (ret || nodes != 4)
+		return -ENXIO;
+
+	/* The media device shall still be the same */
+	ret = check_media(isp_desc, media_dev_name);
+	if (ret || strcmp(bus_info, isp_desc->media_bus_info) || strcmp(serial, isp_desc->media_serial))
+		return -ENXIO;
+
+	/* And its sensor shall still have a descriptor */
+	for (i = 0; i < isp_desc->tuning_nb; i++) {
+		if (tuning_match(&isp_desc->tunings[i], isp_desc->sensor_entity_name)) {
+			isp_desc->tuning = &isp_desc->tunings[i];
+			return 0;
+		}
+	}
+
+	return -ENXIO;
+}
+
+/*
+ * Open and initialize the stats capture video device
+ */
+static int open_stats_vdev(struct isp_descriptor *isp_desc)
+{
+	struct v4l2_requestbuffers req;
+	struct v4l2_capability cap;
+	struct v4l2_format fmt;
+	struct v4l2_buffer buf;
+	int i, ret;
+
+	isp_desc->stat_fd = open(isp_desc->stat_dev_name, O_RDWR | O_NONBLOCK);
+	if (isp_desc->stat_fd == -1) {
+		ret = -errno;
+		printf("Failed to open video device %s\n", isp_desc->stat_dev_name);
+		return ret;
+	}
+
+	ret = ioctl(isp_desc->stat_fd, VIDIOC_QUERYCAP, &cap);
+	if (ret) {
+		printf("Failed to query cap\n");
+		return ret;
+	}
+
+	if ((!(cap.capabilities & V4L2_CAP_META_CAPTURE)) || (!(cap.capabilities & V4L2_CAP_STREAMING))) {
+		printf("Incorrect capabilities (%x)\n", cap.capabilities);
+		return -ENXIO;
+	}
+
+	fmt.type = V4L2_BUF_TYPE_META_CAPTURE;
+	ret = ioctl(isp_desc->stat_fd, VIDIOC_G_FMT, &fmt);
+	if (ret) {
+		printf("Failed to get format\n");
+		return ret;
+	}
+
+	if (fmt.fmt.meta.dataformat != V4L2_META_FMT_ST_DCMIPP_ISP_STAT) {
+		printf("Invalid format (%x)\n", fmt.fmt.meta.dataformat);
+		return -ENXIO;
+	}
+
+	/* Get a ring of meta buffers */
+	req.count = isp_desc->buf_nb;
+	req.type = V4L2_BUF_TYPE_META_CAPTURE;
+	req.memory = V4L2_MEMORY_MMAP;
+	ret = ioctl(isp_desc->stat_fd, VIDIOC_REQBUFS, &req);
+	if (ret) {
+		printf("Failed to request buffers\n");
+		return ret;
+	}
+
+	if (req.count < 1 || req.count > ISP_BUF_NB_MAX) {
+		printf("Invalid number of buffers (%d)\n", req.count);
+		return -ENOMEM;
+	}
+
+	isp_desc->stats_buf_nb = req.count;
+
+	for (i = 0; i < req.count; i++) {
+		buf.type = V4L2_BUF_TYPE_META_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		buf.index = i;
+
+		ret = ioctl(isp_desc->stat_fd, VIDIOC_QUERYBUF, &buf);
+		if (ret) {
+			printf("Failed to query buffer %d\n", i);
+			return ret;
+		}
+		isp_desc->stats_buf_len = buf.length;
+
+		isp_desc->stats[i] = mmap(NULL, isp_desc->stats_buf_len, PROT_READ | PROT_WRITE, MAP_SHARED, isp_desc->stat_fd, buf.m.offset);
+		if (isp_desc->stats[i] == MAP_FAILED) {
+			printf("Failed to map buffer %d\n", i);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Close the stats video device
+ */
+static void close_stats_vdev(struct isp_descriptor *isp_desc)
+{
+	int i;
+
+	for (i = 0; i < isp_desc->stats_buf_nb; i++)
+		if (isp_desc->stats[i] && isp_desc->stats[i] != MAP_FAILED)
+			munmap(isp_desc->stats[i], isp_desc->stats_buf_len);
+
+	close(isp_desc->stat_fd);
+}
+
+/*
+ * Open and initialize the params video output device
+ */
+static int open_params_vdev(struct isp_descriptor *isp_desc)
+{
+	struct v4l2_requestbuffers req;
+	struct v4l2_capability cap;
+	struct v4l2_format fmt;
+	struct v4l2_buffer buf;
+	int i, ret;
+
+	isp_desc->params_fd = open(isp_desc->params_dev_name, O_RDWR | O_NONBLOCK);
+	if (isp_desc->params_fd == -1) {
+		ret = -errno;
+		printf("Failed to open video device %s\n", isp_desc->params_dev_name);
+		return ret;
+	}
+
+	ret = ioctl(isp_desc->params_fd, VIDIOC_QUERYCAP, &cap);
+	if (ret) {
+		printf("Failed to query cap\n");
+		return ret;
+	}
+
+	if ((!(cap.capabilities & V4L2_CAP_META_OUTPUT)) || (!(cap.capabilities & V4L2_CAP_STREAMING))) {
+		printf("Incorrect capabilities (%x)\n", cap.capabilities);
+		return -ENXIO;
+	}
+
+	fmt.type = V4L2_BUF_TYPE_META_OUTPUT;
+	ret = ioctl(isp_desc->params_fd, VIDIOC_G_FMT, &fmt);
+	if (ret) {
+		printf("Failed to get format\n");
+		return ret;
+	}
+
+	if (fmt.fmt.meta.dataformat != V4L2_META_FMT_ST_DCMIPP_ISP_PARAMS) {
+		printf("Invalid format (%x)\n", fmt.fmt.meta.dataformat);
+		return -ENXIO;
+	}
+
+	/* Get a ring of meta buffers */
+	req.count = isp_desc->buf_nb;
+	req.type = V4L2_BUF_TYPE_META_OUTPUT;
+	req.memory = V4L2_MEMORY_MMAP;
+	ret = ioctl(isp_desc->params_fd, VIDIOC_REQBUFS, &req);
+	if (ret) {
+		printf("Failed to request buffers\n");
+		return ret;
+	}
+
+	if (req.count < 1 || req.count > ISP_BUF_NB_MAX) {
+		printf("Invalid number of buffers (%d)\n", req.count);
+		return -ENOMEM;
+	}
+
+	isp_desc->params_buf_nb = req.count;
+
+	for (i = 0; i < req.count; i++) {
+		buf.type = V4L2_BUF_TYPE_META_OUTPUT;
+		buf.memory = V4L2_MEMORY_MMAP;
+		buf.index = i;
+
+		ret = ioctl(isp_desc->params_fd, VIDIOC_QUERYBUF, &buf);
+		if (ret) {
+			printf("Failed to query buffer %d\n", i);
+			return ret;
+		}
+		isp_desc->params_buf_len = buf.length;
+
+		isp_desc->params[i] = mmap(NULL, isp_desc->params_buf_len, PROT_READ | PROT_WRITE, MAP_SHARED, isp_desc->params_fd, buf.m.offset);
+		if (isp_desc->params[i] == MAP_FAILED) {
+			printf("Failed to map buffer %d\n", i);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+
+}
+
+/*
+ * Close the params video output device
+ */
+static void close_params_vdev(struct isp_descriptor *isp_desc)
+{
+	int i;
+
+	for (i = 0; i < isp_desc->params_buf_nb; i++)
+		if (isp_desc->params[i] && isp_desc->params[i] != MAP_FAILED)
+			munmap(isp_desc->params[i], isp_desc->params_buf_len);
+
+	close(isp_desc->params_fd);
+}
+
+static void to_fmt_str(char *fmt_str, int fmt)
+{
+	if (fmt >= MEDIA_BUS_FMT_SBGGR8_1X8 && fmt <= MEDIA_BUS_FMT_SRGGB16_1X16)
+		strncpy(fmt_str, "Raw Bayer", STR_MAX_LEN);
+	else if (fmt == MEDIA_BUS_FMT_RGB565_2X8_LE)
+		strncpy(fmt_str, "RGB565", STR_MAX_LEN);
+	else if (fmt == MEDIA_BUS_FMT_RGB888_1X24)
+		strncpy(fmt_str, "RGB888", STR_MAX_LEN);
+	else if (fmt == MEDIA_BUS_FMT_YUV8_1X24)
+		strncpy(fmt_str, "YUV 420", STR_MAX_LEN);
+	else if (fmt >= MEDIA_BUS_FMT_UYVY8_2X8 && fmt <= MEDIA_BUS_FMT_YVYU8_2X8)
+		strncpy(fmt_str, "YUV 422", STR_MAX_LEN);
+	else
+		snprintf(fmt_str, STR_MAX_LEN, "Format = 0x%x", fmt);
+}
+
+/*
+ * Read all the sensor controls at once
+ */
+static int sensor_ctrls_read(struct sensor_ctrls *ctrls)
+{
+	struct v4l2_ext_control ext[SENSOR_CTRL_MAX];
+	struct v4l2_ext_controls ext_ctrls;
+	int i, ret;
+
+	memset(ext, 0, sizeof(ext));
+	for (i = 0; i < ctrls->nb; i++)
+		ext[i].id = ctrls->ctrl[i].id;
+
+	memset(&ext_ctrls, 0, sizeof(ext_ctrls));
+	ext_ctrls.which = V4L2_CTRL_WHICH_CUR_VAL;
+	ext_ctrls.count = ctrls->nb;
+	ext_ctrls.controls = ext;
+
+	ret = ioctl(ctrls->fd, VIDIOC_G_EXT_CTRLS, &ext_ctrls);
+	if (ret) {
+		printf("VIDIOC_G_EXT_CTRLS failed (CID %x)\n", ext[ext_ctrls.error_idx < ctrls->nb ? ext_ctrls.error_idx : 0].id);
+		return ret;
+	}
+
+	for (i = 0; i < ctrls->nb; i++) {
+		ctrls->ctrl[i].value = ext[i].value;
+		ctrls->ctrl[i].dirty = false;
+	}
+
+	return 0;
+}
+
+static int sensor_ctrls_init(struct sensor_ctrls *ctrls, int fd, const __u32 *ids, int nb)
+{
+	int i;
+
+	memset(ctrls, 0, sizeof(*ctrls));
+	ctrls->fd = fd;
+	ctrls->nb = nb;
+	for (i = 0; i < nb; i++)
+		ctrls->ctrl[i].id = ids[i];
+
+	return sensor_ctrls_read(ctrls);
+}
+
+static int sensor_ctrl_find(struct sensor_ctrls *ctrls, __u32 id)
+{
+	int i;
+
+	for (i = 0; i < ctrls->nb; i++)
+		if (ctrls->ctrl[i].id == id)
+			return i;
+
+	return -1;
+}
+
+/*
+ * Get the value of a sensor control, as it will be once the staged updates are committed
+ */
+static __s32 sensor_ctrl_get(struct sensor_ctrls *ctrls, __u32 id)
+{
+	int i = sensor_ctrl_find(ctrls, id);
+
+	if (i < 0)
+		return 0;
+
+	return ctrls->ctrl[i].dirty ? ctrls->ctrl[i].staged : ctrls->ctrl[i].value;
+}
+
+/*
+ * Stage the update of a sensor control, which is dropped if the sensor already has this value
+ */
+static void sensor_ctrl_set(struct sensor_ctrls *ctrls, __u32 id, __s32 value)
+{
+	int i = sensor_ctrl_find(ctrls, id);
+
+	if (i < 0)
+		return;
+
+	ctrls->ctrl[i].staged = value;
+	ctrls->ctrl[i].dirty = value != ctrls->ctrl[i].value;
+}
+
+/*
+ * Take into account a sensor control changed by another application
+ */
+static void sensor_ctrl_changed(struct sensor_ctrls *ctrls, __u32 id, __s32 value)
+{
+	int i = sensor_ctrl_find(ctrls, id);
+
+	if (i < 0)
+		return;
+
+	ctrls->ctrl[i].value = value;
+	if (ctrls->ctrl[i].dirty)
+		ctrls->ctrl[i].dirty = ctrls->ctrl[i].staged != value;
+}
+
+/*
+ * Write all the staged updates with a single VIDIOC_S_EXT_CTRLS, so that they land on the same frame
+ * On failure, the shadow copy is read back from the sensor.
+ */
+static int sensor_ctrls_commit(struct sensor_ctrls *ctrls)
+{
+	struct v4l2_ext_control ext[SENSOR_CTRL_MAX];
+	struct v4l2_ext_controls ext_ctrls;
+	int i, nb = 0, ret;
+
+	memset(ext, 0, sizeof(ext));
+	for (i = 0; i < ctrls->nb; i++) {
+		if (!ctrls->ctrl[i].dirty)
+			continue;
+		ext[nb].id = ctrls->ctrl[i].id;
+		ext[nb].value = ctrls->ctrl[i].staged;
+		nb++;
+	}
+
+	if (!nb)
+		return 0;
+
+	memset(&ext_ctrls, 0, sizeof(ext_ctrls));
+	ext_ctrls.which = V4L2_CTRL_WHICH_CUR_VAL;
+	ext_ctrls.count = nb;
+	ext_ctrls.controls = ext;
+
+	ret = ioctl(ctrls->fd, VIDIOC_S_EXT_CTRLS, &ext_ctrls);
+	if (ret) {
+		printf("VIDIOC_S_EXT_CTRLS failed (CID %x)\n", ext[ext_ctrls.error_idx < nb ? ext_ctrls.error_idx : 0].id);
+		sensor_ctrls_read(ctrls);
+		return ret;
+	}
+
+	for (i = 0; i < ctrls->nb; i++) {
+		if (!ctrls->ctrl[i].dirty)
+			continue;
+		ctrls->ctrl[i].value = ctrls->ctrl[i].staged;
+		ctrls->ctrl[i].dirty = false;
+	}
+
+	return 0;
+}
+
+/*
+ * Restart the sensor settings history from the current settings
+ */
+static void sensor_history_reset(struct isp_descriptor *isp_desc)
+{
+	struct sensor_history *hist = &isp_desc->sensor_history;
+
+	hist->nb = 0;
+	hist->exposure = sensor_ctrl_get(&isp_desc->sensor_ctrls, V4L2_CID_EXPOSURE);
+	hist->gain = sensor_ctrl_get(&isp_desc->sensor_ctrls, V4L2_CID_ANALOGUE_GAIN);
+}
+
+/*
+ * Record the current sensor settings if they changed, written during the frame 'write_frame'
+ */
+static void sensor_history_push(struct isp_descriptor *isp_desc, __u32 write_frame)
+{
+	struct sensor_history *hist = &isp_desc->sensor_history;
+	__s32 exposure = sensor_ctrl_get(&isp_desc->sensor_ctrls, V4L2_CID_EXPOSURE);
+	__s32 gain = sensor_ctrl_get(&isp_desc->sensor_ctrls, V4L2_CID_ANALOGUE_GAIN);
+	int last = hist->nb - 1;
+
+	if (last >= 0 ? exposure == hist->entry[last].exposure && gain == hist->entry[last].gain :
+			exposure == hist->exposure && gain == hist->gain)
+		return;
+
+	if (hist->nb == SENSOR_HISTORY_MAX) {
+		hist->exposure = hist->entry[0].exposure;
+		hist->gain = hist->entry[0].gain;
+		memmove(&hist->entry[0], &hist->entry[1], --hist->nb * sizeof(hist->entry[0]));
+	}
+	hist->entry[hist->nb].sequence = write_frame + isp_desc->tuning->aec.latency;
+	hist->entry[hist->nb].exposure = exposure;
+	hist->entry[hist->nb].gain = gain;
+	hist->nb++;
+}
+
+/*
+ * Get the sensor settings active on the frame 'sequence', frames being looked up in order
+ */
+static void sensor_history_get(struct isp_descriptor *isp_desc, __u32 sequence, __s32 *exposure, __s32 *gain)
+{
+	struct sensor_history *hist = &isp_desc->sensor_history;
+
+	while (hist->nb && (__s32)(sequence - hist->entry[0].sequence) >= 0) {
+		hist->exposure = hist->entry[0].exposure;
+		hist->gain = hist->entry[0].gain;
+		memmove(&hist->entry[0], &hist->entry[1], --hist->nb * sizeof(hist->entry[0]));
+	}
+
+	*exposure = hist->exposure;
+	*gain = hist->gain;
+}
+
+/*
+ * First frame on which a sensor update written now can be latched
+ * Without frame sync events, the frame following the last stats is assumed to be in progress.
+ */
+static __u32 write_frame(struct isp_descriptor *isp_desc)
+{
+	__u32 frame = isp_desc->stats_sequence + 1;
+
+	if (isp_desc->frame_sync && (__s32)(isp_desc->frame_sequence - frame) > 0)
+		frame = isp_desc->frame_sequence;
+
+	return frame;
+}
+
+/*
+ * Restart the stats profile history and counters from the current profile
+ */
+static void stat_profile_reset(struct isp_descriptor *isp_desc)
+{
+	struct stat_profile_history *hist = &isp_desc->stat_profile;
+
+	hist->prev = hist->profile;
+	memset(hist->frames, 0, sizeof(hist->frames));
+	hist->bytes = 0;
+	hist->bytes_full = 0;
+}
+
+static unsigned int stat_profile_parts(enum v4l2_isp_stat_profile profile)
+{
+	switch (profile) {
+	case V4L2_STAT_PROFILE_AVERAGE_PRE:
+		return STATS_PRE;
+	case V4L2_STAT_PROFILE_AVERAGE_POST:
+		return STATS_POST;
+	default:
+		return STATS_PRE | STATS_POST | STATS_HISTO;
+	}
+}
+
+/*
+ * Parts of the stats filled on the frame 'sequence'
+ */
+static unsigned int stat_profile_get(const struct isp_descriptor *isp_desc, __u32 sequence)
+{
+	const struct stat_profile_history *hist = &isp_desc->stat_profile;
+
+	if ((__s32)(sequence - hist->from) >= 0)
+		return stat_profile_parts(hist->profile);
+	if ((__s32)(sequence - hist->from) == -1)
+		return stat_profile_parts(hist->profile) & stat_profile_parts(hist->prev);
+
+	return stat_profile_parts(hist->prev);
+}
+
+/*
+ * Bytes of stats written by the ISP for a frame of each profile
+ */
+static size_t stat_profile_bytes(const struct isp_descriptor *isp_desc, enum v4l2_isp_stat_profile profile)
+{
+	const struct stm32_dcmipp_isp_histo_cfg *cfg = &isp_desc->state.applied.histo_cfg;
+	size_t histo = 0;
+
+	if ((isp_desc->state.known & STM32_DCMIPP_ISP_HISTO) && cfg->hreg && cfg->vreg)
+		histo = isp_histo_nb(cfg) * isp_histo_bin_nb(cfg) * sizeof(__u16);
+
+	switch (profile) {
+	case V4L2_STAT_PROFILE_AVERAGE_PRE:
+		return sizeof(struct stm32_dcmipp_stat_avr_bins);
+	case V4L2_STAT_PROFILE_AVERAGE_POST:
+		return sizeof(struct stm32_dcmipp_stat_avr_bins) + sizeof(__u32);
+	default:
+		return offsetof(struct stm32_dcmipp_stat_buf, histograms) + histo;
+	}
+}
+
+/*
+ * Count a stats buffer filled by the ISP, a frame on a profile change counting for the previous profile
+ */
+static void stat_profile_account(struct isp_descriptor *isp_desc, __u32 sequence)
+{
+	struct stat_profile_history *hist = &isp_desc->stat_profile;
+	enum v4l2_isp_stat_profile profile = (__s32)(sequence - hist->from) >= 0 ? hist->profile : hist->prev;
+
+	hist->frames[profile]++;
+	hist->bytes += stat_profile_bytes(isp_desc, profile);
+	hist->bytes_full += stat_profile_bytes(isp_desc, V4L2_STAT_PROFILE_FULL);
+}
+
+static void histo_history_reset(struct isp_descriptor *isp_desc)
+{
+	isp_desc->histo_history.nb = 0;
+	isp_desc->histo_history.id = ISP_HISTO_ID_NONE;
+}
+
+/*
+ * Record the histogram configuration 'id', active from the frame 'sequence'
+ */
+static void histo_history_push(struct isp_descriptor *isp_desc, __u32 sequence, __s32 id)
+{
+	struct histo_history *hist = &isp_desc->histo_history;
+
+	if (hist->nb == ISP_BUF_NB_MAX) {
+		hist->id = hist->entry[0].id;
+		memmove(&hist->entry[0], &hist->entry[1], --hist->nb * sizeof(hist->entry[0]));
+	}
+	hist->entry[hist->nb].sequence = sequence;
+	hist->entry[hist->nb].id = id;
+	hist->nb++;
+}
+
+/*
+ * Get the histogram configuration active on the frame 'sequence', frames being looked up in order
+ */
+static __s32 histo_history_get(struct isp_descriptor *isp_desc, __u32 sequence)
+{
+	struct histo_history *hist = &isp_desc->histo_history;
+
+	while (hist->nb && (__s32)(sequence - hist->entry[0].sequence) >= 0) {
+		hist->id = hist->entry[0].id;
+		memmove(&hist->entry[0], &hist->entry[1], --hist->nb * sizeof(hist->entry[0]));
+	}
+
+	return hist->id;
+}
+
+/*
+ * Subscribe to the events of a subdev, and watch it if at least one subscription succeeds
+ * Not all drivers support these events: the others are just not used.
+ * 'ctrl_events' is set if all the control events could be subscribed.
+ */
+static int subscribe_subdev_events(struct isp_descriptor *isp_desc, int fd, const __u32 *ctrls, int ctrl_nb,
+				   bool *ctrl_events)
+{
+	struct v4l2_event_subscription sub;
+	struct epoll_event ev;
+	bool subscribed = false;
+	int i, ctrl_subscribed = 0;
+
+	memset(&sub, 0, sizeof(sub));
+	sub.type = V4L2_EVENT_FRAME_SYNC;
+	if (!ioctl(fd, VIDIOC_SUBSCRIBE_EVENT, &sub)) {
+		isp_desc->frame_sync = true;
+		subscribed = true;
+	}
+
+	for (i = 0; i < ctrl_nb; i++) {
+		memset(&sub, 0, sizeof(sub));
+		sub.type = V4L2_EVENT_CTRL;
+		sub.id = ctrls[i];
+		if (!ioctl(fd, VIDIOC_SUBSCRIBE_EVENT, &sub)) {
+			subscribed = true;
+			ctrl_subscribed++;
+		}
+	}
+
+	if (ctrl_events)
+		*ctrl_events = ctrl_nb && ctrl_subscribed == ctrl_nb;
+
+	if (!subscribed)
+		return 0;
+
+	ev.events = EPOLLPRI;
+	ev.data.fd = fd;
+	if (epoll_ctl(isp_desc->epoll_fd, EPOLL_CTL_ADD, fd, &ev)) {
+		printf("Failed to watch events\n");
+		return -errno;
+	}
+
+	return 0;
+}
+
+/*
+ * Open the sensor subdev and set up the event loop
+ *
+ * The stats and params devices are only watched while streaming. The frame sync events give the
+ * frame in progress, and the control events the sensor settings changed by other applications.
+ */
+static int open_events(struct isp_descriptor *isp_desc)
+{
+	static const __u32 sensor_ctrls[] = { V4L2_CID_EXPOSURE, V4L2_CID_ANALOGUE_GAIN };
+	int ret;
+
+	isp_desc->sensor_fd = open(isp_desc->sensor_subdev_name, O_RDWR);
+	if (isp_desc->sensor_fd == -1) {
+		ret = -errno;
+		printf("Failed to open sensor subdev %s\n", isp_desc->sensor_subdev_name);
+		return ret;
+	}
+
+	isp_desc->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (isp_desc->epoll_fd == -1) {
+		ret = -errno;
+		printf("Failed to create the event loop\n");
+		return ret;
+	}
+
+	ret = sensor_ctrls_init(&isp_desc->sensor_ctrls, isp_desc->sensor_fd, sensor_ctrls, 2);
+	if (ret) {
+		printf("Failed to get sensor controls\n");
+		return ret;
+	}
+
+	ret = subscribe_subdev_events(isp_desc, isp_desc->sensor_fd, sensor_ctrls, 2, &isp_desc->sensor_ctrls.events);
+	if (ret)
+		return ret;
+
+	return subscribe_subdev_events(isp_desc, isp_desc->isp_fd, NULL, 0, NULL);
+}
+
+/*
+ * Search, open and initialize all DCMIPP devices
+ */
+static int discover_dcmipp(struct isp_descriptor *isp_desc)
+{
+	struct v4l2_subdev_selection sel;
+	struct v4l2_subdev_format fmt;
+	int ret;
+
+	if (!isp_desc->use_cache || load_discovery_cache(isp_desc)) {
+		/* find dcmipp media dev */
+		ret = find_media(isp_desc);
+		if (ret)
+			return ret;
+
+		/* find isp sub dev, params and stat video devs, sensor sub dev */
+		ret = find_entities(isp_desc);
+		if (ret)
+			return ret;
+
+		if (isp_desc->use_cache)
+			save_discovery_cache(isp_desc);
+	}
+
+	/* Get input frame params */
+	isp_desc->isp_fd = open(isp_desc->isp_subdev_name, O_RDWR);
+	if (isp_desc->isp_fd == -1) {
+		ret = -errno;
+		printf("Failed to open isp subdev %s\n", isp_desc->isp_subdev_name);
+		return ret;
+	}
+
+	fmt.which = V4L2_SUBDEV_FORMAT_ACTIVE;
+	fmt.pad = 0;
+	ret = ioctl(isp_desc->isp_fd, VIDIOC_SUBDEV_G_FMT, &fmt);
+	if (ret) {
+		printf("Failed to get format\n");
+		return ret;
+	}
+	isp_desc->fmt = fmt.format.code;
+	to_fmt_str(isp_desc->fmt_str, isp_desc->fmt);
+
+	sel.which = V4L2_SUBDEV_FORMAT_ACTIVE;
+	sel.pad = 0;
+	sel.target = V4L2_SEL_TGT_COMPOSE;
+	ret = ioctl(isp_desc->isp_fd, VIDIOC_SUBDEV_G_SELECTION, &sel);
+	if (ret) {
+		printf("Failed to get selection\n");
+		return ret;
+	}
+	isp_desc->width = sel.r.width;
+	isp_desc->height = sel.r.height;
+
+	ret = open_params_vdev(isp_desc);
+	if (ret)
+		return ret;
+
+	ret = open_stats_vdev(isp_desc);
+	if (ret)
+		return ret;
+
+	return open_events(isp_desc);
+}
+
+/*
+ * Close all DCMIPP devices which have been opened
+ */
+static void close_dcmipp(struct isp_descriptor *isp_desc)
+{
+	if (isp_desc->epoll_fd != -1)
+		close(isp_desc->epoll_fd);
+
+	if (isp_desc->sensor_fd != -1)
+		close(isp_desc->sensor_fd);
+
+	if (isp_desc->params_fd != -1)
+		close_params_vdev(isp_desc);
+
+	if (isp_desc->stat_fd != -1)
+		close_stats_vdev(isp_desc);
+
+	if (isp_desc->isp_fd != -1)
+		close(isp_desc->isp_fd);
+}
+
+/*
+ * Helpers to access V4L2 controls
+ */
+static int set_ext_ctrl(int fd, struct v4l2_ext_controls *extCtrls)
+{
+	int ret;
+
+	ret = ioctl(fd, VIDIOC_S_EXT_CTRLS, extCtrls);
+	if (ret)
+		printf("VIDIOC_S_EXT_CTRLS setting failed (CID %x)\n", extCtrls->controls->id);
+
+	return ret;
+}
+
+static int set_ext_ctrl_int(int fd, unsigned int class, int v4l2_cid, int value)
+{
+	struct v4l2_ext_controls extCtrls;
+	struct v4l2_ext_control extCtrl;
+
+	memset(&extCtrl, 0, sizeof(struct v4l2_ext_control));
+	extCtrl.id = v4l2_cid;
+	extCtrl.value = value;
+
+	extCtrls.controls = &extCtrl;
+	extCtrls.count = 1;
+	extCtrls.ctrl_class = class;
+
+	return set_ext_ctrl(fd, &extCtrls);
+}
+
+/*
+ * Start streaming on both the stats capture and the params output devices.
+ * All the stats buffers are queued so that the ISP can fill them frame after frame.
+ */
+static int start_streaming(struct isp_descriptor *isp_desc)
+{
+	enum v4l2_buf_type type;
+	struct epoll_event ev;
+	struct v4l2_buffer buf;
+	int i, ret;
+
+	/* Queue buff */
+	for (i = 0; i < isp_desc->stats_buf_nb; i++) {
+		memset(&buf, 0, sizeof(buf));
+		buf.type = V4L2_BUF_TYPE_META_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		buf.index = i;
+
+		ret = ioctl(isp_desc->stat_fd, VIDIOC_QBUF, &buf);
+		if (ret) {
+			printf("Failed to queue buffer %d\n", i);
+			return ret;
+		}
+	}
+
+	/* Start streams */
+	type = V4L2_BUF_TYPE_META_CAPTURE;
+	ret = ioctl(isp_desc->stat_fd, VIDIOC_STREAMON, &type);
+	if (ret) {
+		printf("Failed to start stat stream\n");
+		return ret;
+	}
+
+	type = V4L2_BUF_TYPE_META_OUTPUT;
+	ret = ioctl(isp_desc->params_fd, VIDIOC_STREAMON, &type);
+	if (ret) {
+		printf("Failed to start params stream\n");
+		type = V4L2_BUF_TYPE_META_CAPTURE;
+		ioctl(isp_desc->stat_fd, VIDIOC_STREAMOFF, &type);
+		return ret;
+	}
+
+	/* Watch the filled stats buffers and the consumed params buffers */
+	ev.events = EPOLLIN;
+	ev.data.fd = isp_desc->stat_fd;
+	ret = epoll_ctl(isp_desc->epoll_fd, EPOLL_CTL_ADD, isp_desc->stat_fd, &ev);
+	if (!ret) {
+		ev.events = EPOLLOUT;
+		ev.data.fd = isp_desc->params_fd;
+		ret = epoll_ctl(isp_desc->epoll_fd, EPOLL_CTL_ADD, isp_desc->params_fd, &ev);
+	}
+	if (ret) {
+		ret = -errno;
+		printf("Failed to watch the stats and params devices\n");
+		epoll_ctl(isp_desc->epoll_fd, EPOLL_CTL_DEL, isp_desc->stat_fd, NULL);
+		type = V4L2_BUF_TYPE_META_OUTPUT;
+		ioctl(isp_desc->params_fd, VIDIOC_STREAMOFF, &type);
+		type = V4L2_BUF_TYPE_META_CAPTURE;
+		ioctl(isp_desc->stat_fd, VIDIOC_STREAMOFF, &type);
+		return ret;
+	}
+
+	isp_desc->streaming = true;
+	isp_desc->stats_frames = 0;
+	sensor_history_reset(isp_desc);
+	histo_history_reset(isp_desc);
+	isp_desc->stats_dropped = 0;
+	isp_desc->stats_skipped = 0;
+	stat_profile_reset(isp_desc);
+	memset(isp_desc->params_queued, 0, sizeof(isp_desc->params_queued));
+
+	return 0;
+}
+
+/*
+ * Stop streaming on both the stats capture and the params output devices.
+ * STREAMOFF returns all the queued buffers to userspace.
+ */
+static void stop_streaming(struct isp_descriptor *isp_desc)
+{
+	enum v4l2_buf_type type;
+
+	if (!isp_desc->streaming)
+		return;
+
+	/* Not streaming, these devices would be reported in error */
+	epoll_ctl(isp_desc->epoll_fd, EPOLL_CTL_DEL, isp_desc->stat_fd, NULL);
+	epoll_ctl(isp_desc->epoll_fd, EPOLL_CTL_DEL, isp_desc->params_fd, NULL);
+
+	type = V4L2_BUF_TYPE_META_OUTPUT;
+	if (ioctl(isp_desc->params_fd, VIDIOC_STREAMOFF, &type))
+		printf("Failed to stop params stream\n");
+
+	type = V4L2_BUF_TYPE_META_CAPTURE;
+	if (ioctl(isp_desc->stat_fd, VIDIOC_STREAMOFF, &type))
+		printf("Failed to stop stat stream\n");
+
+	isp_desc->streaming = false;
+	memset(isp_desc->params_queued, 0, sizeof(isp_desc->params_queued));
+}
+
+/*
+ * Capture time of a buffer, in ns
+ */
+static __u64 buf_timestamp(const struct v4l2_buffer *buf)
+{
+	return buf->timestamp.tv_sec * 1000000000ULL + buf->timestamp.tv_usec * 1000ULL;
+}
+
+/*
+ * Wait until a device is ready for reading (capture) or writing (output).
+ * Return 1 if ready, 0 on timeout, or a negative error (-EINTR if interrupted by a signal).
+ */
+static int wait_fd(int fd, bool output, int timeout_ms)
+{
+	struct timeval tv;
+	fd_set fds;
+	int ret;
+
+	FD_ZERO(&fds);
+	FD_SET(fd, &fds);
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+	ret = select(fd + 1, output ? NULL : &fds, output ? &fds : NULL, NULL, &tv);
+	if (ret < 0)
+		return -errno;
+
+	return ret ? 1 : 0;
+}
+
+/*
+ * Dequeue a stats buffer without waiting and keep track of the sequence
+ * Return -EAGAIN if no buffer is ready.
+ */
+static int dequeue_stat_buf(struct isp_descriptor *isp_desc, struct v4l2_buffer *buf)
+{
+	int ret;
+
+	memset(buf, 0, sizeof(*buf));
+	buf->type = V4L2_BUF_TYPE_META_CAPTURE;
+	buf->memory = V4L2_MEMORY_MMAP;
+	ret = ioctl(isp_desc->stat_fd, VIDIOC_DQBUF, buf);
+	if (ret) {
+		ret = -errno;
+		if (ret != -EAGAIN)
+			printf("Failed to dequeue buffer\n");
+		return ret;
+	}
+
+	/* A gap in the sequence means that the ISP had no buffer to fill */
+	if (isp_desc->stats_frames && buf->sequence > isp_desc->stats_sequence + 1)
+		isp_desc->stats_dropped += buf->sequence - isp_desc->stats_sequence - 1;
+	isp_desc->stats_sequence = buf->sequence;
+	isp_desc->stats_frames++;
+	stat_profile_account(isp_desc, buf->sequence);
+
+	return 0;
+}
+
+/*
+ * Give a stats buffer back to the ISP once it has been processed
+ */
+static int queue_stat(struct isp_descriptor *isp_desc, struct v4l2_buffer *buf)
+{
+	int ret;
+
+	ret = ioctl(isp_desc->stat_fd, VIDIOC_QBUF, buf);
+	if (ret)
+		printf("Failed to queue buffer %d\n", buf->index);
+
+	return ret;
+}
+
+/*
+ * Dequeue the next stats buffer while streaming, without waiting.
+ * If several buffers are already filled, older ones are given back to the ISP right away
+ * and only the most recent one is returned, so that the control loop works on fresh data.
+ * Return -EAGAIN if no buffer is ready.
+ */
+static int dequeue_stat(struct isp_descriptor *isp_desc, struct v4l2_buffer *buf)
+{
+	struct v4l2_buffer next;
+	int ret;
+
+	ret = dequeue_stat_buf(isp_desc, buf);
+	if (ret)
+		return ret;
+
+	/* Catch up with the most recent buff */
+	while (1) {
+		ret = dequeue_stat_buf(isp_desc, &next);
+		if (ret)
+			break;
+
+		ret = queue_stat(isp_desc, buf);
+		if (ret) {
+			queue_stat(isp_desc, &next);
+			return ret;
+		}
+
+		*buf = next;
+		isp_desc->stats_skipped++;
+	}
+
+	return 0;
+}
+
+/*
+ * Get back the params buffers already consumed by the ISP.
+ * If wait is set and all buffers are still in use, wait for the oldest one to be released.
+ */
+static int reclaim_params(struct isp_descriptor *isp_desc, bool wait)
+{
+	struct v4l2_buffer buf;
+	int i, ret, queued = 0;
+
+	for (i = 0; i < isp_desc->params_buf_nb; i++)
+		queued += isp_desc->params_queued[i];
+
+	while (queued) {
+		ret = wait_fd(isp_desc->params_fd, true, wait && queued == isp_desc->params_buf_nb ? 2000 : 0);
+		if (ret < 0) {
+			printf("Select failed (%d)\n", ret);
+			return ret;
+		}
+		if (ret == 0) {
+			if (queued < isp_desc->params_buf_nb || !wait)
+				break;
+			printf("Select timeout\n");
+			return -EBUSY;
+		}
+
+		memset(&buf, 0, sizeof(buf));
+		buf.type = V4L2_BUF_TYPE_META_OUTPUT;
+		buf.memory = V4L2_MEMORY_MMAP;
+		ret = ioctl(isp_desc->params_fd, VIDIOC_DQBUF, &buf);
+		if (ret) {
+			printf("Failed to dequeue buffer\n");
+			return ret;
+		}
+
+		isp_desc->params_queued[buf.index] = false;
+		queued--;
+
+		/* The buffer sequence is the frame from which its params are active */
+		if (isp_desc->params_histo_id[buf.index] != HISTO_ID_UNCHANGED)
+			histo_history_push(isp_desc, buf.sequence, isp_desc->params_histo_id[buf.index]);
+	}
+
+	return 0;
+}
+
+/*
+ * Queue DCMIPP ISP params while streaming.
+ * Params are written in any free buffer of the ring so that several updates can be queued
+ * ahead of the frames they target. Wait only if the whole ring is in use.
+ */
+static int queue_params(struct isp_descriptor *isp_desc, const struct stm32_dcmipp_params_cfg *params)
+{
+	struct v4l2_buffer buf;
+	int i, ret;
+
+	ret = reclaim_params(isp_desc, true);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < isp_desc->params_buf_nb; i++)
+		if (!isp_desc->params_queued[i])
+			break;
+
+	if (i == isp_desc->params_buf_nb) {
+		printf("No params buffer available\n");
+		return -EBUSY;
+	}
+
+	*isp_desc->params[i] = *params;
+
+	memset(&buf, 0, sizeof(buf));
+	buf.type = V4L2_BUF_TYPE_META_OUTPUT;
+	buf.memory = V4L2_MEMORY_MMAP;
+	buf.index = i;
+	buf.bytesused = sizeof(*params);
+
+	ret = ioctl(isp_desc->params_fd, VIDIOC_QBUF, &buf);
+	if (ret) {
+		printf("Failed to queue buffer %d\n", i);
+		return ret;
+	}
+	isp_desc->params_queued[i] = true;
+	isp_desc->params_histo_id[i] = params->module_cfg_update & STM32_DCMIPP_ISP_HISTO ?
+				       isp_desc->state.histo_id : HISTO_ID_UNCHANGED;
+
+	return 0;
+}
+
+/*
+ * Send DCMIPP ISP params when not streaming, with a full stream start / stop cycle
+ */
+static int submit_params(struct isp_descriptor *isp_desc, const struct stm32_dcmipp_params_cfg *params)
+{
+	enum v4l2_buf_type type;
+	struct v4l2_buffer buf;
+	int ret;
+
+	*isp_desc->params[0] = *params;
+
+	/* Queue the buffer */
+	buf.type = V4L2_BUF_TYPE_META_OUTPUT;
+	buf.memory = V4L2_MEMORY_MMAP;
+	buf.index = 0;
+	buf.bytesused = sizeof(*params);
+
+	ret = ioctl(isp_desc->params_fd, VIDIOC_QBUF, &buf);
+	if (ret) {
+		printf("Failed to queue buffer\n");
+		return ret;
+	}
+
+	/* Start stream */
+	type = V4L2_BUF_TYPE_META_OUTPUT;
+	ret = ioctl(isp_desc->params_fd, VIDIOC_STREAMON, &type);
+	if (ret) {
+		printf("Failed to start stream\n");
+		return ret;
+	}
+
+	/* Wait for buff */
+	ret = wait_fd(isp_desc->params_fd, true, 2000);
+	if (ret < 0) {
+		printf("Select failed (%d)\n", ret);
+		return ret;
+	}
+	if (ret == 0) {
+		printf("Select timeout\n");
+		return -EBUSY;
+	}
+
+	/* Get the buff back, indicating the sequence into which it has been pushed */
+	buf.type = V4L2_BUF_TYPE_META_OUTPUT;
+	buf.memory = V4L2_MEMORY_MMAP;
+	ret = ioctl(isp_desc->params_fd, VIDIOC_DQBUF, &buf);
+	if (ret) {
+		printf("Failed to dequeue buffer\n");
+		return ret;
+	}
+
+	/* Stop stream */
+	type = V4L2_BUF_TYPE_META_OUTPUT;
+	ret = ioctl(isp_desc->params_fd, VIDIOC_STREAMOFF, &type);
+	if (ret) {
+		printf("Failed to stop stream\n");
+		return ret;
+	}
+
+	return ret;
+}
+
+#define ISP_MODULE(bit, cfg)	{ bit, offsetof(struct stm32_dcmipp_isp_ctrls_cfg, cfg), \
+				  sizeof(((struct stm32_dcmipp_isp_ctrls_cfg *)0)->cfg) }
+
+static const struct {
+	__u32 bit;
+	size_t offset;
+	size_t size;
+} isp_modules[] = {
+	ISP_MODULE(STM32_DCMIPP_ISP_BPR, bpr_cfg),
+	ISP_MODULE(STM32_DCMIPP_ISP_BLC, blc_cfg),
+	ISP_MODULE(STM32_DCMIPP_ISP_EX, ex_cfg),
+	ISP_MODULE(STM32_DCMIPP_ISP_DM, dm_cfg),
+	ISP_MODULE(STM32_DCMIPP_ISP_CC, cc_cfg),
+	ISP_MODULE(STM32_DCMIPP_ISP_CE, ce_cfg),
+	ISP_MODULE(STM32_DCMIPP_ISP_HISTO, histo_cfg),
+};
+
+/*
+ * Merge the modules updated by some params in the ISP state
+ * A module set back to the configuration the ISP already has is not sent anymore.
+ */
+static void isp_state_stage(struct isp_state *state, const struct stm32_dcmipp_params_cfg *params)
+{
+	const __u8 *src = (const __u8 *)&params->ctrls;
+	const __u8 *applied = (const __u8 *)&state->applied;
+	__u8 *staged = (__u8 *)&state->staged;
+	size_t offset, size;
+	__u32 bit;
+	int i;
+
+	for (i = 0; i < sizeof(isp_modules) / sizeof(isp_modules[0]); i++) {
+		bit = isp_modules[i].bit;
+		offset = isp_modules[i].offset;
+		size = isp_modules[i].size;
+
+		if (!(params->module_cfg_update & bit))
+			continue;
+
+		memcpy(staged + offset, src + offset, size);
+		if (bit == STM32_DCMIPP_ISP_HISTO)
+			state->histo_id = ISP_HISTO_ID_NONE;
+
+		if ((state->known & bit) && !memcmp(staged + offset, applied + offset, size))
+			state->dirty &= ~bit;
+		else
+			state->dirty |= bit;
+	}
+}
+
+/*
+ * Send all the staged updates in a single params buffer
+ */
+static int flush_params(struct isp_descriptor *isp_desc)
+{
+	struct isp_state *state = &isp_desc->state;
+	struct stm32_dcmipp_params_cfg params;
+	int ret;
+
+	if (!state->dirty)
+		return 0;
+
+	params.module_cfg_update = state->dirty;
+	params.ctrls = state->staged;
+
+	/* The params stream is already running: just queue the params for the next frame */
+	if (isp_desc->streaming)
+		ret = queue_params(isp_desc, &params);
+	else
+		ret = submit_params(isp_desc, &params);
+	if (ret)
+		return ret;
+
+	state->applied = state->staged;
+	state->known |= state->dirty;
+	state->dirty = 0;
+
+	return 0;
+}
+
+/*
+ * Apply DCMIPP ISP params
+ *
+ * The params are merged in the ISP state. While streaming, all the updates of a frame are sent
+ * together once its stats are processed. Otherwise they are sent right away, unless held.
+ */
+static int apply_params(struct isp_descriptor *isp_desc, const struct stm32_dcmipp_params_cfg *params)
+{
+	isp_state_stage(&isp_desc->state, params);
+
+	if (isp_desc->streaming || isp_desc->state.hold)
+		return 0;
+
+	return flush_params(isp_desc);
+}
+
+/*
+ * Helper function to configure the stats video capture device and set the stats capture profile
+ */
+static int set_stat_profile(struct isp_descriptor *isp_desc, enum v4l2_isp_stat_profile profile)
+{
+	int ret;
+
+	if (profile > V4L2_STAT_PROFILE_AVERAGE_POST) {
+		printf("Invalid value : %d\n", profile);
+		return -EINVAL;
+	}
+
+	ret = set_ext_ctrl_int(isp_desc->stat_fd, V4L2_CTRL_CLASS_IMAGE_PROC, V4L2_CID_ISP_STAT_PROFILE, profile);
+	if (ret) {
+		printf("Failed to apply Stat capture profile\n");
+		return ret;
+	}
+
+	/* Changed on a frame boundary, the frame in progress may still use the previous profile */
+	isp_desc->stat_profile.prev = isp_desc->streaming ? isp_desc->stat_profile.profile : profile;
+	isp_desc->stat_profile.profile = profile;
+	isp_desc->stat_profile.from = write_frame(isp_desc) + 1;
+
+	return 0;
+}
+
+/*
+ * Read stats from the DCMIPP ISP, starting and stopping the stats stream for a single frame
+ */
+static int get_stat(struct isp_descriptor *isp_desc, struct stm32_dcmipp_stat_buf **stats, enum v4l2_isp_stat_profile profile,
+		    __u64 *timestamp)
+{
+	enum v4l2_buf_type type;
+	struct v4l2_buffer buf;
+	int i, ret;
+
+	/* The stats are already streaming: use isp_event_dispatch() */
+	if (isp_desc->streaming)
+		return -EBUSY;
+
+	/* The stats shall reflect all the updates made so far */
+	ret = flush_params(isp_desc);
+	if (ret)
+		return ret;
+
+	/* Set the stat profile */
+	ret = set_stat_profile(isp_desc, profile);
+	if (ret) {
+		printf("Failed to set stat capture profile\n");
+		return ret;
+	}
+
+	/* Queue buff */
+	for (i = 0; i < isp_desc->stats_buf_nb; i++) {
+		buf.type = V4L2_BUF_TYPE_META_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		buf.index = i;
+
+		ret = ioctl(isp_desc->stat_fd, VIDIOC_QBUF, &buf);
+		if (ret) {
+			printf("Failed to queue buffer %d\n", i);
+			return ret;
+		}
+	}
+
+	/* Start stream */
+	type = V4L2_BUF_TYPE_META_CAPTURE;
+	ret = ioctl(isp_desc->stat_fd, VIDIOC_STREAMON, &type);
+	if (ret) {
+		printf("Failed to start stream\n");
+		return ret;
+	}
+
+	/* Wait for buff */
+	ret = wait_fd(isp_desc->stat_fd, false, 2000);
+	if (ret <= 0) {
+		printf(ret ? "Select failed (%d)\n" : "Select timeout\n", ret);
+		ret = ret ? ret : -EBUSY;
+		goto out;
+	}
+
+	/* Get a buff */
+	buf.type = V4L2_BUF_TYPE_META_CAPTURE;
+	buf.memory = V4L2_MEMORY_MMAP;
+	ret = ioctl(isp_desc->stat_fd, VIDIOC_DQBUF, &buf);
+	if (ret) {
+		printf("Failed to dequeue buffer\n");
+		goto out;
+	}
+
+	/* Return result, still valid after the stream is stopped */
+	*stats = isp_desc->stats[buf.index];
+	if (timestamp)
+		*timestamp = buf_timestamp(&buf);
+
+out:
+	/* Stop stream */
+	type = V4L2_BUF_TYPE_META_CAPTURE;
+	if (ioctl(isp_desc->stat_fd, VIDIOC_STREAMOFF, &type)) {
+		printf("Failed to stop stream\n");
+		if (!ret)
+			ret = -EIO;
+	}
+
+	return ret;
+}
+
+#define LUM_HISTO_BIN_NB_MAX		64
+#define LUM_HISTO_COUNT_MAX		0xFFFF
+
+/*
+ * Luminance histograms on the grid of regions of the tuning, shared by the AEC metering, the adaptive
+ * contrast and the ROIs
+ *
+ * They are extracted after demosaicing, before the color conversion and contrast enhancement blocks,
+ * so that the contrast curve does not change its own measure. With 'color', for the AWB, each region
+ * rather gets the R, Gr, B and Gb histograms extracted before the exposure block, Gb standing for the
+ * luminance. The regions get as many bins as the histogram memory allows, at least 16, and the input
+ * is decimated so that a uniform region cannot saturate a bin.
+ */
+static int lum_histo_config(const struct isp_descriptor *isp_desc, bool color, struct stm32_dcmipp_isp_histo_cfg *cfg)
+{
+	const struct tuning_metering *metering = &isp_desc->tuning->aec.metering;
+	unsigned int histo_nb = metering->hreg * metering->vreg * (color ? 4 : 1);
+	unsigned long pixels;
+	int bin, shift = 0;
+
+	if (histo_nb * 16 > STM32_DCMIPP_HISTO_BIN_MAX) {
+		printf("Too many histogram regions for the color histograms : %d x %d\n", metering->hreg, metering->vreg);
+		return -EINVAL;
+	}
+
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->hreg = metering->hreg;
+	cfg->vreg = metering->vreg;
+	cfg->width = isp_desc->width / cfg->hreg;
+	cfg->height = isp_desc->height / cfg->vreg;
+	cfg->left = (isp_desc->width - cfg->width * cfg->hreg) / 2;
+	cfg->top = (isp_desc->height - cfg->height * cfg->vreg) / 2;
+
+	for (bin = STM32_DCMIPP_ISP_HISTO_BIN_64; bin > STM32_DCMIPP_ISP_HISTO_BIN_16; bin--)
+		if (histo_nb * (4 << (2 * bin)) <= STM32_DCMIPP_HISTO_BIN_MAX)
+			break;
+	cfg->bin = bin;
+
+	pixels = (unsigned long)cfg->width * cfg->height;
+	while ((pixels >> shift) > LUM_HISTO_COUNT_MAX && shift < 2 * STM32_DCMIPP_ISP_HISTO_VHDEC_16)
+		shift++;
+	cfg->hdec = (shift + 1) / 2;
+	cfg->vdec = shift / 2;
+
+	cfg->dyn = STM32_DCMIPP_ISP_HISTO_DYN_LIGHT;
+	cfg->comp = color ? STM32_DCMIPP_ISP_HISTO_COMP_ALL : STM32_DCMIPP_ISP_HISTO_COMP_GB_L_L_L;
+	cfg->src = color ? STM32_DCMIPP_ISP_HISTO_SRC_POST_BLC : STM32_DCMIPP_ISP_HISTO_SRC_POST_DM;
+
+	return 0;
+}
+
+/*
+ * Distance between the histograms of two consecutive regions, and offset of the luminance histogram
+ * of a region (the last component)
+ */
+static unsigned int lum_histo_stride(const struct stm32_dcmipp_isp_histo_cfg *cfg)
+{
+	return isp_histo_nb(cfg) / (cfg->hreg * cfg->vreg) * isp_histo_bin_nb(cfg);
+}
+
+static unsigned int lum_histo_offset(const struct stm32_dcmipp_isp_histo_cfg *cfg)
+{
+	return lum_histo_stride(cfg) - isp_histo_bin_nb(cfg);
+}
+
+/*
+ * Length of the intersection of the segments [a0, a1] and [b0, b1]
+ */
+static float overlap(float a0, float a1, float b0, float b1)
+{
+	float lo = a0 > b0 ? a0 : b0;
+	float hi = a1 < b1 ? a1 : b1;
+
+	return hi > lo ? hi - lo : 0;
+}
+
+/*
+ * Part of each histogram region covered by the ROIs, weighted by their priority
+ * Return the sum of the parts.
+ */
+static float roi_map(const struct stm32_dcmipp_isp_histo_cfg *cfg, const struct isp_roi *rois, unsigned int nb,
+		     float *part)
+{
+	float x0, y0, total = 0;
+	unsigned int i, j, k;
+
+	for (j = 0; j < cfg->vreg; j++) {
+		y0 = cfg->top + j * cfg->height;
+		for (i = 0; i < cfg->hreg; i++) {
+			x0 = cfg->left + i * cfg->width;
+			part[j * cfg->hreg + i] = 0;
+			for (k = 0; k < nb; k++)
+				part[j * cfg->hreg + i] += rois[k].weight / 256.0f *
+					overlap(x0, x0 + cfg->width, rois[k].left, rois[k].left + rois[k].width) *
+					overlap(y0, y0 + cfg->height, rois[k].top, rois[k].top + rois[k].height) /
+					((float)cfg->width * cfg->height);
+			total += part[j * cfg->hreg + i];
+		}
+	}
+
+	return total;
+}
+
+/*
+ * Mix a weight map (NULL for uniform) with the ROI map, the ROIs taking the part 'priority' of the
+ * total weight. Without ROI, the weight map is kept as is. The result is scaled up to 256 (Q8).
+ */
+static void roi_weights(const __u16 *base, unsigned int reg_nb, const float *part, float part_total,
+			float priority, __u16 *weight)
+{
+	float w[TUNING_METERING_REG_MAX * TUNING_METERING_REG_MAX], base_total = 0, max = 0;
+	unsigned int r;
+
+	for (r = 0; r < reg_nb; r++) {
+		weight[r] = base ? base[r] : 256;
+		base_total += weight[r];
+	}
+	if (part_total <= 0)
+		return;
+
+	for (r = 0; r < reg_nb; r++) {
+		w[r] = priority * part[r] / part_total;
+		if (base_total > 0)
+			w[r] += (1 - priority) * weight[r] / base_total;
+		if (w[r] > max)
+			max = w[r];
+	}
+
+	for (r = 0; r < reg_nb; r++)
+		weight[r] = lroundf(w[r] * 256 / max);
+}
+
+/*
+ * AEC metering: weights of the histogram regions (Q8)
+ * The weights of the mode are computed once when the control starts, and mixed with the ROIs map
+ * each time the ROIs change.
+ */
+struct aec_metering {
+	int mode;
+	bool histo; /* measured from the histograms, else from the post-ISP average */
+	unsigned int reg_nb;
+	unsigned int bin_nb;
+	unsigned int stride;
+	unsigned int offset;
+	__u16 base[TUNING_METERING_REG_MAX * TUNING_METERING_REG_MAX];
+	__u16 weight[TUNING_METERING_REG_MAX * TUNING_METERING_REG_MAX];
+};
+
+/*
+ * Compute the weight map of a metering mode, the frame spanning from -1 to 1 in both directions:
+ * - average: uniform, only measured from the histograms with ROIs
+ * - center: gaussian of the distance of the region center to the frame center
+ * - spot: part of the region inside the centered spot
+ * - matrix: weight of the 3 x 3 zone holding the region center
+ */
+static int aec_metering_init(struct aec_metering *metering, int mode, bool roi, const struct tuning_metering *tuning,
+			     const struct stm32_dcmipp_isp_histo_cfg *cfg)
+{
+	float x0, x1, y0, y1, x, y, w, max = 0;
+	int i, j, zx, zy;
+
+	if (mode < ISP_METERING_AVERAGE || mode > ISP_METERING_MATRIX) {
+		printf("Invalid metering mode : %d\n", mode);
+		return -EINVAL;
+	}
+
+	memset(metering, 0, sizeof(*metering));
+	metering->mode = mode;
+	metering->histo = mode != ISP_METERING_AVERAGE;
+	if (!metering->histo && !roi)
+		return 0;
+
+	metering->reg_nb = cfg->hreg * cfg->vreg;
+	metering->bin_nb = isp_histo_bin_nb(cfg);
+	metering->stride = lum_histo_stride(cfg);
+	metering->offset = lum_histo_offset(cfg);
+
+	for (i = 0; i < 9; i++)
+		if (tuning->matrix[i / 3][i % 3] > max)
+			max = tuning->matrix[i / 3][i % 3];
+
+	for (j = 0; j < cfg->vreg; j++) {
+		y0 = 2.0f * j / cfg->vreg - 1;
+		y1 = 2.0f * (j + 1) / cfg->vreg - 1;
+		y = (y0 + y1) / 2;
+		for (i = 0; i < cfg->hreg; i++) {
+			x0 = 2.0f * i / cfg->hreg - 1;
+			x1 = 2.0f * (i + 1) / cfg->hreg - 1;
+			x = (x0 + x1) / 2;
+
+			switch (mode) {
+			case ISP_METERING_AVERAGE:
+				w = 1;
+				break;
+			case ISP_METERING_CENTER:
+				w = expf(-(x * x + y * y) / (2 * tuning->center_sigma * tuning->center_sigma));
+				break;
+			case ISP_METERING_SPOT:
+				w = overlap(x0, x1, -tuning->spot_size, tuning->spot_size) *
+				    overlap(y0, y1, -tuning->spot_size, tuning->spot_size) / ((x1 - x0) * (y1 - y0));
+				break;
+			default:
+				zx = clamp((x + 1) * 3 / 2, 0, 2);
+				zy = clamp((y + 1) * 3 / 2, 0, 2);
+				w = max > 0 ? tuning->matrix[zy][zx] / max : 1;
+				break;
+			}
+
+			metering->base[j * cfg->hreg + i] = lroundf(w * 256);
+		}
+	}
+	memcpy(metering->weight, metering->base, sizeof(metering->weight));
+
+	return 0;
+}
+
+/*
+ * Weighted mean level of the regions, in a single pass over their bins (bin centers, on 8 bits)
+ * Return -EAGAIN if the weighted regions are empty, when the histograms are not configured yet.
+ */
+static int aec_metering_luminance(const struct aec_metering *metering, const __u16 *histograms, float *lum)
+{
+	unsigned int r, b, bin_nb = metering->bin_nb;
+	__u64 level = 0, count = 0;
+	__u32 reg_level, reg_count;
+
+	histograms += metering->offset;
+	for (r = 0; r < metering->reg_nb; r++, histograms += metering->stride) {
+		if (!metering->weight[r])
+			continue;
+
+		reg_level = 0;
+		reg_count = 0;
+		for (b = 0; b < bin_nb; b++) {
+			reg_level += histograms[b] * (2 * b + 1);
+			reg_count += histograms[b];
+		}
+		level += (__u64)reg_level * metering->weight[r];
+		count += (__u64)reg_count * metering->weight[r];
+	}
+
+	if (!count)
+		return -EAGAIN;
+
+	*lum = (float)level * 128 / bin_nb / count;
+
+	return 0;
+}
+
+#define AEC_ATTEMPT_MAX			20
+#define AEC_PENDING_MAX			(TUNING_AEC_LATENCY_MAX + 2)
+#define DB_PER_EV			6.0206 /* 20 * log10(2) */
+
+#define FLICKER_WINDOW			32   /* frames correlated with the flicker aliases */
+#define FLICKER_DETECT_PERIOD		8    /* frames between two detections */
+#define FLICKER_EV_MIN			0.02 /* amplitude of a detected flicker (EV) */
+#define FLICKER_PART_MIN		0.5  /* part of the luminance variance explained by a detected flicker */
+#define FLICKER_BEATS_MIN		2    /* beats of a flicker alias within the window to be detected */
+#define FLICKER_LUM_MIN			8
+#define FLICKER_LUM_MAX			220
+
+/*
+ * Anti-flicker of the AEC
+ *
+ * Under lighting powered by the mains, the light intensity beats at twice the mains frequency. Unless
+ * the exposure time is a multiple of this period, the luminance of the frames beats at the alias of
+ * this frequency with the frame rate. The scene luminance of the last FLICKER_WINDOW frames (log2 of
+ * the average luminance, relative to the active exposure value) is correlated with the 100 and 120 Hz
+ * flickers, at the buffer timestamps: a flicker is detected when it explains most of the variations,
+ * with a significant amplitude. A flicker beating at a multiple of the frame rate does not change the
+ * frames luminance, and cannot be detected.
+ *
+ * Once detected, the exposure time is a multiple of the flicker period whenever longer than it. The
+ * flicker is kept, as it is not seen anymore then.
+ *
+ * @period: flicker period (sensor lines), 0 if none
+ * @beat: frames of a beat of the detected flicker, 0 if not detected
+ * @update: quantize the exposure on the next AEC step, even if converged
+ */
+struct aec_flicker {
+	int mode;
+	float line_time_us;
+	float period;
+	unsigned int beat;
+	bool update;
+	unsigned int nb;
+	unsigned int pos;
+	unsigned int since;
+	float lum[FLICKER_WINDOW];
+	__u64 timestamp[FLICKER_WINDOW];
+};
+
+/*
+ * Auto exposure state, kept across frames
+ *
+ * The exposure value (EV) is the log2 of the total sensor exposure: log2(lines) + gain in dB / 6.02.
+ * Sensor updates are kept as pending until the frame on which they are visible.
+ * The luminance is the post-ISP average, or the weighted mean of the histogram regions if metered.
+ */
+struct aec_state {
+	const struct sensor_tuning *tuning;
+	struct sensor_ctrls *ctrls;
+	int gain;
+	int exposure;
+	float ev_active;
+	float integral;
+	bool converged;
+	bool limit_reached;
+	struct {
+		__u32 sequence;
+		float ev;
+	} pending[AEC_PENDING_MAX];
+	int pending_nb;
+	struct aec_metering metering;
+	struct aec_flicker flicker;
+};
+
+static float aec_ev(const struct sensor_tuning *tuning, int exposure, int gain)
+{
+	return log2f(exposure) + tuning->gain_db[gain] / DB_PER_EV;
+}
+
+/*
+ * Split an exposure value into sensor exposure and analogue gain.
+ * Exposure is used first to keep the noise low, then gain once exposure reaches its max.
+ * Under a flicker of 'period' lines, the exposure is a whole number of periods, the gain taking the rest.
+ */
+static void aec_split_ev(const struct sensor_tuning *tuning, float ev, float period, int *exposure, int *gain)
+{
+	float lines = exp2f(ev);
+
+	if (period > 0 && lines >= period && tuning->exposure_max >= period) {
+		lines = floorf((lines < tuning->exposure_max ? lines : tuning->exposure_max) / period) * period;
+		*exposure = clamp(lroundf(lines), tuning->exposure_min, tuning->exposure_max);
+		*gain = tuning_gain_code(tuning, (ev - log2f(*exposure)) * DB_PER_EV);
+	} else if (lines <= tuning->exposure_max) {
+		*exposure = clamp(lroundf(lines), tuning->exposure_min, tuning->exposure_max);
+		*gain = tuning->gain_min;
+	} else {
+		*exposure = tuning->exposure_max;
+		*gain = tuning_gain_code(tuning, (ev - log2f(tuning->exposure_max)) * DB_PER_EV);
+	}
+}
+
+/*
+ * Get the current sensor gain and exposure
+ * They are only read back from the sensor if the changes made by other applications are not reported.
+ */
+static int aec_init(struct isp_descriptor *isp_desc, struct aec_state *aec)
+{
+	int ret;
+
+	memset(aec, 0, sizeof(*aec));
+	aec->tuning = isp_desc->tuning;
+	aec->ctrls = &isp_desc->sensor_ctrls;
+
+	if (!aec->ctrls->events) {
+		ret = sensor_ctrls_read(aec->ctrls);
+		if (ret) {
+			printf("Failed to get sensor gain and exposure\n");
+			return ret;
+		}
+	}
+
+	aec->exposure = sensor_ctrl_get(aec->ctrls, V4L2_CID_EXPOSURE);
+	aec->gain = sensor_ctrl_get(aec->ctrls, V4L2_CID_ANALOGUE_GAIN);
+	aec->gain = clamp(aec->gain, aec->tuning->gain_min, aec->tuning->gain_max);
+	aec->ev_active = aec_ev(aec->tuning, aec->exposure, aec->gain);
+
+	return 0;
+}
+
+/*
+ * Keep track of a sensor update, visible from the frame 'sequence'
+ */
+static void aec_push_pending(struct aec_state *aec, __u32 sequence, float ev)
+{
+	if (aec->pending_nb == AEC_PENDING_MAX) {
+		aec->ev_active = aec->pending[0].ev;
+		memmove(&aec->pending[0], &aec->pending[1], --aec->pending_nb * sizeof(aec->pending[0]));
+	}
+	aec->pending[aec->pending_nb].sequence = sequence;
+	aec->pending[aec->pending_nb].ev = ev;
+	aec->pending_nb++;
+}
+
+/*
+ * Take into account a sensor control changed by another application during the frame 'write_frame'
+ */
+static void aec_control_changed(struct aec_state *aec, __u32 id, int value, __u32 write_frame)
+{
+	const struct sensor_tuning *tuning = aec->tuning;
+
+	if (id == V4L2_CID_EXPOSURE && value != aec->exposure)
+		aec->exposure = value;
+	else if (id == V4L2_CID_ANALOGUE_GAIN && value != aec->gain)
+		aec->gain = clamp(value, tuning->gain_min, tuning->gain_max);
+	else
+		return;
+
+	aec_push_pending(aec, write_frame + tuning->aec.latency, aec_ev(tuning, aec->exposure, aec->gain));
+	aec->integral = 0;
+	aec->converged = false;
+}
+
+/*
+ * Set the anti-flicker mode, the flicker period being given or to be detected
+ */
+static int aec_flicker_init(struct aec_state *aec, int mode)
+{
+	struct aec_flicker *flicker = &aec->flicker;
+
+	if (mode < ISP_ANTIFLICKER_OFF || mode > ISP_ANTIFLICKER_60HZ) {
+		printf("Invalid anti-flicker mode : %d\n", mode);
+		return -EINVAL;
+	}
+
+	memset(flicker, 0, sizeof(*flicker));
+	if (mode == ISP_ANTIFLICKER_OFF)
+		return 0;
+
+	if (aec->tuning->line_time_us <= 0) {
+		printf("No line time in the tuning of %s, required by the anti-flicker\n", aec->tuning->name);
+		return -EINVAL;
+	}
+
+	flicker->mode = mode;
+	flicker->line_time_us = aec->tuning->line_time_us;
+	if (mode != ISP_ANTIFLICKER_AUTO) {
+		flicker->period = 1000000 / (2 * (mode == ISP_ANTIFLICKER_50HZ ? 50 : 60) * flicker->line_time_us);
+		flicker->update = true;
+	}
+
+	return 0;
+}
+
+/*
+ * Add the frame captured at 'timestamp' (ns) to the flicker detection, with the exposure value active on it
+ */
+static void aec_flicker_detect(struct aec_state *aec, const struct stm32_dcmipp_stat_buf *stats, __u64 timestamp,
+			       bool verbose)
+{
+	static const int flicker_hz[] = { 100, 120 };
+	struct aec_flicker *flicker = &aec->flicker;
+	float lum = isp_math_luminance(stats->post.average_RGB);
+	float mean = 0, var = 0, amp, part, best = 0, period = 0;
+	double re, im, t, fps, alias, duration;
+	unsigned int i, j, first, last, beat = 0;
+
+	if (flicker->mode != ISP_ANTIFLICKER_AUTO)
+		return;
+
+	/* Clipped or too dark frames do not follow the light */
+	last = (flicker->pos + FLICKER_WINDOW - 1) % FLICKER_WINDOW;
+	if (lum < FLICKER_LUM_MIN || lum > FLICKER_LUM_MAX || (flicker->nb && timestamp <= flicker->timestamp[last])) {
+		flicker->nb = 0;
+		return;
+	}
+
+	flicker->lum[flicker->pos] = log2f(lum) - aec->ev_active;
+	flicker->timestamp[flicker->pos] = timestamp;
+	flicker->pos = (flicker->pos + 1) % FLICKER_WINDOW;
+	if (flicker->nb < FLICKER_WINDOW)
+		flicker->nb++;
+	if (flicker->nb < FLICKER_WINDOW || ++flicker->since < FLICKER_DETECT_PERIOD)
+		return;
+	flicker->since = 0;
+
+	/* The window is full: the oldest frame is the next one to be replaced */
+	first = flicker->pos;
+	duration = (timestamp - flicker->timestamp[first]) / 1e9;
+	for (i = 0; i < FLICKER_WINDOW; i++)
+		mean += flicker->lum[i];
+	mean /= FLICKER_WINDOW;
+	for (i = 0; i < FLICKER_WINDOW; i++)
+		var += (flicker->lum[i] - mean) * (flicker->lum[i] - mean);
+	var /= FLICKER_WINDOW;
+	if (!(var > 0) || !(duration > 0))
+		return;
+
+	fps = (FLICKER_WINDOW - 1) / duration;
+	for (j = 0; j < sizeof(flicker_hz) / sizeof(flicker_hz[0]); j++) {
+		/* The alias must beat enough within the window to be told from the scene changes */
+		alias = fabs(flicker_hz[j] - fps * round(flicker_hz[j] / fps));
+		if (alias * duration < FLICKER_BEATS_MIN)
+			continue;
+
+		re = 0;
+		im = 0;
+		for (i = 0; i < FLICKER_WINDOW; i++) {
+			t = 2 * M_PI * flicker_hz[j] * ((flicker->timestamp[i] - flicker->timestamp[first]) / 1e9);
+			re += (flicker->lum[i] - mean) * cos(t);
+			im += (flicker->lum[i] - mean) * sin(t);
+		}
+		amp = 2 * sqrt(re * re + im * im) / FLICKER_WINDOW;
+		part = amp * amp / 2 / var;
+		if (amp > FLICKER_EV_MIN && part > FLICKER_PART_MIN && amp > best) {
+			best = amp;
+			period = 1000000 / (flicker_hz[j] * flicker->line_time_us);
+			beat = clamp((int)lround(fps / alias), 2, FLICKER_WINDOW);
+		}
+	}
+
+	if (!period || period == flicker->period)
+		return;
+
+	if (verbose)
+		printf(">Flicker detected (%.0f Hz, %.2f EV), exposure by %.0f lines\n",
+		       1000000 / (period * flicker->line_time_us), best, period);
+
+	flicker->period = period;
+	flicker->beat = beat;
+	flicker->update = true;
+	flicker->nb = 0;
+}
+
+/*
+ * Ratio of the luminance averaged over a beat of the detected flicker to the luminance of the last frame
+ * added, both at its exposure value: the AEC does not chase the beats of a flicker when the exposure
+ * time is too short to be a multiple of its period.
+ */
+static float aec_flicker_filter(const struct aec_flicker *flicker)
+{
+	unsigned int i, last = (flicker->pos + FLICKER_WINDOW - 1) % FLICKER_WINDOW;
+	float mean = 0;
+
+	if (!flicker->beat || flicker->nb < flicker->beat)
+		return 1;
+
+	for (i = 0; i < flicker->beat; i++)
+		mean += flicker->lum[(last + FLICKER_WINDOW - i) % FLICKER_WINDOW];
+
+	return exp2f(mean / flicker->beat - flicker->lum[last]);
+}
+
+/*
+ * Run one step of the auto exposure algorithm on the stats of the frame 'sequence', captured at
+ * 'timestamp' (ns). A sensor update is written during the frame 'write_frame', and visible 'latency'
+ * frames later.
+ *
+ * A proportional-integral controller works on the log2 of the luminance error, relatively to the
+ * exposure value which was active when the measured frame was captured. This way, the frames
+ * captured before a sensor update lands do not trigger a new correction.
+ * The resulting exposure value is split across sensor exposure and gain in a single update.
+ *
+ * Return 0 on success or a negative error.
+ */
+static int aec_process(struct aec_state *aec, const struct stm32_dcmipp_stat_buf *stats,
+		       __u32 sequence, __u64 timestamp, __u32 write_frame, bool verbose)
+{
+	const struct sensor_tuning *tuning = aec->tuning;
+	float avgL, error, ev, ev_min, ev_max;
+	int ret, exposure, gain;
+
+	/* Retire the sensor updates visible from this frame */
+	while (aec->pending_nb && (__s32)(sequence - aec->pending[0].sequence) >= 0) {
+		aec->ev_active = aec->pending[0].ev;
+		memmove(&aec->pending[0], &aec->pending[1], --aec->pending_nb * sizeof(aec->pending[0]));
+	}
+
+	/* Compare the average or metered luminance with the target */
+	if (!aec->metering.histo ||
+	    aec_metering_luminance(&aec->metering, stats->histograms, &avgL))
+		avgL = isp_math_luminance(stats->post.average_RGB);
+	aec_flicker_detect(aec, stats, timestamp, verbose);
+	avgL *= aec_flicker_filter(&aec->flicker);
+	error = log2f(tuning->aec.target / (avgL >= 1 ? avgL : 1));
+
+	if (verbose) {
+		printf("\nFrame %u\n", sequence);
+		printf(" Current AvgL = %.1f (error %+.2f EV)\n", avgL, error);
+		printf(" Current gain = %d\n", aec->gain);
+		printf(" Current expo = %d\n", aec->exposure);
+	}
+
+	/* Hysteresis around the target */
+	if (fabsf(error) < (aec->converged ? tuning->aec.tolerance_out : tuning->aec.tolerance_in) &&
+	    !aec->flicker.update) {
+		aec->converged = true;
+		aec->limit_reached = false;
+		aec->integral = 0;
+		return 0;
+	}
+	aec->converged = false;
+
+	/* Integrate only the errors measured once all the updates have landed */
+	if (!aec->pending_nb) {
+		aec->integral += error;
+		if (aec->integral > tuning->aec.integral_max)
+			aec->integral = tuning->aec.integral_max;
+		else if (aec->integral < -tuning->aec.integral_max)
+			aec->integral = -tuning->aec.integral_max;
+	}
+
+	ev = tuning->aec.kp * error + tuning->aec.ki * aec->integral;
+	if (ev > tuning->aec.ev_step_max)
+		ev = tuning->aec.ev_step_max;
+	else if (ev < -tuning->aec.ev_step_max)
+		ev = -tuning->aec.ev_step_max;
+	ev += aec->ev_active;
+
+	ev_min = aec_ev(tuning, tuning->exposure_min, tuning->gain_min);
+	ev_max = aec_ev(tuning, tuning->exposure_max, tuning->gain_max);
+	if (ev <= ev_min || ev >= ev_max) {
+		ev = ev <= ev_min ? ev_min : ev_max;
+		/* Do not wind up against a sensor limit */
+		aec->integral = 0;
+	}
+
+	aec_split_ev(tuning, ev, aec->flicker.period, &exposure, &gain);
+	aec->flicker.update = false;
+	if (exposure == aec->exposure && gain == aec->gain) {
+		/* Nothing more can be done if the active settings already are at a limit */
+		aec->limit_reached = !aec->pending_nb && (ev == ev_min || ev == ev_max);
+		return 0;
+	}
+
+	if (verbose)
+		printf(">New gain = %d, expo = %d (%.2f EV)\n", gain, exposure, ev);
+
+	/* Set sensor gain and exposure in a single write */
+	sensor_ctrl_set(aec->ctrls, V4L2_CID_ANALOGUE_GAIN, gain);
+	sensor_ctrl_set(aec->ctrls, V4L2_CID_EXPOSURE, exposure);
+	ret = sensor_ctrls_commit(aec->ctrls);
+	if (ret) {
+		printf("Failed to set sensor gain and exposure\n");
+		aec->exposure = sensor_ctrl_get(aec->ctrls, V4L2_CID_EXPOSURE);
+		aec->gain = clamp(sensor_ctrl_get(aec->ctrls, V4L2_CID_ANALOGUE_GAIN), tuning->gain_min, tuning->gain_max);
+		return ret;
+	}
+	aec->gain = gain;
+	aec->exposure = exposure;
+
+	aec_push_pending(aec, write_frame + tuning->aec.latency, aec_ev(tuning, exposure, gain));
+
+	return 0;
+}
+
+/*
+ * Function to configure both DCMIPP ISP & Sensor gain
+ */
+static int set_sensor_gain_exposure(struct isp_descriptor *isp_desc, bool verbose)
+{
+	struct stm32_dcmipp_stat_buf *stats;
+	struct aec_state aec;
+	__u32 sequence = 0;
+	int ret, attempt = 0;
+
+	ret = aec_init(isp_desc, &aec);
+	if (ret)
+		return ret;
+
+	do {
+		/* Measure the luminance */
+		ret = get_stat(isp_desc, &stats, V4L2_STAT_PROFILE_AVERAGE_POST, NULL);
+		if (ret)
+			break;
+
+		ret = aec_process(&aec, stats, sequence, 0, sequence + 1, verbose);
+		if (ret)
+			break;
+
+		/* Each measurement restarts the stream, which takes more time than the sensor latency:
+		   the previous update has always landed on the next measured frame */
+		sequence += isp_desc->tuning->aec.latency + 1;
+	} while (!aec.converged && !aec.limit_reached && ++attempt < AEC_ATTEMPT_MAX);
+
+	return ret;
+}
+
+#define CONTRAST_POINT_NB		9
+
+/*
+ * Adaptive contrast state, kept across frames
+ *
+ * The contrast enhancement block applies a luminance gain interpolated between 9 points, every 32
+ * levels from 0 to 256, 16 being a gain of 1. The gains follow the equalization curve of the luminance
+ * histogram, with a limited slope, blended with the identity and filtered over time. The block is only
+ * updated when a point moves by at least the tuning threshold.
+ */
+struct contrast_state {
+	const struct tuning_contrast *tuning;
+	unsigned int reg_nb;
+	unsigned int bin_nb;
+	unsigned int stride;
+	unsigned int offset;
+	float gain[CONTRAST_POINT_NB];
+	__u8 lum[CONTRAST_POINT_NB];
+	bool valid;
+	unsigned int stable; /* estimations since the last curve update */
+};
+
+static void contrast_init(struct contrast_state *contrast, const struct tuning_contrast *tuning,
+			  const struct stm32_dcmipp_isp_histo_cfg *cfg)
+{
+	memset(contrast, 0, sizeof(*contrast));
+	contrast->tuning = tuning;
+	contrast->reg_nb = cfg->hreg * cfg->vreg;
+	contrast->bin_nb = isp_histo_bin_nb(cfg);
+	contrast->stride = lum_histo_stride(cfg);
+	contrast->offset = lum_histo_offset(cfg);
+}
+
+/*
+ * Gains of the equalization curve of the luminance histogram of the frame
+ *
+ * The bins are clipped to 'slope_max' times the mean bin, the clipped pixels being spread over all the
+ * bins, which bounds the slope of the curve. A point gain is the equalized level over the level, the
+ * first one being the slope of the first bin.
+ *
+ * Return -EAGAIN if the histograms are empty, when they are not configured yet.
+ */
+static int contrast_estimate(struct contrast_state *contrast, const __u16 *histograms, float gain[CONTRAST_POINT_NB])
+{
+	const struct tuning_contrast *tuning = contrast->tuning;
+	unsigned int r, b, k, bin_nb = contrast->bin_nb, step = bin_nb / (CONTRAST_POINT_NB - 1);
+	__u32 bins[LUM_HISTO_BIN_NB_MAX] = { 0 };
+	float total = 0, limit, excess = 0, cdf = 0, bin;
+
+	histograms += contrast->offset;
+	for (r = 0; r < contrast->reg_nb; r++, histograms += contrast->stride)
+		for (b = 0; b < bin_nb; b++)
+			bins[b] += histograms[b];
+
+	for (b = 0; b < bin_nb; b++)
+		total += bins[b];
+	if (!total)
+		return -EAGAIN;
+
+	limit = tuning->slope_max * total / bin_nb;
+	for (b = 0; b < bin_nb; b++)
+		if (bins[b] > limit)
+			excess += bins[b] - limit;
+	excess /= bin_nb;
+
+	for (b = 0, k = 0; b < bin_nb; b++) {
+		bin = (bins[b] < limit ? bins[b] : limit) + excess;
+		if (!b)
+			gain[k++] = bin * bin_nb / total;
+		cdf += bin;
+		if ((b + 1) % step == 0) {
+			gain[k] = cdf * (CONTRAST_POINT_NB - 1) / (total * k);
+			k++;
+		}
+	}
+
+	for (k = 0; k < CONTRAST_POINT_NB; k++) {
+		gain[k] = 1 + tuning->strength * (gain[k] - 1);
+		if (gain[k] < tuning->gain_min)
+			gain[k] = tuning->gain_min;
+		else if (gain[k] > tuning->gain_max)
+			gain[k] = tuning->gain_max;
+	}
+
+	return 0;
+}
+
+/*
+ * Blend the estimated curve 'gain' with the previous one (weight 'smoothing'), and apply it
+ */
+static int contrast_update(struct isp_descriptor *isp_desc, struct contrast_state *contrast,
+			   const float gain[CONTRAST_POINT_NB], float smoothing, bool verbose)
+{
+	struct stm32_dcmipp_params_cfg params = {
+		.module_cfg_update = STM32_DCMIPP_ISP_CE,
+	};
+	__u8 *lum = params.ctrls.ce_cfg.lum;
+	int k, change = 0, ret;
+
+	for (k = 0; k < CONTRAST_POINT_NB; k++) {
+		if (contrast->valid)
+			contrast->gain[k] += smoothing * (gain[k] - contrast->gain[k]);
+		else
+			contrast->gain[k] = gain[k];
+		lum[k] = lroundf(contrast->gain[k] * 16);
+		if (abs(lum[k] - contrast->lum[k]) > change)
+			change = abs(lum[k] - contrast->lum[k]);
+	}
+
+	if (contrast->valid && change < contrast->tuning->threshold) {
+		contrast->stable++;
+		return 0;
+	}
+
+	if (verbose) {
+		printf(">New contrast curve");
+		for (k = 0; k < CONTRAST_POINT_NB; k++)
+			printf(" %u", lum[k]);
+		printf("\n");
+	}
+
+	params.ctrls.ce_cfg.en = 1;
+	ret = apply_params(isp_desc, &params);
+	if (ret) {
+		printf("Failed to apply contrast\n");
+		return ret;
+	}
+
+	memcpy(contrast->lum, lum, sizeof(contrast->lum));
+	contrast->valid = true;
+	contrast->stable = 0;
+
+	return 0;
+}
+
+/*
+ * Run one step of the adaptive contrast, the new curve being blended with the previous one (weight
+ * 'smoothing')
+ */
+static int contrast_process(struct isp_descriptor *isp_desc, struct contrast_state *contrast,
+			    const struct stm32_dcmipp_stat_buf *stats, float smoothing, bool verbose)
+{
+	float gain[CONTRAST_POINT_NB];
+
+	if (contrast_estimate(contrast, stats->histograms, gain))
+		return 0;
+
+	return contrast_update(isp_desc, contrast, gain, smoothing, verbose);
+}
+
+/*
+ * Function to apply the adaptive contrast from a single measurement
+ */
+static int set_contrast_adaptive(struct isp_descriptor *isp_desc, bool verbose)
+{
+	struct stm32_dcmipp_params_cfg params = {
+		.module_cfg_update = STM32_DCMIPP_ISP_HISTO,
+	};
+	struct stm32_dcmipp_stat_buf *stats;
+	struct contrast_state contrast;
+	float gain[CONTRAST_POINT_NB];
+	int ret;
+
+	ret = lum_histo_config(isp_desc, false, &params.ctrls.histo_cfg);
+	if (ret)
+		return ret;
+	contrast_init(&contrast, &isp_desc->tuning->contrast, &params.ctrls.histo_cfg);
+
+	ret = apply_params(isp_desc, &params);
+	if (ret) {
+		printf("Failed to apply contrast histo config\n");
+		return ret;
+	}
+
+	ret = get_stat(isp_desc, &stats, V4L2_STAT_PROFILE_FULL, NULL);
+	if (ret)
+		return ret;
+
+	if (contrast_estimate(&contrast, stats->histograms, gain)) {
+		printf("No luminance histogram for the contrast estimation\n");
+		return -EAGAIN;
+	}
+
+	return contrast_update(isp_desc, &contrast, gain, 1.0, verbose);
+}
+
+/*
+ * Function to demonstrate the DCMIPP ISP contrast block control
+ */
+static int set_contrast(struct isp_descriptor *isp_desc, int type, bool verbose)
+{
+	struct stm32_dcmipp_params_cfg params = {
+		.module_cfg_update = STM32_DCMIPP_ISP_CE,
+	};
+	__u8 dynamic[9] = { 32, 32, 32, 27, 23, 20, 18, 17, 16 };
+	__u8 *lum;
+
+	int i, ret;
+
+	switch (type) {
+	case ISP_CONTRAST_NONE:
+		/* Disabled */
+		break;
+	case ISP_CONTRAST_50:
+		/* 50% */
+		params.ctrls.ce_cfg.en = 1;
+		lum = params.ctrls.ce_cfg.lum;
+
+		for (i = 0; i < 9; i++)
+			lum[i] = 8;
+		break;
+	case ISP_CONTRAST_200:
+		/* 200% */
+		params.ctrls.ce_cfg.en = 1;
+		lum = params.ctrls.ce_cfg.lum;
+		for (i = 0; i < 9; i++)
+			lum[i] = 32;
+		break;
+	case ISP_CONTRAST_DYNAMIC:
+		/* Dynamic */
+		params.ctrls.ce_cfg.en = 1;
+		lum = params.ctrls.ce_cfg.lum;
+		memcpy(lum, dynamic, sizeof(dynamic));
+		break;
+	case ISP_CONTRAST_ADAPTIVE:
+		/* From the luminance histogram */
+		return set_contrast_adaptive(isp_desc, verbose);
+	default:
+		printf("Unknown contrast type (%d)\n", type);
+		return -EINVAL;
+	}
+
+	ret = apply_params(isp_desc, &params);
+	if (ret)
+		printf("Failed to apply contrast\n");
+
+	return ret;
+}
+
+/*
+ * Illuminant converted once into the register format
+ */
+struct illuminant_reg {
+	int id;
+	int cct;
+	float wb_ratio;
+	__u32 wb[3];
+	__s16 ccm[9];
+	struct stm32_dcmipp_isp_ex_cfg ex_cfg;
+	struct stm32_dcmipp_isp_cc_cfg cc_cfg;
+};
+
+/*
+ * Table of illuminants sorted by increasing color temperature
+ */
+struct ccm_table {
+	struct illuminant_reg ill[TUNING_ILLUMINANT_MAX];
+	int nb;
+};
+
+/*
+ * Build the illuminant table: the float calibration values are converted once here,
+ * so that only integer interpolation remains to be done on each frame
+ */
+static int ccm_table_init(struct ccm_table *tbl, const struct tuning_illuminant *cal, int nb)
+{
+	struct illuminant_reg *ill;
+	int i, j;
+
+	if (nb < 1 || nb > TUNING_ILLUMINANT_MAX) {
+		printf("Invalid number of illuminants : %d\n", nb);
+		return -EINVAL;
+	}
+
+	memset(tbl, 0, sizeof(*tbl));
+
+	for (i = 0; i < nb; i++) {
+		/* Insertion sort on the color temperature */
+		for (j = tbl->nb; j > 0 && tbl->ill[j - 1].cct > cal[i].cct; j--)
+			tbl->ill[j] = tbl->ill[j - 1];
+		ill = &tbl->ill[j];
+		tbl->nb++;
+
+		ill->id = i;
+		ill->cct = cal[i].cct;
+		ill->wb_ratio = cal[i].wb[2] / cal[i].wb[0];
+
+		for (j = 0; j < 3; j++) {
+			ill->wb[j] = cal[i].wb[j] * 256;
+			ill->ccm[3 * j + 0] = cal[i].ccm[j][0] * 256;
+			ill->ccm[3 * j + 1] = cal[i].ccm[j][1] * 256;
+			ill->ccm[3 * j + 2] = cal[i].ccm[j][2] * 256;
+		}
+
+		/* Set exposure */
+		isp_math_shift_mult(isp_math_q16(cal[i].wb[0]), &ill->ex_cfg.shift_r, &ill->ex_cfg.mult_r);
+		isp_math_shift_mult(isp_math_q16(cal[i].wb[1]), &ill->ex_cfg.shift_g, &ill->ex_cfg.mult_g);
+		isp_math_shift_mult(isp_math_q16(cal[i].wb[2]), &ill->ex_cfg.shift_b, &ill->ex_cfg.mult_b);
+		ill->ex_cfg.en = 1;
+
+		/* Set colorconv */
+		ill->cc_cfg.rr = isp_math_cconv_reg(ill->ccm[0]);
+		ill->cc_cfg.rg = isp_math_cconv_reg(ill->ccm[1]);
+		ill->cc_cfg.rb = isp_math_cconv_reg(ill->ccm[2]);
+		ill->cc_cfg.gr = isp_math_cconv_reg(ill->ccm[3]);
+		ill->cc_cfg.gg = isp_math_cconv_reg(ill->ccm[4]);
+		ill->cc_cfg.gb = isp_math_cconv_reg(ill->ccm[5]);
+		ill->cc_cfg.br = isp_math_cconv_reg(ill->ccm[6]);
+		ill->cc_cfg.bg = isp_math_cconv_reg(ill->ccm[7]);
+		ill->cc_cfg.bb = isp_math_cconv_reg(ill->ccm[8]);
+		ill->cc_cfg.en = 1;
+		ill->cc_cfg.clamp = STM32_DCMIPP_ISP_CC_CLAMP_DISABLED;
+	}
+
+	/* The blue / red gain ratio is expected to decrease when the color temperature increases */
+	for (i = 1; i < tbl->nb; i++)
+		if (tbl->ill[i].wb_ratio >= tbl->ill[i - 1].wb_ratio)
+			printf("Warning, white balance of illuminant %d is not consistent with its temperature\n",
+			       tbl->ill[i].id);
+
+	return 0;
+}
+
+static struct illuminant_reg *ccm_table_get(struct ccm_table *tbl, int id)
+{
+	int i;
+
+	for (i = 0; i < tbl->nb; i++)
+		if (tbl->ill[i].id == id)
+			return &tbl->ill[i];
+
+	return NULL;
+}
+
+/*
+ * Estimate the color temperature from the white balance gains, by locating their blue / red ratio
+ * between the ones of the calibrated illuminants
+ */
+static int ccm_estimate_cct(struct ccm_table *tbl, float gain_r, float gain_b)
+{
+	struct illuminant_reg *lo, *hi;
+	float ratio = gain_b / gain_r;
+	int i;
+
+	if (ratio >= tbl->ill[0].wb_ratio)
+		return tbl->ill[0].cct;
+
+	for (i = 1; i < tbl->nb; i++) {
+		lo = &tbl->ill[i - 1];
+		hi = &tbl->ill[i];
+		if (ratio >= hi->wb_ratio)
+			return lo->cct + (hi->cct - lo->cct) * (lo->wb_ratio - ratio) / (lo->wb_ratio - hi->wb_ratio);
+	}
+
+	return tbl->ill[tbl->nb - 1].cct;
+}
+
+/*
+ * Get the exposure (if ex_cfg is not NULL) and color conversion registers for a color temperature
+ * Outside the calibrated range, or on a calibrated illuminant, the cached registers are used as is.
+ */
+static void ccm_interpolate(struct ccm_table *tbl, int cct,
+			    struct stm32_dcmipp_isp_ex_cfg *ex_cfg, struct stm32_dcmipp_isp_cc_cfg *cc_cfg)
+{
+	struct illuminant_reg *lo, *hi;
+	__s16 ccm[9];
+	__u32 wb[3];
+	int i, w;
+
+	for (i = 0; i < tbl->nb - 1; i++)
+		if (cct < tbl->ill[i + 1].cct)
+			break;
+
+	lo = &tbl->ill[i];
+	if (i == tbl->nb - 1 || cct <= lo->cct) {
+		if (ex_cfg)
+			*ex_cfg = lo->ex_cfg;
+		*cc_cfg = lo->cc_cfg;
+		return;
+	}
+	hi = &tbl->ill[i + 1];
+
+	/* Q8 weight of the upper illuminant */
+	w = ((cct - lo->cct) << 8) / (hi->cct - lo->cct);
+
+	if (ex_cfg) {
+		for (i = 0; i < 3; i++)
+			wb[i] = lo->wb[i] + ((((int)hi->wb[i] - (int)lo->wb[i]) * w) >> 8);
+
+		isp_math_shift_mult(wb[0] << 8, &ex_cfg->shift_r, &ex_cfg->mult_r);
+		isp_math_shift_mult(wb[1] << 8, &ex_cfg->shift_g, &ex_cfg->mult_g);
+		isp_math_shift_mult(wb[2] << 8, &ex_cfg->shift_b, &ex_cfg->mult_b);
+		ex_cfg->en = 1;
+	}
+
+	for (i = 0; i < 9; i++)
+		ccm[i] = lo->ccm[i] + (((hi->ccm[i] - lo->ccm[i]) * w) >> 8);
+
+	*cc_cfg = lo->cc_cfg;
+	cc_cfg->rr = isp_math_cconv_reg(ccm[0]);
+	cc_cfg->rg = isp_math_cconv_reg(ccm[1]);
+	cc_cfg->rb = isp_math_cconv_reg(ccm[2]);
+	cc_cfg->gr = isp_math_cconv_reg(ccm[3]);
+	cc_cfg->gg = isp_math_cconv_reg(ccm[4]);
+	cc_cfg->gb = isp_math_cconv_reg(ccm[5]);
+	cc_cfg->br = isp_math_cconv_reg(ccm[6]);
+	cc_cfg->bg = isp_math_cconv_reg(ccm[7]);
+	cc_cfg->bb = isp_math_cconv_reg(ccm[8]);
+}
+
+/*
+ * Function to adapt the DCMIPP ISP configuration based on the ambiant light profile
+ */
+static int set_profile(struct isp_descriptor *isp_desc, struct ccm_table *tbl, int type)
+{
+	struct stm32_dcmipp_params_cfg params = {
+		.module_cfg_update = STM32_DCMIPP_ISP_BLC |
+				     STM32_DCMIPP_ISP_EX |
+				     STM32_DCMIPP_ISP_CC,
+	};
+	struct illuminant_reg *ill;
+	int ret;
+
+	/* Black level of the sensor */
+	params.ctrls.blc_cfg.en = 1;
+	params.ctrls.blc_cfg.blc_r = isp_desc->tuning->black_level;
+	params.ctrls.blc_cfg.blc_g = isp_desc->tuning->black_level;
+	params.ctrls.blc_cfg.blc_b = isp_desc->tuning->black_level;
+
+	ill = ccm_table_get(tbl, type);
+	if (!ill) {
+		printf("Invalid profile : %d\n", type);
+		return -EINVAL;
+	}
+
+	/* Set exposure and colorconv */
+	params.ctrls.ex_cfg = ill->ex_cfg;
+	params.ctrls.cc_cfg = ill->cc_cfg;
+
+	ret = apply_params(isp_desc, &params);
+	if (ret)
+		printf("Failed to apply exposure\n");
+
+	return ret;
+}
+
+/*
+ * Function to set the histogram configuration
+ */
+static int set_histogram(struct isp_descriptor *isp_desc, const struct stm32_dcmipp_isp_histo_cfg *cfg)
+{
+	int ret;
+	struct stm32_dcmipp_params_cfg params = {
+		.module_cfg_update = STM32_DCMIPP_ISP_HISTO,
+	};
+
+	params.ctrls.histo_cfg = *cfg;
+
+	ret = apply_params(isp_desc, &params);
+	if (ret)
+		printf("Failed to apply histo config\n");
+
+	return ret;
+}
+
+#define AWB_GAIN_MIN			0.5
+#define AWB_GAIN_MAX			4.0
+#define AWB_SMOOTHING			0.2 /* Weight of a new estimation in the temporal filter */
+#define AWB_LUM_MIN			8   /* Below, the scene is too dark for a reliable estimation */
+#define AWB_LUM_MAX			220 /* Above, the scene is mostly clipped */
+#define AWB_WHITE_PATCH_PERCENT		2   /* Part of the brightest pixels considered as white */
+#define AWB_HISTO_BIN_NB		64
+
+/*
+ * Auto white balance state, kept across frames
+ *
+ * The black level is corrected by the ISP from the start of the AWB, so that the gains apply to the
+ * signal only. The white patch uses the color histograms extracted after the black level correction,
+ * before the exposure block. The gray world starts from the raw pre-demosaicing averages, less the
+ * black level. Once its gains are applied, it rather uses the post-demosaicing averages divided by
+ * these gains: they are larger, so less quantized.
+ * With ROIs, the gray world averages are taken from the color histograms of the regions, weighted
+ * toward the ROIs.
+ */
+struct awb_state {
+	int mode;
+	float gain[3];
+	int cct;
+	bool valid;
+	int black_level;
+	struct ccm_table *ccm;
+	struct stm32_dcmipp_isp_ex_cfg ex_cfg;
+	struct stm32_dcmipp_isp_cc_cfg cc_cfg;
+	struct stm32_dcmipp_isp_histo_cfg histo_cfg;
+	bool roi; /* gray world on the ROIs, from the color histograms of histo_cfg */
+	bool roi_weighted;
+	__u16 weight[TUNING_METERING_REG_MAX * TUNING_METERING_REG_MAX];
+	unsigned int stable; /* frames processed since the last gains update */
+};
+
+/*
+ * Initialize the AWB, enable the black level correction and configure the histogram block if required
+ * by the algorithm
+ */
+static int awb_init(struct isp_descriptor *isp_desc, struct awb_state *awb, struct ccm_table *ccm, int mode)
+{
+	struct stm32_dcmipp_params_cfg params = {
+		.module_cfg_update = STM32_DCMIPP_ISP_BLC,
+	};
+	int ret;
+
+	if (mode != ISP_AWB_GRAY_WORLD && mode != ISP_AWB_WHITE_PATCH) {
+		printf("Invalid AWB mode : %d\n", mode);
+		return -EINVAL;
+	}
+
+	memset(awb, 0, sizeof(*awb));
+	awb->mode = mode;
+	awb->ccm = ccm;
+	awb->black_level = isp_desc->tuning->black_level;
+
+	/* Black level of the sensor, as with the illuminant profiles */
+	params.ctrls.blc_cfg.en = 1;
+	params.ctrls.blc_cfg.blc_r = awb->black_level;
+	params.ctrls.blc_cfg.blc_g = awb->black_level;
+	params.ctrls.blc_cfg.blc_b = awb->black_level;
+
+	if (mode != ISP_AWB_WHITE_PATCH)
+		goto apply;
+
+	/* One full frame region, with R, Gr, B and Gb histograms extracted before the exposure block */
+	awb->histo_cfg.width = isp_desc->width;
+	awb->histo_cfg.height = isp_desc->height;
+	awb->histo_cfg.hreg = 1;
+	awb->histo_cfg.vreg = 1;
+	awb->histo_cfg.bin = STM32_DCMIPP_ISP_HISTO_BIN_64;
+	awb->histo_cfg.dyn = STM32_DCMIPP_ISP_HISTO_DYN_LIGHT;
+	awb->histo_cfg.comp = STM32_DCMIPP_ISP_HISTO_COMP_ALL;
+	awb->histo_cfg.hdec = STM32_DCMIPP_ISP_HISTO_VHDEC_16;
+	awb->histo_cfg.vdec = STM32_DCMIPP_ISP_HISTO_VHDEC_16;
+	awb->histo_cfg.src = STM32_DCMIPP_ISP_HISTO_SRC_POST_BLC;
+	params.ctrls.histo_cfg = awb->histo_cfg;
+	params.module_cfg_update |= STM32_DCMIPP_ISP_HISTO;
+
+apply:
+	ret = apply_params(isp_desc, &params);
+	if (ret)
+		printf("Failed to apply AWB config\n");
+
+	return ret;
+}
+
+/*
+ * Return the level above which the brightest AWB_WHITE_PATCH_PERCENT of a histogram lie
+ * The level is interpolated within the bin where the count is reached, as if its pixels were spread
+ * evenly over it: the bin center alone is too coarse for the gains.
+ */
+static float awb_white_level(const __u16 *bins)
+{
+	unsigned int total = 0, acc = 0;
+	float target;
+	int i;
+
+	for (i = 0; i < AWB_HISTO_BIN_NB; i++)
+		total += bins[i];
+	target = total * AWB_WHITE_PATCH_PERCENT / 100.0f;
+
+	for (i = AWB_HISTO_BIN_NB - 1; i > 0; i--) {
+		if (acc + bins[i] >= target)
+			break;
+		acc += bins[i];
+	}
+
+	return bins[i] ? i + 1 - (target - acc) / bins[i] : i + 0.5f;
+}
+
+/*
+ * Weighted averages of the R, G and B histograms of the regions, in a single pass over their bins
+ * Return -EAGAIN if the weighted regions are empty.
+ */
+static int awb_roi_average(const struct awb_state *awb, const __u16 *histograms, float avg[3])
+{
+	static const int comp_rgb[4] = { 0, 1, 2, 1 }; /* R, Gr, B, Gb */
+	const struct stm32_dcmipp_isp_histo_cfg *cfg = &awb->histo_cfg;
+	unsigned int r, c, b, bin_nb = isp_histo_bin_nb(cfg), reg_nb = cfg->hreg * cfg->vreg;
+	__u64 level[3] = { 0 }, count = 0;
+	__u32 reg_level, reg_count;
+
+	for (r = 0; r < reg_nb; r++) {
+		for (c = 0; c < 4; c++, histograms += bin_nb) {
+			if (!awb->weight[r])
+				continue;
+			reg_level = 0;
+			reg_count = 0;
+			for (b = 0; b < bin_nb; b++) {
+				reg_level += histograms[b] * (2 * b + 1);
+				reg_count += histograms[b];
+			}
+			level[comp_rgb[c]] += (__u64)reg_level * awb->weight[r];
+			if (!c)
+				count += (__u64)reg_count * awb->weight[r];
+		}
+	}
+
+	if (!count)
+		return -EAGAIN;
+
+	/* Green is the sum of Gr and Gb */
+	for (c = 0; c < 3; c++)
+		avg[c] = (float)level[c] * 128 / bin_nb / count / (c == 1 ? 2 : 1);
+
+	return 0;
+}
+
+/*
+ * Estimate the white balance gains (green is the reference)
+ * Return -EAGAIN if the stats cannot give a reliable estimation
+ */
+static int awb_estimate(struct awb_state *awb, const struct stm32_dcmipp_stat_buf *stats, float gain[3])
+{
+	const __u32 *avg = stats->pre.average_RGB;
+	float r, g, b, roi_avg[3];
+	int lum, i;
+
+	lum = isp_math_luminance(avg);
+	if (lum < AWB_LUM_MIN || lum > AWB_LUM_MAX)
+		return -EAGAIN;
+
+	if (awb->mode == ISP_AWB_WHITE_PATCH) {
+		/* Components are stored R, Gr, B, Gb */
+		r = awb_white_level(&stats->histograms[0]);
+		g = (awb_white_level(&stats->histograms[AWB_HISTO_BIN_NB]) +
+		     awb_white_level(&stats->histograms[3 * AWB_HISTO_BIN_NB])) / 2;
+		b = awb_white_level(&stats->histograms[2 * AWB_HISTO_BIN_NB]);
+	} else if (awb->roi_weighted && !awb_roi_average(awb, stats->histograms, roi_avg)) {
+		/* Gray world on the ROIs */
+		r = roi_avg[0];
+		g = roi_avg[1];
+		b = roi_avg[2];
+	} else if (awb->valid) {
+		/* Gray world on the averages after the gains, finer than the raw ones, back to the sensor signal */
+		r = stats->post.average_RGB[0] * 128.0f / (awb->ex_cfg.mult_r << awb->ex_cfg.shift_r);
+		g = stats->post.average_RGB[1] * 128.0f / (awb->ex_cfg.mult_g << awb->ex_cfg.shift_g);
+		b = stats->post.average_RGB[2] * 128.0f / (awb->ex_cfg.mult_b << awb->ex_cfg.shift_b);
+	} else {
+		/* Gray world: the average of the scene is expected to be gray, the raw averages keep the black level */
+		r = (float)avg[0] - awb->black_level;
+		g = (float)avg[1] - awb->black_level;
+		b = (float)avg[2] - awb->black_level;
+	}
+
+	if (!(r > 0 && g > 0 && b > 0))
+		return -EAGAIN;
+
+	gain[0] = g / r;
+	gain[1] = 1.0;
+	gain[2] = g / b;
+
+	for (i = 0; i < 3; i++) {
+		if (gain[i] < AWB_GAIN_MIN)
+			gain[i] = AWB_GAIN_MIN;
+		else if (gain[i] > AWB_GAIN_MAX)
+			gain[i] = AWB_GAIN_MAX;
+	}
+
+	return 0;
+}
+
+/*
+ * Run one step of the auto white balance algorithm
+ *
+ * The new estimation is blended with the previous gains (weight 'smoothing'). The color temperature
+ * estimated from these gains selects the color conversion matrix interpolated from the illuminant table.
+ * The exposure and color conversion blocks are only updated when their register values change.
+ */
+static int awb_process(struct isp_descriptor *isp_desc, struct awb_state *awb,
+		       const struct stm32_dcmipp_stat_buf *stats, float smoothing, bool verbose)
+{
+	struct stm32_dcmipp_params_cfg params = { 0 };
+	struct stm32_dcmipp_isp_ex_cfg *ex_cfg = &params.ctrls.ex_cfg;
+	struct stm32_dcmipp_isp_cc_cfg *cc_cfg = &params.ctrls.cc_cfg;
+	float gain[3];
+	int i, ret;
+
+	/* A scene not suitable for an estimation keeps the gains */
+	if (awb_estimate(awb, stats, gain)) {
+		awb->stable++;
+		return 0;
+	}
+
+	for (i = 0; i < 3; i++) {
+		if (awb->valid)
+			awb->gain[i] += smoothing * (gain[i] - awb->gain[i]);
+		else
+			awb->gain[i] = gain[i];
+	}
+
+	isp_math_shift_mult(isp_math_q16(awb->gain[0]), &ex_cfg->shift_r, &ex_cfg->mult_r);
+	isp_math_shift_mult(isp_math_q16(awb->gain[1]), &ex_cfg->shift_g, &ex_cfg->mult_g);
+	isp_math_shift_mult(isp_math_q16(awb->gain[2]), &ex_cfg->shift_b, &ex_cfg->mult_b);
+	ex_cfg->en = 1;
+
+	awb->cct = ccm_estimate_cct(awb->ccm, awb->gain[0], awb->gain[2]);
+	ccm_interpolate(awb->ccm, awb->cct, NULL, cc_cfg);
+
+	if (!awb->valid || memcmp(ex_cfg, &awb->ex_cfg, sizeof(*ex_cfg)))
+		params.module_cfg_update |= STM32_DCMIPP_ISP_EX;
+	if (!awb->valid || memcmp(cc_cfg, &awb->cc_cfg, sizeof(*cc_cfg)))
+		params.module_cfg_update |= STM32_DCMIPP_ISP_CC;
+
+	if (!params.module_cfg_update) {
+		awb->stable++;
+		return 0;
+	}
+
+	if (verbose)
+		printf(">New WB gains R %.3f G %.3f B %.3f, CCT %dK\n",
+		       awb->gain[0], awb->gain[1], awb->gain[2], awb->cct);
+
+	ret = apply_params(isp_desc, &params);
+	if (ret) {
+		printf("Failed to apply white balance\n");
+		return ret;
+	}
+
+	awb->ex_cfg = *ex_cfg;
+	awb->cc_cfg = *cc_cfg;
+	awb->valid = true;
+	awb->stable = 0;
+
+	return 0;
+}
+
+/*
+ * Function to apply the white balance from a single measurement
+ */
+static int set_white_balance(struct isp_descriptor *isp_desc, struct ccm_table *ccm, int mode, bool verbose)
+{
+	struct stm32_dcmipp_stat_buf *stats;
+	struct awb_state awb;
+	int ret;
+
+	ret = awb_init(isp_desc, &awb, ccm, mode);
+	if (ret)
+		return ret;
+
+	ret = get_stat(isp_desc, &stats, V4L2_STAT_PROFILE_FULL, NULL);
+	if (ret)
+		return ret;
+
+	if (awb_estimate(&awb, stats, awb.gain)) {
+		printf("Scene not suitable for white balance estimation\n");
+		return -EAGAIN;
+	}
+
+	return awb_process(isp_desc, &awb, stats, 1.0, verbose);
+}
+
+/*
+ * Library handle
+ *
+ * The lock serializes all the device accesses and the control algorithms state. It is not held
+ * while waiting for the next stats, so that params can be submitted from other threads meanwhile.
+ */
+#define ISP_EVENT_MAX		8
+
+#define STATS_HOLD_FRAMES	8    /* estimations without contrast update before holding it */
+#define STATS_WATCH_EV		0.25 /* luminance change resuming the held algorithms */
+
+#define SCENE_AVERAGE_EV	0.2  /* change of an average component, in EV */
+#define SCENE_AVERAGE_FLOOR	4    /* level added to the averages, against the noise of dark scenes */
+#define SCENE_HISTO_DIST	0.15 /* part of the histograms pixels moved to other bins */
+#define SCENE_BAD_PIXEL_JUMP	0.3  /* relative change of the bad pixel count */
+#define SCENE_BAD_PIXEL_FLOOR	64
+#define SCENE_STILL_SCORE	0.5  /* score of a still frame, 1 being a scene change */
+#define SCENE_STILL_FRAMES	8    /* still frames before gating the settled algorithms */
+#define SCENE_WATCHDOG_FRAMES	64   /* gated frames between two runs of the algorithms */
+
+/*
+ * Adaptive stats profile of the control loop
+ *
+ * On each frame, the cheapest stats profile still feeding the started algorithms is selected. Once
+ * the AEC has converged and the adaptive contrast curve is stable, both are held: their histograms
+ * are not needed anymore, and the averages are enough to watch the luminance. They resume as soon as
+ * it changes by more than STATS_WATCH_EV. With the scene change detector, the algorithms it gates are
+ * held instead.
+ *
+ * @ref: luminance on the pre and post averages when the algorithms were held, 0 if not measured
+ */
+struct stats_adapt {
+	bool hold;
+	float ref[2];
+};
+
+/*
+ * Scene change detector gating the control algorithms
+ *
+ * Each frame is scored against a reference, on the parts of the stats both have: the largest of the
+ * averages changes, of the histograms distance and of the bad pixel count jump, each relative to its
+ * threshold. While the algorithms run, the reference follows the frames. Once they have settled on
+ * SCENE_STILL_FRAMES still frames, they are gated and the reference is frozen. They resume on the
+ * first frame scoring above 1, and run every SCENE_WATCHDOG_FRAMES meanwhile against slow drifts,
+ * resuming as well if they have not settled then.
+ *
+ * @refresh: the watchdog runs the algorithms on the next frame having all the stats they need
+ * @quiet: consecutive still frames
+ * @watchdog: gated frames since the algorithms last ran
+ * @changes: scene changes detected since the stream start
+ * @parts: parts of the stats in the reference
+ * @histo_len: histograms bins compared, 0 if the control algorithms do not configure them
+ */
+struct scene_detect {
+	bool still;
+	bool refresh;
+	unsigned int quiet;
+	unsigned int watchdog;
+	unsigned int changes;
+	unsigned int parts;
+	unsigned int histo_len;
+	__u32 average[2][3];
+	__u32 bad_pixels;
+	__u16 histograms[STM32_DCMIPP_HISTO_BIN_MAX];
+};
+
+/*
+ * Parts of the stats needed by each algorithm
+ */
+static unsigned int aec_parts(const struct aec_state *aec)
+{
+	return STATS_POST | (aec->metering.histo ? STATS_HISTO : 0);
+}
+
+static unsigned int awb_parts(const struct awb_state *awb)
+{
+	return STATS_PRE | (awb->mode == ISP_AWB_WHITE_PATCH || awb->roi_weighted ? STATS_HISTO : 0);
+}
+
+static float stats_adapt_lum(const struct stm32_dcmipp_stat_avr_bins *loc)
+{
+	float lum = isp_math_luminance(loc->average_RGB);
+
+	return lum >= 1 ? lum : 1;
+}
+
+/*
+ * Histogram scheduler: the configuration of each frame follows the pattern, and the last histograms
+ * of each configuration are kept
+ *
+ * @pos: position in the pattern of the next configuration to send
+ */
+struct histo_sched {
+	struct isp_histo_sched_cfg cfg;
+	unsigned int pos;
+	bool valid[ISP_HISTO_SCHED_CFG_MAX];
+	struct isp_histo_entry cache[ISP_HISTO_SCHED_CFG_MAX];
+};
+
+static int histo_sched_check(const struct isp_histo_sched_cfg *cfg)
+{
+	const struct stm32_dcmipp_isp_histo_cfg *c;
+	bool used[ISP_HISTO_SCHED_CFG_MAX] = { 0 };
+	unsigned int i, j;
+
+	if (!cfg->cfg_nb || cfg->cfg_nb > ISP_HISTO_SCHED_CFG_MAX || !cfg->pattern_len ||
+	    cfg->pattern_len > ISP_HISTO_SCHED_PATTERN_MAX)
+		return -EINVAL;
+
+	for (i = 0; i < cfg->pattern_len; i++) {
+		if (cfg->pattern[i] >= cfg->cfg_nb)
+			return -EINVAL;
+		used[cfg->pattern[i]] = true;
+	}
+
+	for (i = 0; i < cfg->cfg_nb; i++) {
+		c = &cfg->cfg[i];
+		if (!used[i] || !c->hreg || !c->vreg || !c->width || !c->height ||
+		    c->comp > STM32_DCMIPP_ISP_HISTO_COMP_ALL || c->src > STM32_DCMIPP_ISP_HISTO_SRC_POST_CE ||
+		    c->bin > STM32_DCMIPP_ISP_HISTO_BIN_256 ||
+		    isp_histo_nb(c) * isp_histo_bin_nb(c) > STM32_DCMIPP_HISTO_BIN_MAX)
+			return -EINVAL;
+		/* The frames of two identical configurations could not be told apart */
+		for (j = 0; j < i; j++)
+			if (!memcmp(c, &cfg->cfg[j], sizeof(*c)))
+				return -EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * Longest interval between two frames of the configuration 'id' in the repeated pattern
+ */
+static __u32 histo_sched_period(const struct isp_histo_sched_cfg *cfg, unsigned int id)
+{
+	unsigned int i, gap = 0, period = 0;
+
+	/* Start after an occurrence, so that every interval ends in the pattern twice unrolled */
+	for (i = 0; i < cfg->pattern_len; i++)
+		if (cfg->pattern[i] == id)
+			break;
+	for (i++; i <= 2 * cfg->pattern_len; i++) {
+		gap++;
+		if (cfg->pattern[i % cfg->pattern_len] == id) {
+			if (gap > period)
+				period = gap;
+			gap = 0;
+		}
+	}
+
+	return period;
+}
+
+/*
+ * Stage the configuration of the next frame of the pattern
+ */
+static int histo_sched_next(struct isp_descriptor *isp_desc, struct histo_sched *sched)
+{
+	unsigned int id = sched->cfg.pattern[sched->pos];
+	int ret;
+
+	ret = set_histogram(isp_desc, &sched->cfg.cfg[id]);
+	if (ret)
+		return ret;
+	isp_desc->state.histo_id = id;
+	sched->pos = (sched->pos + 1) % sched->cfg.pattern_len;
+
+	return 0;
+}
+
+static void histo_sched_store(struct histo_sched *sched, __s32 id, const struct stm32_dcmipp_stat_buf *buf,
+			      __u32 sequence, __u64 timestamp)
+{
+	const struct stm32_dcmipp_isp_histo_cfg *cfg = &sched->cfg.cfg[id];
+	struct isp_histo_entry *entry = &sched->cache[id];
+
+	entry->sequence = sequence;
+	entry->timestamp = timestamp;
+	memcpy(entry->histograms, buf->histograms, isp_histo_nb(cfg) * isp_histo_bin_nb(cfg) * sizeof(__u16));
+	sched->valid[id] = true;
+}
+
+struct isp_handle {
+	pthread_mutex_t lock;
+	struct isp_descriptor desc;
+	struct sensor_tuning tunings[TUNING_SENSOR_MAX];
+	struct ccm_table ccm;
+	struct aec_state aec;
+	struct awb_state awb;
+	struct contrast_state contrast;
+	struct stm32_dcmipp_isp_histo_cfg histo_cfg;
+	struct isp_publisher *publisher;
+	struct isp_roi_server *roi_server;
+	__u64 roi_generation;
+	unsigned int roi_nb;
+	struct histo_sched *histo_sched;
+	bool control_histo;
+	struct stats_adapt adapt;
+	struct scene_detect scene;
+	unsigned int held;
+	unsigned int control_errors;
+	bool do_adapt;
+	bool do_scene;
+	bool do_aec;
+	bool do_awb;
+	bool do_contrast;
+	bool do_roi;
+	bool verbose;
+};
+
+int isp_luminance(const __u32 rgb[3])
+{
+	return isp_math_luminance(rgb);
+}
+
+int isp_open(const struct isp_open_cfg *cfg, struct isp_handle **handle)
+{
+	const char *tuning_file = cfg->tuning_file;
+	struct isp_handle *h;
+	int ret;
+
+	h = calloc(1, sizeof(*h));
+	if (!h)
+		return -ENOMEM;
+
+	h->verbose = cfg->verbose;
+	h->desc.buf_nb = cfg->buf_nb ? cfg->buf_nb : ISP_BUF_NB_DEFAULT;
+	h->desc.use_cache = cfg->cache;
+	h->desc.isp_fd = -1;
+	h->desc.params_fd = -1;
+	h->desc.stat_fd = -1;
+	h->desc.sensor_fd = -1;
+	h->desc.epoll_fd = -1;
+	h->desc.state.histo_id = ISP_HISTO_ID_NONE;
+
+	if (h->desc.buf_nb < ISP_BUF_NB_MIN || h->desc.buf_nb > ISP_BUF_NB_MAX) {
+		printf("Invalid number of buffers : %d\n", h->desc.buf_nb);
+		ret = -EINVAL;
+		goto err;
+	}
+
+	/* Load the sensor descriptors, from the default tuning file if present */
+	if (!tuning_file && !access(TUNING_FILE_DEFAULT, R_OK))
+		tuning_file = TUNING_FILE_DEFAULT;
+
+	if (tuning_file) {
+		ret = tuning_load(tuning_file, h->tunings, TUNING_SENSOR_MAX);
+		if (ret < 0) {
+			printf("Failed to load tuning file %s\n", tuning_file);
+			goto err;
+		}
+	} else {
+		ret = tuning_default(h->tunings, TUNING_SENSOR_MAX);
+	}
+	h->desc.tunings = h->tunings;
+	h->desc.tuning_nb = ret;
+
+	ret = discover_dcmipp(&h->desc);
+	if (ret)
+		goto err;
+
+	ret = ccm_table_init(&h->ccm, h->desc.tuning->illuminants, h->desc.tuning->illuminant_nb);
+	if (ret)
+		goto err;
+
+	pthread_mutex_init(&h->lock, NULL);
+	*handle = h;
+
+	return 0;
+
+err:
+	close_dcmipp(&h->desc);
+	free(h);
+	return ret;
+}
+
+void isp_close(struct isp_handle *h)
+{
+	isp_control_stop(h);
+	isp_stream_stop(h);
+	isp_publish_stop(h);
+	isp_roi_stop(h);
+	isp_histo_sched_stop(h);
+	close_dcmipp(&h->desc);
+	pthread_mutex_destroy(&h->lock);
+	free(h);
+}
+
+int isp_get_info(struct isp_handle *h, struct isp_info *info)
+{
+	struct isp_descriptor *isp_desc = &h->desc;
+
+	memset(info, 0, sizeof(*info));
+	snprintf(info->media_dev_name, sizeof(info->media_dev_name), "%s", isp_desc->media_dev_name);
+	snprintf(info->isp_subdev_name, sizeof(info->isp_subdev_name), "%s", isp_desc->isp_subdev_name);
+	snprintf(info->stat_dev_name, sizeof(info->stat_dev_name), "%s", isp_desc->stat_dev_name);
+	snprintf(info->params_dev_name, sizeof(info->params_dev_name), "%s", isp_desc->params_dev_name);
+	snprintf(info->sensor_subdev_name, sizeof(info->sensor_subdev_name), "%s", isp_desc->sensor_subdev_name);
+	snprintf(info->sensor_name, sizeof(info->sensor_name), "%s", isp_desc->tuning->name);
+	snprintf(info->fmt_str, sizeof(info->fmt_str), "%s", isp_desc->fmt_str);
+	info->width = isp_desc->width;
+	info->height = isp_desc->height;
+	info->stats_buf_nb = isp_desc->stats_buf_nb;
+	info->params_buf_nb = isp_desc->params_buf_nb;
+
+	return 0;
+}
+
+int isp_stream_start(struct isp_handle *h)
+{
+	int ret;
+
+	pthread_mutex_lock(&h->lock);
+	ret = h->desc.streaming ? -EBUSY : start_streaming(&h->desc);
+	if (!ret) {
+		h->held = 0;
+		h->scene.changes = 0;
+		h->control_errors = 0;
+	}
+	pthread_mutex_unlock(&h->lock);
+
+	return ret;
+}
+
+void isp_stream_stop(struct isp_handle *h)
+{
+	pthread_mutex_lock(&h->lock);
+	if (h->desc.streaming) {
+		stop_streaming(&h->desc);
+		/* Send the updates made since the last frame */
+		if (!h->desc.state.hold)
+			flush_params(&h->desc);
+	}
+	pthread_mutex_unlock(&h->lock);
+}
+
+void isp_get_counters(struct isp_handle *h, struct isp_counters *counters)
+{
+	pthread_mutex_lock(&h->lock);
+	counters->frames = h->desc.stats_frames;
+	counters->skipped = h->desc.stats_skipped;
+	counters->dropped = h->desc.stats_dropped;
+	memcpy(counters->profile_frames, h->desc.stat_profile.frames, sizeof(counters->profile_frames));
+	counters->stat_bytes = h->desc.stat_profile.bytes;
+	counters->stat_bytes_full = h->desc.stat_profile.bytes_full;
+	counters->held = h->held;
+	counters->scene_changes = h->scene.changes;
+	counters->control_errors = h->control_errors;
+	pthread_mutex_unlock(&h->lock);
+}
+
+int isp_event_fd(struct isp_handle *h)
+{
+	return h->desc.epoll_fd;
+}
+
+/*
+ * Dequeue and handle all the pending events of a subdev
+ */
+static void handle_subdev_events(struct isp_handle *h, int fd)
+{
+	struct isp_descriptor *isp_desc = &h->desc;
+	struct v4l2_event ev;
+
+	do {
+		memset(&ev, 0, sizeof(ev));
+		if (ioctl(fd, VIDIOC_DQEVENT, &ev))
+			return;
+
+		switch (ev.type) {
+		case V4L2_EVENT_FRAME_SYNC:
+			isp_desc->frame_sequence = ev.u.frame_sync.frame_sequence;
+			break;
+		case V4L2_EVENT_CTRL:
+			/* Only the changes made by other applications are reported */
+			if (!(ev.u.ctrl.changes & V4L2_EVENT_CTRL_CH_VALUE))
+				break;
+			sensor_ctrl_changed(&isp_desc->sensor_ctrls, ev.id, ev.u.ctrl.value);
+			if (h->do_aec)
+				aec_control_changed(&h->aec, ev.id, ev.u.ctrl.value, write_frame(isp_desc));
+			break;
+		default:
+			break;
+		}
+	} while (ev.pending);
+}
+
+/*
+ * Handle the events of a subdev, of the stats publication or of the ROI input
+ */
+static void handle_events(struct isp_handle *h, int fd)
+{
+	if (h->publisher && isp_publisher_handle(h->publisher, fd))
+		return;
+
+	if (h->roi_server && isp_roi_server_handle(h->roi_server, fd))
+		return;
+
+	handle_subdev_events(h, fd);
+}
+
+/*
+ * Handle the subdev events already pending, so that the sensor controls shadow copy is up to date
+ * when isp_event_dispatch() is not running. The stats and params devices are only watched while
+ * streaming: nothing is lost for them.
+ */
+static void poll_subdev_events(struct isp_handle *h)
+{
+	struct epoll_event events[ISP_EVENT_MAX];
+	int i, n;
+
+	if (h->desc.streaming)
+		return;
+
+	n = epoll_wait(h->desc.epoll_fd, events, ISP_EVENT_MAX, 0);
+	for (i = 0; i < n; i++)
+		handle_events(h, events[i].data.fd);
+}
+
+/*
+ * Weight the AEC metering and the AWB toward the ROIs still valid, each time they change
+ */
+static void roi_update(struct isp_handle *h)
+{
+	float part[TUNING_METERING_REG_MAX * TUNING_METERING_REG_MAX], total, priority;
+	unsigned int nb = 0, reg_nb = h->histo_cfg.hreg * h->histo_cfg.vreg;
+	struct isp_roi rois[ISP_ROI_ACTIVE_MAX];
+	__u64 generation = 0;
+	struct timespec ts;
+
+	if (h->roi_server) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		nb = isp_roi_server_get(h->roi_server, ts.tv_sec * 1000000000ULL + ts.tv_nsec, rois, &generation);
+	}
+	if (generation == h->roi_generation && nb == h->roi_nb)
+		return;
+	h->roi_generation = generation;
+	h->roi_nb = nb;
+
+	total = roi_map(&h->histo_cfg, rois, nb, part);
+	priority = h->desc.tuning->aec.metering.roi_priority;
+
+	if (h->do_aec) {
+		roi_weights(h->aec.metering.base, reg_nb, part, total, priority, h->aec.metering.weight);
+		h->aec.metering.histo = h->aec.metering.mode != ISP_METERING_AVERAGE || total > 0;
+	}
+	if (h->do_awb && h->awb.roi) {
+		roi_weights(NULL, reg_nb, part, total, priority, h->awb.weight);
+		h->awb.roi_weighted = total > 0;
+	}
+
+	if (h->verbose)
+		printf(">%u ROIs\n", nb);
+}
+
+/*
+ * Parts of the stats needed by all the started algorithms
+ */
+static unsigned int control_parts(const struct isp_handle *h)
+{
+	return (h->do_aec ? aec_parts(&h->aec) : 0) | (h->do_awb ? awb_parts(&h->awb) : 0) |
+	       (h->do_contrast ? STATS_HISTO : 0);
+}
+
+static bool control_settled(const struct isp_handle *h)
+{
+	return (!h->do_aec || (h->aec.converged && !h->aec.pending_nb)) &&
+	       (!h->do_awb || h->awb.stable >= STATS_HOLD_FRAMES) &&
+	       (!h->do_contrast || h->contrast.stable >= STATS_HOLD_FRAMES);
+}
+
+static void scene_detect_ref(struct scene_detect *scene, const struct stm32_dcmipp_stat_buf *stats,
+			     unsigned int parts)
+{
+	if (parts & STATS_PRE)
+		memcpy(scene->average[0], stats->pre.average_RGB, sizeof(scene->average[0]));
+	if (parts & STATS_POST) {
+		memcpy(scene->average[1], stats->post.average_RGB, sizeof(scene->average[1]));
+		scene->bad_pixels = stats->bad_pixel_count;
+	}
+	if (parts & STATS_HISTO)
+		memcpy(scene->histograms, stats->histograms, scene->histo_len * sizeof(scene->histograms[0]));
+	scene->parts |= parts;
+}
+
+/*
+ * Score a frame against the reference, 1 being a scene change
+ */
+static float scene_detect_score(const struct scene_detect *scene, const struct stm32_dcmipp_stat_buf *stats,
+				unsigned int parts)
+{
+	const __u32 *average[2] = { stats->pre.average_RGB, stats->post.average_RGB };
+	unsigned int common = parts & scene->parts, dist = 0, total = 0, l, i;
+	float score = 0, d;
+
+	for (l = 0; l < 2; l++) {
+		if (!(common & (l ? STATS_POST : STATS_PRE)))
+			continue;
+		for (i = 0; i < 3; i++) {
+			d = fabsf(log2f((float)(average[l][i] + SCENE_AVERAGE_FLOOR) /
+					(scene->average[l][i] + SCENE_AVERAGE_FLOOR))) / SCENE_AVERAGE_EV;
+			if (d > score)
+				score = d;
+		}
+	}
+
+	if (common & STATS_POST) {
+		d = fabsf((float)stats->bad_pixel_count - scene->bad_pixels) /
+		    (stats->bad_pixel_count + scene->bad_pixels + SCENE_BAD_PIXEL_FLOOR) / SCENE_BAD_PIXEL_JUMP;
+		if (d > score)
+			score = d;
+	}
+
+	if (common & STATS_HISTO) {
+		for (i = 0; i < scene->histo_len; i++) {
+			dist += abs(stats->histograms[i] - scene->histograms[i]);
+			total += stats->histograms[i] + scene->histograms[i];
+		}
+		d = total ? (float)dist / total / SCENE_HISTO_DIST : 0;
+		if (d > score)
+			score = d;
+	}
+
+	return score;
+}
+
+/*
+ * Score the frame before the algorithms are run: resume them on a scene change, or let the watchdog
+ * run them
+ */
+static void scene_detect_update(struct isp_handle *h, const struct stm32_dcmipp_stat_buf *stats, unsigned int parts)
+{
+	struct scene_detect *scene = &h->scene;
+	float score = scene_detect_score(scene, stats, parts);
+
+	if (!scene->still) {
+		scene->quiet = score < SCENE_STILL_SCORE ? scene->quiet + 1 : 0;
+		scene_detect_ref(scene, stats, parts);
+		return;
+	}
+
+	/* The parts missing from the reference, after a stats profile change */
+	scene_detect_ref(scene, stats, parts & ~scene->parts);
+
+	if (score > 1) {
+		scene->still = false;
+		scene->refresh = false;
+		scene->quiet = 0;
+		scene->changes++;
+		scene_detect_ref(scene, stats, parts);
+		/* Settled again only once measured on the new scene */
+		h->aec.converged = false;
+		h->awb.stable = 0;
+		h->contrast.stable = 0;
+		if (h->verbose)
+			printf(">Scene changed (score %.2f), control resumed\n", score);
+	} else if (++scene->watchdog >= SCENE_WATCHDOG_FRAMES) {
+		scene->refresh = true;
+	}
+}
+
+/*
+ * Gate the algorithms once settled on a still scene, or check them after a watchdog run
+ */
+static void scene_detect_settle(struct isp_handle *h, unsigned int parts)
+{
+	struct scene_detect *scene = &h->scene;
+
+	if (scene->refresh) {
+		/* Wait for a frame with all their stats, with the adaptive stats profile */
+		if ((parts & control_parts(h)) != control_parts(h))
+			return;
+		scene->refresh = false;
+		scene->watchdog = 0;
+		if (!control_settled(h)) {
+			scene->still = false;
+			scene->quiet = 0;
+			if (h->verbose)
+				printf(">Scene drifted, control resumed\n");
+		}
+	} else if (!scene->still && scene->quiet >= SCENE_STILL_FRAMES && control_settled(h)) {
+		scene->still = true;
+		scene->watchdog = 0;
+		if (h->verbose)
+			printf(">Scene still, control gated\n");
+	}
+}
+
+static bool scene_gated(const struct isp_handle *h)
+{
+	return h->do_scene && h->scene.still && !h->scene.refresh;
+}
+
+/*
+ * Hold or resume the settled algorithms, and select the stats profile of the next frames
+ * The profile is changed once at a time, on a frame boundary.
+ */
+static int stats_adapt_update(struct isp_handle *h, const struct stm32_dcmipp_stat_buf *stats, unsigned int parts,
+			      __u32 sequence)
+{
+	const struct stm32_dcmipp_stat_avr_bins *loc[2] = { &stats->pre, &stats->post };
+	struct stat_profile_history *hist = &h->desc.stat_profile;
+	struct stats_adapt *adapt = &h->adapt;
+	enum v4l2_isp_stat_profile profile;
+	unsigned int needs = 0, l;
+
+	if (h->do_scene) {
+		adapt->hold = scene_gated(h);
+	} else if (adapt->hold) {
+		for (l = 0; l < 2; l++) {
+			if (!(parts & (l ? STATS_POST : STATS_PRE)))
+				continue;
+			if (!adapt->ref[l])
+				adapt->ref[l] = stats_adapt_lum(loc[l]);
+			else if (fabsf(log2f(stats_adapt_lum(loc[l]) / adapt->ref[l])) > STATS_WATCH_EV)
+				adapt->hold = false;
+		}
+		/* Settled again only once measured on the new scene */
+		if (!adapt->hold) {
+			h->aec.converged = false;
+			h->contrast.stable = 0;
+			if (h->verbose)
+				printf(">Luminance changed, control resumed\n");
+		}
+	} else if ((h->do_aec || h->do_contrast) && (!h->do_aec || (h->aec.converged && !h->aec.pending_nb)) &&
+		   (!h->do_contrast || h->contrast.stable >= STATS_HOLD_FRAMES)) {
+		adapt->hold = true;
+		for (l = 0; l < 2; l++)
+			adapt->ref[l] = parts & (l ? STATS_POST : STATS_PRE) ? stats_adapt_lum(loc[l]) : 0;
+		if (h->verbose)
+			printf(">Control settled, held\n");
+	}
+
+	/* The stats publication and the histogram scheduler need all the stats */
+	if (h->publisher || h->histo_sched)
+		needs = STATS_PRE | STATS_POST | STATS_HISTO;
+	if (h->do_awb && !scene_gated(h))
+		needs |= awb_parts(&h->awb);
+	if (h->do_aec && !adapt->hold)
+		needs |= aec_parts(&h->aec);
+	if (h->do_contrast && !adapt->hold)
+		needs |= STATS_HISTO;
+	/* At least an average to watch the luminance */
+	if (!(needs & (STATS_PRE | STATS_POST)))
+		needs |= STATS_POST;
+
+	if (!(needs & ~STATS_PRE))
+		profile = V4L2_STAT_PROFILE_AVERAGE_PRE;
+	else if (!(needs & ~STATS_POST))
+		profile = V4L2_STAT_PROFILE_AVERAGE_POST;
+	else
+		profile = V4L2_STAT_PROFILE_FULL;
+
+	if (profile == hist->profile || (__s32)(sequence - hist->from) < 0)
+		return 0;
+
+	if (h->verbose)
+		printf(">Stats profile %d\n", profile);
+
+	return set_stat_profile(&h->desc, profile);
+}
+
+/*
+ * Log and count a failure of a control algorithm: the other ones still run on the frame
+ */
+static void control_error(struct isp_handle *h, const char *algo, __u32 sequence, int err)
+{
+	h->control_errors++;
+	printf("%s failed on frame %u (%d)\n", algo, sequence, err);
+}
+
+/*
+ * Wait for the devices events and handle them
+ *
+ * The subdev events are handled first, then the params buffers consumed by the ISP are reclaimed,
+ * and finally the started control algorithms are run on the most recent stats, before the buffer
+ * is given back to the ISP. The stats are copied in 'stats' if not NULL.
+ * A failed algorithm is logged and counted (see isp_counters) without stopping the processing.
+ * A negative timeout waits forever.
+ *
+ * Return 1 if new stats have been processed, 0 if not, or a negative error (-EINTR if interrupted
+ * by a signal).
+ */
+int isp_event_dispatch(struct isp_handle *h, int timeout_ms, struct isp_stats *stats)
+{
+	struct isp_descriptor *isp_desc = &h->desc;
+	struct epoll_event events[ISP_EVENT_MAX];
+	struct stm32_dcmipp_stat_buf *buf_stats;
+	bool stat_ready = false, params_ready = false;
+	struct v4l2_buffer buf;
+	__s32 exposure, gain, histo_id;
+	unsigned int parts;
+	bool gated, held;
+	int i, n, err, ret = 0;
+
+	/* Wait without holding the lock, so that params can be submitted meanwhile */
+	n = epoll_wait(isp_desc->epoll_fd, events, ISP_EVENT_MAX, timeout_ms);
+	if (n < 0)
+		return -errno;
+
+	pthread_mutex_lock(&h->lock);
+
+	for (i = 0; i < n; i++) {
+		if (events[i].data.fd == isp_desc->stat_fd)
+			stat_ready = true;
+		else if (events[i].data.fd == isp_desc->params_fd)
+			params_ready = true;
+		else
+			handle_events(h, events[i].data.fd);
+	}
+
+	/* The scheduled histograms of a frame are tagged from the params buffers consumed up to it */
+	if ((params_ready || (stat_ready && h->histo_sched)) && isp_desc->streaming)
+		ret = reclaim_params(isp_desc, false);
+
+	if (!ret && stat_ready && isp_desc->streaming) {
+		/* Another thread may have taken the buff meanwhile */
+		ret = dequeue_stat(isp_desc, &buf);
+		if (ret == -EAGAIN) {
+			ret = 0;
+			goto out;
+		}
+		if (ret)
+			goto out;
+
+		buf_stats = isp_desc->stats[buf.index];
+
+		/* Settings written by other applications, then active on this frame */
+		sensor_history_push(isp_desc, write_frame(isp_desc));
+		sensor_history_get(isp_desc, buf.sequence, &exposure, &gain);
+		histo_id = histo_history_get(isp_desc, buf.sequence);
+		if (stats) {
+			stats->sequence = buf.sequence;
+			stats->timestamp = buf_timestamp(&buf);
+			stats->exposure = exposure;
+			stats->gain = gain;
+			stats->histo_id = h->histo_sched ? histo_id : ISP_HISTO_ID_NONE;
+			stats->buf = *buf_stats;
+		}
+		if (h->histo_sched && histo_id >= 0)
+			histo_sched_store(h->histo_sched, histo_id, buf_stats, buf.sequence, buf_timestamp(&buf));
+		if (h->publisher)
+			isp_publisher_write(h->publisher, buf.sequence, buf_timestamp(&buf), exposure, gain, buf_stats);
+
+		if (h->do_roi)
+			roi_update(h);
+
+		/* Each algorithm only runs on the frames having the parts of the stats it needs */
+		parts = stat_profile_get(isp_desc, buf.sequence);
+		if (h->do_scene)
+			scene_detect_update(h, buf_stats, parts);
+		gated = scene_gated(h);
+		held = gated || (h->do_adapt && h->adapt.hold);
+		if (held)
+			h->held++;
+
+		if (h->do_aec && !held && (parts & aec_parts(&h->aec)) == aec_parts(&h->aec)) {
+			err = aec_process(&h->aec, buf_stats, buf.sequence, buf_timestamp(&buf), write_frame(isp_desc),
+					  h->verbose);
+			if (err)
+				control_error(h, "AEC", buf.sequence, err);
+		}
+
+		if (h->do_awb && !gated && (parts & awb_parts(&h->awb)) == awb_parts(&h->awb)) {
+			err = awb_process(isp_desc, &h->awb, buf_stats, AWB_SMOOTHING, h->verbose);
+			if (err)
+				control_error(h, "AWB", buf.sequence, err);
+		}
+
+		if (h->do_contrast && !held && (parts & STATS_HISTO)) {
+			err = contrast_process(isp_desc, &h->contrast, buf_stats, isp_desc->tuning->contrast.smoothing,
+					       h->verbose);
+			if (err)
+				control_error(h, "Contrast", buf.sequence, err);
+		}
+
+		if (h->do_scene)
+			scene_detect_settle(h, parts);
+
+		if (h->do_adapt) {
+			err = stats_adapt_update(h, buf_stats, parts, buf.sequence);
+			if (err)
+				control_error(h, "Stats profile selection", buf.sequence, err);
+		}
+
+		if (h->histo_sched) {
+			err = histo_sched_next(isp_desc, h->histo_sched);
+			if (err)
+				control_error(h, "Histogram scheduler", buf.sequence, err);
+		}
+
+		sensor_history_push(isp_desc, write_frame(isp_desc));
+
+		if (queue_stat(isp_desc, &buf))
+			ret = -EIO;
+
+		/* One params buffer for all the updates made since the previous frame */
+		if (!ret)
+			ret = flush_params(isp_desc);
+		if (!ret)
+			ret = 1;
+	}
+
+out:
+	pthread_mutex_unlock(&h->lock);
+
+	return ret;
+}
+
+/*
+ * Get a copy of the stats of a single frame, when not streaming
+ */
+int isp_stat_read(struct isp_handle *h, enum v4l2_isp_stat_profile profile, struct isp_stats *stats)
+{
+	struct stm32_dcmipp_stat_buf *buf;
+	int ret;
+
+	pthread_mutex_lock(&h->lock);
+	ret = get_stat(&h->desc, &buf, profile, &stats->timestamp);
+	if (!ret) {
+		stats->sequence = 0;
+		stats->histo_id = ISP_HISTO_ID_NONE;
+		stats->exposure = sensor_ctrl_get(&h->desc.sensor_ctrls, V4L2_CID_EXPOSURE);
+		stats->gain = sensor_ctrl_get(&h->desc.sensor_ctrls, V4L2_CID_ANALOGUE_GAIN);
+		stats->buf = *buf;
+	}
+	pthread_mutex_unlock(&h->lock);
+
+	return ret;
+}
+
+int isp_set_stat_profile(struct isp_handle *h, enum v4l2_isp_stat_profile profile)
+{
+	int ret;
+
+	pthread_mutex_lock(&h->lock);
+	ret = set_stat_profile(&h->desc, profile);
+	pthread_mutex_unlock(&h->lock);
+
+	return ret;
+}
+
+int isp_params_submit(struct isp_handle *h, const struct stm32_dcmipp_params_cfg *params)
+{
+	int ret;
+
+	pthread_mutex_lock(&h->lock);
+	ret = apply_params(&h->desc, params);
+	pthread_mutex_unlock(&h->lock);
+
+	return ret;
+}
+
+/*
+ * Hold the params updates until isp_params_commit(), to send them in a single params buffer
+ */
+void isp_params_hold(struct isp_handle *h)
+{
+	pthread_mutex_lock(&h->lock);
+	h->desc.state.hold = true;
+	pthread_mutex_unlock(&h->lock);
+}
+
+int isp_params_commit(struct isp_handle *h)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&h->lock);
+	h->desc.state.hold = false;
+	if (!h->desc.streaming)
+		ret = flush_params(&h->desc);
+	pthread_mutex_unlock(&h->lock);
+
+	return ret;
+}
+
+int isp_set_contrast(struct isp_handle *h, int type)
+{
+	int ret;
+
+	pthread_mutex_lock(&h->lock);
+	ret = set_contrast(&h->desc, type, h->verbose);
+	pthread_mutex_unlock(&h->lock);
+
+	return ret;
+}
+
+int isp_set_illuminant(struct isp_handle *h, int id)
+{
+	int ret;
+
+	pthread_mutex_lock(&h->lock);
+	ret = set_profile(&h->desc, &h->ccm, id);
+	pthread_mutex_unlock(&h->lock);
+
+	return ret;
+}
+
+int isp_set_histogram(struct isp_handle *h, const struct stm32_dcmipp_isp_histo_cfg *cfg)
+{
+	int ret;
+
+	pthread_mutex_lock(&h->lock);
+	ret = h->histo_sched ? -EBUSY : set_histogram(&h->desc, cfg);
+	pthread_mutex_unlock(&h->lock);
+
+	return ret;
+}
+
+/*
+ * Converge the sensor gain and exposure, when not streaming
+ */
+int isp_aec_run(struct isp_handle *h)
+{
+	int ret;
+
+	pthread_mutex_lock(&h->lock);
+	poll_subdev_events(h);
+	ret = set_sensor_gain_exposure(&h->desc, h->verbose);
+	pthread_mutex_unlock(&h->lock);
+
+	return ret;
+}
+
+/*
+ * Apply the white balance from a single measurement, when not streaming
+ */
+int isp_awb_run(struct isp_handle *h, int mode)
+{
+	int ret;
+
+	pthread_mutex_lock(&h->lock);
+	ret = set_white_balance(&h->desc, &h->ccm, mode, h->verbose);
+	pthread_mutex_unlock(&h->lock);
+
+	return ret;
+}
+
+int isp_control_start(struct isp_handle *h, const struct isp_control_cfg *cfg)
+{
+	bool roi_awb = cfg->roi && cfg->awb && cfg->awb_mode == ISP_AWB_GRAY_WORLD;
+	bool lum_histo = cfg->contrast || (cfg->aec && (cfg->metering != ISP_METERING_AVERAGE || cfg->roi)) || roi_awb;
+	bool control_histo = lum_histo || (cfg->awb && cfg->awb_mode == ISP_AWB_WHITE_PATCH);
+	struct stm32_dcmipp_params_cfg histo_prev = {
+		.module_cfg_update = STM32_DCMIPP_ISP_HISTO,
+	};
+	__s32 histo_id;
+	int ret = 0;
+
+	pthread_mutex_lock(&h->lock);
+
+	if (h->do_aec || h->do_awb || h->do_contrast) {
+		ret = -EBUSY;
+		goto unlock;
+	}
+
+	if (control_histo && h->histo_sched) {
+		printf("The histograms are used by the scheduler\n");
+		ret = -EBUSY;
+		goto unlock;
+	}
+
+	/* To give the histograms back as they were if the start fails */
+	histo_prev.ctrls.histo_cfg = h->desc.state.staged.histo_cfg;
+	histo_id = h->desc.state.histo_id;
+
+	/* The metering, the adaptive contrast and the ROIs share the histograms */
+	if (lum_histo) {
+		if (cfg->awb && cfg->awb_mode == ISP_AWB_WHITE_PATCH) {
+			printf("The histograms cannot be shared with the white patch AWB\n");
+			ret = -EBUSY;
+			goto out;
+		}
+		ret = lum_histo_config(&h->desc, roi_awb, &h->histo_cfg);
+		if (ret)
+			goto out;
+	}
+
+	if (cfg->awb) {
+		ret = awb_init(&h->desc, &h->awb, &h->ccm, cfg->awb_mode);
+		if (ret)
+			goto out;
+		if (roi_awb) {
+			h->awb.roi = true;
+			h->awb.histo_cfg = h->histo_cfg;
+		}
+	}
+
+	if (cfg->aec) {
+		poll_subdev_events(h);
+		ret = aec_init(&h->desc, &h->aec);
+		if (!ret)
+			ret = aec_flicker_init(&h->aec, cfg->antiflicker);
+		if (!ret)
+			ret = aec_metering_init(&h->aec.metering, cfg->metering, cfg->roi, &h->desc.tuning->aec.metering,
+						&h->histo_cfg);
+		if (ret)
+			goto out;
+	}
+
+	if (cfg->contrast)
+		contrast_init(&h->contrast, &h->desc.tuning->contrast, &h->histo_cfg);
+
+	if (lum_histo) {
+		ret = set_histogram(&h->desc, &h->histo_cfg);
+		if (ret)
+			goto out;
+	}
+
+	h->do_aec = cfg->aec;
+	h->do_awb = cfg->awb;
+	h->do_contrast = cfg->contrast;
+	h->do_roi = cfg->roi && lum_histo;
+	h->do_adapt = cfg->adaptive_stats;
+	h->adapt.hold = false;
+	h->do_scene = cfg->scene_gate;
+	memset(&h->scene, 0, sizeof(h->scene));
+	/* The histograms are compared when configured by the algorithms */
+	if (lum_histo)
+		h->scene.histo_len = isp_histo_nb(&h->histo_cfg) * isp_histo_bin_nb(&h->histo_cfg);
+	else if (cfg->awb && cfg->awb_mode == ISP_AWB_WHITE_PATCH)
+		h->scene.histo_len = isp_histo_nb(&h->awb.histo_cfg) * isp_histo_bin_nb(&h->awb.histo_cfg);
+	/* Weight the new algorithms toward the ROIs already received */
+	h->roi_nb = UINT_MAX;
+	h->control_histo = control_histo;
+
+out:
+	if (ret && memcmp(&h->desc.state.staged.histo_cfg, &histo_prev.ctrls.histo_cfg,
+			  sizeof(histo_prev.ctrls.histo_cfg))) {
+		isp_state_stage(&h->desc.state, &histo_prev);
+		h->desc.state.histo_id = histo_id;
+	}
+unlock:
+	pthread_mutex_unlock(&h->lock);
+	return ret;
+}
+
+/*
+ * Publish the stats of each frame dispatched while streaming to the processes connecting to the
+ * Unix socket 'socket_path'. The connections are handled by isp_event_dispatch().
+ */
+int isp_publish_start(struct isp_handle *h, const char *socket_path)
+{
+	int ret;
+
+	pthread_mutex_lock(&h->lock);
+	ret = h->publisher ? -EBUSY : isp_publisher_create(socket_path, h->desc.epoll_fd, &h->publisher);
+	pthread_mutex_unlock(&h->lock);
+
+	return ret;
+}
+
+void isp_publish_stop(struct isp_handle *h)
+{
+	pthread_mutex_lock(&h->lock);
+	if (h->publisher) {
+		isp_publisher_destroy(h->publisher);
+		h->publisher = NULL;
+	}
+	pthread_mutex_unlock(&h->lock);
+}
+
+/*
+ * Rotate the histogram configurations of 'cfg' across the frames while streaming
+ * The histograms block cannot be shared with the control algorithms using it.
+ */
+int isp_histo_sched_start(struct isp_handle *h, const struct isp_histo_sched_cfg *cfg)
+{
+	struct histo_sched *sched;
+	unsigned int i;
+	int ret;
+
+	ret = histo_sched_check(cfg);
+	if (ret) {
+		printf("Invalid histogram schedule\n");
+		return ret;
+	}
+
+	pthread_mutex_lock(&h->lock);
+
+	if (h->histo_sched || h->control_histo) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	sched = calloc(1, sizeof(*sched));
+	if (!sched) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	sched->cfg = *cfg;
+	for (i = 0; i < cfg->cfg_nb; i++)
+		sched->cache[i].period = histo_sched_period(cfg, i);
+
+	ret = histo_sched_next(&h->desc, sched);
+	if (ret) {
+		free(sched);
+		goto out;
+	}
+	h->histo_sched = sched;
+
+out:
+	pthread_mutex_unlock(&h->lock);
+	return ret;
+}
+
+void isp_histo_sched_stop(struct isp_handle *h)
+{
+	pthread_mutex_lock(&h->lock);
+	free(h->histo_sched);
+	h->histo_sched = NULL;
+	pthread_mutex_unlock(&h->lock);
+}
+
+/*
+ * Get the last histograms of the scheduled configuration 'id'
+ * Return -EAGAIN if none was captured yet.
+ */
+int isp_histo_sched_get(struct isp_handle *h, unsigned int id, struct isp_histo_entry *entry)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&h->lock);
+	if (!h->histo_sched || id >= h->histo_sched->cfg.cfg_nb)
+		ret = -EINVAL;
+	else if (!h->histo_sched->valid[id])
+		ret = -EAGAIN;
+	else
+		*entry = h->histo_sched->cache[id];
+	pthread_mutex_unlock(&h->lock);
+
+	return ret;
+}
+
+/*
+ * Receive the regions of interest of the processes connecting to the Unix socket 'socket_path' (see
+ * isp-roi.h). The connections are handled by isp_event_dispatch(), and the ROIs are used by the control
+ * algorithms started with the 'roi' option.
+ */
+int isp_roi_start(struct isp_handle *h, const char *socket_path)
+{
+	int ret;
+
+	pthread_mutex_lock(&h->lock);
+	ret = h->roi_server ? -EBUSY : isp_roi_server_create(socket_path, h->desc.epoll_fd, &h->roi_server);
+	pthread_mutex_unlock(&h->lock);
+
+	return ret;
+}
+
+void isp_roi_stop(struct isp_handle *h)
+{
+	pthread_mutex_lock(&h->lock);
+	if (h->roi_server) {
+		isp_roi_server_destroy(h->roi_server);
+		h->roi_server = NULL;
+	}
+	pthread_mutex_unlock(&h->lock);
+}
+
+void isp_control_stop(struct isp_handle *h)
+{
+	pthread_mutex_lock(&h->lock);
+
+	h->do_aec = false;
+	h->do_awb = false;
+	h->do_contrast = false;
+	h->do_roi = false;
+	h->control_histo = false;
+	h->do_scene = false;
+
+	/* Give the full stats back to the application */
+	if (h->do_adapt && h->desc.stat_profile.profile != V4L2_STAT_PROFILE_FULL)
+		set_stat_profile(&h->desc, V4L2_STAT_PROFILE_FULL);
+	h->do_adapt = false;
+
+	pthread_mutex_unlock(&h->lock);
+}
@@ -0,0 +1,254 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (C) 2026 ST Microelectronics.
+ */
+
+#ifndef LIBDCMIPP_ISP_H
+#define LIBDCMIPP_ISP_H
+
+#include <stdbool.h>
+#include <linux/types.h>
+
+#include "v4l2-controls.h"
+#include "stm32-dcmipp-config.h"
+
+/*
+ * DCMIPP ISP control library
+ *
+ * An isp_handle is opened once: it discovers the DCMIPP devices, loads the sensor tuning and
+ * keeps the devices open until it is closed. All the functions taking a handle can be called
+ * from several threads. Functions return 0 on success or a negative error.
+ */
+
+#define ISP_NAME_LEN		32
+
+/* Depth of the stats and params meta buffer rings */
+#define ISP_BUF_NB_MIN		2
+#define ISP_BUF_NB_MAX		4
+#define ISP_BUF_NB_DEFAULT	3
+
+/* Auto white balance algorithms */
+#define ISP_AWB_GRAY_WORLD	0
+#define ISP_AWB_WHITE_PATCH	1
+
+/* Auto exposure metering modes, weighting the histogram regions of the frame (see tuning.h) */
+#define ISP_METERING_AVERAGE	0
+#define ISP_METERING_CENTER	1
+#define ISP_METERING_SPOT	2
+#define ISP_METERING_MATRIX	3
+
+/* Auto exposure anti-flicker modes, under lighting powered by the mains (see tuning.h for the line time) */
+#define ISP_ANTIFLICKER_OFF	0
+#define ISP_ANTIFLICKER_AUTO	1
+#define ISP_ANTIFLICKER_50HZ	2
+#define ISP_ANTIFLICKER_60HZ	3
+
+/* Contrast types of isp_set_contrast() */
+#define ISP_CONTRAST_NONE	0
+#define ISP_CONTRAST_50		1
+#define ISP_CONTRAST_200	2
+#define ISP_CONTRAST_DYNAMIC	3
+#define ISP_CONTRAST_ADAPTIVE	4
+
+struct isp_handle;
+
+/*
+ * Open configuration
+ *
+ * @tuning_file: sensor tuning file, NULL for the default file if present, else the built-in descriptors
+ * @buf_nb: number of stats and params buffers, 0 for ISP_BUF_NB_DEFAULT
+ * @cache: use the device discovery cache, saved in /var/cache
+ * @verbose: trace the control algorithms
+ */
+struct isp_open_cfg {
+	const char *tuning_file;
+	int buf_nb;
+	bool cache;
+	bool verbose;
+};
+
+/*
+ * Devices and frame information
+ */
+struct isp_info {
+	char media_dev_name[ISP_NAME_LEN];
+	char isp_subdev_name[ISP_NAME_LEN];
+	char stat_dev_name[ISP_NAME_LEN];
+	char params_dev_name[ISP_NAME_LEN];
+	char sensor_subdev_name[ISP_NAME_LEN];
+	char sensor_name[ISP_NAME_LEN];
+	int width;
+	int height;
+	char fmt_str[ISP_NAME_LEN];
+	int stats_buf_nb;
+	int params_buf_nb;
+};
+
+/*
+ * Statistics of one frame
+ *
+ * @sequence: frame sequence number
+ * @timestamp: capture time (ns, CLOCK_MONOTONIC)
+ * @exposure, @gain: sensor settings active on the frame
+ * @histo_id: scheduled histogram configuration of the frame, ISP_HISTO_ID_NONE if not scheduled
+ */
+struct isp_stats {
+	__u32 sequence;
+	__u64 timestamp;
+	__s32 exposure;
+	__s32 gain;
+	__s32 histo_id;
+	struct stm32_dcmipp_stat_buf buf;
+};
+
+/*
+ * Streaming counters, reset on each isp_stream_start()
+ *
+ * @frames: stats buffers dequeued
+ * @skipped: stats buffers given back unread to catch up with the most recent one
+ * @dropped: frames without stats because the ISP had no buffer to fill
+ * @profile_frames: stats buffers filled with each profile (V4L2_STAT_PROFILE_*)
+ * @stat_bytes: stats written by the ISP, estimated from the profile of each buffer
+ * @stat_bytes_full: the same if all the buffers had been filled with the full profile
+ * @held: frames on which the settled control algorithms were not run (see isp_control_cfg)
+ * @scene_changes: scene changes resuming the control algorithms gated by the scene detector
+ * @control_errors: failures of the control algorithms, the frames being processed anyway
+ */
+struct isp_counters {
+	unsigned int frames;
+	unsigned int skipped;
+	unsigned int dropped;
+	unsigned int profile_frames[V4L2_STAT_PROFILE_AVERAGE_POST + 1];
+	__u64 stat_bytes;
+	__u64 stat_bytes_full;
+	unsigned int held;
+	unsigned int scene_changes;
+	unsigned int control_errors;
+};
+
+/*
+ * Control algorithms run by isp_event_dispatch()
+ *
+ * @metering: ISP_METERING_* mode of the AEC
+ * @antiflicker: ISP_ANTIFLICKER_* mode of the AEC: once a flicker is detected (or given), the exposure
+ *   time is a multiple of its period, the rest of the exposure being taken by the gain
+ * @contrast: adaptive contrast, updated from the luminance histograms of each frame
+ * @roi: weight the AEC metering and the gray world AWB toward the ROIs received (see isp_roi_start())
+ * @adaptive_stats: select on each frame the cheapest stats profile feeding the algorithms, holding the
+ *   AEC and the adaptive contrast once settled until the luminance changes. The stats given by
+ *   isp_event_dispatch() then miss the parts which are not needed.
+ * @scene_gate: run the AEC, the AWB and the adaptive contrast only when a scene change is detected
+ *   on the stats (averages, histograms, bad pixel count), once they have settled on a still scene.
+ *   They still run at a low rate meanwhile.
+ *
+ * The metering modes other than average, the adaptive contrast and the ROIs use the histogram block,
+ * which cannot be shared with the white patch AWB.
+ */
+struct isp_control_cfg {
+	bool aec;
+	bool awb;
+	int awb_mode;
+	int metering;
+	int antiflicker;
+	bool contrast;
+	bool roi;
+	bool adaptive_stats;
+	bool scene_gate;
+};
+
+int isp_open(const struct isp_open_cfg *cfg, struct isp_handle **handle);
+void isp_close(struct isp_handle *handle);
+int isp_get_info(struct isp_handle *handle, struct isp_info *info);
+
+/*
+ * Continuous streaming of the stats and params queues
+ *
+ * All the devices events are multiplexed on a single file descriptor (isp_event_fd), which can be
+ * added to the poll loop of the application. isp_event_dispatch() handles them, running the started
+ * control algorithms on each new stats.
+ */
+int isp_stream_start(struct isp_handle *handle);
+void isp_stream_stop(struct isp_handle *handle);
+void isp_get_counters(struct isp_handle *handle, struct isp_counters *counters);
+int isp_event_fd(struct isp_handle *handle);
+int isp_event_dispatch(struct isp_handle *handle, int timeout_ms, struct isp_stats *stats);
+
+/*
+ * Stats and params, streaming or not
+ *
+ * The library keeps the configuration of all the ISP blocks: only the modules which really change
+ * are sent. While streaming, all the updates made during a frame are sent together in a single
+ * params buffer. Otherwise they are sent right away, or on isp_params_commit() if held.
+ */
+int isp_stat_read(struct isp_handle *handle, enum v4l2_isp_stat_profile profile, struct isp_stats *stats);
+int isp_set_stat_profile(struct isp_handle *handle, enum v4l2_isp_stat_profile profile);
+int isp_params_submit(struct isp_handle *handle, const struct stm32_dcmipp_params_cfg *params);
+void isp_params_hold(struct isp_handle *handle);
+int isp_params_commit(struct isp_handle *handle);
+
+/* Single settings */
+int isp_set_contrast(struct isp_handle *handle, int type);
+int isp_set_illuminant(struct isp_handle *handle, int id);
+int isp_set_histogram(struct isp_handle *handle, const struct stm32_dcmipp_isp_histo_cfg *cfg);
+int isp_aec_run(struct isp_handle *handle);
+int isp_awb_run(struct isp_handle *handle, int mode);
+
+/* Control algorithms run by isp_event_dispatch() on each frame */
+int isp_control_start(struct isp_handle *handle, const struct isp_control_cfg *cfg);
+void isp_control_stop(struct isp_handle *handle);
+
+/*
+ * Publication of the stats of each frame to other processes, while streaming (see isp-publish.h)
+ * The Unix socket connections are handled by isp_event_dispatch().
+ */
+int isp_publish_start(struct isp_handle *handle, const char *socket_path);
+void isp_publish_stop(struct isp_handle *handle);
+
+/*
+ * Regions of interest given by other processes, while streaming (see isp-roi.h)
+ * The Unix socket connections are handled by isp_event_dispatch().
+ */
+int isp_roi_start(struct isp_handle *handle, const char *socket_path);
+void isp_roi_stop(struct isp_handle *handle);
+
+/*
+ * Histogram scheduler, while streaming
+ *
+ * The histogram block takes a single configuration at a time. The scheduler gives each frame the
+ * next configuration of a pattern repeated in a loop, tags the stats of each frame with the
+ * configuration which produced its histograms (isp_stats.histo_id), and keeps the last histograms
+ * of each configuration.
+ */
+#define ISP_HISTO_SCHED_CFG_MAX		8
+#define ISP_HISTO_SCHED_PATTERN_MAX	32
+#define ISP_HISTO_ID_NONE		(-1)
+
+/*
+ * @cfg: histogram configurations, all different, each one used in the pattern
+ * @pattern: index in 'cfg' of the configuration of each frame
+ */
+struct isp_histo_sched_cfg {
+	unsigned int cfg_nb;
+	struct stm32_dcmipp_isp_histo_cfg cfg[ISP_HISTO_SCHED_CFG_MAX];
+	unsigned int pattern_len;
+	__u8 pattern[ISP_HISTO_SCHED_PATTERN_MAX];
+};
+
+/*
+ * @sequence, @timestamp: frame of the histograms
+ * @period: maximum number of frames between two refreshes
+ */
+struct isp_histo_entry {
+	__u32 sequence;
+	__u32 period;
+	__u64 timestamp;
+	__u16 histograms[STM32_DCMIPP_HISTO_BIN_MAX];
+};
+
+int isp_histo_sched_start(struct isp_handle *handle, const struct isp_histo_sched_cfg *cfg);
+void isp_histo_sched_stop(struct isp_handle *handle);
+int isp_histo_sched_get(struct isp_handle *handle, unsigned int id, struct isp_histo_entry *entry);
+
+int isp_luminance(const __u32 rgb[3]);
+
+#endif
@@ -0,0 +1,590 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (C) 2026 ST Microelectronics.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tuning.h"
+
+/*
+ * Minimal JSON parser, enough for the tuning file (no unicode escapes)
+ * The string values and member names point into the file buffer, which is modified in place.
+ */
+enum json_type {
+	JSON_NULL,
+	JSON_BOOL,
+	JSON_NUMBER,
+	JSON_STRING,
+	JSON_ARRAY,
+	JSON_OBJECT,
+};
+
+struct json_node {
+	enum json_type type;
+	const char *key;
+	const char *str;
+	double num;
+	struct json_node *child;
+	struct json_node *next;
+};
+
+struct json_parser {
+	char *p;
+	int line;
+};
+
+static struct json_node *json_parse_value(struct json_parser *js);
+
+static void json_free(struct json_node *node)
+{
+	struct json_node *next;
+
+	while (node) {
+		next = node->next;
+		json_free(node->child);
+		free(node);
+		node = next;
+	}
+}
+
+static void json_skip(struct json_parser *js)
+{
+	while (isspace((unsigned char)*js->p)) {
+		if (*js->p == '\n')
+			js->line++;
+		js->p++;
+	}
+}
+
+static char *json_parse_string(struct json_parser *js)
+{
+	char *start, *out;
+
+	if (*js->p != '"')
+		return NULL;
+
+	start = out = ++js->p;
+	while (*js->p && *js->p != '"') {
+		if (*js->p == '\\') {
+			js->p++;
+			switch (*js->p) {
+			case 'n':
+				*out++ = '\n';
+				break;
+			case 't':
+				*out++ = '\t';
+				break;
+			case '"':
+			case '\\':
+			case '/':
+				*out++ = *js->p;
+				break;
+			default:
+				return NULL;
+			}
+			js->p++;
+		} else {
+			*out++ = *js->p++;
+		}
+	}
+
+	if (*js->p != '"')
+		return NULL;
+	js->p++;
+	*out = '\0';
+
+	return start;
+}
+
+/*
+ * Parse the members of an object or the elements of an array
+ */
+static int json_parse_list(struct json_parser *js, struct json_node *parent, char end)
+{
+	struct json_node **tail = &parent->child, *node;
+	const char *key = NULL;
+
+	js->p++;
+	json_skip(js);
+	if (*js->p == end) {
+		js->p++;
+		return 0;
+	}
+
+	for (;;) {
+		json_skip(js);
+		if (parent->type == JSON_OBJECT) {
+			key = json_parse_string(js);
+			if (!key)
+				return -EINVAL;
+			json_skip(js);
+			if (*js->p++ != ':')
+				return -EINVAL;
+		}
+
+		node = json_parse_value(js);
+		if (!node)
+			return -EINVAL;
+		node->key = key;
+		*tail = node;
+		tail = &node->next;
+
+		json_skip(js);
+		if (*js->p == ',') {
+			js->p++;
+			continue;
+		}
+		if (*js->p != end)
+			return -EINVAL;
+		js->p++;
+		return 0;
+	}
+}
+
+static struct json_node *json_parse_value(struct json_parser *js)
+{
+	struct json_node *node;
+	char *end;
+
+	json_skip(js);
+
+	node = calloc(1, sizeof(*node));
+	if (!node)
+		return NULL;
+
+	if (*js->p == '{' || *js->p == '[') {
+		node->type = *js->p == '{' ? JSON_OBJECT : JSON_ARRAY;
+		if (json_parse_list(js, node, *js->p == '{' ? '}' : ']'))
+			goto err;
+	} else if (*js->p == '"') {
+		node->type = JSON_STRING;
+		node->str = json_parse_string(js);
+		if (!node->str)
+			goto err;
+	} else if (!strncmp(js->p, "true", 4) || !strncmp(js->p, "false", 5)) {
+		node->type = JSON_BOOL;
+		node->num = *js->p == 't';
+		js->p += *js->p == 't' ? 4 : 5;
+	} else if (!strncmp(js->p, "null", 4)) {
+		node->type = JSON_NULL;
+		js->p += 4;
+	} else {
+		node->type = JSON_NUMBER;
+		node->num = strtod(js->p, &end);
+		if (end == js->p)
+			goto err;
+		js->p = end;
+	}
+
+	return node;
+
+err:
+	json_free(node);
+	return NULL;
+}
+
+static struct json_node *json_get(struct json_node *obj, const char *key)
+{
+	struct json_node *node;
+
+	if (!obj || obj->type != JSON_OBJECT)
+		return NULL;
+
+	for (node = obj->child; node; node = node->next)
+		if (!strcmp(node->key, key))
+			return node;
+
+	return NULL;
+}
+
+static void json_get_int(struct json_node *obj, const char *key, int *value)
+{
+	struct json_node *node = json_get(obj, key);
+
+	if (node && node->type == JSON_NUMBER)
+		*value = node->num;
+}
+
+static void json_get_float(struct json_node *obj, const char *key, float *value)
+{
+	struct json_node *node = json_get(obj, key);
+
+	if (node && node->type == JSON_NUMBER)
+		*value = node->num;
+}
+
+static void json_get_str(struct json_node *obj, const char *key, char *value, size_t len)
+{
+	struct json_node *node = json_get(obj, key);
+
+	if (node && node->type == JSON_STRING)
+		snprintf(value, len, "%s", node->str);
+}
+
+/*
+ * Read an array of numbers, return the number of values read or -EINVAL
+ */
+static int json_get_floats(struct json_node *array, float *values, int max)
+{
+	struct json_node *node;
+	int nb = 0;
+
+	if (!array || array->type != JSON_ARRAY)
+		return -EINVAL;
+
+	for (node = array->child; node; node = node->next) {
+		if (node->type != JSON_NUMBER || nb == max)
+			return -EINVAL;
+		values[nb++] = node->num;
+	}
+
+	return nb;
+}
+
+/*
+ * Fill the gain code to dB table from a constant step
+ */
+static void tuning_gain_linear(struct sensor_tuning *tuning, float db_unit)
+{
+	int i;
+
+	for (i = 0; i <= TUNING_GAIN_CODE_MAX; i++)
+		tuning->gain_db[i] = i * db_unit;
+}
+
+/*
+ * Built-in descriptor of the IMX335 sensor
+ */
+static void tuning_imx335(struct sensor_tuning *tuning)
+{
+	const float matrix[3][3] = { { 1, 1, 1 }, { 2, 4, 2 }, { 2, 3, 2 } };
+	const struct tuning_illuminant illuminants[] = {
+		{
+			.name = "D50 (daylight)",
+			.cct = 5000,
+			.wb = { 2.2, 1.0, 1.8 },
+			.ccm = { {  1.8008,	-0.6484,	-0.1523 },
+				 { -0.3555,	 1.6992,	-0.3438 },
+				 {  0.0977,	-0.957,		 1.8594 } },
+		},
+		{
+			.name = "TL84 (fluo lamp)",
+			.cct = 4000,
+			.wb = { 1.7, 1.0, 2.35 },
+			.ccm = { {  1.551345,	-0.6937,	 0.13106 },
+				 { -0.38671,	 1.676898,	-0.33936 },
+				 {  0.055462,	-0.6677,	 1.599442 } },
+		},
+	};
+
+	memset(tuning, 0, sizeof(*tuning));
+	strncpy(tuning->name, "imx335", TUNING_NAME_LEN);
+	tuning->exposure_min = 50;
+	tuning->exposure_max = 4491;
+	tuning->gain_min = 0;
+	tuning->gain_max = 240;
+	tuning_gain_linear(tuning, 0.3);
+	isp_math_index_init(&tuning->gain_index, tuning->gain_db, tuning->gain_min, tuning->gain_max);
+	tuning->black_level = 12;
+	tuning->line_time_us = 7.4; /* 4500 lines at 30 fps */
+
+	tuning->aec.target = 56; /* Note: 56 is transformed to 128 after gamma correction */
+	tuning->aec.latency = 2;
+	tuning->aec.kp = 0.8;
+	tuning->aec.ki = 0.15;
+	tuning->aec.integral_max = 1.0;
+	tuning->aec.ev_step_max = 2.0;
+	tuning->aec.tolerance_in = 0.1;
+	tuning->aec.tolerance_out = 0.25;
+
+	/* The sky is usually in the top of the frame */
+	tuning->aec.metering.hreg = 8;
+	tuning->aec.metering.vreg = 8;
+	tuning->aec.metering.center_sigma = 0.5;
+	tuning->aec.metering.spot_size = 0.15;
+	memcpy(tuning->aec.metering.matrix, matrix, sizeof(matrix));
+	tuning->aec.metering.roi_priority = 0.8;
+
+	tuning->contrast.slope_max = 2.0;
+	tuning->contrast.strength = 0.5;
+	tuning->contrast.gain_min = 0.5;
+	tuning->contrast.gain_max = 2.0;
+	tuning->contrast.smoothing = 0.2;
+	tuning->contrast.threshold = 2;
+
+	memcpy(tuning->illuminants, illuminants, sizeof(illuminants));
+	tuning->illuminant_nb = sizeof(illuminants) / sizeof(illuminants[0]);
+}
+
+/*
+ * Get the built-in sensor descriptors
+ */
+int tuning_default(struct sensor_tuning *tunings, int max)
+{
+	if (max < 1)
+		return -EINVAL;
+
+	tuning_imx335(&tunings[0]);
+
+	return 1;
+}
+
+static int tuning_parse_illuminant(struct json_node *obj, struct tuning_illuminant *ill)
+{
+	struct json_node *row;
+	int i;
+
+	memset(ill, 0, sizeof(*ill));
+	json_get_str(obj, "name", ill->name, sizeof(ill->name));
+	json_get_int(obj, "cct", &ill->cct);
+
+	if (!ill->cct || json_get_floats(json_get(obj, "wb"), ill->wb, 3) != 3)
+		return -EINVAL;
+
+	row = json_get(obj, "ccm");
+	if (!row || row->type != JSON_ARRAY)
+		return -EINVAL;
+
+	for (i = 0, row = row->child; i < 3; i++, row = row->next)
+		if (!row || json_get_floats(row, ill->ccm[i], 3) != 3)
+			return -EINVAL;
+
+	return 0;
+}
+
+/*
+ * Parse one sensor descriptor. Missing values are taken from the IMX335 descriptor.
+ */
+static int tuning_parse_sensor(struct json_node *obj, struct sensor_tuning *tuning)
+{
+	struct json_node *node, *aec, *metering, *contrast;
+	float db_unit = 0;
+	int i, nb;
+
+	tuning_imx335(tuning);
+	memset(tuning->name, 0, sizeof(tuning->name));
+
+	json_get_str(obj, "name", tuning->name, sizeof(tuning->name));
+	if (!tuning->name[0]) {
+		printf("Missing sensor name\n");
+		return -EINVAL;
+	}
+
+	json_get_int(obj, "exposure_min", &tuning->exposure_min);
+	json_get_int(obj, "exposure_max", &tuning->exposure_max);
+	json_get_int(obj, "gain_min", &tuning->gain_min);
+	json_get_int(obj, "gain_max", &tuning->gain_max);
+	json_get_int(obj, "black_level", &tuning->black_level);
+	json_get_float(obj, "line_time_us", &tuning->line_time_us);
+
+	if (tuning->exposure_min < 1 || tuning->exposure_max < tuning->exposure_min ||
+	    tuning->gain_min < 0 || tuning->gain_max < tuning->gain_min ||
+	    tuning->gain_max > TUNING_GAIN_CODE_MAX) {
+		printf("Invalid exposure / gain limits for %s\n", tuning->name);
+		return -EINVAL;
+	}
+
+	if (tuning->line_time_us < 0) {
+		printf("Invalid line time for %s\n", tuning->name);
+		return -EINVAL;
+	}
+
+	/* Gain in dB is either linear with the gain code, or given for each code */
+	json_get_float(obj, "gain_db_unit", &db_unit);
+	node = json_get(obj, "gain_db_table");
+	if (node) {
+		nb = json_get_floats(node, tuning->gain_db, TUNING_GAIN_CODE_MAX + 1);
+		if (nb <= tuning->gain_max) {
+			printf("Invalid gain table for %s\n", tuning->name);
+			return -EINVAL;
+		}
+	} else if (db_unit > 0) {
+		tuning_gain_linear(tuning, db_unit);
+	}
+
+	if (isp_math_index_init(&tuning->gain_index, tuning->gain_db, tuning->gain_min, tuning->gain_max)) {
+		printf("Gain table of %s is not increasing\n", tuning->name);
+		return -EINVAL;
+	}
+
+	aec = json_get(obj, "aec");
+	json_get_int(aec, "target", &tuning->aec.target);
+	json_get_int(aec, "latency", &tuning->aec.latency);
+	json_get_float(aec, "kp", &tuning->aec.kp);
+	json_get_float(aec, "ki", &tuning->aec.ki);
+	json_get_float(aec, "integral_max", &tuning->aec.integral_max);
+	json_get_float(aec, "ev_step_max", &tuning->aec.ev_step_max);
+	json_get_float(aec, "tolerance_in", &tuning->aec.tolerance_in);
+	json_get_float(aec, "tolerance_out", &tuning->aec.tolerance_out);
+
+	if (tuning->aec.latency < 0 || tuning->aec.latency > TUNING_AEC_LATENCY_MAX) {
+		printf("Invalid AEC latency for %s\n", tuning->name);
+		return -EINVAL;
+	}
+
+	metering = json_get(aec, "metering");
+	json_get_int(metering, "hreg", &tuning->aec.metering.hreg);
+	json_get_int(metering, "vreg", &tuning->aec.metering.vreg);
+	json_get_float(metering, "center_sigma", &tuning->aec.metering.center_sigma);
+	json_get_float(metering, "spot_size", &tuning->aec.metering.spot_size);
+	json_get_float(metering, "roi_priority", &tuning->aec.metering.roi_priority);
+
+	if (tuning->aec.metering.hreg < 1 || tuning->aec.metering.hreg > TUNING_METERING_REG_MAX ||
+	    tuning->aec.metering.vreg < 1 || tuning->aec.metering.vreg > TUNING_METERING_REG_MAX ||
+	    tuning->aec.metering.center_sigma <= 0 || tuning->aec.metering.spot_size <= 0 ||
+	    tuning->aec.metering.spot_size > 1 || tuning->aec.metering.roi_priority < 0 ||
+	    tuning->aec.metering.roi_priority > 1) {
+		printf("Invalid AEC metering for %s\n", tuning->name);
+		return -EINVAL;
+	}
+
+	node = json_get(metering, "matrix");
+	if (node) {
+		if (node->type != JSON_ARRAY)
+			node = NULL;
+		else
+			node = node->child;
+		for (i = 0; i < 3 && node; i++, node = node->next)
+			if (json_get_floats(node, tuning->aec.metering.matrix[i], 3) != 3 ||
+			    tuning->aec.metering.matrix[i][0] < 0 || tuning->aec.metering.matrix[i][1] < 0 ||
+			    tuning->aec.metering.matrix[i][2] < 0)
+				break;
+		if (i < 3) {
+			printf("Invalid AEC metering matrix for %s\n", tuning->name);
+			return -EINVAL;
+		}
+	}
+
+	contrast = json_get(obj, "contrast");
+	json_get_float(contrast, "slope_max", &tuning->contrast.slope_max);
+	json_get_float(contrast, "strength", &tuning->contrast.strength);
+	json_get_float(contrast, "gain_min", &tuning->contrast.gain_min);
+	json_get_float(contrast, "gain_max", &tuning->contrast.gain_max);
+	json_get_float(contrast, "smoothing", &tuning->contrast.smoothing);
+	json_get_int(contrast, "threshold", &tuning->contrast.threshold);
+
+	if (tuning->contrast.slope_max < 1 || tuning->contrast.strength < 0 || tuning->contrast.strength > 1 ||
+	    tuning->contrast.gain_min <= 0 || tuning->contrast.gain_max < tuning->contrast.gain_min ||
+	    tuning->contrast.gain_max * 16 > 255 || tuning->contrast.smoothing <= 0 ||
+	    tuning->contrast.smoothing > 1 || tuning->contrast.threshold < 1) {
+		printf("Invalid contrast tuning for %s\n", tuning->name);
+		return -EINVAL;
+	}
+
+	node = json_get(obj, "illuminants");
+	if (node) {
+		if (node->type != JSON_ARRAY)
+			return -EINVAL;
+
+		tuning->illuminant_nb = 0;
+		for (node = node->child; node; node = node->next) {
+			if (tuning->illuminant_nb == TUNING_ILLUMINANT_MAX ||
+			    tuning_parse_illuminant(node, &tuning->illuminants[tuning->illuminant_nb])) {
+				printf("Invalid illuminant %d for %s\n", tuning->illuminant_nb, tuning->name);
+				return -EINVAL;
+			}
+			tuning->illuminant_nb++;
+		}
+	}
+
+	if (!tuning->illuminant_nb) {
+		printf("No illuminant for %s\n", tuning->name);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * Load the sensor descriptors of a tuning file
+ * Return the number of descriptors or a negative error.
+ */
+int tuning_load(const char *path, struct sensor_tuning *tunings, int max)
+{
+	struct json_parser js = { .line = 1 };
+	struct json_node *root = NULL, *node;
+	char *buf = NULL;
+	long len;
+	FILE *f;
+	int nb = 0, ret;
+
+	f = fopen(path, "r");
+	if (!f)
+		return -errno;
+
+	if (fseek(f, 0, SEEK_END) || (len = ftell(f)) < 0 || fseek(f, 0, SEEK_SET)) {
+		ret = -EIO;
+		goto out;
+	}
+
+	buf = malloc(len + 1);
+	if (!buf) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if (fread(buf, 1, len, f) != (size_t)len) {
+		ret = -EIO;
+		goto out;
+	}
+	buf[len] = '\0';
+
+	js.p = buf;
+	root = json_parse_value(&js);
+	if (!root) {
+		printf("Tuning file %s: syntax error line %d\n", path, js.line);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	node = json_get(root, "sensors");
+	if (!node || node->type != JSON_ARRAY) {
+		printf("Tuning file %s: no sensors array\n", path);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	for (node = node->child; node; node = node->next) {
+		if (nb == max) {
+			printf("Tuning file %s: too many sensors\n", path);
+			ret = -EINVAL;
+			goto out;
+		}
+
+		ret = tuning_parse_sensor(node, &tunings[nb]);
+		if (ret) {
+			printf("Tuning file %s: invalid sensor %d\n", path, nb);
+			goto out;
+		}
+		nb++;
+	}
+
+	ret = nb;
+
+out:
+	json_free(root);
+	free(buf);
+	fclose(f);
+	return ret;
+}
+
+/*
+ * Check if a media entity is the sensor of a descriptor (e.g. "imx335 1-001a" for "imx335")
+ */
+bool tuning_match(const struct sensor_tuning *tuning, const char *entity_name)
+{
+	return !strncmp(entity_name, tuning->name, strlen(tuning->name));
+}
+
+/*
+ * Get the gain code whose gain is the nearest to 'db', within the gain limits
+ */
+int tuning_gain_code(const struct sensor_tuning *tuning, float db)
+{
+	return isp_math_index_nearest(&tuning->gain_index, tuning->gain_db, db);
+}
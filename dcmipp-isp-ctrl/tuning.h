@@ -0,0 +1,126 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/*
+ * Copyright (C) 2026 ST Microelectronics.
+ */
+
+#ifndef TUNING_H
+#define TUNING_H
+
+#include <stdbool.h>
+
+#include "isp-math.h"
+
+#define TUNING_NAME_LEN			32
+#define TUNING_SENSOR_MAX		8
+#define TUNING_GAIN_CODE_MAX		1023
+#define TUNING_ILLUMINANT_MAX		8
+#define TUNING_AEC_LATENCY_MAX		4
+#define TUNING_METERING_REG_MAX		16 /* STM32_DCMIPP_ISP_HISTO_MAX_VHREG */
+
+/* Default location of the tuning file */
+#define TUNING_FILE_DEFAULT		"/usr/share/dcmipp-isp-ctrl/tuning.json"
+
+/*
+ * Illuminant calibration: color temperature, white balance (exposure) gains and color conversion
+ */
+struct tuning_illuminant {
+	char name[TUNING_NAME_LEN];
+	int cct;
+	float wb[3];
+	float ccm[3][3];
+};
+
+/*
+ * AEC metering on a grid of histogram regions covering the frame, also used by the adaptive contrast
+ *
+ * @hreg, @vreg: number of regions, horizontally and vertically
+ * @center_sigma: standard deviation of the center-weighted map, relative to the frame half size
+ * @spot_size: size of the spot, relative to the frame size
+ * @matrix: weights of the 3 x 3 zones of the matrix map, top row first
+ * @roi_priority: part of the total weight given to the regions of interest, when there are some
+ */
+struct tuning_metering {
+	int hreg;
+	int vreg;
+	float center_sigma;
+	float spot_size;
+	float matrix[3][3];
+	float roi_priority;
+};
+
+/*
+ * Auto exposure tuning
+ *
+ * @target: average luminance target (before gamma correction)
+ * @latency: frames before a sensor update is visible in the stats
+ * @kp, @ki: proportional and integral coefficients of the controller
+ * @integral_max: integral clamp (EV)
+ * @ev_step_max: max correction for one update (EV)
+ * @tolerance_in: converged when the error gets below this value (EV)
+ * @tolerance_out: leave the converged state above this value (EV)
+ * @metering: weight maps of the metering modes
+ */
+struct tuning_aec {
+	int target;
+	int latency;
+	float kp;
+	float ki;
+	float integral_max;
+	float ev_step_max;
+	float tolerance_in;
+	float tolerance_out;
+	struct tuning_metering metering;
+};
+
+/*
+ * Adaptive contrast: histogram equalization curve applied by the contrast enhancement block
+ *
+ * @slope_max: max slope of the equalization curve (clip limit of the histogram), 1 being the identity
+ * @strength: blend of the equalization curve with the identity, from 0 (identity) to 1
+ * @gain_min, @gain_max: limits of the luminance gains of the curve
+ * @smoothing: weight of a new curve in the temporal filter
+ * @threshold: min change of a point of the curve (1/16 gain steps) before the curve is updated
+ */
+struct tuning_contrast {
+	float slope_max;
+	float strength;
+	float gain_min;
+	float gain_max;
+	float smoothing;
+	int threshold;
+};
+
+/*
+ * Sensor descriptor, with its tables computed once at load time
+ *
+ * @name: sensor media entity name (prefix match)
+ * @exposure_min, @exposure_max: exposure limits (lines)
+ * @gain_min, @gain_max: analogue gain code limits
+ * @gain_db: gain code to dB table
+ * @gain_index: dB to gain code index of the table
+ * @black_level: black level of the sensor output
+ * @line_time_us: time of a sensor line at the streamed frame rate, converting the exposure to a time
+ *   (0 if unknown, without anti-flicker)
+ */
+struct sensor_tuning {
+	char name[TUNING_NAME_LEN];
+	int exposure_min;
+	int exposure_max;
+	int gain_min;
+	int gain_max;
+	float gain_db[TUNING_GAIN_CODE_MAX + 1];
+	struct isp_math_index gain_index;
+	int black_level;
+	float line_time_us;
+	struct tuning_aec aec;
+	struct tuning_contrast contrast;
+	struct tuning_illuminant illuminants[TUNING_ILLUMINANT_MAX];
+	int illuminant_nb;
+};
+
+int tuning_default(struct sensor_tuning *tunings, int max);
+int tuning_load(const char *path, struct sensor_tuning *tunings, int max);
+bool tuning_match(const struct sensor_tuning *tuning, const char *entity_name);
+int tuning_gain_code(const struct sensor_tuning *tuning, float db);
+
+#endif